@@ -0,0 +1,867 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * Microbenchmarks of the parts of the plugin that don't need libpurple: protobuf decoding,
+ * framing, voice packet parsing, mixing, and the channel tree at the size of a large server. Run
+ * with `make bench`, optionally passing a substring of the benchmark names to run only some of
+ * them. Before the benchmarks run, the vector mixers are checked against the scalar one, and a
+ * mismatch fails the run.
+ *
+ * Each benchmark prints one line in the format of Go benchmarks, so that tools like benchstat can
+ * compare runs:
+ *
+ *   BenchmarkName <operations> <nanoseconds> ns/op <allocations> allocs/op
+ *
+ * Operation counts and inputs are fixed, and the random generator is seeded, so that every run
+ * does the same work.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "mumble-channel-tree.h"
+#include "mumble-message.h"
+#include "mumble-mixer.h"
+#include "mumble-name-index.h"
+#include "mumble-user.h"
+#include "mumble-voice-packet.h"
+#include "protobuf-utils.h"
+
+#define CHANNEL_COUNT 10000
+#define USER_COUNT    50000
+#define BRANCH_COUNT  1000
+#define FIELD_COUNT   1000
+#define PACKET_COUNT  1024
+#define STREAM_COUNT  32
+#define FRAME_SAMPLES 960
+#define SEED          1
+
+/*
+ * Fuzzy searches are timed over all names, so their budget in microseconds is only there to
+ * satisfy the interface.
+ */
+#define FUZZY_SEARCH_BUDGET (60 * G_USEC_PER_SEC)
+
+typedef void (*BenchFunc)();
+
+typedef struct {
+  const gchar *name;
+  BenchFunc func;
+} Bench;
+
+static void bench_varint_decode();
+static GByteArray *create_string_payload();
+static void bench_string_decode();
+static void bench_bytes_view_decode();
+static void bench_user_state_merge();
+static void bench_frame_encode();
+static void bench_frame_decode();
+static void bench_mumble_varint_decode();
+static void bench_voice_packet_read_opus();
+static void bench_voice_packet_read_legacy();
+static void bench_voice_packet_read(GPtrArray *packets);
+static void bench_mix();
+static void bench_mix_scalar();
+static void bench_mix_sse2();
+static void bench_mix_avx2();
+static void bench_mix_with(gboolean dispatch, MumbleMixerImplementation implementation);
+static gboolean check_mixer();
+static gfloat **create_streams(GRand *rand, guint samples, gfloat *gains);
+static void free_streams(gfloat **streams);
+static void bench_tree_add_channels();
+static void bench_tree_add_users();
+static void bench_tree_channel_lookup();
+static void bench_tree_user_lookup();
+static void bench_tree_channel_by_name();
+static void bench_tree_user_by_name();
+static void bench_tree_move_user();
+static void bench_tree_channel_user_names();
+static void bench_tree_traverse();
+static void bench_tree_linked_channels();
+static void bench_tree_remove_subtree();
+static void bench_name_prefix();
+static void bench_name_fuzzy();
+static MumbleChannelTree *build_tree(guint channel_count, guint user_count);
+static MumbleChannelTree *build_branch_tree(guint channel_count, guint branch_count, guint user_count);
+static void add_channels(MumbleChannelTree *tree, GRand *rand, guint channel_count);
+static void add_users(MumbleChannelTree *tree, GRand *rand, guint channel_count, guint user_count);
+static void start_timer();
+static void stop_timer(guint64 operations);
+static gint64 get_time();
+
+static const Bench benches[] = {
+  { "BenchmarkVarintDecode",           bench_varint_decode            },
+  { "BenchmarkStringDecode",           bench_string_decode            },
+  { "BenchmarkBytesViewDecode",        bench_bytes_view_decode        },
+  { "BenchmarkUserStateMerge",         bench_user_state_merge         },
+  { "BenchmarkFrameEncode",            bench_frame_encode             },
+  { "BenchmarkFrameDecode",            bench_frame_decode             },
+  { "BenchmarkMumbleVarintDecode",     bench_mumble_varint_decode     },
+  { "BenchmarkVoicePacketReadOpus",    bench_voice_packet_read_opus   },
+  { "BenchmarkVoicePacketReadLegacy",  bench_voice_packet_read_legacy },
+  { "BenchmarkMix32Streams",           bench_mix                      },
+  { "BenchmarkMix32StreamsScalar",     bench_mix_scalar               },
+  { "BenchmarkMix32StreamsSSE2",       bench_mix_sse2                 },
+  { "BenchmarkMix32StreamsAVX2",       bench_mix_avx2                 },
+  { "BenchmarkTreeAddChannels",        bench_tree_add_channels        },
+  { "BenchmarkTreeAddUsers",           bench_tree_add_users           },
+  { "BenchmarkTreeChannelLookup",      bench_tree_channel_lookup      },
+  { "BenchmarkTreeUserLookup",         bench_tree_user_lookup         },
+  { "BenchmarkTreeChannelByName",      bench_tree_channel_by_name     },
+  { "BenchmarkTreeUserByName",         bench_tree_user_by_name        },
+  { "BenchmarkTreeMoveUser",           bench_tree_move_user           },
+  { "BenchmarkTreeChannelUserNames",   bench_tree_channel_user_names  },
+  { "BenchmarkTreeTraverse",           bench_tree_traverse            },
+  { "BenchmarkTreeLinkedChannels",     bench_tree_linked_channels     },
+  { "BenchmarkTreeRemoveSubtree",      bench_tree_remove_subtree      },
+  { "BenchmarkNamePrefix",             bench_name_prefix              },
+  { "BenchmarkNameFuzzy",              bench_name_fuzzy               }
+};
+
+static const gchar *current_name;
+static gint64 start_time;
+static guint64 start_allocations;
+
+/*
+ * Allocations are counted by interposing the allocator of glibc, which catches the allocations
+ * made inside GLib as well. Elsewhere only times are reported. GLib versions before 2.76 have their
+ * own slice allocator for lists and nodes, which G_SLICE=always-malloc turns off; `make bench`
+ * sets it.
+ */
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS 1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *memory, size_t size);
+
+static guint64 allocation_count;
+
+void *malloc(size_t size) {
+  allocation_count++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+  allocation_count++;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *memory, size_t size) {
+  allocation_count++;
+  return __libc_realloc(memory, size);
+}
+#else
+#define COUNT_ALLOCATIONS 0
+
+static guint64 allocation_count;
+#endif
+
+int main(int argc, char **argv) {
+  if (!check_mixer()) {
+    return 1;
+  }
+
+  const gchar *filter = (argc > 1) ? argv[1] : NULL;
+  for (guint index = 0; index < G_N_ELEMENTS(benches); index++) {
+    if (!filter || strstr(benches[index].name, filter)) {
+      current_name = benches[index].name;
+      benches[index].func();
+    }
+  }
+
+  return 0;
+}
+
+static void bench_varint_decode() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  GByteArray *payload = g_byte_array_new();
+  for (guint index = 0; index < FIELD_COUNT; index++) {
+    guint bits = g_rand_int_range(rand, 1, 36);
+    guint64 value = ((guint64) g_rand_int(rand) << 32) | g_rand_int(rand);
+    encode_protobuf_unsigned_varint(payload, 1 + index % 15, value >> (64 - bits));
+  }
+
+  guint passes = 5000;
+  guint64 sum = 0;
+  start_timer();
+  for (guint pass = 0; pass < passes; pass++) {
+    for (guint offset = 0; offset < payload->len;) {
+      guint field_number;
+      guint wire_type;
+      guint64 value;
+      decode_protobuf_tag(payload, &offset, &field_number, &wire_type);
+      decode_protobuf_unsigned_varint(payload, &offset, &value);
+      sum += value;
+    }
+  }
+  stop_timer((guint64) passes * FIELD_COUNT);
+
+  g_assert(sum);
+  g_byte_array_unref(payload);
+  g_rand_free(rand);
+}
+
+static GByteArray *create_string_payload() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  GByteArray *payload = g_byte_array_new();
+  gchar text[41];
+  for (guint index = 0; index < FIELD_COUNT; index++) {
+    guint length = g_rand_int_range(rand, 5, 41);
+    for (guint position = 0; position < length; position++) {
+      text[position] = 'a' + g_rand_int_range(rand, 0, 26);
+    }
+    text[length] = '\0';
+    encode_protobuf_string(payload, 5, text);
+  }
+  g_rand_free(rand);
+  return payload;
+}
+
+static void bench_string_decode() {
+  GByteArray *payload = create_string_payload();
+
+  guint passes = 1000;
+  start_timer();
+  for (guint pass = 0; pass < passes; pass++) {
+    for (guint offset = 0; offset < payload->len;) {
+      guint field_number;
+      guint wire_type;
+      gchar *value;
+      decode_protobuf_tag(payload, &offset, &field_number, &wire_type);
+      decode_protobuf_string(payload, &offset, &value);
+      g_free(value);
+    }
+  }
+  stop_timer((guint64) passes * FIELD_COUNT);
+
+  g_byte_array_unref(payload);
+}
+
+static void bench_bytes_view_decode() {
+  GByteArray *payload = create_string_payload();
+
+  guint passes = 5000;
+  gsize total_length = 0;
+  start_timer();
+  for (guint pass = 0; pass < passes; pass++) {
+    for (guint offset = 0; offset < payload->len;) {
+      guint field_number;
+      guint wire_type;
+      const guint8 *value;
+      gsize length;
+      decode_protobuf_tag(payload, &offset, &field_number, &wire_type);
+      decode_protobuf_bytes_view(payload, &offset, &value, &length);
+      total_length += length;
+    }
+  }
+  stop_timer((guint64) passes * FIELD_COUNT);
+
+  g_assert(total_length);
+  g_byte_array_unref(payload);
+}
+
+/*
+ * A user who keeps toggling self-mute, the most common UserState on a busy server, with every
+ * other update also renaming the user.
+ */
+static void bench_user_state_merge() {
+  GByteArray *payloads[2];
+  for (guint index = 0; index < 2; index++) {
+    payloads[index] = g_byte_array_new();
+    encode_protobuf_unsigned_varint(payloads[index], 1, 42);
+    encode_protobuf_string(payloads[index], 3, index ? "Alice" : "Alice (away)");
+    encode_protobuf_unsigned_varint(payloads[index], 5, 7);
+    encode_protobuf_unsigned_varint(payloads[index], 9, index);
+  }
+  MumbleUser *user = mumble_user_new(42, "Alice", 7);
+
+  guint count = 1000000;
+  guint changed = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    MumbleUserUpdate update;
+    mumble_user_update_read(&update, payloads[index & 1]);
+    changed |= mumble_user_merge(user, &update);
+  }
+  stop_timer(count);
+
+  g_assert(changed);
+  mumble_user_free(user);
+  g_byte_array_unref(payloads[0]);
+  g_byte_array_unref(payloads[1]);
+}
+
+static void bench_frame_encode() {
+  GByteArray *payload = g_byte_array_new();
+  encode_protobuf_unsigned_varint(payload, 3, 1);
+  encode_protobuf_string(payload, 5, "A typical chat message of a hundred bytes or so, sent to the channel that the user is in.");
+  MumbleMessage *message = mumble_message_new(MUMBLE_TEXT_MESSAGE, payload);
+  guint8 buffer[256];
+
+  guint count = 5000000;
+  guint64 total_length = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    total_length += mumble_message_write(message, buffer);
+  }
+  stop_timer(count);
+
+  g_assert(total_length);
+  mumble_message_free(message);
+}
+
+static void bench_frame_decode() {
+  GByteArray *payload = g_byte_array_new();
+  encode_protobuf_unsigned_varint(payload, 3, 1);
+  encode_protobuf_string(payload, 5, "A typical chat message of a hundred bytes or so, sent to the channel that the user is in.");
+  MumbleMessage *message = mumble_message_new(MUMBLE_TEXT_MESSAGE, payload);
+  guint8 buffer[256];
+  gint length = mumble_message_write(message, buffer);
+  mumble_message_free(message);
+
+  guint count = 2000000;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    mumble_message_free(mumble_message_read(buffer, length));
+  }
+  stop_timer(count);
+}
+
+/*
+ * Values of every size up to 64 bits, so that every length of the encoding is decoded, with an
+ * occasional negative number like the ones in positional data.
+ */
+static void bench_mumble_varint_decode() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  GByteArray *buffer = g_byte_array_new();
+  for (guint index = 0; index < FIELD_COUNT; index++) {
+    guint bits = g_rand_int_range(rand, 1, 65);
+    guint64 value = (((guint64) g_rand_int(rand) << 32) | g_rand_int(rand)) >> (64 - bits);
+    write_mumble_varint(buffer, (index % 16) ? value : ~value);
+  }
+
+  guint passes = 5000;
+  guint64 sum = 0;
+  start_timer();
+  for (guint pass = 0; pass < passes; pass++) {
+    for (gsize offset = 0; offset < buffer->len;) {
+      guint64 value;
+      read_mumble_varint(buffer->data, buffer->len, &offset, &value);
+      sum += value;
+    }
+  }
+  stop_timer((guint64) passes * FIELD_COUNT);
+
+  g_assert(sum);
+  g_byte_array_unref(buffer);
+  g_rand_free(rand);
+}
+
+/*
+ * Opus packets as the server relays them: a session, a sequence number that grows through the
+ * varint lengths, and 20 ms of speech at 24 kbit/s.
+ */
+static void bench_voice_packet_read_opus() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  GPtrArray *packets = g_ptr_array_new_with_free_func((GDestroyNotify) g_byte_array_unref);
+  guint8 payload[60];
+  for (guint index = 0; index < PACKET_COUNT; index++) {
+    for (guint position = 0; position < sizeof(payload); position++) {
+      payload[position] = g_rand_int(rand);
+    }
+    MumbleVoicePacket packet = { 0 };
+    packet.type           = MUMBLE_VOICE_OPUS;
+    packet.session        = g_rand_int_range(rand, 0, 1000);
+    packet.sequence       = (guint64) index * 4099;
+    packet.payload        = payload;
+    packet.payload_length = sizeof(payload);
+    packet.terminator     = index == PACKET_COUNT - 1;
+    GByteArray *buffer = g_byte_array_new();
+    mumble_voice_packet_write(&packet, buffer, TRUE);
+    g_ptr_array_add(packets, buffer);
+  }
+
+  bench_voice_packet_read(packets);
+
+  g_ptr_array_unref(packets);
+  g_rand_free(rand);
+}
+
+/*
+ * Speex packets from older clients carry two 20 ms frames of 38 bytes each, and the last packet of
+ * the transmission ends with an empty frame. They can't be written, so they are built by hand.
+ */
+static void bench_voice_packet_read_legacy() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  GPtrArray *packets = g_ptr_array_new_with_free_func((GDestroyNotify) g_byte_array_unref);
+  for (guint index = 0; index < PACKET_COUNT; index++) {
+    GByteArray *buffer = g_byte_array_new();
+    guint8 header = MUMBLE_VOICE_SPEEX << 5;
+    g_byte_array_append(buffer, &header, 1);
+    write_mumble_varint(buffer, g_rand_int_range(rand, 0, 1000));
+    write_mumble_varint(buffer, (guint64) index * 4099);
+
+    gboolean last = index == PACKET_COUNT - 1;
+    for (guint frame = 0; frame < 2; frame++) {
+      guint8 frame_header = 38 | ((frame == 0 || last) ? 0x80 : 0);
+      g_byte_array_append(buffer, &frame_header, 1);
+      for (guint position = 0; position < 38; position++) {
+        guint8 byte = g_rand_int(rand);
+        g_byte_array_append(buffer, &byte, 1);
+      }
+    }
+    if (last) {
+      guint8 terminator = 0;
+      g_byte_array_append(buffer, &terminator, 1);
+    }
+    g_ptr_array_add(packets, buffer);
+  }
+
+  bench_voice_packet_read(packets);
+
+  g_ptr_array_unref(packets);
+  g_rand_free(rand);
+}
+
+static void bench_voice_packet_read(GPtrArray *packets) {
+  guint passes = 2000;
+  guint64 parsed = 0;
+  start_timer();
+  for (guint pass = 0; pass < passes; pass++) {
+    for (guint index = 0; index < packets->len; index++) {
+      GByteArray *buffer = g_ptr_array_index(packets, index);
+      MumbleVoicePacket packet;
+      parsed += mumble_voice_packet_read(&packet, buffer->data, buffer->len, TRUE);
+    }
+  }
+  stop_timer((guint64) passes * packets->len);
+
+  g_assert(parsed == (guint64) passes * packets->len);
+}
+
+/*
+ * A 20 ms frame at 48 kHz from each of 32 speakers, which is more than talk at once even on large
+ * servers. An operation is the mix of one frame.
+ */
+static void bench_mix() {
+  bench_mix_with(TRUE, MUMBLE_MIXER_SCALAR);
+}
+
+static void bench_mix_scalar() {
+  bench_mix_with(FALSE, MUMBLE_MIXER_SCALAR);
+}
+
+static void bench_mix_sse2() {
+  bench_mix_with(FALSE, MUMBLE_MIXER_SSE2);
+}
+
+static void bench_mix_avx2() {
+  bench_mix_with(FALSE, MUMBLE_MIXER_AVX2);
+}
+
+static void bench_mix_with(gboolean dispatch, MumbleMixerImplementation implementation) {
+  if (!dispatch && !mumble_mixer_is_supported(implementation)) {
+    return;
+  }
+
+  GRand *rand = g_rand_new_with_seed(SEED);
+  gfloat gains[STREAM_COUNT];
+  gfloat **streams = create_streams(rand, FRAME_SAMPLES, gains);
+  gint16 output[FRAME_SAMPLES];
+
+  guint count = 20000;
+  gint64 total = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    if (dispatch) {
+      mumble_mixer_mix((const gfloat *const *) streams, gains, STREAM_COUNT, output, FRAME_SAMPLES);
+    } else {
+      mumble_mixer_mix_with(implementation, (const gfloat *const *) streams, gains, STREAM_COUNT, output, FRAME_SAMPLES);
+    }
+    total += output[index % FRAME_SAMPLES];
+  }
+  stop_timer(count);
+
+  g_assert(total);
+  free_streams(streams);
+  g_rand_free(rand);
+}
+
+/*
+ * The vector mixers must match the scalar one bit for bit. They are compared on random input that
+ * is loud enough to reach the clipper, with a sample count that leaves a tail for the fallback.
+ */
+static gboolean check_mixer() {
+  const MumbleMixerImplementation implementations[] = { MUMBLE_MIXER_SSE2, MUMBLE_MIXER_AVX2 };
+  const gchar *names[] = { "SSE2", "AVX2" };
+  const guint samples = 48000 + 13;
+
+  GRand *rand = g_rand_new_with_seed(SEED);
+  gfloat gains[STREAM_COUNT];
+  gfloat **streams = create_streams(rand, samples, gains);
+  gint16 *expected = g_new(gint16, samples);
+  gint16 *output = g_new(gint16, samples);
+  gboolean matches = TRUE;
+
+  for (guint index = 0; index < G_N_ELEMENTS(implementations); index++) {
+    if (!mumble_mixer_is_supported(implementations[index])) {
+      continue;
+    }
+    for (guint input_count = 1; input_count <= STREAM_COUNT; input_count *= 2) {
+      mumble_mixer_mix_with(MUMBLE_MIXER_SCALAR, (const gfloat *const *) streams, gains, input_count, expected, samples);
+      mumble_mixer_mix_with(implementations[index], (const gfloat *const *) streams, gains, input_count, output, samples);
+      for (guint sample = 0; sample < samples; sample++) {
+        if (output[sample] != expected[sample]) {
+          fprintf(stderr, "The %s mixer gives %d instead of %d for sample %u of %u streams\n", names[index], output[sample], expected[sample], sample, input_count);
+          matches = FALSE;
+          break;
+        }
+      }
+    }
+  }
+
+  g_free(output);
+  g_free(expected);
+  free_streams(streams);
+  g_rand_free(rand);
+  return matches;
+}
+
+/*
+ * Samples are within [-1, 1] like decoded Opus, and gains go up to 2 like a boosted speaker.
+ */
+static gfloat **create_streams(GRand *rand, guint samples, gfloat *gains) {
+  gfloat **streams = g_new(gfloat *, STREAM_COUNT);
+  for (guint index = 0; index < STREAM_COUNT; index++) {
+    streams[index] = g_new(gfloat, samples);
+    for (guint sample = 0; sample < samples; sample++) {
+      streams[index][sample] = g_rand_double_range(rand, -1, 1);
+    }
+    gains[index] = g_rand_double_range(rand, 0, 2);
+  }
+  return streams;
+}
+
+static void free_streams(gfloat **streams) {
+  for (guint index = 0; index < STREAM_COUNT; index++) {
+    g_free(streams[index]);
+  }
+  g_free(streams);
+}
+
+static void bench_tree_add_channels() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  MumbleChannelTree *tree = mumble_channel_tree_new();
+
+  start_timer();
+  add_channels(tree, rand, CHANNEL_COUNT);
+  stop_timer(CHANNEL_COUNT);
+
+  mumble_channel_tree_free(tree);
+  g_rand_free(rand);
+}
+
+static void bench_tree_add_users() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  MumbleChannelTree *tree = mumble_channel_tree_new();
+  add_channels(tree, rand, CHANNEL_COUNT);
+
+  start_timer();
+  add_users(tree, rand, CHANNEL_COUNT, USER_COUNT);
+  stop_timer(USER_COUNT);
+
+  mumble_channel_tree_free(tree);
+  g_rand_free(rand);
+}
+
+static void bench_tree_channel_lookup() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+
+  guint count = 5000000;
+  guint found = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    found += mumble_channel_tree_get_channel(tree, (index * 7919) % (CHANNEL_COUNT + 1)) != NULL;
+  }
+  stop_timer(count);
+
+  g_assert(found == count);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_user_lookup() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+
+  guint count = 5000000;
+  guint found = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    found += mumble_channel_tree_get_user(tree, (index * 7919) % USER_COUNT) != NULL;
+  }
+  stop_timer(count);
+
+  g_assert(found == count);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_channel_by_name() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+  gchar **names = g_new0(gchar *, 1024);
+  for (guint index = 0; index < 1024; index++) {
+    names[index] = g_strdup_printf("Channel %u", 1 + (index * 7919) % CHANNEL_COUNT);
+  }
+
+  guint count = 1000000;
+  guint found = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    found += mumble_channel_tree_get_channel_by_name(tree, names[index % 1024]) != NULL;
+  }
+  stop_timer(count);
+
+  g_assert(found == count);
+  g_strfreev(names);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_user_by_name() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+  gchar **names = g_new0(gchar *, 1024);
+  for (guint index = 0; index < 1024; index++) {
+    names[index] = g_strdup_printf("User %u", (index * 7919) % USER_COUNT);
+  }
+
+  guint count = 1000000;
+  guint found = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    found += mumble_channel_tree_get_user_by_name(tree, names[index % 1024]) != NULL;
+  }
+  stop_timer(count);
+
+  g_assert(found == count);
+  g_strfreev(names);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_move_user() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+
+  guint count = 1000000;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    mumble_channel_tree_set_user_channel_id(tree, (index * 7919) % USER_COUNT, (index * 104729) % (CHANNEL_COUNT + 1));
+  }
+  stop_timer(count);
+
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_channel_user_names() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+
+  guint count = 1000000;
+  guint total_length = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    GList *names = mumble_channel_tree_get_channel_user_names(tree, (index * 7919) % (CHANNEL_COUNT + 1));
+    total_length += g_list_length(names);
+    g_list_free(names);
+  }
+  stop_timer(count);
+
+  g_assert(total_length);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_tree_traverse() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+
+  guint count = 10;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    GList *channels = mumble_channel_tree_get_channels_in_topological_order(tree);
+    g_list_free(channels);
+  }
+  stop_timer(count);
+
+  mumble_channel_tree_free(tree);
+}
+
+/*
+ * Every channel is linked to two others on average, so that most channels are reachable through
+ * links from most others.
+ */
+static void bench_tree_linked_channels() {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, 0);
+  for (guint index = 0; index < CHANNEL_COUNT; index++) {
+    mumble_channel_tree_link(tree, g_rand_int_range(rand, 1, CHANNEL_COUNT + 1), g_rand_int_range(rand, 1, CHANNEL_COUNT + 1));
+  }
+
+  guint count = 100;
+  guint total_length = 0;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    GArray *linked_ids = mumble_channel_tree_get_linked_channels(tree, 1 + (index * 7919) % CHANNEL_COUNT);
+    total_length += linked_ids->len;
+    g_array_free(linked_ids, TRUE);
+  }
+  stop_timer(count);
+
+  g_assert(total_length);
+  mumble_channel_tree_free(tree);
+  g_rand_free(rand);
+}
+
+/*
+ * A branch of 1000 channels, about a tenth of the server with its users, is removed at once, like
+ * when an admin deletes a whole section of the tree.
+ */
+static void bench_tree_remove_subtree() {
+  MumbleChannelTree *tree = build_branch_tree(CHANNEL_COUNT, BRANCH_COUNT, USER_COUNT);
+  GArray *removed_ids = g_array_new(FALSE, FALSE, sizeof(guint));
+
+  start_timer();
+  g_list_free(mumble_channel_tree_remove_subtree(tree, 1, removed_ids));
+  stop_timer(1);
+
+  g_assert(removed_ids->len == BRANCH_COUNT);
+  g_array_free(removed_ids, TRUE);
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_name_prefix() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+  const gchar *prefixes[] = { "user 1", "channel 42", "u", "user 4999", "nobody" };
+
+  guint count = 200000;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    g_array_free(mumble_name_index_find_prefix(tree->names, MUMBLE_NAME_CHANNEL | MUMBLE_NAME_USER, prefixes[index % G_N_ELEMENTS(prefixes)], 20), TRUE);
+  }
+  stop_timer(count);
+
+  mumble_channel_tree_free(tree);
+}
+
+static void bench_name_fuzzy() {
+  MumbleChannelTree *tree = build_tree(CHANNEL_COUNT, USER_COUNT);
+  const gchar *patterns[] = { "usr42", "chnl 9", "zq" };
+
+  guint count = 100;
+  gboolean complete = TRUE;
+  start_timer();
+  for (guint index = 0; index < count; index++) {
+    gboolean search_complete;
+    g_array_free(mumble_name_index_find_fuzzy(tree->names, MUMBLE_NAME_CHANNEL | MUMBLE_NAME_USER, patterns[index % G_N_ELEMENTS(patterns)], 20, FUZZY_SEARCH_BUDGET, &search_complete), TRUE);
+    complete &= search_complete;
+  }
+  stop_timer(count);
+
+  g_assert(complete);
+
+  mumble_channel_tree_free(tree);
+}
+
+static MumbleChannelTree *build_tree(guint channel_count, guint user_count) {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  MumbleChannelTree *tree = mumble_channel_tree_new();
+  add_channels(tree, rand, channel_count);
+  add_users(tree, rand, channel_count, user_count);
+  g_rand_free(rand);
+  return tree;
+}
+
+/*
+ * Channels 1 to @branch_count form a branch under channel 1, and the other channels hang off the
+ * root or each other, so that removing channel 1 removes exactly the branch.
+ */
+static MumbleChannelTree *build_branch_tree(guint channel_count, guint branch_count, guint user_count) {
+  GRand *rand = g_rand_new_with_seed(SEED);
+  MumbleChannelTree *tree = mumble_channel_tree_new();
+  for (guint channel_id = 1; channel_id <= channel_count; channel_id++) {
+    guint parent_id;
+    if (channel_id == 1) {
+      parent_id = 0;
+    } else if (channel_id <= branch_count) {
+      parent_id = g_rand_int_range(rand, 1, channel_id);
+    } else {
+      parent_id = g_rand_int_range(rand, branch_count, channel_id);
+      parent_id = (parent_id == branch_count) ? 0 : parent_id;
+    }
+    gchar *name = g_strdup_printf("Channel %u", channel_id);
+    MumbleChannel *channel = mumble_channel_new(channel_id, name, NULL);
+    channel->position = g_rand_int_range(rand, 0, 4);
+    mumble_channel_tree_add_channel(tree, channel, parent_id);
+    g_free(name);
+  }
+  add_users(tree, rand, channel_count, user_count);
+  g_rand_free(rand);
+  return tree;
+}
+
+/*
+ * Channels get IDs from 1 up and random parents among the channels before them, which makes a
+ * tree of logarithmic depth like the ones on real servers.
+ */
+static void add_channels(MumbleChannelTree *tree, GRand *rand, guint channel_count) {
+  for (guint channel_id = 1; channel_id <= channel_count; channel_id++) {
+    gchar *name = g_strdup_printf("Channel %u", channel_id);
+    MumbleChannel *channel = mumble_channel_new(channel_id, name, NULL);
+    channel->position = g_rand_int_range(rand, 0, 4);
+    mumble_channel_tree_add_channel(tree, channel, g_rand_int_range(rand, 0, channel_id));
+    g_free(name);
+  }
+}
+
+static void add_users(MumbleChannelTree *tree, GRand *rand, guint channel_count, guint user_count) {
+  for (guint session_id = 0; session_id < user_count; session_id++) {
+    gchar *name = g_strdup_printf("User %u", session_id);
+    mumble_channel_tree_add_user(tree, mumble_user_new(session_id, name, g_rand_int_range(rand, 0, channel_count + 1)));
+    g_free(name);
+  }
+}
+
+static void start_timer() {
+  start_allocations = allocation_count;
+  start_time        = get_time();
+}
+
+static void stop_timer(guint64 operations) {
+  gint64 elapsed_time = get_time() - start_time;
+  guint64 allocations = allocation_count - start_allocations;
+
+  operations = MAX(operations, 1);
+  if (COUNT_ALLOCATIONS) {
+    printf("%-32s %10" G_GUINT64_FORMAT " %14.2f ns/op %10.2f allocs/op\n", current_name, operations, (gdouble) elapsed_time / operations, (gdouble) allocations / operations);
+  } else {
+    printf("%-32s %10" G_GUINT64_FORMAT " %14.2f ns/op\n", current_name, operations, (gdouble) elapsed_time / operations);
+  }
+  fflush(stdout);
+}
+
+static gint64 get_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (gint64) now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
@@ -0,0 +1,318 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-aes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+static void set_key_portable(MumbleAesKey *, const guint8 *);
+static void encrypt_portable(const MumbleAesKey *, const guint8 *, guint8 *);
+static void decrypt_portable(const MumbleAesKey *, const guint8 *, guint8 *);
+#ifdef HAVE_X86
+static void set_key_aesni(MumbleAesKey *, const guint8 *);
+static void encrypt_aesni(const MumbleAesKey *, const guint8 *, guint8 *);
+static void decrypt_aesni(const MumbleAesKey *, const guint8 *, guint8 *);
+#endif
+
+static const guint8 sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+static const guint8 inverse_sbox[256] = {
+  0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb,
+  0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb,
+  0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e,
+  0x08, 0x2e, 0xa1, 0x66, 0x28, 0xd9, 0x24, 0xb2, 0x76, 0x5b, 0xa2, 0x49, 0x6d, 0x8b, 0xd1, 0x25,
+  0x72, 0xf8, 0xf6, 0x64, 0x86, 0x68, 0x98, 0x16, 0xd4, 0xa4, 0x5c, 0xcc, 0x5d, 0x65, 0xb6, 0x92,
+  0x6c, 0x70, 0x48, 0x50, 0xfd, 0xed, 0xb9, 0xda, 0x5e, 0x15, 0x46, 0x57, 0xa7, 0x8d, 0x9d, 0x84,
+  0x90, 0xd8, 0xab, 0x00, 0x8c, 0xbc, 0xd3, 0x0a, 0xf7, 0xe4, 0x58, 0x05, 0xb8, 0xb3, 0x45, 0x06,
+  0xd0, 0x2c, 0x1e, 0x8f, 0xca, 0x3f, 0x0f, 0x02, 0xc1, 0xaf, 0xbd, 0x03, 0x01, 0x13, 0x8a, 0x6b,
+  0x3a, 0x91, 0x11, 0x41, 0x4f, 0x67, 0xdc, 0xea, 0x97, 0xf2, 0xcf, 0xce, 0xf0, 0xb4, 0xe6, 0x73,
+  0x96, 0xac, 0x74, 0x22, 0xe7, 0xad, 0x35, 0x85, 0xe2, 0xf9, 0x37, 0xe8, 0x1c, 0x75, 0xdf, 0x6e,
+  0x47, 0xf1, 0x1a, 0x71, 0x1d, 0x29, 0xc5, 0x89, 0x6f, 0xb7, 0x62, 0x0e, 0xaa, 0x18, 0xbe, 0x1b,
+  0xfc, 0x56, 0x3e, 0x4b, 0xc6, 0xd2, 0x79, 0x20, 0x9a, 0xdb, 0xc0, 0xfe, 0x78, 0xcd, 0x5a, 0xf4,
+  0x1f, 0xdd, 0xa8, 0x33, 0x88, 0x07, 0xc7, 0x31, 0xb1, 0x12, 0x10, 0x59, 0x27, 0x80, 0xec, 0x5f,
+  0x60, 0x51, 0x7f, 0xa9, 0x19, 0xb5, 0x4a, 0x0d, 0x2d, 0xe5, 0x7a, 0x9f, 0x93, 0xc9, 0x9c, 0xef,
+  0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61,
+  0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
+};
+
+static const guint8 round_constants[MUMBLE_AES_ROUNDS] = { 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36 };
+
+void mumble_aes_set_key(MumbleAesKey *key, const guint8 *raw) {
+  static gsize best_implementation = 0;
+
+  if (g_once_init_enter(&best_implementation)) {
+    MumbleAesImplementation implementation = MUMBLE_AES_PORTABLE;
+    if (mumble_aes_is_supported(MUMBLE_AES_AESNI)) {
+      implementation = MUMBLE_AES_AESNI;
+    }
+    g_once_init_leave(&best_implementation, implementation + 1);
+  }
+
+  mumble_aes_set_key_with(best_implementation - 1, key, raw);
+}
+
+void mumble_aes_set_key_with(MumbleAesImplementation implementation, MumbleAesKey *key, const guint8 *raw) {
+  key->implementation = implementation;
+#ifdef HAVE_X86
+  if (implementation == MUMBLE_AES_AESNI) {
+    set_key_aesni(key, raw);
+    return;
+  }
+#endif
+  key->implementation = MUMBLE_AES_PORTABLE;
+  set_key_portable(key, raw);
+}
+
+void mumble_aes_encrypt(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+#ifdef HAVE_X86
+  if (key->implementation == MUMBLE_AES_AESNI) {
+    encrypt_aesni(key, input, output);
+    return;
+  }
+#endif
+  encrypt_portable(key, input, output);
+}
+
+void mumble_aes_decrypt(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+#ifdef HAVE_X86
+  if (key->implementation == MUMBLE_AES_AESNI) {
+    decrypt_aesni(key, input, output);
+    return;
+  }
+#endif
+  decrypt_portable(key, input, output);
+}
+
+gboolean mumble_aes_is_supported(MumbleAesImplementation implementation) {
+  switch (implementation) {
+    case MUMBLE_AES_PORTABLE:
+      return TRUE;
+#ifdef HAVE_X86
+    case MUMBLE_AES_AESNI:
+      return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+/*
+ * The portable version works on the state byte by byte in the column-major order of FIPS-197,
+ * so byte i is row i % 4 of column i / 4. Decryption uses the straightforward inverse cipher
+ * with the encryption round keys in reverse, so decrypt_keys is just a reversed copy.
+ */
+static inline guint8 multiply_by_two(guint8 value) {
+  return (value << 1) ^ ((value >> 7) * 0x1b);
+}
+
+static inline guint8 multiply(guint8 value, guint8 factor) {
+  guint8 product = 0;
+  while (factor) {
+    if (factor & 1) {
+      product ^= value;
+    }
+    value = multiply_by_two(value);
+    factor >>= 1;
+  }
+  return product;
+}
+
+static void set_key_portable(MumbleAesKey *key, const guint8 *raw) {
+  guint8 *words = key->encrypt_keys;
+  memcpy(words, raw, MUMBLE_AES_BLOCK_SIZE);
+
+  for (guint i = 4; i < 4 * (MUMBLE_AES_ROUNDS + 1); i++) {
+    guint8 temp[4];
+    memcpy(temp, words + 4 * (i - 1), 4);
+    if (i % 4 == 0) {
+      guint8 first = temp[0];
+      temp[0] = sbox[temp[1]] ^ round_constants[i / 4 - 1];
+      temp[1] = sbox[temp[2]];
+      temp[2] = sbox[temp[3]];
+      temp[3] = sbox[first];
+    }
+    for (guint j = 0; j < 4; j++) {
+      words[4 * i + j] = words[4 * (i - 4) + j] ^ temp[j];
+    }
+  }
+
+  for (guint round = 0; round <= MUMBLE_AES_ROUNDS; round++) {
+    memcpy(key->decrypt_keys + round * MUMBLE_AES_BLOCK_SIZE, key->encrypt_keys + (MUMBLE_AES_ROUNDS - round) * MUMBLE_AES_BLOCK_SIZE, MUMBLE_AES_BLOCK_SIZE);
+  }
+}
+
+static inline void add_round_key(guint8 *state, const guint8 *round_key) {
+  for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+    state[i] ^= round_key[i];
+  }
+}
+
+static void encrypt_portable(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+  guint8 state[MUMBLE_AES_BLOCK_SIZE];
+  guint8 shifted[MUMBLE_AES_BLOCK_SIZE];
+
+  memcpy(state, input, MUMBLE_AES_BLOCK_SIZE);
+  add_round_key(state, key->encrypt_keys);
+
+  for (guint round = 1; round <= MUMBLE_AES_ROUNDS; round++) {
+    for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+      guint row = i % 4;
+      guint column = i / 4;
+      shifted[i] = sbox[state[row + 4 * ((column + row) % 4)]];
+    }
+    if (round < MUMBLE_AES_ROUNDS) {
+      for (guint column = 0; column < 4; column++) {
+        guint8 *a = shifted + 4 * column;
+        guint8 all = a[0] ^ a[1] ^ a[2] ^ a[3];
+        state[4 * column]     = a[0] ^ all ^ multiply_by_two(a[0] ^ a[1]);
+        state[4 * column + 1] = a[1] ^ all ^ multiply_by_two(a[1] ^ a[2]);
+        state[4 * column + 2] = a[2] ^ all ^ multiply_by_two(a[2] ^ a[3]);
+        state[4 * column + 3] = a[3] ^ all ^ multiply_by_two(a[3] ^ a[0]);
+      }
+    } else {
+      memcpy(state, shifted, MUMBLE_AES_BLOCK_SIZE);
+    }
+    add_round_key(state, key->encrypt_keys + round * MUMBLE_AES_BLOCK_SIZE);
+  }
+
+  memcpy(output, state, MUMBLE_AES_BLOCK_SIZE);
+}
+
+static void decrypt_portable(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+  guint8 state[MUMBLE_AES_BLOCK_SIZE];
+  guint8 shifted[MUMBLE_AES_BLOCK_SIZE];
+
+  memcpy(state, input, MUMBLE_AES_BLOCK_SIZE);
+  add_round_key(state, key->decrypt_keys);
+
+  for (guint round = 1; round <= MUMBLE_AES_ROUNDS; round++) {
+    for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+      guint row = i % 4;
+      guint column = i / 4;
+      shifted[i] = inverse_sbox[state[row + 4 * ((column + 4 - row) % 4)]];
+    }
+    add_round_key(shifted, key->decrypt_keys + round * MUMBLE_AES_BLOCK_SIZE);
+    if (round < MUMBLE_AES_ROUNDS) {
+      for (guint column = 0; column < 4; column++) {
+        guint8 *a = shifted + 4 * column;
+        state[4 * column]     = multiply(a[0], 14) ^ multiply(a[1], 11) ^ multiply(a[2], 13) ^ multiply(a[3], 9);
+        state[4 * column + 1] = multiply(a[0], 9)  ^ multiply(a[1], 14) ^ multiply(a[2], 11) ^ multiply(a[3], 13);
+        state[4 * column + 2] = multiply(a[0], 13) ^ multiply(a[1], 9)  ^ multiply(a[2], 14) ^ multiply(a[3], 11);
+        state[4 * column + 3] = multiply(a[0], 11) ^ multiply(a[1], 13) ^ multiply(a[2], 9)  ^ multiply(a[3], 14);
+      }
+    } else {
+      memcpy(state, shifted, MUMBLE_AES_BLOCK_SIZE);
+    }
+  }
+
+  memcpy(output, state, MUMBLE_AES_BLOCK_SIZE);
+}
+
+#ifdef HAVE_X86
+/*
+ * AES-NI decryption uses the equivalent inverse cipher, which needs the middle round keys passed
+ * through InvMixColumns (aesimc). The round constant of aeskeygenassist must be an immediate,
+ * hence the macro.
+ */
+__attribute__((target("aes,sse2")))
+static inline __m128i expand_key_step(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+#define EXPAND_KEY(round, constant) \
+  round_keys[round] = expand_key_step(round_keys[round - 1], _mm_aeskeygenassist_si128(round_keys[round - 1], constant))
+
+__attribute__((target("aes,sse2")))
+static void set_key_aesni(MumbleAesKey *key, const guint8 *raw) {
+  __m128i round_keys[MUMBLE_AES_ROUNDS + 1];
+
+  round_keys[0] = _mm_loadu_si128((const __m128i *) raw);
+  EXPAND_KEY(1, 0x01);
+  EXPAND_KEY(2, 0x02);
+  EXPAND_KEY(3, 0x04);
+  EXPAND_KEY(4, 0x08);
+  EXPAND_KEY(5, 0x10);
+  EXPAND_KEY(6, 0x20);
+  EXPAND_KEY(7, 0x40);
+  EXPAND_KEY(8, 0x80);
+  EXPAND_KEY(9, 0x1b);
+  EXPAND_KEY(10, 0x36);
+
+  for (guint round = 0; round <= MUMBLE_AES_ROUNDS; round++) {
+    _mm_storeu_si128((__m128i *) (key->encrypt_keys + round * MUMBLE_AES_BLOCK_SIZE), round_keys[round]);
+    __m128i decrypt_key = round_keys[MUMBLE_AES_ROUNDS - round];
+    if (round > 0 && round < MUMBLE_AES_ROUNDS) {
+      decrypt_key = _mm_aesimc_si128(decrypt_key);
+    }
+    _mm_storeu_si128((__m128i *) (key->decrypt_keys + round * MUMBLE_AES_BLOCK_SIZE), decrypt_key);
+  }
+}
+
+#undef EXPAND_KEY
+
+__attribute__((target("aes,sse2")))
+static void encrypt_aesni(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+  const __m128i *round_keys = (const __m128i *) key->encrypt_keys;
+
+  __m128i state = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input), _mm_loadu_si128(round_keys));
+  for (guint round = 1; round < MUMBLE_AES_ROUNDS; round++) {
+    state = _mm_aesenc_si128(state, _mm_loadu_si128(round_keys + round));
+  }
+  state = _mm_aesenclast_si128(state, _mm_loadu_si128(round_keys + MUMBLE_AES_ROUNDS));
+  _mm_storeu_si128((__m128i *) output, state);
+}
+
+__attribute__((target("aes,sse2")))
+static void decrypt_aesni(const MumbleAesKey *key, const guint8 *input, guint8 *output) {
+  const __m128i *round_keys = (const __m128i *) key->decrypt_keys;
+
+  __m128i state = _mm_xor_si128(_mm_loadu_si128((const __m128i *) input), _mm_loadu_si128(round_keys));
+  for (guint round = 1; round < MUMBLE_AES_ROUNDS; round++) {
+    state = _mm_aesdec_si128(state, _mm_loadu_si128(round_keys + round));
+  }
+  state = _mm_aesdeclast_si128(state, _mm_loadu_si128(round_keys + MUMBLE_AES_ROUNDS));
+  _mm_storeu_si128((__m128i *) output, state);
+}
+#endif
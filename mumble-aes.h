@@ -0,0 +1,104 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_AES_H
+#define MUMBLE_AES_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumbleaes
+ * @short_description: AES-128 block cipher
+ *
+ * Single-block AES-128 encryption and decryption for the OCB2 mode used on
+ * the voice channel. AES-NI is used when the CPU has it, with a portable
+ * table-based version as a fallback. Both produce identical output.
+ */
+
+#define MUMBLE_AES_BLOCK_SIZE 16
+#define MUMBLE_AES_ROUNDS     10
+
+/**
+ * MumbleAesImplementation:
+ * @MUMBLE_AES_PORTABLE: Portable C
+ * @MUMBLE_AES_AESNI:    AES-NI instructions
+ */
+typedef enum {
+  MUMBLE_AES_PORTABLE,
+  MUMBLE_AES_AESNI
+} MumbleAesImplementation;
+
+typedef struct _MumbleAesKey MumbleAesKey;
+
+/**
+ * MumbleAesKey:
+ * @implementation: Implementation the round keys were expanded for
+ * @encrypt_keys:   Encryption round keys
+ * @decrypt_keys:   Decryption round keys, in the order and form the
+ *                  implementation uses them
+ */
+struct _MumbleAesKey {
+  MumbleAesImplementation implementation;
+  guint8 encrypt_keys[(MUMBLE_AES_ROUNDS + 1) * MUMBLE_AES_BLOCK_SIZE];
+  guint8 decrypt_keys[(MUMBLE_AES_ROUNDS + 1) * MUMBLE_AES_BLOCK_SIZE];
+};
+
+/**
+ * mumble_aes_set_key:
+ * @key: A #MumbleAesKey
+ * @raw: 16 bytes of key material
+ *
+ * Expand @raw into @key for the fastest implementation available.
+ */
+void mumble_aes_set_key(MumbleAesKey *key, const guint8 *raw);
+
+/**
+ * mumble_aes_set_key_with:
+ * @implementation: A #MumbleAesImplementation supported by the CPU
+ *
+ * Like mumble_aes_set_key(), but for a specific implementation.
+ */
+void mumble_aes_set_key_with(MumbleAesImplementation implementation, MumbleAesKey *key, const guint8 *raw);
+
+/**
+ * mumble_aes_encrypt:
+ * @key:    A #MumbleAesKey
+ * @input:  16 bytes of plaintext
+ * @output: 16 bytes to write the ciphertext to, may be the same as @input
+ */
+void mumble_aes_encrypt(const MumbleAesKey *key, const guint8 *input, guint8 *output);
+
+/**
+ * mumble_aes_decrypt:
+ * @key:    A #MumbleAesKey
+ * @input:  16 bytes of ciphertext
+ * @output: 16 bytes to write the plaintext to, may be the same as @input
+ */
+void mumble_aes_decrypt(const MumbleAesKey *key, const guint8 *input, guint8 *output);
+
+/**
+ * mumble_aes_is_supported:
+ * @implementation: A #MumbleAesImplementation
+ *
+ * Returns: Whether @implementation can run on this CPU
+ */
+gboolean mumble_aes_is_supported(MumbleAesImplementation implementation);
+
+#endif
@@ -0,0 +1,225 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mumble-base64.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+#define INVALID    0xFF
+#define WHITESPACE 0xFE
+#define PADDING    0xFD
+
+static const guint8 *get_decoding_table();
+static gsize decode_scalar(MumbleBase64Decoder *, const guint8 *, gsize, guint8 *);
+#ifdef HAVE_X86
+static gsize decode_ssse3(MumbleBase64Decoder *, const guint8 *, gsize, guint8 *);
+#endif
+
+void mumble_base64_decoder_init(MumbleBase64Decoder *decoder) {
+  static gsize best_implementation = 0;
+
+  if (g_once_init_enter(&best_implementation)) {
+    MumbleBase64Implementation implementation = MUMBLE_BASE64_SCALAR;
+    if (mumble_base64_is_supported(MUMBLE_BASE64_SSSE3)) {
+      implementation = MUMBLE_BASE64_SSSE3;
+    }
+    g_once_init_leave(&best_implementation, implementation + 1);
+  }
+
+  mumble_base64_decoder_init_with(best_implementation - 1, decoder);
+}
+
+void mumble_base64_decoder_init_with(MumbleBase64Implementation implementation, MumbleBase64Decoder *decoder) {
+  decoder->implementation = implementation;
+  decoder->bits = 0;
+  decoder->count = 0;
+  decoder->padding = 0;
+  decoder->failed = FALSE;
+}
+
+gsize mumble_base64_decoder_feed(MumbleBase64Decoder *decoder, const gchar *input, gsize length, guint8 *output) {
+#ifdef HAVE_X86
+  if (decoder->implementation == MUMBLE_BASE64_SSSE3) {
+    return decode_ssse3(decoder, (const guint8 *) input, length, output);
+  }
+#endif
+  return decode_scalar(decoder, (const guint8 *) input, length, output);
+}
+
+gboolean mumble_base64_decoder_finish(MumbleBase64Decoder *decoder, guint8 *output, gsize *written) {
+  *written = 0;
+  if (decoder->failed || (decoder->count == 1) || (decoder->padding && decoder->count)) {
+    return FALSE;
+  }
+  if (!decoder->count) {
+    return TRUE;
+  }
+
+  guint32 bits = decoder->bits << (6 * (4 - decoder->count));
+  output[0] = bits >> 16;
+  if (decoder->count == 3) {
+    output[1] = bits >> 8;
+  }
+  *written = decoder->count - 1;
+  decoder->count = 0;
+  return TRUE;
+}
+
+gboolean mumble_base64_is_supported(MumbleBase64Implementation implementation) {
+  switch (implementation) {
+    case MUMBLE_BASE64_SCALAR:
+      return TRUE;
+#ifdef HAVE_X86
+    case MUMBLE_BASE64_SSSE3:
+      return __builtin_cpu_supports("ssse3");
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+static const guint8 *get_decoding_table() {
+  static guint8 table[256];
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    static const gchar alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (guint i = 0; i < 256; i++) {
+      table[i] = INVALID;
+    }
+    for (guint i = 0; i < 64; i++) {
+      table[(guint8) alphabet[i]] = i;
+    }
+    table[' '] = table['\t'] = table['\n'] = table['\r'] = table['\f'] = WHITESPACE;
+    table['='] = PADDING;
+    g_once_init_leave(&initialized, 1);
+  }
+
+  return table;
+}
+
+/*
+ * Four characters make three bytes. After the padding that ends the input, only more padding
+ * and whitespace may follow.
+ */
+static gsize decode_scalar(MumbleBase64Decoder *decoder, const guint8 *input, gsize length, guint8 *output) {
+  const guint8 *table = get_decoding_table();
+  guint8 *start = output;
+
+  for (gsize i = 0; (i < length) && !decoder->failed; i++) {
+    guint8 value = table[input[i]];
+    if (value == WHITESPACE) {
+      continue;
+    }
+
+    if (value == PADDING) {
+      if (decoder->count < 2) {
+        decoder->failed = TRUE;
+      } else if (++decoder->padding + decoder->count == 4) {
+        guint32 bits = decoder->bits << (6 * decoder->padding);
+        *output++ = bits >> 16;
+        if (decoder->count == 3) {
+          *output++ = bits >> 8;
+        }
+        decoder->bits = 0;
+        decoder->count = 0;
+      }
+      continue;
+    }
+
+    if ((value == INVALID) || decoder->padding) {
+      decoder->failed = TRUE;
+      continue;
+    }
+
+    decoder->bits = (decoder->bits << 6) | value;
+    if (++decoder->count == 4) {
+      *output++ = decoder->bits >> 16;
+      *output++ = decoder->bits >> 8;
+      *output++ = decoder->bits;
+      decoder->bits = 0;
+      decoder->count = 0;
+    }
+  }
+
+  return output - start;
+}
+
+#ifdef HAVE_X86
+/*
+ * The vector version classifies characters by their high and low nibbles with two table
+ * lookups, which flags anything outside the alphabet, and then adds an offset chosen by the high
+ * nibble to get the 6-bit values. Blocks with whitespace, padding or invalid characters are left
+ * to the scalar version, which also takes single characters until a group boundary is reached
+ * again. A block writes 16
+ * bytes of which 12 are used, so the loop stops early enough for the buffer size promised by
+ * MUMBLE_BASE64_MAX_DECODED_SIZE().
+ */
+__attribute__((target("ssse3")))
+static gsize decode_ssse3(MumbleBase64Decoder *decoder, const guint8 *input, gsize length, guint8 *output) {
+  const __m128i low_nibble_table  = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+  const __m128i high_nibble_table = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+  const __m128i offset_table      = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m128i nibble_mask = _mm_set1_epi8(0x0F);
+  const __m128i slash = _mm_set1_epi8('/');
+  const __m128i merge_pairs = _mm_set1_epi32(0x01400140);
+  const __m128i merge_quads = _mm_set1_epi32(0x00011000);
+  const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+  guint8 *start = output;
+  gsize i = 0;
+
+  while (i < length) {
+    if (decoder->padding || decoder->failed || (i + 24 > length)) {
+      output += decode_scalar(decoder, input + i, length - i, output);
+      break;
+    }
+    if (decoder->count) {
+      output += decode_scalar(decoder, input + i, 1, output);
+      i++;
+      continue;
+    }
+
+    __m128i characters = _mm_loadu_si128((const __m128i *) (input + i));
+    __m128i high_nibbles = _mm_and_si128(_mm_srli_epi32(characters, 4), nibble_mask);
+    __m128i low_nibbles = _mm_and_si128(characters, nibble_mask);
+    __m128i classes = _mm_and_si128(_mm_shuffle_epi8(low_nibble_table, low_nibbles), _mm_shuffle_epi8(high_nibble_table, high_nibbles));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi8(classes, _mm_setzero_si128()))) {
+      output += decode_scalar(decoder, input + i, 4, output);
+      i += 4;
+      continue;
+    }
+
+    __m128i offsets = _mm_shuffle_epi8(offset_table, _mm_add_epi8(_mm_cmpeq_epi8(characters, slash), high_nibbles));
+    __m128i values = _mm_add_epi8(characters, offsets);
+    __m128i pairs = _mm_maddubs_epi16(values, merge_pairs);
+    __m128i quads = _mm_madd_epi16(pairs, merge_quads);
+    _mm_storeu_si128((__m128i *) output, _mm_shuffle_epi8(quads, pack));
+
+    output += 12;
+    i += 16;
+  }
+
+  return output - start;
+}
+#endif
@@ -0,0 +1,112 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_BASE64_H
+#define MUMBLE_BASE64_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblebase64
+ * @short_description: Incremental base64 decoder
+ *
+ * Decodes base64 in pieces of any size, carrying incomplete groups of four
+ * characters over to the next piece. Whitespace is skipped. The SSSE3 version
+ * decodes 16 characters at a time and is picked at run time if the CPU
+ * supports it, with a scalar version as a fallback. Both produce identical
+ * output.
+ */
+
+/**
+ * MUMBLE_BASE64_MAX_DECODED_SIZE:
+ * @length: Number of input characters
+ *
+ * Size of the output buffer that mumble_base64_decoder_feed() needs for
+ * @length characters.
+ */
+#define MUMBLE_BASE64_MAX_DECODED_SIZE(length) (((length) / 4 + 1) * 3)
+
+/**
+ * MumbleBase64Implementation:
+ * @MUMBLE_BASE64_SCALAR: Portable C
+ * @MUMBLE_BASE64_SSSE3:  SSSE3, 16 characters at a time
+ */
+typedef enum {
+  MUMBLE_BASE64_SCALAR,
+  MUMBLE_BASE64_SSSE3
+} MumbleBase64Implementation;
+
+typedef struct _MumbleBase64Decoder {
+  MumbleBase64Implementation implementation;
+  guint32 bits;
+  guint count;
+  guint padding;
+  gboolean failed;
+} MumbleBase64Decoder;
+
+/**
+ * mumble_base64_decoder_init:
+ * @decoder: A #MumbleBase64Decoder
+ *
+ * Prepare @decoder for new input, using the fastest implementation available.
+ */
+void mumble_base64_decoder_init(MumbleBase64Decoder *decoder);
+
+/**
+ * mumble_base64_decoder_init_with:
+ * @implementation: A #MumbleBase64Implementation supported by the CPU
+ *
+ * Like mumble_base64_decoder_init(), but using a specific implementation.
+ */
+void mumble_base64_decoder_init_with(MumbleBase64Implementation implementation, MumbleBase64Decoder *decoder);
+
+/**
+ * mumble_base64_decoder_feed:
+ * @decoder: A #MumbleBase64Decoder
+ * @input:   Base64 characters
+ * @length:  Number of characters in @input
+ * @output:  Buffer of at least MUMBLE_BASE64_MAX_DECODED_SIZE(@length) bytes
+ *
+ * Decode the next piece of input. Once invalid input has been seen, nothing
+ * more is decoded.
+ *
+ * Returns: Number of bytes written to @output
+ */
+gsize mumble_base64_decoder_feed(MumbleBase64Decoder *decoder, const gchar *input, gsize length, guint8 *output);
+
+/**
+ * mumble_base64_decoder_finish:
+ * @decoder: A #MumbleBase64Decoder
+ * @output:  Buffer of at least 2 bytes for the bits of unpadded input
+ * @written: Return location for the number of bytes written to @output
+ *
+ * Returns: %FALSE if the input was invalid or ended in the middle of a byte
+ */
+gboolean mumble_base64_decoder_finish(MumbleBase64Decoder *decoder, guint8 *output, gsize *written);
+
+/**
+ * mumble_base64_is_supported:
+ * @implementation: A #MumbleBase64Implementation
+ *
+ * Returns: Whether @implementation can run on this CPU
+ */
+gboolean mumble_base64_is_supported(MumbleBase64Implementation implementation);
+
+#endif
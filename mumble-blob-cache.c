@@ -0,0 +1,176 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <glib/gstdio.h>
+#include "mumble-blob-cache.h"
+
+typedef struct {
+  gchar *key;
+  GBytes *blob;
+} MumbleBlobCacheEntry;
+
+/*
+ * The queue holds the entries from the most to the least recently used, and the table maps hex
+ * keys to their links in the queue.
+ */
+struct _MumbleBlobCache {
+  gchar *directory;
+  gsize memory_size;
+  gsize size;
+  GQueue entries;
+  GHashTable *links;
+};
+
+static gchar *get_key(const guint8 *, gsize);
+static void remember_blob(MumbleBlobCache *, gchar *, GBytes *);
+static void free_entry(MumbleBlobCacheEntry *);
+
+GBytes *mumble_blob_cache_lookup(MumbleBlobCache *cache, const guint8 *hash, gsize length) {
+  gchar *key = get_key(hash, length);
+  if (!key) {
+    return NULL;
+  }
+
+  GList *link = g_hash_table_lookup(cache->links, key);
+  if (link) {
+    g_queue_unlink(&cache->entries, link);
+    g_queue_push_head_link(&cache->entries, link);
+    g_free(key);
+    return g_bytes_ref(((MumbleBlobCacheEntry *) link->data)->blob);
+  }
+
+  if (!cache->directory) {
+    g_free(key);
+    return NULL;
+  }
+
+  /*
+   * Files are never changed once written, since their names are hashes of their contents, so
+   * they can be mapped rather than read.
+   */
+  gchar *path = g_build_filename(cache->directory, key, NULL);
+  GMappedFile *file = g_mapped_file_new(path, FALSE, NULL);
+  g_free(path);
+  if (!file) {
+    g_free(key);
+    return NULL;
+  }
+
+  GBytes *blob = g_mapped_file_get_bytes(file);
+  g_mapped_file_unref(file);
+  remember_blob(cache, key, g_bytes_ref(blob));
+  return blob;
+}
+
+void mumble_blob_cache_insert(MumbleBlobCache *cache, GBytes *blob) {
+  gsize size;
+  const guint8 *data = g_bytes_get_data(blob, &size);
+  gchar *key = g_compute_checksum_for_data(G_CHECKSUM_SHA1, data, size);
+
+  if (g_hash_table_contains(cache->links, key)) {
+    g_free(key);
+    return;
+  }
+
+  if (cache->directory) {
+    gchar *path = g_build_filename(cache->directory, key, NULL);
+    if (!g_file_test(path, G_FILE_TEST_EXISTS)) {
+      g_file_set_contents(path, (const gchar *) data, size, NULL);
+    }
+    g_free(path);
+  }
+
+  remember_blob(cache, key, g_bytes_ref(blob));
+}
+
+gchar *mumble_blob_cache_get_path(MumbleBlobCache *cache, const guint8 *hash, gsize length) {
+  gchar *key = get_key(hash, length);
+  if (!key || !cache->directory) {
+    g_free(key);
+    return NULL;
+  }
+  gchar *path = g_build_filename(cache->directory, key, NULL);
+  g_free(key);
+  return path;
+}
+
+void mumble_blob_cache_free(MumbleBlobCache *cache) {
+  g_queue_clear_full(&cache->entries, (GDestroyNotify) free_entry);
+  g_hash_table_destroy(cache->links);
+  g_free(cache->directory);
+  g_free(cache);
+}
+
+MumbleBlobCache *mumble_blob_cache_new(const gchar *directory, gsize memory_size) {
+  MumbleBlobCache *cache = g_new0(MumbleBlobCache, 1);
+
+  if (directory && (g_mkdir_with_parents(directory, 0700) == 0)) {
+    cache->directory = g_strdup(directory);
+  }
+  cache->memory_size = memory_size;
+  g_queue_init(&cache->entries);
+  cache->links = g_hash_table_new(g_str_hash, g_str_equal);
+
+  return cache;
+}
+
+static gchar *get_key(const guint8 *hash, gsize length) {
+  if (length != MUMBLE_BLOB_CACHE_HASH_SIZE) {
+    return NULL;
+  }
+  gchar *key = g_malloc(2 * length + 1);
+  for (gsize i = 0; i < length; i++) {
+    g_snprintf(key + 2 * i, 3, "%.2x", hash[i]);
+  }
+  return key;
+}
+
+/*
+ * Takes ownership of the key and a reference to the blob. A blob larger than the whole memory
+ * budget is not kept at all.
+ */
+static void remember_blob(MumbleBlobCache *cache, gchar *key, GBytes *blob) {
+  gsize size = g_bytes_get_size(blob);
+  if (size > cache->memory_size) {
+    g_free(key);
+    g_bytes_unref(blob);
+    return;
+  }
+
+  while (cache->size + size > cache->memory_size) {
+    MumbleBlobCacheEntry *oldest = g_queue_pop_tail(&cache->entries);
+    g_hash_table_remove(cache->links, oldest->key);
+    cache->size -= g_bytes_get_size(oldest->blob);
+    free_entry(oldest);
+  }
+
+  MumbleBlobCacheEntry *entry = g_new(MumbleBlobCacheEntry, 1);
+  entry->key = key;
+  entry->blob = blob;
+  g_queue_push_head(&cache->entries, entry);
+  g_hash_table_insert(cache->links, key, cache->entries.head);
+  cache->size += size;
+}
+
+static void free_entry(MumbleBlobCacheEntry *entry) {
+  g_free(entry->key);
+  g_bytes_unref(entry->blob);
+  g_free(entry);
+}
@@ -0,0 +1,88 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_BLOB_CACHE_H
+#define MUMBLE_BLOB_CACHE_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumbleblobcache
+ * @short_description: Cache of blobs by hash
+ *
+ * Servers send long channel descriptions, user comments and avatars as SHA-1
+ * hashes, and the contents only on request. The cache keeps blobs under the
+ * hash of their contents, in memory up to a size limit with the least
+ * recently used ones evicted first, and in a directory where each blob is a
+ * file named by its hash in hexadecimal. Files are memory-mapped when read.
+ * Since the key is computed from the contents, one server can't make the
+ * cache return wrong data for another.
+ */
+
+#define MUMBLE_BLOB_CACHE_HASH_SIZE 20
+
+typedef struct _MumbleBlobCache MumbleBlobCache;
+
+/**
+ * mumble_blob_cache_lookup:
+ * @cache:  A #MumbleBlobCache
+ * @hash:   SHA-1 hash of the blob
+ * @length: Length of @hash in bytes
+ *
+ * Look for a blob in memory and then on disk.
+ *
+ * Returns: (transfer full) (nullable): The blob, or %NULL if it isn't cached
+ */
+GBytes *mumble_blob_cache_lookup(MumbleBlobCache *cache, const guint8 *hash, gsize length);
+
+/**
+ * mumble_blob_cache_insert:
+ * @cache: A #MumbleBlobCache
+ * @blob:  Contents of the blob
+ *
+ * Store a blob in memory and on disk under its SHA-1 hash.
+ */
+void mumble_blob_cache_insert(MumbleBlobCache *cache, GBytes *blob);
+
+/**
+ * mumble_blob_cache_get_path:
+ * @cache:  A #MumbleBlobCache
+ * @hash:   SHA-1 hash of the blob
+ * @length: Length of @hash in bytes
+ *
+ * Returns: (transfer full) (nullable): Path of the file that holds the blob
+ * on disk whether it exists or not, or %NULL if there is no cache directory or
+ * @hash is not a SHA-1 hash
+ */
+gchar *mumble_blob_cache_get_path(MumbleBlobCache *cache, const guint8 *hash, gsize length);
+
+void mumble_blob_cache_free(MumbleBlobCache *cache);
+
+/**
+ * mumble_blob_cache_new:
+ * @directory:   (nullable): Directory for the cache on disk, created if it
+ *               doesn't exist, or %NULL to keep blobs in memory only
+ * @memory_size: Total size of the blobs to keep in memory in bytes
+ *
+ * Returns: A new #MumbleBlobCache
+ */
+MumbleBlobCache *mumble_blob_cache_new(const gchar *directory, gsize memory_size);
+
+#endif
@@ -17,11 +17,121 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdlib.h>
 #include "mumble-channel-tree.h"
 #include "mumble-user.h"
 #include "utils.h"
 
+/*
+ * Each channel has an entry with its node and its children in a GSequence sorted like the
+ * official client sorts them. The sequence finds the place of a child in O(log n), and the
+ * children of the node are linked in the same order, so traversals need no sorting. The users in
+ * the channel are indexed in the entry too, created on first use, so that listing a channel or
+ * removing a subtree doesn't go through every user on the server.
+ */
+typedef struct _MumbleChannelTreeEntry {
+  GNode *node;
+  GSequence *children;
+  GSequenceIter *iter;
+  GHashTable *users;
+} MumbleChannelTreeEntry;
+
+typedef struct _MumbleChannelTreeRemoval {
+  MumbleChannelTree *tree;
+  MumbleChannelTreeEntry *parent;
+  GArray *removed_ids;
+  GList *moved_users;
+} MumbleChannelTreeRemoval;
+
 static GNode *mumble_channel_tree_get_node(MumbleChannelTree *tree, guint channel_id);
+static MumbleChannelTreeEntry *new_entry(MumbleChannel *channel);
+static void free_entry(MumbleChannelTreeEntry *entry);
+static void place_node(GNode *parent, MumbleChannelTreeEntry *entry);
+static void sort_changed(MumbleChannelTree *tree, guint channel_id);
+static gint compare_siblings(gconstpointer a, gconstpointer b, gpointer user_data);
+static gboolean remove_channel(GNode *node, gpointer data);
+static void index_user(MumbleChannelTree *tree, MumbleUser *user);
+static void unindex_user(MumbleChannelTree *tree, MumbleUser *user);
+static gboolean find_link(GArray *links, guint linked_id, guint *index);
+static void insert_link(MumbleChannelTree *tree, guint channel_id, guint linked_id);
+static void erase_link(MumbleChannelTree *tree, guint channel_id, guint linked_id);
+static gint compare_ids(gconstpointer a, gconstpointer b);
+
+void mumble_channel_tree_link(MumbleChannelTree *tree, guint channel_id, guint linked_id) {
+  if (channel_id != linked_id) {
+    insert_link(tree, channel_id, linked_id);
+    insert_link(tree, linked_id, channel_id);
+  }
+}
+
+void mumble_channel_tree_unlink(MumbleChannelTree *tree, guint channel_id, guint linked_id) {
+  erase_link(tree, channel_id, linked_id);
+  erase_link(tree, linked_id, channel_id);
+}
+
+void mumble_channel_tree_set_links(MumbleChannelTree *tree, guint channel_id, const guint *linked_ids, guint count) {
+  guint *new_ids = g_memdup2(linked_ids, count * sizeof(guint));
+  qsort(new_ids, count, sizeof(guint), compare_ids);
+
+  /*
+   * Walk the old and the new set in step, like in a merge, so that only the links that changed
+   * are touched. The old set is copied because unlinking edits it.
+   */
+  GArray *links = mumble_channel_tree_get_links(tree, channel_id);
+  guint old_count = links ? links->len : 0;
+  guint *old_ids = links ? g_memdup2(links->data, old_count * sizeof(guint)) : NULL;
+
+  guint i = 0;
+  guint j = 0;
+  while (i < old_count || j < count) {
+    if (j == count || (i < old_count && old_ids[i] < new_ids[j])) {
+      mumble_channel_tree_unlink(tree, channel_id, old_ids[i++]);
+    } else if (i == old_count || new_ids[j] < old_ids[i]) {
+      mumble_channel_tree_link(tree, channel_id, new_ids[j++]);
+    } else {
+      i++;
+      j++;
+    }
+  }
+
+  g_free(old_ids);
+  g_free(new_ids);
+}
+
+void mumble_channel_tree_remove_links(MumbleChannelTree *tree, guint channel_id) {
+  mumble_channel_tree_set_links(tree, channel_id, NULL, 0);
+}
+
+gboolean mumble_channel_tree_is_linked(MumbleChannelTree *tree, guint channel_id, guint linked_id) {
+  GArray *links = mumble_channel_tree_get_links(tree, channel_id);
+  guint index;
+  return links && find_link(links, linked_id, &index);
+}
+
+GArray *mumble_channel_tree_get_links(MumbleChannelTree *tree, guint channel_id) {
+  return g_hash_table_lookup(tree->links, GUINT_TO_POINTER(channel_id));
+}
+
+GArray *mumble_channel_tree_get_linked_channels(MumbleChannelTree *tree, guint channel_id) {
+  GArray *component = g_array_new(FALSE, FALSE, sizeof(guint));
+  GHashTable *visited = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  /* Breadth-first search, with the result doubling as the queue. */
+  g_array_append_val(component, channel_id);
+  g_hash_table_add(visited, GUINT_TO_POINTER(channel_id));
+  for (guint head = 0; head < component->len; head++) {
+    GArray *links = mumble_channel_tree_get_links(tree, g_array_index(component, guint, head));
+    for (guint i = 0; links && i < links->len; i++) {
+      guint linked_id = g_array_index(links, guint, i);
+      if (g_hash_table_add(visited, GUINT_TO_POINTER(linked_id))) {
+        g_array_append_val(component, linked_id);
+      }
+    }
+  }
+
+  g_hash_table_destroy(visited);
+  return component;
+}
 
 gboolean mumble_channel_tree_has_children(MumbleChannelTree *tree, guint channel_id) {
   return g_node_n_children(mumble_channel_tree_get_node(tree, channel_id));
@@ -41,11 +151,16 @@ guint mumble_channel_tree_get_parent_id(MumbleChannelTree *tree, guint channel_i
 GList *mumble_channel_tree_get_channels_in_topological_order(MumbleChannelTree *tree) {
   GList *channels = NULL;
   g_node_traverse(tree->root, G_PRE_ORDER, G_TRAVERSE_ALL, -1, g_node_traverse_func_create_list, &channels);
-  return channels;
+  return g_list_reverse(channels);
 }
 
 void mumble_channel_tree_set_user_channel_id(MumbleChannelTree *tree, guint session_id, guint channel_id) {
-  mumble_channel_tree_get_user(tree, session_id)->channel_id = channel_id;
+  MumbleUser *user = mumble_channel_tree_get_user(tree, session_id);
+  if (user && user->channel_id != channel_id) {
+    unindex_user(tree, user);
+    user->channel_id = channel_id;
+    index_user(tree, user);
+  }
 }
 
 guint mumble_channel_tree_get_user_channel_id(MumbleChannelTree *tree, guint session_id) {
@@ -54,63 +169,273 @@ guint mumble_channel_tree_get_user_channel_id(MumbleChannelTree *tree, guint ses
 }
 
 MumbleChannel *mumble_channel_tree_get_channel_by_name(MumbleChannelTree *tree, gchar *name) {
-  MumbleChannel *channel = NULL;
-  GList *channels = g_hash_table_get_values(tree->id_to_channel);
-  for (GList *node = channels; node; node = node->next) {
-    MumbleChannel *cursor_channel = node->data;
-    if (!g_strcmp0(name, cursor_channel->name)) {
-      channel = cursor_channel;
-      break;
-    }
+  guint channel_id;
+  if (!mumble_name_index_lookup(tree->names, MUMBLE_NAME_CHANNEL, name, &channel_id)) {
+    return NULL;
   }
-  g_list_free(channels);
-  return channel;
+  return mumble_channel_tree_get_channel(tree, channel_id);
 }
 
 GList *mumble_channel_tree_get_channel_user_names(MumbleChannelTree *tree, guint channel_id) {
   GList *names = NULL;
-  GList *users = g_hash_table_get_values(tree->id_to_user);
-  for (GList *node = users; node; node = node->next) {
-    MumbleUser *user = node->data;
-    if (user->channel_id == channel_id) {
-      names = g_list_append(names, user->name);
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+  if (entry && entry->users) {
+    GHashTableIter iter;
+    gpointer user;
+    g_hash_table_iter_init(&iter, entry->users);
+    while (g_hash_table_iter_next(&iter, &user, NULL)) {
+      names = g_list_prepend(names, ((MumbleUser *) user)->name);
     }
   }
-
-  g_list_free(users);
-
   return names;
 }
 
 void mumble_channel_tree_remove_user(MumbleChannelTree *tree, guint session_id) {
-  g_hash_table_remove(tree->id_to_user, &session_id);
+  MumbleUser *user = mumble_channel_tree_get_user(tree, session_id);
+  if (user) {
+    unindex_user(tree, user);
+    mumble_name_index_remove(tree->names, MUMBLE_NAME_USER, session_id);
+    g_hash_table_remove(tree->id_to_user, &session_id);
+  }
 }
 
 void mumble_channel_tree_add_user(MumbleChannelTree *tree, MumbleUser *user) {
+  mumble_channel_tree_remove_user(tree, user->session_id);
   g_hash_table_insert(tree->id_to_user, &user->session_id, user);
+  index_user(tree, user);
+  mumble_name_index_insert(tree->names, MUMBLE_NAME_USER, user->session_id, user->name);
+}
+
+void mumble_channel_tree_update_user_name(MumbleChannelTree *tree, guint session_id) {
+  MumbleUser *user = mumble_channel_tree_get_user(tree, session_id);
+  if (user) {
+    mumble_name_index_insert(tree->names, MUMBLE_NAME_USER, session_id, user->name);
+  }
+}
+
+MumbleUser *mumble_channel_tree_get_user_by_name(MumbleChannelTree *tree, gchar *name) {
+  guint session_id;
+  if (!mumble_name_index_lookup(tree->names, MUMBLE_NAME_USER, name, &session_id)) {
+    return NULL;
+  }
+  return mumble_channel_tree_get_user(tree, session_id);
 }
 
 MumbleUser *mumble_channel_tree_get_user(MumbleChannelTree *tree, guint session_id) {
   return g_hash_table_lookup(tree->id_to_user, &session_id);
 }
 
-void mumble_channel_tree_add_channel(MumbleChannelTree *tree, MumbleChannel *channel, guint parent_id) {
-  GNode *parent = mumble_channel_tree_get_node(tree, parent_id);
-  if (parent) {
-    g_node_append(parent, g_node_new(channel));
-    g_hash_table_insert(tree->id_to_channel, &channel->id, channel);
+void mumble_channel_tree_set_channel_name(MumbleChannelTree *tree, guint channel_id, gchar *name) {
+  MumbleChannel *channel = mumble_channel_tree_get_channel(tree, channel_id);
+  if (channel && g_strcmp0(channel->name, name)) {
+    mumble_channel_set_name(channel, name);
+    mumble_name_index_insert(tree->names, MUMBLE_NAME_CHANNEL, channel_id, name);
+    sort_changed(tree, channel_id);
   }
 }
 
-void mumble_channel_tree_remove_subtree(MumbleChannelTree *tree, guint channel_id) {
-  GNode *subtree = mumble_channel_tree_get_node(tree, channel_id);
-  if (subtree) {
-    g_node_destroy(subtree);
+void mumble_channel_tree_set_channel_position(MumbleChannelTree *tree, guint channel_id, gint position) {
+  MumbleChannel *channel = mumble_channel_tree_get_channel(tree, channel_id);
+  if (channel && channel->position != position) {
+    channel->position = position;
+    sort_changed(tree, channel_id);
   }
 }
 
+gboolean mumble_channel_tree_add_channel(MumbleChannelTree *tree, MumbleChannel *channel, guint parent_id) {
+  MumbleChannelTreeEntry *parent = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(parent_id));
+  if (!parent) {
+    return FALSE;
+  }
+
+  MumbleChannelTreeEntry *entry = new_entry(channel);
+  entry->iter = g_sequence_insert_sorted(parent->children, entry, compare_siblings, NULL);
+  place_node(parent->node, entry);
+  g_hash_table_insert(tree->id_to_entry, GUINT_TO_POINTER(channel->id), entry);
+  g_hash_table_insert(tree->id_to_channel, &channel->id, channel);
+  mumble_name_index_insert(tree->names, MUMBLE_NAME_CHANNEL, channel->id, channel->name);
+  return TRUE;
+}
+
+GList *mumble_channel_tree_remove_subtree(MumbleChannelTree *tree, guint channel_id, GArray *removed_ids) {
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+  if (!entry || !entry->iter) {
+    return NULL;
+  }
+
+  GNode *subtree = entry->node;
+  MumbleChannelTreeRemoval removal = {
+    .tree        = tree,
+    .parent      = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(((MumbleChannel *) subtree->parent->data)->id)),
+    .removed_ids = removed_ids,
+    .moved_users = NULL
+  };
+
+  g_sequence_remove(entry->iter);
+  g_node_traverse(subtree, G_PRE_ORDER, G_TRAVERSE_ALL, -1, remove_channel, &removal);
+  g_node_destroy(subtree);
+
+  return removal.moved_users;
+}
+
+static gboolean find_link(GArray *links, guint linked_id, guint *index) {
+  guint low = 0;
+  guint high = links->len;
+  while (low < high) {
+    guint middle = low + (high - low) / 2;
+    guint id = g_array_index(links, guint, middle);
+    if (id == linked_id) {
+      *index = middle;
+      return TRUE;
+    }
+    if (id < linked_id) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  *index = low;
+  return FALSE;
+}
+
+static void insert_link(MumbleChannelTree *tree, guint channel_id, guint linked_id) {
+  GArray *links = mumble_channel_tree_get_links(tree, channel_id);
+  if (!links) {
+    links = g_array_new(FALSE, FALSE, sizeof(guint));
+    g_hash_table_insert(tree->links, GUINT_TO_POINTER(channel_id), links);
+  }
+  guint index;
+  if (!find_link(links, linked_id, &index)) {
+    g_array_insert_val(links, index, linked_id);
+  }
+}
+
+static void erase_link(MumbleChannelTree *tree, guint channel_id, guint linked_id) {
+  GArray *links = mumble_channel_tree_get_links(tree, channel_id);
+  guint index;
+  if (links && find_link(links, linked_id, &index)) {
+    g_array_remove_index(links, index);
+    if (!links->len) {
+      g_hash_table_remove(tree->links, GUINT_TO_POINTER(channel_id));
+    }
+  }
+}
+
+static gint compare_ids(gconstpointer a, gconstpointer b) {
+  guint id_a = *(const guint *) a;
+  guint id_b = *(const guint *) b;
+  return (id_a > id_b) - (id_a < id_b);
+}
+
 static GNode *mumble_channel_tree_get_node(MumbleChannelTree *tree, guint channel_id) {
-  return g_node_find(tree->root, G_IN_ORDER, G_TRAVERSE_ALL, mumble_channel_tree_get_channel(tree, channel_id));
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+  return entry ? entry->node : NULL;
+}
+
+static MumbleChannelTreeEntry *new_entry(MumbleChannel *channel) {
+  MumbleChannelTreeEntry *entry = g_new0(MumbleChannelTreeEntry, 1);
+  entry->node = g_node_new(channel);
+  entry->children = g_sequence_new(NULL);
+  return entry;
+}
+
+static void free_entry(MumbleChannelTreeEntry *entry) {
+  g_sequence_free(entry->children);
+  if (entry->users) {
+    g_hash_table_destroy(entry->users);
+  }
+  g_free(entry);
+}
+
+/*
+ * Link the node of an entry next to the node of a neighbour in the sequence. Both ways are
+ * O(1), unlike g_node_append(), which walks the children to find the last one.
+ */
+static void place_node(GNode *parent, MumbleChannelTreeEntry *entry) {
+  GSequenceIter *next = g_sequence_iter_next(entry->iter);
+  if (!g_sequence_iter_is_end(next)) {
+    g_node_insert_before(parent, ((MumbleChannelTreeEntry *) g_sequence_get(next))->node, entry->node);
+  } else if (!g_sequence_iter_is_begin(entry->iter)) {
+    g_node_insert_after(parent, ((MumbleChannelTreeEntry *) g_sequence_get(g_sequence_iter_prev(entry->iter)))->node, entry->node);
+  } else {
+    g_node_prepend(parent, entry->node);
+  }
+}
+
+static void sort_changed(MumbleChannelTree *tree, guint channel_id) {
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+  if (entry && entry->iter) {
+    GNode *parent = entry->node->parent;
+    g_sequence_sort_changed(entry->iter, compare_siblings, NULL);
+    g_node_unlink(entry->node);
+    place_node(parent, entry);
+  }
+}
+
+static gint compare_siblings(gconstpointer a, gconstpointer b, gpointer user_data) {
+  MumbleChannel *channel_a = ((MumbleChannelTreeEntry *) a)->node->data;
+  MumbleChannel *channel_b = ((MumbleChannelTreeEntry *) b)->node->data;
+  if (channel_a->position != channel_b->position) {
+    return channel_a->position < channel_b->position ? -1 : 1;
+  }
+  gint result = g_utf8_collate(channel_a->name ? channel_a->name : "", channel_b->name ? channel_b->name : "");
+  if (!result) {
+    result = (channel_a->id > channel_b->id) - (channel_a->id < channel_b->id);
+  }
+  return result;
+}
+
+/*
+ * Called once for each channel of a removed subtree, parents first. The node itself is destroyed
+ * with the whole subtree afterwards.
+ */
+static gboolean remove_channel(GNode *node, gpointer data) {
+  MumbleChannelTreeRemoval *removal = data;
+  MumbleChannelTree *tree = removal->tree;
+  guint channel_id = ((MumbleChannel *) node->data)->id;
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+
+  if (entry->users) {
+    guint parent_id = ((MumbleChannel *) removal->parent->node->data)->id;
+    if (!removal->parent->users) {
+      removal->parent->users = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    GHashTableIter iter;
+    gpointer user;
+    g_hash_table_iter_init(&iter, entry->users);
+    while (g_hash_table_iter_next(&iter, &user, NULL)) {
+      ((MumbleUser *) user)->channel_id = parent_id;
+      g_hash_table_add(removal->parent->users, user);
+      removal->moved_users = g_list_prepend(removal->moved_users, user);
+    }
+  }
+
+  mumble_channel_tree_remove_links(tree, channel_id);
+  mumble_name_index_remove(tree->names, MUMBLE_NAME_CHANNEL, channel_id);
+  if (removal->removed_ids) {
+    g_array_append_val(removal->removed_ids, channel_id);
+  }
+
+  g_hash_table_remove(tree->id_to_entry, GUINT_TO_POINTER(channel_id));
+  g_hash_table_remove(tree->id_to_channel, &channel_id);
+  return FALSE;
+}
+
+static void index_user(MumbleChannelTree *tree, MumbleUser *user) {
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(user->channel_id));
+  if (entry) {
+    if (!entry->users) {
+      entry->users = g_hash_table_new(g_direct_hash, g_direct_equal);
+    }
+    g_hash_table_add(entry->users, user);
+  }
+}
+
+static void unindex_user(MumbleChannelTree *tree, MumbleUser *user) {
+  MumbleChannelTreeEntry *entry = g_hash_table_lookup(tree->id_to_entry, GUINT_TO_POINTER(user->channel_id));
+  if (entry && entry->users) {
+    g_hash_table_remove(entry->users, user);
+  }
 }
 
 MumbleChannel *mumble_channel_tree_get_channel(MumbleChannelTree *tree, guint channel_id) {
@@ -120,7 +445,11 @@ MumbleChannel *mumble_channel_tree_get_channel(MumbleChannelTree *tree, guint ch
 void mumble_channel_tree_free(MumbleChannelTree *tree) {
   g_hash_table_destroy(tree->id_to_channel);
   g_hash_table_destroy(tree->id_to_user);
+  g_hash_table_destroy(tree->id_to_entry);
+  g_hash_table_destroy(tree->links);
+  mumble_name_index_free(tree->names);
   g_node_destroy(tree->root);
+  g_free(tree);
 }
 
 MumbleChannelTree *mumble_channel_tree_copy(MumbleChannelTree *tree) {
@@ -132,11 +461,17 @@ MumbleChannelTree *mumble_channel_tree_new() {
 
   tree->id_to_channel = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, mumble_channel_free);
   tree->id_to_user    = g_hash_table_new_full(g_int_hash, g_int_equal, NULL, mumble_user_free);
+  tree->id_to_entry   = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) free_entry);
+  tree->links         = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) g_array_unref);
+  tree->names         = mumble_name_index_new();
 
   // There is always a root channel.
   MumbleChannel *channel = mumble_channel_new(0, "Root", "");
-  tree->root = g_node_new(channel);
+  MumbleChannelTreeEntry *entry = new_entry(channel);
+  tree->root = entry->node;
+  g_hash_table_insert(tree->id_to_entry, GUINT_TO_POINTER(channel->id), entry);
   g_hash_table_insert(tree->id_to_channel, &channel->id, channel);
+  mumble_name_index_insert(tree->names, MUMBLE_NAME_CHANNEL, channel->id, channel->name);
 
   return tree;
 }
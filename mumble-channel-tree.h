@@ -22,14 +22,74 @@
 
 #include <glib-object.h>
 #include "mumble-channel.h"
+#include "mumble-name-index.h"
 #include "mumble-user.h"
 
+/**
+ * MumbleChannelTree:
+ * @id_to_entry: Map from channel IDs to the nodes of the tree and the users
+ *               in the channels. Children of each node are kept sorted like in
+ *               the official client, by position and then by name, so
+ *               traversals come out in order.
+ * @links: Map from channel IDs to sorted #GArray of the IDs of the channels
+ *         linked to them. Links go both ways and may refer to channels that
+ *         the tree doesn't have yet.
+ * @names: Index of the names of the channels and users, which also serves
+ *         the lookups by name.
+ */
 typedef struct _MumbleChannelTree {
   GHashTable *id_to_channel;
   GHashTable *id_to_user;
   GNode *root;
+  GHashTable *id_to_entry;
+  GHashTable *links;
+  MumbleNameIndex *names;
 } MumbleChannelTree;
 
+/**
+ * mumble_channel_tree_link:
+ * @tree:       A #MumbleChannelTree
+ * @channel_id: A channel ID
+ * @linked_id:  ID of the channel to link to
+ */
+void mumble_channel_tree_link(MumbleChannelTree *tree, guint channel_id, guint linked_id);
+void mumble_channel_tree_unlink(MumbleChannelTree *tree, guint channel_id, guint linked_id);
+
+/**
+ * mumble_channel_tree_set_links:
+ * @tree:       A #MumbleChannelTree
+ * @channel_id: A channel ID
+ * @linked_ids: IDs of all the channels linked to the channel, in any order
+ * @count:      Number of IDs in @linked_ids
+ *
+ * Replace the links of a channel, touching only the links that differ.
+ */
+void mumble_channel_tree_set_links(MumbleChannelTree *tree, guint channel_id, const guint *linked_ids, guint count);
+void mumble_channel_tree_remove_links(MumbleChannelTree *tree, guint channel_id);
+gboolean mumble_channel_tree_is_linked(MumbleChannelTree *tree, guint channel_id, guint linked_id);
+
+/**
+ * mumble_channel_tree_get_links:
+ * @tree:       A #MumbleChannelTree
+ * @channel_id: A channel ID
+ *
+ * Returns: (transfer none) (nullable): Sorted IDs of the channels linked
+ * directly to the channel, or %NULL if there are none
+ */
+GArray *mumble_channel_tree_get_links(MumbleChannelTree *tree, guint channel_id);
+
+/**
+ * mumble_channel_tree_get_linked_channels:
+ * @tree:       A #MumbleChannelTree
+ * @channel_id: A channel ID
+ *
+ * Find the channels linked to a channel directly or through other channels.
+ * Users in any of them hear those who talk in the channel.
+ *
+ * Returns: (transfer full): IDs of the channels, starting with @channel_id
+ */
+GArray *mumble_channel_tree_get_linked_channels(MumbleChannelTree *tree, guint channel_id);
+
 gboolean mumble_channel_tree_has_children(MumbleChannelTree *tree, guint channel_id);
 guint mumble_channel_tree_get_parent_id(MumbleChannelTree *tree, guint channel_id);
 GList *mumble_channel_tree_get_channels_in_topological_order(MumbleChannelTree *tree);
@@ -39,9 +99,53 @@ MumbleChannel *mumble_channel_tree_get_channel_by_name(MumbleChannelTree *tree,
 GList *mumble_channel_tree_get_channel_user_names(MumbleChannelTree *tree, guint channel_id);
 void mumble_channel_tree_remove_user(MumbleChannelTree *tree, guint session_id);
 void mumble_channel_tree_add_user(MumbleChannelTree *tree, MumbleUser *user);
+
+/**
+ * mumble_channel_tree_update_user_name:
+ * @tree:       A #MumbleChannelTree
+ * @session_id: Session ID of a user whose name changed
+ */
+void mumble_channel_tree_update_user_name(MumbleChannelTree *tree, guint session_id);
+MumbleUser *mumble_channel_tree_get_user_by_name(MumbleChannelTree *tree, gchar *name);
 MumbleUser *mumble_channel_tree_get_user(MumbleChannelTree *tree, guint session_id);
-void mumble_channel_tree_add_channel(MumbleChannelTree *tree, MumbleChannel *channel, guint parent_id);
-void mumble_channel_tree_remove_subtree(MumbleChannelTree *tree, guint channel_id);
+/**
+ * mumble_channel_tree_set_channel_name:
+ * @tree:       A #MumbleChannelTree
+ * @channel_id: A channel ID
+ * @name:       New name of the channel
+ *
+ * Rename a channel, moving it among its siblings in O(log n).
+ */
+void mumble_channel_tree_set_channel_name(MumbleChannelTree *tree, guint channel_id, gchar *name);
+void mumble_channel_tree_set_channel_position(MumbleChannelTree *tree, guint channel_id, gint position);
+
+/**
+ * mumble_channel_tree_add_channel:
+ * @tree:      A #MumbleChannelTree
+ * @channel:   (transfer full): The channel to add
+ * @parent_id: ID of the parent channel
+ *
+ * Add a channel under an existing parent. The tree takes ownership of
+ * @channel only if it was added.
+ *
+ * Returns: %FALSE if there is no channel with @parent_id
+ */
+gboolean mumble_channel_tree_add_channel(MumbleChannelTree *tree, MumbleChannel *channel, guint parent_id);
+
+/**
+ * mumble_channel_tree_remove_subtree:
+ * @tree:        A #MumbleChannelTree
+ * @channel_id:  ID of the channel to remove with its descendants
+ * @removed_ids: (nullable): Array of #guint to append the IDs of the removed
+ *               channels to
+ *
+ * Remove a channel and its descendants, with their links. Users in them are
+ * moved to the parent of the channel, like the server does. Takes time in
+ * proportion to the size of the subtree. The root can't be removed.
+ *
+ * Returns: (transfer container): The users that were moved
+ */
+GList *mumble_channel_tree_remove_subtree(MumbleChannelTree *tree, guint channel_id, GArray *removed_ids);
 MumbleChannel *mumble_channel_tree_get_channel(MumbleChannelTree *tree, guint channel_id);
 void mumble_channel_tree_free(MumbleChannelTree *tree);
 MumbleChannelTree *mumble_channel_tree_copy(MumbleChannelTree *tree);
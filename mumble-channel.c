@@ -24,6 +24,13 @@ void mumble_channel_set_description(MumbleChannel *channel, gchar *description)
   channel->description = g_strdup(description);
 }
 
+void mumble_channel_set_description_hash(MumbleChannel *channel, GBytes *description_hash) {
+  g_clear_pointer(&channel->description_hash, g_bytes_unref);
+  if (description_hash) {
+    channel->description_hash = g_bytes_ref(description_hash);
+  }
+}
+
 void mumble_channel_set_name(MumbleChannel *channel, gchar *name) {
   g_free(channel->name);
   channel->name = g_strdup(name);
@@ -31,11 +38,15 @@ void mumble_channel_set_name(MumbleChannel *channel, gchar *name) {
 
 void mumble_channel_free(MumbleChannel *channel) {
   g_free(channel->name);
+  g_free(channel->description);
+  g_clear_pointer(&channel->description_hash, g_bytes_unref);
   g_free(channel);
 }
 
 MumbleChannel *mumble_channel_copy(MumbleChannel *channel) {
   MumbleChannel *copy = mumble_channel_new(channel->id, channel->name, channel->description);
+  copy->position = channel->position;
+  mumble_channel_set_description_hash(copy, channel->description_hash);
   return copy;
 }
 
@@ -24,10 +24,19 @@
 
 typedef struct _MumbleChannel {
   guint id;
+  gint position;
   gchar *name;
   gchar *description;
+  GBytes *description_hash;
 } MumbleChannel;
 
+/**
+ * mumble_channel_set_description_hash:
+ * @channel:          A #MumbleChannel
+ * @description_hash: (nullable): SHA-1 hash of the description, which the
+ *                    server sends instead of long descriptions
+ */
+void mumble_channel_set_description_hash(MumbleChannel *channel, GBytes *description_hash);
 void mumble_channel_set_description(MumbleChannel *channel, gchar *description);
 void mumble_channel_set_name(MumbleChannel *channel, gchar *name);
 void mumble_channel_free(MumbleChannel *channel);
@@ -0,0 +1,297 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-crypt-state.h"
+
+/*
+ * Packets older than this many nonces are rejected as too late.
+ */
+#define LATE_WINDOW 30
+
+static gboolean ocb_encrypt(const MumbleAesKey *, const guint8 *, guint8 *, gsize, const guint8 *, guint8 *);
+static gboolean ocb_decrypt(const MumbleAesKey *, const guint8 *, guint8 *, gsize, const guint8 *, guint8 *);
+
+void mumble_crypt_state_set_key(MumbleCryptState *state, const guint8 *key, const guint8 *client_nonce, const guint8 *server_nonce) {
+  memcpy(state->raw_key, key, MUMBLE_CRYPT_STATE_KEY_SIZE);
+  memcpy(state->encrypt_iv, client_nonce, MUMBLE_AES_BLOCK_SIZE);
+  memcpy(state->decrypt_iv, server_nonce, MUMBLE_AES_BLOCK_SIZE);
+  memset(state->decrypt_history, 0, sizeof(state->decrypt_history));
+  mumble_aes_set_key(&state->key, key);
+  state->last_good_time = 0;
+}
+
+void mumble_crypt_state_set_decrypt_iv(MumbleCryptState *state, const guint8 *iv) {
+  memcpy(state->decrypt_iv, iv, MUMBLE_AES_BLOCK_SIZE);
+  state->resync++;
+}
+
+gboolean mumble_crypt_state_encrypt(MumbleCryptState *state, const guint8 *source, guint8 *destination, gsize length) {
+  guint8 tag[MUMBLE_AES_BLOCK_SIZE];
+
+  for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+    if (++state->encrypt_iv[i]) {
+      break;
+    }
+  }
+
+  if (!ocb_encrypt(&state->key, source, destination + MUMBLE_CRYPT_STATE_OVERHEAD, length, state->encrypt_iv, tag)) {
+    return FALSE;
+  }
+
+  destination[0] = state->encrypt_iv[0];
+  destination[1] = tag[0];
+  destination[2] = tag[1];
+  destination[3] = tag[2];
+  return TRUE;
+}
+
+/*
+ * Only the low byte of the nonce travels with the packet, so the rest is inferred from how far
+ * it is from the previous one. A packet at most LATE_WINDOW behind is decrypted with a temporary
+ * nonce that is then restored, and the history of the second byte for each low byte catches
+ * replays.
+ */
+gboolean mumble_crypt_state_decrypt(MumbleCryptState *state, const guint8 *source, guint8 *destination, gsize length) {
+  guint8 saved_iv[MUMBLE_AES_BLOCK_SIZE];
+  guint8 tag[MUMBLE_AES_BLOCK_SIZE];
+  guint8 iv_byte;
+  gboolean restore = FALSE;
+  gint late = 0;
+  gint lost = 0;
+
+  if (length < MUMBLE_CRYPT_STATE_OVERHEAD) {
+    return FALSE;
+  }
+
+  iv_byte = source[0];
+  memcpy(saved_iv, state->decrypt_iv, MUMBLE_AES_BLOCK_SIZE);
+
+  if (((state->decrypt_iv[0] + 1) & 0xFF) == iv_byte) {
+    if (iv_byte > state->decrypt_iv[0]) {
+      state->decrypt_iv[0] = iv_byte;
+    } else if (iv_byte < state->decrypt_iv[0]) {
+      state->decrypt_iv[0] = iv_byte;
+      for (guint i = 1; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+        if (++state->decrypt_iv[i]) {
+          break;
+        }
+      }
+    } else {
+      return FALSE;
+    }
+  } else {
+    gint difference = iv_byte - state->decrypt_iv[0];
+    if (difference > 128) {
+      difference -= 256;
+    } else if (difference < -128) {
+      difference += 256;
+    }
+
+    if (iv_byte < state->decrypt_iv[0] && difference > -LATE_WINDOW && difference < 0) {
+      late = 1;
+      lost = -1;
+      state->decrypt_iv[0] = iv_byte;
+      restore = TRUE;
+    } else if (iv_byte > state->decrypt_iv[0] && difference > -LATE_WINDOW && difference < 0) {
+      late = 1;
+      lost = -1;
+      state->decrypt_iv[0] = iv_byte;
+      for (guint i = 1; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+        if (state->decrypt_iv[i]--) {
+          break;
+        }
+      }
+      restore = TRUE;
+    } else if (iv_byte > state->decrypt_iv[0] && difference > 0) {
+      lost = iv_byte - state->decrypt_iv[0] - 1;
+      state->decrypt_iv[0] = iv_byte;
+    } else if (iv_byte < state->decrypt_iv[0] && difference > 0) {
+      lost = 256 - state->decrypt_iv[0] + iv_byte - 1;
+      state->decrypt_iv[0] = iv_byte;
+      for (guint i = 1; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+        if (++state->decrypt_iv[i]) {
+          break;
+        }
+      }
+    } else {
+      return FALSE;
+    }
+
+    if (state->decrypt_history[state->decrypt_iv[0]] == state->decrypt_iv[1]) {
+      memcpy(state->decrypt_iv, saved_iv, MUMBLE_AES_BLOCK_SIZE);
+      return FALSE;
+    }
+  }
+
+  if (!ocb_decrypt(&state->key, source + MUMBLE_CRYPT_STATE_OVERHEAD, destination, length - MUMBLE_CRYPT_STATE_OVERHEAD, state->decrypt_iv, tag) || memcmp(tag, source + 1, 3) != 0) {
+    memcpy(state->decrypt_iv, saved_iv, MUMBLE_AES_BLOCK_SIZE);
+    return FALSE;
+  }
+
+  state->decrypt_history[state->decrypt_iv[0]] = state->decrypt_iv[1];
+  if (restore) {
+    memcpy(state->decrypt_iv, saved_iv, MUMBLE_AES_BLOCK_SIZE);
+  }
+
+  state->good++;
+  if (late > 0 || state->late > 0) {
+    state->late += late;
+  }
+  if (lost > 0 || state->lost > 0) {
+    state->lost += lost;
+  }
+  state->last_good_time = g_get_monotonic_time();
+  return TRUE;
+}
+
+void mumble_crypt_state_free(MumbleCryptState *state) {
+  memset(state, 0, sizeof(MumbleCryptState));
+  g_free(state);
+}
+
+MumbleCryptState *mumble_crypt_state_new() {
+  return g_new0(MumbleCryptState, 1);
+}
+
+static inline void xor_block(guint8 *destination, const guint8 *a, const guint8 *b) {
+  for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE; i++) {
+    destination[i] = a[i] ^ b[i];
+  }
+}
+
+/*
+ * Multiplication by x and x + 1 in GF(2^128), as OCB2 defines them on big-endian blocks.
+ */
+static inline void times_two(guint8 *block) {
+  guint8 carry = block[0] >> 7;
+  for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE - 1; i++) {
+    block[i] = (block[i] << 1) | (block[i + 1] >> 7);
+  }
+  block[MUMBLE_AES_BLOCK_SIZE - 1] = (block[MUMBLE_AES_BLOCK_SIZE - 1] << 1) ^ (carry * 0x87);
+}
+
+static inline void times_three(guint8 *block) {
+  guint8 original[MUMBLE_AES_BLOCK_SIZE];
+  memcpy(original, block, MUMBLE_AES_BLOCK_SIZE);
+  times_two(block);
+  xor_block(block, block, original);
+}
+
+static inline void length_block(guint8 *block, gsize length, const guint8 *delta) {
+  memset(block, 0, MUMBLE_AES_BLOCK_SIZE);
+  block[MUMBLE_AES_BLOCK_SIZE - 1] = length * 8;
+  xor_block(block, block, delta);
+}
+
+/*
+ * OCB2 is vulnerable to forgeries when the second to last block is the encoded length of a full
+ * block (the XEX* attack), so like Mumble, such a block is deliberately corrupted by flipping a
+ * bit, and the receiving side rejects a final block that decrypts to the same pattern.
+ */
+static gboolean ocb_encrypt(const MumbleAesKey *key, const guint8 *plain, guint8 *encrypted, gsize length, const guint8 *nonce, guint8 *tag) {
+  guint8 delta[MUMBLE_AES_BLOCK_SIZE];
+  guint8 checksum[MUMBLE_AES_BLOCK_SIZE] = { 0 };
+  guint8 temp[MUMBLE_AES_BLOCK_SIZE];
+  guint8 pad[MUMBLE_AES_BLOCK_SIZE];
+
+  mumble_aes_encrypt(key, nonce, delta);
+
+  while (length > MUMBLE_AES_BLOCK_SIZE) {
+    gboolean flip_bit = FALSE;
+    if (length - MUMBLE_AES_BLOCK_SIZE <= MUMBLE_AES_BLOCK_SIZE) {
+      guint8 sum = 0;
+      for (guint i = 0; i < MUMBLE_AES_BLOCK_SIZE - 1; i++) {
+        sum |= plain[i];
+      }
+      flip_bit = sum == 0;
+    }
+
+    times_two(delta);
+    xor_block(temp, delta, plain);
+    if (flip_bit) {
+      temp[0] ^= 1;
+    }
+    mumble_aes_encrypt(key, temp, temp);
+    xor_block(encrypted, delta, temp);
+    xor_block(checksum, checksum, plain);
+    if (flip_bit) {
+      checksum[0] ^= 1;
+    }
+
+    length -= MUMBLE_AES_BLOCK_SIZE;
+    plain += MUMBLE_AES_BLOCK_SIZE;
+    encrypted += MUMBLE_AES_BLOCK_SIZE;
+  }
+
+  times_two(delta);
+  length_block(temp, length, delta);
+  mumble_aes_encrypt(key, temp, pad);
+  memcpy(temp, plain, length);
+  memcpy(temp + length, pad + length, MUMBLE_AES_BLOCK_SIZE - length);
+  xor_block(checksum, checksum, temp);
+  xor_block(temp, pad, temp);
+  memcpy(encrypted, temp, length);
+
+  times_three(delta);
+  xor_block(temp, delta, checksum);
+  mumble_aes_encrypt(key, temp, tag);
+  return TRUE;
+}
+
+static gboolean ocb_decrypt(const MumbleAesKey *key, const guint8 *encrypted, guint8 *plain, gsize length, const guint8 *nonce, guint8 *tag) {
+  guint8 delta[MUMBLE_AES_BLOCK_SIZE];
+  guint8 checksum[MUMBLE_AES_BLOCK_SIZE] = { 0 };
+  guint8 temp[MUMBLE_AES_BLOCK_SIZE];
+  guint8 pad[MUMBLE_AES_BLOCK_SIZE];
+  gboolean success = TRUE;
+
+  mumble_aes_encrypt(key, nonce, delta);
+
+  while (length > MUMBLE_AES_BLOCK_SIZE) {
+    times_two(delta);
+    xor_block(temp, delta, encrypted);
+    mumble_aes_decrypt(key, temp, temp);
+    xor_block(plain, delta, temp);
+    xor_block(checksum, checksum, plain);
+
+    length -= MUMBLE_AES_BLOCK_SIZE;
+    plain += MUMBLE_AES_BLOCK_SIZE;
+    encrypted += MUMBLE_AES_BLOCK_SIZE;
+  }
+
+  times_two(delta);
+  length_block(temp, length, delta);
+  mumble_aes_encrypt(key, temp, pad);
+  memset(temp, 0, MUMBLE_AES_BLOCK_SIZE);
+  memcpy(temp, encrypted, length);
+  xor_block(temp, temp, pad);
+  xor_block(checksum, checksum, temp);
+  memcpy(plain, temp, length);
+
+  if (memcmp(temp, delta, MUMBLE_AES_BLOCK_SIZE - 1) == 0) {
+    success = FALSE;
+  }
+
+  times_three(delta);
+  xor_block(temp, delta, checksum);
+  mumble_aes_encrypt(key, temp, tag);
+  return success;
+}
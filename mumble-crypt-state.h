@@ -0,0 +1,111 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_CRYPT_STATE_H
+#define MUMBLE_CRYPT_STATE_H
+
+#include <glib.h>
+#include "mumble-aes.h"
+
+/**
+ * SECTION:mumblecryptstate
+ * @short_description: OCB2-AES128 encryption of the voice channel
+ *
+ * Encrypts and decrypts UDP packets the way Mumble does. Each packet is
+ * prefixed with the low byte of its nonce and the first three bytes of its
+ * OCB2 tag, four bytes in total. The nonces count up from the ones in
+ * CryptSetup, and the receiving side tolerates reordering and loss of up to
+ * a few dozen packets. When decryption keeps failing, the nonces have drifted
+ * apart and a resync has to be requested from the server.
+ */
+
+#define MUMBLE_CRYPT_STATE_KEY_SIZE 16
+#define MUMBLE_CRYPT_STATE_OVERHEAD 4
+
+/**
+ * MumbleCryptState:
+ * @encrypt_iv:     Nonce of the last encrypted packet
+ * @decrypt_iv:     Nonce of the last decrypted packet
+ * @good:           Number of packets decrypted successfully
+ * @late:           Number of packets that arrived out of order
+ * @lost:           Number of packets never received
+ * @resync:         Number of times the decrypt nonce was set by the server
+ * @last_good_time: Monotonic time of the last successful decryption
+ */
+typedef struct _MumbleCryptState {
+  MumbleAesKey key;
+  guint8 raw_key[MUMBLE_CRYPT_STATE_KEY_SIZE];
+  guint8 encrypt_iv[MUMBLE_AES_BLOCK_SIZE];
+  guint8 decrypt_iv[MUMBLE_AES_BLOCK_SIZE];
+  guint8 decrypt_history[256];
+  guint32 good;
+  guint32 late;
+  guint32 lost;
+  guint32 resync;
+  gint64 last_good_time;
+} MumbleCryptState;
+
+/**
+ * mumble_crypt_state_set_key:
+ * @state:        A #MumbleCryptState
+ * @key:          16-byte key from CryptSetup
+ * @client_nonce: 16-byte nonce for encryption
+ * @server_nonce: 16-byte nonce for decryption
+ *
+ * Start over with new key material. Statistics are kept.
+ */
+void mumble_crypt_state_set_key(MumbleCryptState *state, const guint8 *key, const guint8 *client_nonce, const guint8 *server_nonce);
+
+/**
+ * mumble_crypt_state_set_decrypt_iv:
+ * @state: A #MumbleCryptState
+ * @iv:    16-byte nonce from the server
+ *
+ * Resynchronize the decrypt nonce.
+ */
+void mumble_crypt_state_set_decrypt_iv(MumbleCryptState *state, const guint8 *iv);
+
+/**
+ * mumble_crypt_state_encrypt:
+ * @state:        A #MumbleCryptState
+ * @source:       Plaintext
+ * @destination:  Buffer of @length + %MUMBLE_CRYPT_STATE_OVERHEAD bytes
+ * @length:       Length of @source
+ *
+ * Returns: %FALSE if the packet can't be encrypted safely
+ */
+gboolean mumble_crypt_state_encrypt(MumbleCryptState *state, const guint8 *source, guint8 *destination, gsize length);
+
+/**
+ * mumble_crypt_state_decrypt:
+ * @state:       A #MumbleCryptState
+ * @source:      Encrypted packet
+ * @destination: Buffer of @length - %MUMBLE_CRYPT_STATE_OVERHEAD bytes
+ * @length:      Length of @source
+ *
+ * Returns: %FALSE if the packet is a replay, too old or fails to
+ * authenticate. The decrypt nonce is left unchanged in that case.
+ */
+gboolean mumble_crypt_state_decrypt(MumbleCryptState *state, const guint8 *source, guint8 *destination, gsize length);
+
+void mumble_crypt_state_free(MumbleCryptState *state);
+MumbleCryptState *mumble_crypt_state_new();
+
+#endif
@@ -0,0 +1,295 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-html-splitter.h"
+
+typedef enum {
+  TOKEN_CHARACTER,
+  TOKEN_SPACE,
+  TOKEN_ENTITY,
+  TOKEN_OPEN_TAG,
+  TOKEN_CLOSE_TAG,
+  TOKEN_VOID_TAG,
+  TOKEN_LINE_BREAK
+} MumbleHtmlTokenType;
+
+typedef struct {
+  MumbleHtmlTokenType type;
+  const gchar *start;
+  gsize size;
+  gsize length;
+  const gchar *name;
+  gsize name_size;
+} MumbleHtmlToken;
+
+/*
+ * Open elements form a stack whose entries are never modified after they are pushed, so a
+ * pointer to the top is a complete snapshot of the stack. The entries live until the split is
+ * done.
+ */
+typedef struct _MumbleHtmlElement MumbleHtmlElement;
+struct _MumbleHtmlElement {
+  const MumbleHtmlToken *token;
+  MumbleHtmlElement *parent;
+  gsize closing_length;
+};
+
+static GArray *tokenize(const gchar *);
+static gsize scan_tag(MumbleHtmlToken *, const gchar *);
+static gsize get_length(const gchar *, gsize);
+static gboolean is_void_element(const gchar *, gsize);
+static MumbleHtmlElement *apply_token(GPtrArray *, MumbleHtmlElement *, const MumbleHtmlToken *);
+static void append_opening_tags(GString *, MumbleHtmlElement *);
+static void append_closing_tags(GString *, MumbleHtmlElement *);
+static gsize get_opening_length(MumbleHtmlElement *);
+
+static const gchar *void_elements[] = { "area", "base", "br", "col", "embed", "hr", "img", "input", "link", "meta", "param", "source", "track", "wbr" };
+
+gsize mumble_html_get_length(const gchar *text) {
+  return get_length(text, strlen(text));
+}
+
+/*
+ * Pieces are filled greedily, remembering the last position after whitespace or a line break
+ * together with the elements open there. When the next token doesn't fit along with the closing
+ * tags it would need, the piece is cut at that position, or right there if there is none, and
+ * the next piece starts over from the token after the cut.
+ */
+gchar **mumble_html_split(const gchar *text, gsize max_length) {
+  GPtrArray *pieces = g_ptr_array_new();
+
+  if (!max_length || (mumble_html_get_length(text) <= max_length)) {
+    g_ptr_array_add(pieces, g_strdup(text));
+    g_ptr_array_add(pieces, NULL);
+    return (gchar **) g_ptr_array_free(pieces, FALSE);
+  }
+
+  GArray *tokens = tokenize(text);
+  GPtrArray *elements = g_ptr_array_new_with_free_func(g_free);
+  MumbleHtmlElement *top = NULL;
+  guint index = 0;
+
+  while (index < tokens->len) {
+    GString *piece = g_string_new(NULL);
+    append_opening_tags(piece, top);
+    gsize length = get_opening_length(top);
+    gsize prefix_size = piece->len;
+
+    gboolean has_break = FALSE;
+    guint break_index = 0;
+    gsize break_size = 0;
+    MumbleHtmlElement *break_top = NULL;
+
+    for (; index < tokens->len; index++) {
+      const MumbleHtmlToken *token = &g_array_index(tokens, MumbleHtmlToken, index);
+      MumbleHtmlElement *next_top = apply_token(elements, top, token);
+      gsize closing_length = next_top ? next_top->closing_length : 0;
+
+      if ((piece->len > prefix_size) && (length + token->length + closing_length > max_length)) {
+        if (has_break) {
+          g_string_truncate(piece, break_size);
+          index = break_index;
+          top = break_top;
+        }
+        break;
+      }
+
+      g_string_append_len(piece, token->start, token->size);
+      length += token->length;
+      top = next_top;
+
+      if ((token->type == TOKEN_SPACE) || (token->type == TOKEN_LINE_BREAK)) {
+        has_break = TRUE;
+        break_index = index + 1;
+        break_size = piece->len;
+        break_top = top;
+      }
+    }
+
+    append_closing_tags(piece, top);
+    g_ptr_array_add(pieces, g_string_free(piece, FALSE));
+  }
+
+  g_ptr_array_free(elements, TRUE);
+  g_array_free(tokens, TRUE);
+
+  g_ptr_array_add(pieces, NULL);
+  return (gchar **) g_ptr_array_free(pieces, FALSE);
+}
+
+static GArray *tokenize(const gchar *text) {
+  GArray *tokens = g_array_new(FALSE, TRUE, sizeof(MumbleHtmlToken));
+
+  for (const gchar *position = text; *position;) {
+    MumbleHtmlToken token = { TOKEN_CHARACTER, position, 0, 0, NULL, 0 };
+
+    if ((*position == '<') && (token.size = scan_tag(&token, position))) {
+      token.length = get_length(position, token.size);
+    } else if (*position == '&') {
+      const gchar *end = position + 1;
+      while (g_ascii_isalnum(*end) || (*end == '#')) {
+        end++;
+      }
+      if ((*end == ';') && (end > position + 1)) {
+        token.type = TOKEN_ENTITY;
+        token.size = end + 1 - position;
+      } else {
+        token.size = 1;
+      }
+      token.length = token.size;
+    } else {
+      token.size = g_utf8_next_char(position) - position;
+      token.length = get_length(position, token.size);
+      if (g_ascii_isspace(*position)) {
+        token.type = TOKEN_SPACE;
+      }
+    }
+
+    g_array_append_val(tokens, token);
+    position += token.size;
+  }
+
+  return tokens;
+}
+
+/*
+ * Returns the size of the tag at the start of text, or 0 if it isn't a tag after all and the
+ * '<' should be taken as an ordinary character. Comments and declarations count as void tags.
+ */
+static gsize scan_tag(MumbleHtmlToken *token, const gchar *text) {
+  if (g_str_has_prefix(text, "<!--")) {
+    const gchar *end = strstr(text + 4, "-->");
+    if (!end) {
+      return 0;
+    }
+    token->type = TOKEN_VOID_TAG;
+    return end + 3 - text;
+  }
+
+  const gchar *name = text + 1;
+  gboolean closing = (*name == '/');
+  if (closing) {
+    name++;
+  }
+  if (!g_ascii_isalpha(*name) && (*name != '!')) {
+    return 0;
+  }
+
+  const gchar *name_end = name + 1;
+  while (g_ascii_isalnum(*name_end)) {
+    name_end++;
+  }
+
+  gchar quote = 0;
+  const gchar *end = name_end;
+  for (; *end && (quote || (*end != '>')); end++) {
+    if (quote) {
+      if (*end == quote) {
+        quote = 0;
+      }
+    } else if ((*end == '"') || (*end == '\'')) {
+      quote = *end;
+    }
+  }
+  if (!*end) {
+    return 0;
+  }
+
+  token->name = name;
+  token->name_size = name_end - name;
+
+  if ((token->name_size == 2) && (g_ascii_strncasecmp(name, "br", 2) == 0)) {
+    token->type = TOKEN_LINE_BREAK;
+  } else if (closing) {
+    token->type = TOKEN_CLOSE_TAG;
+  } else if ((*name == '!') || (end[-1] == '/') || is_void_element(name, token->name_size)) {
+    token->type = TOKEN_VOID_TAG;
+  } else {
+    token->type = TOKEN_OPEN_TAG;
+  }
+
+  return end + 1 - text;
+}
+
+static gsize get_length(const gchar *text, gsize size) {
+  gsize length = 0;
+  for (const gchar *position = text; position < text + size; position = g_utf8_next_char(position)) {
+    length += (g_utf8_get_char(position) >= 0x10000) ? 2 : 1;
+  }
+  return length;
+}
+
+static gboolean is_void_element(const gchar *name, gsize size) {
+  for (guint i = 0; i < G_N_ELEMENTS(void_elements); i++) {
+    if ((strlen(void_elements[i]) == size) && (g_ascii_strncasecmp(name, void_elements[i], size) == 0)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+/*
+ * A closing tag closes the innermost open element with the same name and everything inside it,
+ * and is ignored if there is no such element.
+ */
+static MumbleHtmlElement *apply_token(GPtrArray *elements, MumbleHtmlElement *top, const MumbleHtmlToken *token) {
+  if (token->type == TOKEN_OPEN_TAG) {
+    MumbleHtmlElement *element = g_new(MumbleHtmlElement, 1);
+    element->token = token;
+    element->parent = top;
+    element->closing_length = (top ? top->closing_length : 0) + token->name_size + 3;
+    g_ptr_array_add(elements, element);
+    return element;
+  }
+
+  if (token->type == TOKEN_CLOSE_TAG) {
+    for (MumbleHtmlElement *element = top; element; element = element->parent) {
+      if ((element->token->name_size == token->name_size) && (g_ascii_strncasecmp(element->token->name, token->name, token->name_size) == 0)) {
+        return element->parent;
+      }
+    }
+  }
+
+  return top;
+}
+
+static void append_opening_tags(GString *string, MumbleHtmlElement *top) {
+  if (top) {
+    append_opening_tags(string, top->parent);
+    g_string_append_len(string, top->token->start, top->token->size);
+  }
+}
+
+static void append_closing_tags(GString *string, MumbleHtmlElement *top) {
+  for (MumbleHtmlElement *element = top; element; element = element->parent) {
+    g_string_append(string, "</");
+    g_string_append_len(string, element->token->name, element->token->name_size);
+    g_string_append_c(string, '>');
+  }
+}
+
+static gsize get_opening_length(MumbleHtmlElement *top) {
+  gsize length = 0;
+  for (MumbleHtmlElement *element = top; element; element = element->parent) {
+    length += element->token->length;
+  }
+  return length;
+}
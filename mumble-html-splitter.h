@@ -0,0 +1,60 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_HTML_SPLITTER_H
+#define MUMBLE_HTML_SPLITTER_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblehtmlsplitter
+ * @short_description: Splitting of long text messages
+ *
+ * Splits HTML text into pieces that each fit the server's message length
+ * limit. Lengths are counted in UTF-16 code units like the server counts
+ * them. Pieces end after a line break or whitespace when possible, and never
+ * inside a tag, an entity or a UTF-8 sequence. Elements that are open where a
+ * piece ends are closed at its end and opened again at the start of the next
+ * one, so that every piece is well-formed on its own.
+ */
+
+/**
+ * mumble_html_get_length:
+ * @text: UTF-8 text
+ *
+ * Returns: Length of @text in UTF-16 code units
+ */
+gsize mumble_html_get_length(const gchar *text);
+
+/**
+ * mumble_html_split:
+ * @text:       Valid UTF-8 HTML text
+ * @max_length: Maximum length of a piece in UTF-16 code units, or 0 for no
+ *              limit
+ *
+ * Split @text into pieces of at most @max_length. A single tag or entity that
+ * is longer than @max_length on its own still ends up in a piece of its own.
+ *
+ * Returns: (transfer full): %NULL-terminated array of pieces, to be freed
+ * with g_strfreev()
+ */
+gchar **mumble_html_split(const gchar *text, gsize max_length);
+
+#endif
@@ -0,0 +1,245 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-base64.h"
+#include "mumble-inline-image-scanner.h"
+
+#define URI_SCHEME     "data:"
+#define BASE64_SUFFIX  ";base64"
+#define MAX_HEADER_SIZE 128
+
+/*
+ * TEXT copies text until a quote that may start a data URI. PREFIX matches the scheme and HEADER
+ * collects the media type up to the comma, giving up and copying what was matched when the
+ * value turns out to be something else. DATA decodes base64 until the closing quote, and SKIP
+ * drops the rest of an image that is too large or invalid.
+ */
+typedef enum {
+  STATE_TEXT,
+  STATE_PREFIX,
+  STATE_HEADER,
+  STATE_DATA,
+  STATE_SKIP
+} MumbleInlineImageScannerState;
+
+struct _MumbleInlineImageScanner {
+  MumbleInlineImageScannerState state;
+  gchar quote;
+  GString *header;
+  GString *output;
+  gchar *mime_type;
+  GByteArray *image;
+  MumbleBase64Decoder decoder;
+  gsize max_image_size;
+  guint image_count;
+  MumbleInlineImageFunc image_func;
+  gpointer user_data;
+};
+
+static gsize scan_text(MumbleInlineImageScanner *, const gchar *, gsize);
+static gsize scan_header(MumbleInlineImageScanner *, const gchar *, gsize);
+static gsize scan_data(MumbleInlineImageScanner *, const gchar *, gsize);
+static void start_image(MumbleInlineImageScanner *);
+static void finish_image(MumbleInlineImageScanner *);
+static void abandon_header(MumbleInlineImageScanner *);
+static void drop_image(MumbleInlineImageScanner *);
+
+void mumble_inline_image_scanner_feed(MumbleInlineImageScanner *scanner, const gchar *text, gsize length) {
+  while (length) {
+    gsize consumed;
+    switch (scanner->state) {
+      case STATE_TEXT:
+        consumed = scan_text(scanner, text, length);
+        break;
+      case STATE_PREFIX:
+      case STATE_HEADER:
+        consumed = scan_header(scanner, text, length);
+        break;
+      default:
+        consumed = scan_data(scanner, text, length);
+        break;
+    }
+    text += consumed;
+    length -= consumed;
+  }
+}
+
+gchar *mumble_inline_image_scanner_finish(MumbleInlineImageScanner *scanner) {
+  if ((scanner->state == STATE_PREFIX) || (scanner->state == STATE_HEADER)) {
+    abandon_header(scanner);
+  }
+  drop_image(scanner);
+  scanner->state = STATE_TEXT;
+
+  gchar *output = g_string_free(scanner->output, FALSE);
+  scanner->output = g_string_new(NULL);
+  return output;
+}
+
+guint mumble_inline_image_scanner_get_image_count(MumbleInlineImageScanner *scanner) {
+  return scanner->image_count;
+}
+
+void mumble_inline_image_scanner_free(MumbleInlineImageScanner *scanner) {
+  drop_image(scanner);
+  g_string_free(scanner->header, TRUE);
+  g_string_free(scanner->output, TRUE);
+  g_free(scanner);
+}
+
+MumbleInlineImageScanner *mumble_inline_image_scanner_new(gsize max_image_size, MumbleInlineImageFunc image_func, gpointer user_data) {
+  MumbleInlineImageScanner *scanner = g_new0(MumbleInlineImageScanner, 1);
+  scanner->state = STATE_TEXT;
+  scanner->header = g_string_new(NULL);
+  scanner->output = g_string_new(NULL);
+  scanner->max_image_size = max_image_size;
+  scanner->image_func = image_func;
+  scanner->user_data = user_data;
+  return scanner;
+}
+
+static gsize scan_text(MumbleInlineImageScanner *scanner, const gchar *text, gsize length) {
+  gsize i = 0;
+  while ((i < length) && (text[i] != '"') && (text[i] != '\'')) {
+    i++;
+  }
+
+  if (i < length) {
+    scanner->quote = text[i];
+    scanner->state = STATE_PREFIX;
+    g_string_truncate(scanner->header, 0);
+    i++;
+  }
+
+  g_string_append_len(scanner->output, text, i);
+  return i;
+}
+
+/*
+ * A character that doesn't fit is left unconsumed so that it is scanned again as text, since it
+ * may be a quote that starts another attribute value.
+ */
+static gsize scan_header(MumbleInlineImageScanner *scanner, const gchar *text, gsize length) {
+  gsize scheme_length = strlen(URI_SCHEME);
+
+  for (gsize i = 0; i < length; i++) {
+    gchar character = text[i];
+
+    if (scanner->state == STATE_PREFIX) {
+      if (g_ascii_tolower(character) != URI_SCHEME[scanner->header->len]) {
+        abandon_header(scanner);
+        return i;
+      }
+      g_string_append_c(scanner->header, character);
+      if (scanner->header->len == scheme_length) {
+        scanner->state = STATE_HEADER;
+      }
+      continue;
+    }
+
+    if (character == ',') {
+      const gchar *media_type = scanner->header->str + scheme_length;
+      gsize media_type_length = scanner->header->len - scheme_length;
+      gsize suffix_length = strlen(BASE64_SUFFIX);
+      if ((g_ascii_strncasecmp(media_type, "image/", 6) == 0) && (media_type_length > suffix_length) && (g_ascii_strcasecmp(media_type + media_type_length - suffix_length, BASE64_SUFFIX) == 0)) {
+        scanner->mime_type = g_strndup(media_type, media_type_length - suffix_length);
+        start_image(scanner);
+        return i + 1;
+      }
+      g_string_append_c(scanner->header, character);
+      abandon_header(scanner);
+      return i + 1;
+    }
+
+    if ((character == scanner->quote) || (scanner->header->len >= MAX_HEADER_SIZE)) {
+      abandon_header(scanner);
+      return i;
+    }
+    g_string_append_c(scanner->header, character);
+  }
+
+  return length;
+}
+
+static gsize scan_data(MumbleInlineImageScanner *scanner, const gchar *text, gsize length) {
+  const gchar *end = memchr(text, scanner->quote, length);
+  gsize size = end ? (gsize) (end - text) : length;
+
+  if (scanner->state == STATE_DATA) {
+    guint old_length = scanner->image->len;
+    g_byte_array_set_size(scanner->image, old_length + MUMBLE_BASE64_MAX_DECODED_SIZE(size));
+    gsize decoded = mumble_base64_decoder_feed(&scanner->decoder, text, size, scanner->image->data + old_length);
+    g_byte_array_set_size(scanner->image, old_length + decoded);
+
+    if (scanner->decoder.failed || (scanner->image->len > scanner->max_image_size)) {
+      drop_image(scanner);
+      scanner->state = STATE_SKIP;
+    }
+  }
+
+  if (!end) {
+    return length;
+  }
+
+  if (scanner->state == STATE_DATA) {
+    finish_image(scanner);
+  }
+  g_string_append_c(scanner->output, scanner->quote);
+  scanner->state = STATE_TEXT;
+  return size + 1;
+}
+
+static void start_image(MumbleInlineImageScanner *scanner) {
+  scanner->image = g_byte_array_new();
+  mumble_base64_decoder_init(&scanner->decoder);
+  scanner->state = STATE_DATA;
+}
+
+static void finish_image(MumbleInlineImageScanner *scanner) {
+  guint8 tail[2];
+  gsize tail_length;
+  if (!mumble_base64_decoder_finish(&scanner->decoder, tail, &tail_length) || !(scanner->image->len + tail_length)) {
+    drop_image(scanner);
+    return;
+  }
+  g_byte_array_append(scanner->image, tail, tail_length);
+
+  GByteArray *image = scanner->image;
+  scanner->image = NULL;
+  gchar *uri = scanner->image_func(scanner->mime_type, image, scanner->user_data);
+  scanner->image_count++;
+  if (uri) {
+    g_string_append(scanner->output, uri);
+    g_free(uri);
+  }
+  g_clear_pointer(&scanner->mime_type, g_free);
+}
+
+static void abandon_header(MumbleInlineImageScanner *scanner) {
+  g_string_append_len(scanner->output, scanner->header->str, scanner->header->len);
+  g_string_truncate(scanner->header, 0);
+  scanner->state = STATE_TEXT;
+}
+
+static void drop_image(MumbleInlineImageScanner *scanner) {
+  g_clear_pointer(&scanner->image, g_byte_array_unref);
+  g_clear_pointer(&scanner->mime_type, g_free);
+}
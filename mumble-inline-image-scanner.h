@@ -0,0 +1,93 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_INLINE_IMAGE_SCANNER_H
+#define MUMBLE_INLINE_IMAGE_SCANNER_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumbleinlineimagescanner
+ * @short_description: Extraction of inline images from HTML
+ *
+ * Mumble clients send images inline in text messages as base64 data URIs in
+ * quoted attribute values, such as &lt;img src="data:image/png;base64,...">.
+ * The scanner takes HTML in pieces of any size, decodes the images it finds
+ * on the fly and replaces each URI with one returned by a callback, typically
+ * a reference to an image store. The rest of the text is copied as it is.
+ *
+ * Only the text outside images and the image being decoded are held in
+ * memory, so an image never exists both in base64 and decoded form.
+ */
+
+/**
+ * MumbleInlineImageFunc:
+ * @mime_type: MIME type of the image from the URI, such as image/png
+ * @data:      (transfer full): Decoded image
+ * @user_data: User data passed to mumble_inline_image_scanner_new()
+ *
+ * Returns: (transfer full) (nullable): URI to put in place of the data URI,
+ * or %NULL to leave the attribute empty
+ */
+typedef gchar *(*MumbleInlineImageFunc)(const gchar *mime_type, GByteArray *data, gpointer user_data);
+
+typedef struct _MumbleInlineImageScanner MumbleInlineImageScanner;
+
+/**
+ * mumble_inline_image_scanner_feed:
+ * @scanner: A #MumbleInlineImageScanner
+ * @text:    Next piece of HTML
+ * @length:  Length of @text in bytes
+ */
+void mumble_inline_image_scanner_feed(MumbleInlineImageScanner *scanner, const gchar *text, gsize length);
+
+/**
+ * mumble_inline_image_scanner_finish:
+ * @scanner: A #MumbleInlineImageScanner
+ *
+ * End the input. An image still being decoded is dropped. The scanner can be
+ * fed new input afterwards.
+ *
+ * Returns: (transfer full): The HTML with the data URIs replaced
+ */
+gchar *mumble_inline_image_scanner_finish(MumbleInlineImageScanner *scanner);
+
+/**
+ * mumble_inline_image_scanner_get_image_count:
+ * @scanner: A #MumbleInlineImageScanner
+ *
+ * Returns: Number of images passed to the callback so far
+ */
+guint mumble_inline_image_scanner_get_image_count(MumbleInlineImageScanner *scanner);
+
+void mumble_inline_image_scanner_free(MumbleInlineImageScanner *scanner);
+
+/**
+ * mumble_inline_image_scanner_new:
+ * @max_image_size: Largest decoded image to accept in bytes, larger ones are
+ *                  dropped
+ * @image_func:     Function to call for every decoded image
+ * @user_data:      User data for @image_func
+ *
+ * Returns: A new #MumbleInlineImageScanner
+ */
+MumbleInlineImageScanner *mumble_inline_image_scanner_new(gsize max_image_size, MumbleInlineImageFunc image_func, gpointer user_data);
+
+#endif
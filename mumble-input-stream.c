@@ -24,6 +24,9 @@
 struct _MumbleInputStreamPrivate {
   guint8 *buffer;
   gint offset;
+  MumbleStats *stats;
+  MumbleTrace *trace;
+  gint64 read_time;
 };
 
 G_DEFINE_TYPE_WITH_PRIVATE(MumbleInputStream, mumble_input_stream, G_TYPE_FILTER_INPUT_STREAM)
@@ -41,6 +44,16 @@ void mumble_input_stream_read_message_async(MumbleInputStream *stream, GCancella
   start_read(stream, task, 6);
 }
 
+void mumble_input_stream_set_stats(MumbleInputStream *stream, MumbleStats *stats) {
+  MumbleInputStreamPrivate *priv = mumble_input_stream_get_instance_private(stream);
+  priv->stats = stats;
+}
+
+void mumble_input_stream_set_trace(MumbleInputStream *stream, MumbleTrace *trace) {
+  MumbleInputStreamPrivate *priv = mumble_input_stream_get_instance_private(stream);
+  priv->trace = trace;
+}
+
 GInputStream *mumble_input_stream_new(GInputStream *base_stream) {
   return g_object_new(MUMBLE_TYPE_INPUT_STREAM, "base-stream", base_stream, NULL);
 }
@@ -50,6 +63,8 @@ static void mumble_input_stream_init(MumbleInputStream *stream) {
 
   priv->buffer = g_malloc(MAX_MESSAGE_SIZE);
   priv->offset = 0;
+  priv->stats  = NULL;
+  priv->trace  = NULL;
 }
 
 static void mumble_input_stream_class_init(MumbleInputStreamClass *mumble_input_stream_class) {
@@ -82,10 +97,25 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer user_data) {
     return;
   }
 
+  MumbleStats *stats = priv->stats;
+  gint64 start_time = ((stats && stats->timing) || priv->trace) ? mumble_stats_get_time() : 0;
+  if (!priv->offset) {
+    priv->read_time = start_time;
+  }
+
   priv->offset += count;
   MumbleMessage *message = mumble_message_read(priv->buffer, priv->offset);
 
   if (message) {
+    if (stats) {
+      mumble_stats_count_in(stats, message->type, priv->offset, (start_time && stats->timing) ? (mumble_stats_get_time() - start_time) : 0);
+    }
+    if (priv->trace) {
+      message->trace_span = mumble_trace_span_new(message->type);
+      message->trace_span->points[MUMBLE_TRACE_READ]  = priv->read_time;
+      message->trace_span->points[MUMBLE_TRACE_FRAME] = start_time;
+      mumble_trace_span_mark(message->trace_span, MUMBLE_TRACE_DECODED);
+    }
     priv->offset = 0;
 
     g_task_return_pointer(task, message, mumble_message_free);
@@ -23,6 +23,8 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "mumble-message.h"
+#include "mumble-stats.h"
+#include "mumble-trace.h"
 
 #define MUMBLE_TYPE_INPUT_STREAM mumble_input_stream_get_type()
 
@@ -45,6 +47,25 @@ typedef enum {
 
 MumbleMessage *mumble_input_stream_read_message_finish(MumbleInputStream *stream, GAsyncResult *result, GError **error);
 void mumble_input_stream_read_message_async(MumbleInputStream *stream, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_ata);
+/**
+ * mumble_input_stream_set_stats:
+ * @stream: A #MumbleInputStream
+ * @stats:  (nullable): #MumbleStats to count the frames read in, or %NULL
+ *
+ * The stats are updated from the thread that reads the stream.
+ */
+void mumble_input_stream_set_stats(MumbleInputStream *stream, MumbleStats *stats);
+
+/**
+ * mumble_input_stream_set_trace:
+ * @stream: A #MumbleInputStream
+ * @trace:  (nullable): #MumbleTrace to start spans for, or %NULL
+ *
+ * Give every message read a #MumbleTraceSpan with the times when the first
+ * and the last bytes of its frame were read and when it was decoded.
+ */
+void mumble_input_stream_set_trace(MumbleInputStream *stream, MumbleTrace *trace);
+
 GInputStream *mumble_input_stream_new(GInputStream *base_stream);
 GType mumble_input_stream_get_type();
 
@@ -0,0 +1,164 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "mumble-jitter-buffer.h"
+
+#define MIN_TARGET_FRAMES 2
+#define MAX_TARGET_FRAMES 20
+
+/*
+ * After this many consecutive missing frames without anything left in the buffer, the speaker is
+ * considered to have stopped without a terminator packet.
+ */
+#define MAX_MISSING_FRAMES 10
+
+static void update_jitter(MumbleJitterBuffer *buffer, guint64 sequence, gint64 arrival_time);
+static MumbleJitterBufferSlot *get_slot(MumbleJitterBuffer *buffer, guint64 sequence);
+static guint64 get_first_sequence(MumbleJitterBuffer *buffer);
+
+gboolean mumble_jitter_buffer_push(MumbleJitterBuffer *buffer, guint64 sequence, guint frames, const guint8 *data, gsize length, gboolean terminator, gint64 arrival_time) {
+  if ((length > MUMBLE_JITTER_BUFFER_MAX_PACKET) || !frames) {
+    return FALSE;
+  }
+
+  update_jitter(buffer, sequence, arrival_time);
+
+  if (buffer->playing && ((sequence < buffer->next_sequence) || (sequence - buffer->next_sequence >= MUMBLE_JITTER_BUFFER_SLOTS))) {
+    buffer->late++;
+    return FALSE;
+  }
+
+  MumbleJitterBufferSlot *slot = get_slot(buffer, sequence);
+  if (slot->used) {
+    if (slot->sequence == sequence) {
+      return FALSE;
+    }
+    buffer->queued_frames -= slot->frames;
+  }
+
+  slot->sequence     = sequence;
+  slot->arrival_time = arrival_time;
+  slot->frames       = frames;
+  slot->terminator   = terminator;
+  slot->length       = length;
+  slot->used         = TRUE;
+  memcpy(slot->data, data, length);
+
+  buffer->queued_frames += frames;
+
+  return TRUE;
+}
+
+MumbleJitterBufferResult mumble_jitter_buffer_pop(MumbleJitterBuffer *buffer, MumbleJitterBufferSlot **slot) {
+  if (!buffer->playing) {
+    if (!buffer->queued_frames) {
+      return MUMBLE_JITTER_BUFFER_IDLE;
+    }
+
+    guint64 first_sequence = get_first_sequence(buffer);
+    MumbleJitterBufferSlot *first_slot = get_slot(buffer, first_sequence);
+    if ((buffer->queued_frames < buffer->target_frames) && !first_slot->terminator) {
+      return MUMBLE_JITTER_BUFFER_BUFFERING;
+    }
+
+    buffer->playing = TRUE;
+    buffer->next_sequence = first_sequence;
+    buffer->missing_frames = 0;
+  }
+
+  MumbleJitterBufferSlot *next_slot = get_slot(buffer, buffer->next_sequence);
+  if (next_slot->used && (next_slot->sequence == buffer->next_sequence)) {
+    next_slot->used = FALSE;
+    buffer->queued_frames -= next_slot->frames;
+    buffer->next_sequence += next_slot->frames;
+    buffer->missing_frames = 0;
+
+    if (next_slot->terminator) {
+      buffer->playing = FALSE;
+    }
+
+    *slot = next_slot;
+    return MUMBLE_JITTER_BUFFER_PACKET;
+  }
+
+  if (!buffer->queued_frames && (++buffer->missing_frames > MAX_MISSING_FRAMES)) {
+    buffer->playing = FALSE;
+    return MUMBLE_JITTER_BUFFER_IDLE;
+  }
+
+  buffer->next_sequence++;
+  buffer->lost++;
+
+  return MUMBLE_JITTER_BUFFER_LOST;
+}
+
+void mumble_jitter_buffer_reset(MumbleJitterBuffer *buffer) {
+  for (guint i = 0; i < MUMBLE_JITTER_BUFFER_SLOTS; i++) {
+    buffer->slots[i].used = FALSE;
+  }
+
+  buffer->playing       = FALSE;
+  buffer->queued_frames = 0;
+  buffer->target_frames = MIN_TARGET_FRAMES;
+  buffer->jitter        = 0;
+  buffer->last_arrival_time = 0;
+}
+
+void mumble_jitter_buffer_free(MumbleJitterBuffer *buffer) {
+  g_free(buffer);
+}
+
+MumbleJitterBuffer *mumble_jitter_buffer_new() {
+  MumbleJitterBuffer *buffer = g_new0(MumbleJitterBuffer, 1);
+  mumble_jitter_buffer_reset(buffer);
+  return buffer;
+}
+
+/*
+ * Interarrival jitter as in RFC 3550: the difference between the spacing of arrival times and
+ * the spacing of the frames themselves, smoothed with a gain of 1/16. Enough frames are
+ * buffered to cover about three times the jitter.
+ */
+static void update_jitter(MumbleJitterBuffer *buffer, guint64 sequence, gint64 arrival_time) {
+  if (buffer->last_arrival_time) {
+    gdouble transit_difference = (arrival_time - buffer->last_arrival_time) - ((gint64) (sequence - buffer->last_arrival_sequence)) * MUMBLE_JITTER_BUFFER_FRAME_DURATION;
+    buffer->jitter += (fabs(transit_difference) - buffer->jitter) / 16;
+    buffer->target_frames = CLAMP((guint) ceil(3 * buffer->jitter / MUMBLE_JITTER_BUFFER_FRAME_DURATION) + 1, MIN_TARGET_FRAMES, MAX_TARGET_FRAMES);
+  }
+
+  buffer->last_arrival_time = arrival_time;
+  buffer->last_arrival_sequence = sequence;
+}
+
+static MumbleJitterBufferSlot *get_slot(MumbleJitterBuffer *buffer, guint64 sequence) {
+  return &buffer->slots[sequence % MUMBLE_JITTER_BUFFER_SLOTS];
+}
+
+static guint64 get_first_sequence(MumbleJitterBuffer *buffer) {
+  guint64 first_sequence = G_MAXUINT64;
+  for (guint i = 0; i < MUMBLE_JITTER_BUFFER_SLOTS; i++) {
+    if (buffer->slots[i].used) {
+      first_sequence = MIN(first_sequence, buffer->slots[i].sequence);
+    }
+  }
+  return first_sequence;
+}
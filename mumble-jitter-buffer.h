@@ -0,0 +1,124 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_JITTER_BUFFER_H
+#define MUMBLE_JITTER_BUFFER_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblejitterbuffer
+ * @short_description: Voice jitter buffer
+ *
+ * Reorders the voice packets of a single speaker by sequence number and holds
+ * them back long enough to absorb the variation in their arrival times. The
+ * sequence number of a Mumble voice packet counts 10 ms frames, so a packet
+ * carrying 20 ms of audio advances it by two.
+ *
+ * The buffer is a fixed-size ring indexed by sequence number and doesn't
+ * allocate after it has been created.
+ */
+
+#define MUMBLE_JITTER_BUFFER_SLOTS          64
+#define MUMBLE_JITTER_BUFFER_MAX_PACKET     1275
+#define MUMBLE_JITTER_BUFFER_FRAME_DURATION 10000
+
+/**
+ * MumbleJitterBufferResult:
+ * @MUMBLE_JITTER_BUFFER_IDLE:      Nothing to play
+ * @MUMBLE_JITTER_BUFFER_BUFFERING: Waiting for enough packets to start playing
+ * @MUMBLE_JITTER_BUFFER_PACKET:    A packet is returned
+ * @MUMBLE_JITTER_BUFFER_LOST:      The next 10 ms frame is missing and should be concealed
+ */
+typedef enum {
+  MUMBLE_JITTER_BUFFER_IDLE,
+  MUMBLE_JITTER_BUFFER_BUFFERING,
+  MUMBLE_JITTER_BUFFER_PACKET,
+  MUMBLE_JITTER_BUFFER_LOST
+} MumbleJitterBufferResult;
+
+typedef struct _MumbleJitterBufferSlot {
+  guint64 sequence;
+  gint64 arrival_time;
+  guint frames;
+  gboolean used;
+  gboolean terminator;
+  gsize length;
+  guint8 data[MUMBLE_JITTER_BUFFER_MAX_PACKET];
+} MumbleJitterBufferSlot;
+
+/**
+ * MumbleJitterBuffer:
+ * @next_sequence:     Sequence number of the next frame to play
+ * @playing:           Whether playout has started
+ * @queued_frames:     Number of 10 ms frames in the buffer
+ * @target_frames:     Number of frames to buffer before starting to play
+ * @jitter:            Smoothed variation of arrival times in microseconds
+ * @lost:              Number of concealed frames
+ * @late:              Number of packets dropped for arriving too late
+ */
+typedef struct _MumbleJitterBuffer {
+  MumbleJitterBufferSlot slots[MUMBLE_JITTER_BUFFER_SLOTS];
+  guint64 next_sequence;
+  gboolean playing;
+  guint queued_frames;
+  guint target_frames;
+  gdouble jitter;
+  gint64 last_arrival_time;
+  guint64 last_arrival_sequence;
+  guint missing_frames;
+  guint lost;
+  guint late;
+} MumbleJitterBuffer;
+
+/**
+ * mumble_jitter_buffer_push:
+ * @buffer:       A #MumbleJitterBuffer
+ * @sequence:     Sequence number of the packet
+ * @frames:       Number of 10 ms frames in the packet
+ * @data:         Codec data
+ * @length:       Length of @data
+ * @terminator:   Whether the packet ends the transmission
+ * @arrival_time: Monotonic arrival time in microseconds
+ *
+ * Copy a packet into @buffer.
+ *
+ * Returns: %FALSE if the packet was dropped because it arrived too late or
+ * doesn't fit
+ */
+gboolean mumble_jitter_buffer_push(MumbleJitterBuffer *buffer, guint64 sequence, guint frames, const guint8 *data, gsize length, gboolean terminator, gint64 arrival_time);
+
+/**
+ * mumble_jitter_buffer_pop:
+ * @buffer: A #MumbleJitterBuffer
+ * @slot:   Destination for the returned packet
+ *
+ * Take the next packet to play. The packet stays valid until the next call
+ * to mumble_jitter_buffer_push().
+ *
+ * Returns: A #MumbleJitterBufferResult
+ */
+MumbleJitterBufferResult mumble_jitter_buffer_pop(MumbleJitterBuffer *buffer, MumbleJitterBufferSlot **slot);
+
+void mumble_jitter_buffer_reset(MumbleJitterBuffer *buffer);
+void mumble_jitter_buffer_free(MumbleJitterBuffer *buffer);
+MumbleJitterBuffer *mumble_jitter_buffer_new();
+
+#endif
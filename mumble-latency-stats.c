@@ -0,0 +1,100 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "mumble-latency-stats.h"
+
+static guint get_window_size(MumbleLatencyStats *stats);
+static gint compare_samples(gconstpointer a, gconstpointer b);
+
+void mumble_latency_stats_add(MumbleLatencyStats *stats, gdouble latency) {
+  stats->samples[stats->count % MUMBLE_LATENCY_STATS_WINDOW] = latency;
+  stats->count++;
+}
+
+gdouble mumble_latency_stats_get_mean(MumbleLatencyStats *stats) {
+  guint size = get_window_size(stats);
+  if (!size) {
+    return 0;
+  }
+
+  gdouble sum = 0;
+  for (guint i = 0; i < size; i++) {
+    sum += stats->samples[i];
+  }
+  return sum / size;
+}
+
+gdouble mumble_latency_stats_get_variance(MumbleLatencyStats *stats) {
+  guint size = get_window_size(stats);
+  if (!size) {
+    return 0;
+  }
+
+  gdouble mean = mumble_latency_stats_get_mean(stats);
+  gdouble sum = 0;
+  for (guint i = 0; i < size; i++) {
+    gdouble difference = stats->samples[i] - mean;
+    sum += difference * difference;
+  }
+  return sum / size;
+}
+
+gdouble mumble_latency_stats_get_percentile(MumbleLatencyStats *stats, gdouble percentile) {
+  guint size = get_window_size(stats);
+  if (!size) {
+    return 0;
+  }
+
+  gdouble sorted[MUMBLE_LATENCY_STATS_WINDOW];
+  memcpy(sorted, stats->samples, size * sizeof(gdouble));
+  qsort(sorted, size, sizeof(gdouble), compare_samples);
+
+  guint rank = ceil(CLAMP(percentile, 0, 100) / 100 * size);
+  return sorted[rank ? rank - 1 : 0];
+}
+
+void mumble_latency_stats_reset(MumbleLatencyStats *stats) {
+  stats->count = 0;
+}
+
+void mumble_latency_stats_free(MumbleLatencyStats *stats) {
+  g_free(stats);
+}
+
+MumbleLatencyStats *mumble_latency_stats_copy(MumbleLatencyStats *stats) {
+  return g_memdup2(stats, sizeof(MumbleLatencyStats));
+}
+
+MumbleLatencyStats *mumble_latency_stats_new() {
+  return g_new0(MumbleLatencyStats, 1);
+}
+
+static guint get_window_size(MumbleLatencyStats *stats) {
+  return MIN(stats->count, MUMBLE_LATENCY_STATS_WINDOW);
+}
+
+static gint compare_samples(gconstpointer a, gconstpointer b) {
+  gdouble difference = *((gdouble *) a) - *((gdouble *) b);
+  return (difference > 0) - (difference < 0);
+}
+
+G_DEFINE_BOXED_TYPE(MumbleLatencyStats, mumble_latency_stats, mumble_latency_stats_copy, mumble_latency_stats_free)
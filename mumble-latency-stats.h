@@ -0,0 +1,87 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_LATENCY_STATS_H
+#define MUMBLE_LATENCY_STATS_H
+
+#include <glib-object.h>
+
+/**
+ * SECTION:mumblelatencystats
+ * @short_description: Latency statistics
+ *
+ * Keeps a sliding window of the most recent latency samples and computes the
+ * mean, variance and percentiles over it.
+ */
+
+#define MUMBLE_LATENCY_STATS_WINDOW 64
+
+/**
+ * MumbleLatencyStats:
+ * @samples: Ring buffer of the most recent samples in milliseconds
+ * @count:   Total number of samples added
+ */
+typedef struct _MumbleLatencyStats {
+  gdouble samples[MUMBLE_LATENCY_STATS_WINDOW];
+  guint64 count;
+} MumbleLatencyStats;
+
+/**
+ * mumble_latency_stats_add:
+ * @stats:   A #MumbleLatencyStats
+ * @latency: Latency in milliseconds
+ *
+ * Add a sample to @stats, replacing the oldest one if the window is full.
+ */
+void mumble_latency_stats_add(MumbleLatencyStats *stats, gdouble latency);
+
+/**
+ * mumble_latency_stats_get_mean:
+ * @stats: A #MumbleLatencyStats
+ *
+ * Returns: Mean of the samples in the window, or 0 if there are none
+ */
+gdouble mumble_latency_stats_get_mean(MumbleLatencyStats *stats);
+
+/**
+ * mumble_latency_stats_get_variance:
+ * @stats: A #MumbleLatencyStats
+ *
+ * Returns: Variance of the samples in the window, or 0 if there are none
+ */
+gdouble mumble_latency_stats_get_variance(MumbleLatencyStats *stats);
+
+/**
+ * mumble_latency_stats_get_percentile:
+ * @stats:      A #MumbleLatencyStats
+ * @percentile: Percentile between 0 and 100
+ *
+ * Returns: Nearest-rank percentile of the samples in the window, or 0 if there
+ * are none
+ */
+gdouble mumble_latency_stats_get_percentile(MumbleLatencyStats *stats, gdouble percentile);
+
+void mumble_latency_stats_reset(MumbleLatencyStats *stats);
+void mumble_latency_stats_free(MumbleLatencyStats *stats);
+MumbleLatencyStats *mumble_latency_stats_copy(MumbleLatencyStats *stats);
+MumbleLatencyStats *mumble_latency_stats_new();
+GType mumble_latency_stats_get_type();
+
+#endif
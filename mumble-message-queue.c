@@ -0,0 +1,87 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mumble-message-queue.h"
+
+/*
+ * One slot is always left empty, so that a full queue can be told apart from an empty one without
+ * a shared counter. The producer owns the tail and the consumer owns the head.
+ */
+
+gboolean mumble_message_queue_push(MumbleMessageQueue *queue, gpointer item) {
+  gint tail = g_atomic_int_get(&queue->tail);
+  gint next = (tail + 1) & queue->mask;
+
+  if (next == g_atomic_int_get(&queue->head)) {
+    return FALSE;
+  }
+
+  queue->slots[tail] = item;
+  g_atomic_int_set(&queue->tail, next);
+
+  return TRUE;
+}
+
+gpointer mumble_message_queue_pop(MumbleMessageQueue *queue) {
+  gint head = g_atomic_int_get(&queue->head);
+
+  if (head == g_atomic_int_get(&queue->tail)) {
+    return NULL;
+  }
+
+  gpointer item = queue->slots[head];
+  g_atomic_int_set(&queue->head, (head + 1) & queue->mask);
+
+  return item;
+}
+
+guint mumble_message_queue_get_length(MumbleMessageQueue *queue) {
+  return (g_atomic_int_get(&queue->tail) - g_atomic_int_get(&queue->head)) & queue->mask;
+}
+
+gboolean mumble_message_queue_is_full(MumbleMessageQueue *queue) {
+  return ((g_atomic_int_get(&queue->tail) + 1) & queue->mask) == g_atomic_int_get(&queue->head);
+}
+
+gboolean mumble_message_queue_is_empty(MumbleMessageQueue *queue) {
+  return g_atomic_int_get(&queue->head) == g_atomic_int_get(&queue->tail);
+}
+
+void mumble_message_queue_free(MumbleMessageQueue *queue, GDestroyNotify free_func) {
+  gpointer item;
+  while ((item = mumble_message_queue_pop(queue))) {
+    if (free_func) {
+      free_func(item);
+    }
+  }
+
+  g_free(queue->slots);
+  g_free(queue);
+}
+
+MumbleMessageQueue *mumble_message_queue_new(guint capacity) {
+  MumbleMessageQueue *queue = g_new0(MumbleMessageQueue, 1);
+
+  guint size = 1 << g_bit_storage(MAX(capacity, 1));
+  queue->slots = g_new0(gpointer, size);
+  queue->mask  = size - 1;
+
+  return queue;
+}
@@ -0,0 +1,79 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_MESSAGE_QUEUE_H
+#define MUMBLE_MESSAGE_QUEUE_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblemessagequeue
+ * @short_description: Bounded single-producer single-consumer queue
+ *
+ * A lock-free ring buffer of pointers that is used for handing messages over
+ * between exactly two threads. Only one thread may push and only one thread
+ * may pop.
+ */
+
+typedef struct _MumbleMessageQueue {
+  gpointer *slots;
+  guint mask;
+  gint head;
+  gint tail;
+} MumbleMessageQueue;
+
+/**
+ * mumble_message_queue_push:
+ * @queue: A #MumbleMessageQueue
+ * @item:  Non-%NULL pointer to enqueue
+ *
+ * Called only by the producer thread.
+ *
+ * Returns: %FALSE if @queue is full
+ */
+gboolean mumble_message_queue_push(MumbleMessageQueue *queue, gpointer item);
+
+/**
+ * mumble_message_queue_pop:
+ * @queue: A #MumbleMessageQueue
+ *
+ * Called only by the consumer thread.
+ *
+ * Returns: The oldest item or %NULL if @queue is empty
+ */
+gpointer mumble_message_queue_pop(MumbleMessageQueue *queue);
+
+/**
+ * mumble_message_queue_get_length:
+ * @queue: A #MumbleMessageQueue
+ *
+ * Can be called from any thread, but the length may have changed by the time
+ * it returns.
+ *
+ * Returns: Number of items in the queue
+ */
+guint mumble_message_queue_get_length(MumbleMessageQueue *queue);
+
+gboolean mumble_message_queue_is_full(MumbleMessageQueue *queue);
+gboolean mumble_message_queue_is_empty(MumbleMessageQueue *queue);
+void mumble_message_queue_free(MumbleMessageQueue *queue, GDestroyNotify free_func);
+MumbleMessageQueue *mumble_message_queue_new(guint capacity);
+
+#endif
@@ -21,6 +21,13 @@
 
 G_DEFINE_BOXED_TYPE(MumbleMessage, mumble_message, mumble_message_copy, mumble_message_free)
 
+/*
+ * Messages are created on the network thread and freed on the main thread when it's in use, so
+ * the counters are atomic.
+ */
+static gint allocated_count = 0;
+static gint freed_count     = 0;
+
 MumbleMessage *mumble_message_read(guint8 *buffer, guint length) {
   MumbleMessage *message = NULL;
   if (length >= 6) {
@@ -61,8 +68,16 @@ gint mumble_message_write(MumbleMessage *message, guint8 *buffer) {
   return 6 + packed_size;
 }
 
+void mumble_message_get_allocation_counts(guint *allocated, guint *live) {
+  guint freed = g_atomic_int_get(&freed_count);
+  *allocated = g_atomic_int_get(&allocated_count);
+  *live      = *allocated - freed;
+}
+
 void mumble_message_free(MumbleMessage *message) {
+  g_atomic_int_inc(&freed_count);
   g_byte_array_unref(message->payload);
+  g_free(message->trace_span);
   g_free(message);
 }
 
@@ -73,6 +88,7 @@ MumbleMessage *mumble_message_copy(MumbleMessage *message) {
 
 MumbleMessage *mumble_message_new(MumbleMessageType type, GByteArray *protobuf_message) {
   MumbleMessage *message = g_new0(MumbleMessage, 1);
+  g_atomic_int_inc(&allocated_count);
 
   message->type = type;
   message->payload = protobuf_message;
@@ -94,16 +94,21 @@ typedef enum {
   MUMBLE_SUGGEST_CONFIG
 } MumbleMessageType;
 
+typedef struct _MumbleTraceSpan MumbleTraceSpan;
+
 /**
  * MumbleMessage:
- * @type:    Message type
- * @payload: Message content
+ * @type:       Message type
+ * @payload:    Message content
+ * @trace_span: (nullable): Timestamps of the message when it is traced,
+ *              freed with the message
  *
  * Represents a Mumble protocol message.
  */
 typedef struct _MumbleMessage {
   MumbleMessageType type;
   GByteArray *payload;
+  MumbleTraceSpan *trace_span;
 } MumbleMessage;
 
 GType mumble_message_get_type(void);
@@ -143,6 +148,13 @@ guint mumble_message_get_minimum_bytes(guint8 *buffer, guint length);
  */
 gint mumble_message_write(MumbleMessage *message, guint8 *buffer);
 
+/**
+ * mumble_message_get_allocation_counts:
+ * @allocated: (out): Return location for the number of messages created so far
+ * @live:      (out): Return location for the number of messages not freed yet
+ */
+void mumble_message_get_allocation_counts(guint *allocated, guint *live);
+
 /**
  * mumble_message_free:
  * @message: A #MumbleMessage
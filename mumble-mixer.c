@@ -0,0 +1,196 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <math.h>
+#include "mumble-mixer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86
+#endif
+
+/*
+ * The soft clipper is a Padé approximant of tanh, x * (27 + x^2) / (27 + 9 * x^2), with its input
+ * limited to [-3, 3] where it reaches +-1. Its slope is 1 at the origin, so quiet voices pass
+ * almost unchanged while loud sums are compressed instead of wrapping or clipping hard.
+ */
+#define CLIP_LIMIT 3.0f
+
+typedef void (*MixFunc)(const gfloat *const *, const gfloat *, guint, gint16 *, guint);
+
+static void mix_scalar(const gfloat *const *, const gfloat *, guint, gint16 *, guint);
+#ifdef HAVE_X86
+static void mix_sse2(const gfloat *const *, const gfloat *, guint, gint16 *, guint);
+static void mix_avx2(const gfloat *const *, const gfloat *, guint, gint16 *, guint);
+#endif
+static MixFunc get_mix_func(MumbleMixerImplementation);
+
+void mumble_mixer_mix(const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples) {
+  static gsize best_implementation = 0;
+
+  if (g_once_init_enter(&best_implementation)) {
+    MumbleMixerImplementation implementation = MUMBLE_MIXER_SCALAR;
+    if (mumble_mixer_is_supported(MUMBLE_MIXER_AVX2)) {
+      implementation = MUMBLE_MIXER_AVX2;
+    } else if (mumble_mixer_is_supported(MUMBLE_MIXER_SSE2)) {
+      implementation = MUMBLE_MIXER_SSE2;
+    }
+    g_once_init_leave(&best_implementation, implementation + 1);
+  }
+
+  get_mix_func(best_implementation - 1)(inputs, gains, input_count, output, samples);
+}
+
+void mumble_mixer_mix_with(MumbleMixerImplementation implementation, const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples) {
+  get_mix_func(implementation)(inputs, gains, input_count, output, samples);
+}
+
+gboolean mumble_mixer_is_supported(MumbleMixerImplementation implementation) {
+  switch (implementation) {
+    case MUMBLE_MIXER_SCALAR:
+      return TRUE;
+#ifdef HAVE_X86
+    case MUMBLE_MIXER_SSE2:
+      return __builtin_cpu_supports("sse2");
+    case MUMBLE_MIXER_AVX2:
+      return __builtin_cpu_supports("avx2");
+#endif
+    default:
+      return FALSE;
+  }
+}
+
+static MixFunc get_mix_func(MumbleMixerImplementation implementation) {
+  switch (implementation) {
+#ifdef HAVE_X86
+    case MUMBLE_MIXER_SSE2:
+      return mix_sse2;
+    case MUMBLE_MIXER_AVX2:
+      return mix_avx2;
+#endif
+    default:
+      return mix_scalar;
+  }
+}
+
+static inline gint16 clip_sample(gfloat sum) {
+  gfloat x = fminf(fmaxf(sum, -CLIP_LIMIT), CLIP_LIMIT);
+  gfloat x2 = x * x;
+  gfloat y = x * (27.0f + x2) / (27.0f + 9.0f * x2);
+  return (gint16) lrintf(y * G_MAXINT16);
+}
+
+static void mix_scalar(const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples) {
+  for (guint i = 0; i < samples; i++) {
+    gfloat sum = 0;
+    for (guint j = 0; j < input_count; j++) {
+      sum += inputs[j][i] * gains[j];
+    }
+    output[i] = clip_sample(sum);
+  }
+}
+
+#ifdef HAVE_X86
+/*
+ * The vector versions accumulate in the same order as the scalar one and convert with the
+ * default round-to-nearest-even mode that lrintf() also uses, so the results match bit for bit.
+ * Samples that don't fill a whole vector are left to the scalar version.
+ */
+__attribute__((target("sse2")))
+static void mix_sse2(const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples) {
+  const __m128 limit = _mm_set1_ps(CLIP_LIMIT);
+  const __m128 negative_limit = _mm_set1_ps(-CLIP_LIMIT);
+  const __m128 c1 = _mm_set1_ps(27.0f);
+  const __m128 c2 = _mm_set1_ps(9.0f);
+  const __m128 scale = _mm_set1_ps(G_MAXINT16);
+
+  guint i = 0;
+  for (; i + 8 <= samples; i += 8) {
+    __m128 sum_low = _mm_setzero_ps();
+    __m128 sum_high = _mm_setzero_ps();
+    for (guint j = 0; j < input_count; j++) {
+      __m128 gain = _mm_set1_ps(gains[j]);
+      sum_low  = _mm_add_ps(sum_low, _mm_mul_ps(_mm_loadu_ps(inputs[j] + i), gain));
+      sum_high = _mm_add_ps(sum_high, _mm_mul_ps(_mm_loadu_ps(inputs[j] + i + 4), gain));
+    }
+
+    __m128 x_low  = _mm_min_ps(_mm_max_ps(sum_low, negative_limit), limit);
+    __m128 x_high = _mm_min_ps(_mm_max_ps(sum_high, negative_limit), limit);
+    __m128 x2_low  = _mm_mul_ps(x_low, x_low);
+    __m128 x2_high = _mm_mul_ps(x_high, x_high);
+    __m128 y_low  = _mm_div_ps(_mm_mul_ps(x_low, _mm_add_ps(c1, x2_low)), _mm_add_ps(c1, _mm_mul_ps(c2, x2_low)));
+    __m128 y_high = _mm_div_ps(_mm_mul_ps(x_high, _mm_add_ps(c1, x2_high)), _mm_add_ps(c1, _mm_mul_ps(c2, x2_high)));
+
+    __m128i packed = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(y_low, scale)), _mm_cvtps_epi32(_mm_mul_ps(y_high, scale)));
+    _mm_storeu_si128((__m128i *) (output + i), packed);
+  }
+
+  if (i < samples) {
+    const gfloat *tail_inputs[input_count ? input_count : 1];
+    for (guint j = 0; j < input_count; j++) {
+      tail_inputs[j] = inputs[j] + i;
+    }
+    mix_scalar(tail_inputs, gains, input_count, output + i, samples - i);
+  }
+}
+
+__attribute__((target("avx2")))
+static void mix_avx2(const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples) {
+  const __m256 limit = _mm256_set1_ps(CLIP_LIMIT);
+  const __m256 negative_limit = _mm256_set1_ps(-CLIP_LIMIT);
+  const __m256 c1 = _mm256_set1_ps(27.0f);
+  const __m256 c2 = _mm256_set1_ps(9.0f);
+  const __m256 scale = _mm256_set1_ps(G_MAXINT16);
+
+  guint i = 0;
+  for (; i + 16 <= samples; i += 16) {
+    __m256 sum_low = _mm256_setzero_ps();
+    __m256 sum_high = _mm256_setzero_ps();
+    for (guint j = 0; j < input_count; j++) {
+      __m256 gain = _mm256_set1_ps(gains[j]);
+      sum_low  = _mm256_add_ps(sum_low, _mm256_mul_ps(_mm256_loadu_ps(inputs[j] + i), gain));
+      sum_high = _mm256_add_ps(sum_high, _mm256_mul_ps(_mm256_loadu_ps(inputs[j] + i + 8), gain));
+    }
+
+    __m256 x_low  = _mm256_min_ps(_mm256_max_ps(sum_low, negative_limit), limit);
+    __m256 x_high = _mm256_min_ps(_mm256_max_ps(sum_high, negative_limit), limit);
+    __m256 x2_low  = _mm256_mul_ps(x_low, x_low);
+    __m256 x2_high = _mm256_mul_ps(x_high, x_high);
+    __m256 y_low  = _mm256_div_ps(_mm256_mul_ps(x_low, _mm256_add_ps(c1, x2_low)), _mm256_add_ps(c1, _mm256_mul_ps(c2, x2_low)));
+    __m256 y_high = _mm256_div_ps(_mm256_mul_ps(x_high, _mm256_add_ps(c1, x2_high)), _mm256_add_ps(c1, _mm256_mul_ps(c2, x2_high)));
+
+    /*
+     * The 256-bit pack works within 128-bit lanes, so the result is put back in order with a
+     * 64-bit permutation.
+     */
+    __m256i packed = _mm256_packs_epi32(_mm256_cvtps_epi32(_mm256_mul_ps(y_low, scale)), _mm256_cvtps_epi32(_mm256_mul_ps(y_high, scale)));
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *) (output + i), packed);
+  }
+
+  if (i < samples) {
+    const gfloat *tail_inputs[input_count ? input_count : 1];
+    for (guint j = 0; j < input_count; j++) {
+      tail_inputs[j] = inputs[j] + i;
+    }
+    mix_sse2(tail_inputs, gains, input_count, output + i, samples - i);
+  }
+}
+#endif
@@ -0,0 +1,76 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_MIXER_H
+#define MUMBLE_MIXER_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblemixer
+ * @short_description: PCM mixer
+ *
+ * Sums the decoded voice of several speakers with a gain for each, soft-clips
+ * the result and converts it to 16-bit samples. The AVX2 or SSE2 version is
+ * picked at run time depending on what the CPU supports, with a scalar
+ * version as a fallback. All versions produce identical output.
+ */
+
+/**
+ * MumbleMixerImplementation:
+ * @MUMBLE_MIXER_SCALAR: Portable C
+ * @MUMBLE_MIXER_SSE2:   SSE2, 4 samples at a time
+ * @MUMBLE_MIXER_AVX2:   AVX2, 8 samples at a time
+ */
+typedef enum {
+  MUMBLE_MIXER_SCALAR,
+  MUMBLE_MIXER_SSE2,
+  MUMBLE_MIXER_AVX2
+} MumbleMixerImplementation;
+
+/**
+ * mumble_mixer_mix:
+ * @inputs:      Array of @input_count buffers of @samples samples each
+ * @gains:       Array of @input_count gains, 1.0 being unchanged
+ * @input_count: Number of inputs
+ * @output:      Buffer of @samples samples to write the mix to
+ * @samples:     Number of samples
+ *
+ * Mix @inputs into @output using the fastest implementation available.
+ */
+void mumble_mixer_mix(const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples);
+
+/**
+ * mumble_mixer_mix_with:
+ * @implementation: A #MumbleMixerImplementation supported by the CPU
+ *
+ * Like mumble_mixer_mix(), but using a specific implementation.
+ */
+void mumble_mixer_mix_with(MumbleMixerImplementation implementation, const gfloat *const *inputs, const gfloat *gains, guint input_count, gint16 *output, guint samples);
+
+/**
+ * mumble_mixer_is_supported:
+ * @implementation: A #MumbleMixerImplementation
+ *
+ * Returns: Whether @implementation can run on this CPU
+ */
+gboolean mumble_mixer_is_supported(MumbleMixerImplementation implementation);
+
+#endif
@@ -0,0 +1,318 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-name-index.h"
+
+/*
+ * Names are checked against the clock in batches, since reading the clock costs more than
+ * scoring a name.
+ */
+#define BUDGET_CHECK_INTERVAL 256
+
+#define SCORE_LETTER     1
+#define SCORE_ADJACENT   4
+#define SCORE_WORD_START 6
+
+/*
+ * The letters of a key as a set of 64 bits, where each byte sets the bit of its value modulo 64.
+ * A key that lacks a bit of the pattern can't match, which rules out most keys without scoring
+ * them.
+ */
+typedef guint64 MumbleLetterMask;
+
+typedef struct _MumbleNameIndexEntry {
+  gchar *key;
+  gchar *name;
+  gint kind;
+  guint id;
+  MumbleLetterMask letters;
+  GSequenceIter *iter;
+  guint position;
+} MumbleNameIndexEntry;
+
+/*
+ * The sequence keeps the entries sorted for prefix searches, and the array keeps them packed for
+ * the scans of fuzzy searches.
+ */
+struct _MumbleNameIndex {
+  GSequence *entries;
+  GPtrArray *scan;
+  GHashTable *channels;
+  GHashTable *users;
+};
+
+static GHashTable *get_ids(MumbleNameIndex *index, MumbleNameKind kind);
+static GSequenceIter *find_first(MumbleNameIndex *index, const gchar *key);
+static gchar *fold_name(const gchar *name);
+static MumbleLetterMask get_letters(const gchar *key);
+static gint score_match(const gchar *pattern, const gchar *key);
+static gboolean is_word_start(const gchar *key, const gchar *position);
+static void add_match(GArray *matches, guint max_results, MumbleNameIndexEntry *entry, gint score);
+static gint compare_matches(const MumbleNameMatch *a, const MumbleNameMatch *b);
+static gint compare_entries(gconstpointer a, gconstpointer b, gpointer user_data);
+static void free_entry(MumbleNameIndexEntry *entry);
+
+void mumble_name_index_insert(MumbleNameIndex *index, MumbleNameKind kind, guint id, const gchar *name) {
+  mumble_name_index_remove(index, kind, id);
+  if (!name) {
+    return;
+  }
+
+  MumbleNameIndexEntry *entry = g_new0(MumbleNameIndexEntry, 1);
+  entry->key  = fold_name(name);
+  entry->name = g_strdup(name);
+  entry->kind = kind;
+  entry->id   = id;
+  entry->letters  = get_letters(entry->key);
+  entry->iter     = g_sequence_insert_sorted(index->entries, entry, compare_entries, NULL);
+  entry->position = index->scan->len;
+  g_ptr_array_add(index->scan, entry);
+  g_hash_table_insert(get_ids(index, kind), GUINT_TO_POINTER(id), entry);
+}
+
+void mumble_name_index_remove(MumbleNameIndex *index, MumbleNameKind kind, guint id) {
+  MumbleNameIndexEntry *entry = g_hash_table_lookup(get_ids(index, kind), GUINT_TO_POINTER(id));
+  if (entry) {
+    g_hash_table_remove(get_ids(index, kind), GUINT_TO_POINTER(id));
+    g_ptr_array_remove_index_fast(index->scan, entry->position);
+    if (entry->position < index->scan->len) {
+      ((MumbleNameIndexEntry *) g_ptr_array_index(index->scan, entry->position))->position = entry->position;
+    }
+    g_sequence_remove(entry->iter);
+  }
+}
+
+gboolean mumble_name_index_lookup(MumbleNameIndex *index, MumbleNameKind kind, const gchar *name, guint *id) {
+  if (!name) {
+    return FALSE;
+  }
+
+  gchar *key = fold_name(name);
+  gboolean found = FALSE;
+  for (GSequenceIter *iter = find_first(index, key); !g_sequence_iter_is_end(iter); iter = g_sequence_iter_next(iter)) {
+    MumbleNameIndexEntry *entry = g_sequence_get(iter);
+    if (strcmp(entry->key, key)) {
+      break;
+    }
+    if (entry->kind == kind && !strcmp(entry->name, name)) {
+      *id = entry->id;
+      found = TRUE;
+      break;
+    }
+  }
+  g_free(key);
+
+  return found;
+}
+
+GArray *mumble_name_index_find_prefix(MumbleNameIndex *index, guint kinds, const gchar *prefix, guint max_results) {
+  GArray *matches = g_array_new(FALSE, FALSE, sizeof(MumbleNameMatch));
+
+  gchar *key = fold_name(prefix);
+  for (GSequenceIter *iter = find_first(index, key); !g_sequence_iter_is_end(iter) && matches->len < max_results; iter = g_sequence_iter_next(iter)) {
+    MumbleNameIndexEntry *entry = g_sequence_get(iter);
+    if (!g_str_has_prefix(entry->key, key)) {
+      break;
+    }
+    if (entry->kind & kinds) {
+      MumbleNameMatch match = { entry->kind, entry->id, entry->name, 0 };
+      g_array_append_val(matches, match);
+    }
+  }
+  g_free(key);
+
+  return matches;
+}
+
+GArray *mumble_name_index_find_fuzzy(MumbleNameIndex *index, guint kinds, const gchar *pattern, guint max_results, gint64 budget, gboolean *complete) {
+  GArray *matches = g_array_sized_new(FALSE, FALSE, sizeof(MumbleNameMatch), max_results + 1);
+
+  gchar *key = fold_name(pattern);
+  MumbleLetterMask letters = get_letters(key);
+  gint64 deadline = g_get_monotonic_time() + budget;
+  guint position;
+  for (position = 0; position < index->scan->len; position++) {
+    if (!((position + 1) % BUDGET_CHECK_INTERVAL) && g_get_monotonic_time() > deadline) {
+      break;
+    }
+    MumbleNameIndexEntry *entry = g_ptr_array_index(index->scan, position);
+    if ((entry->kind & kinds) && !(letters & ~entry->letters)) {
+      gint score = score_match(key, entry->key);
+      if (score >= 0) {
+        add_match(matches, max_results, entry, score);
+      }
+    }
+  }
+  g_free(key);
+
+  if (complete) {
+    *complete = position == index->scan->len;
+  }
+  return matches;
+}
+
+guint mumble_name_index_get_size(MumbleNameIndex *index) {
+  return g_sequence_get_length(index->entries);
+}
+
+void mumble_name_index_free(MumbleNameIndex *index) {
+  g_hash_table_destroy(index->channels);
+  g_hash_table_destroy(index->users);
+  g_ptr_array_free(index->scan, TRUE);
+  g_sequence_free(index->entries);
+  g_free(index);
+}
+
+MumbleNameIndex *mumble_name_index_new() {
+  MumbleNameIndex *index = g_new0(MumbleNameIndex, 1);
+
+  index->entries  = g_sequence_new((GDestroyNotify) free_entry);
+  index->scan     = g_ptr_array_new();
+  index->channels = g_hash_table_new(g_direct_hash, g_direct_equal);
+  index->users    = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+  return index;
+}
+
+static GHashTable *get_ids(MumbleNameIndex *index, MumbleNameKind kind) {
+  return kind == MUMBLE_NAME_CHANNEL ? index->channels : index->users;
+}
+
+/*
+ * Keys are compared byte by byte, so all the keys that start with a given key follow it in a
+ * single run. A probe with a kind below all the others lands before the first of them.
+ */
+static GSequenceIter *find_first(MumbleNameIndex *index, const gchar *key) {
+  MumbleNameIndexEntry probe = { (gchar *) key, NULL, -1, 0, NULL };
+  return g_sequence_search(index->entries, &probe, compare_entries, NULL);
+}
+
+/*
+ * Most names are plain ASCII, which needs no Unicode tables.
+ */
+static gchar *fold_name(const gchar *name) {
+  const gchar *cursor = name;
+  while (*cursor && !(*cursor & 0x80)) {
+    cursor++;
+  }
+  if (!*cursor) {
+    return g_ascii_strdown(name, -1);
+  }
+
+  gchar *normalized = g_utf8_normalize(name, -1, G_NORMALIZE_ALL);
+  if (!normalized) {
+    return g_ascii_strdown(name, -1);
+  }
+  gchar *key = g_utf8_casefold(normalized, -1);
+  g_free(normalized);
+  return key;
+}
+
+static MumbleLetterMask get_letters(const gchar *key) {
+  MumbleLetterMask letters = 0;
+  for (const guchar *byte = (const guchar *) key; *byte; byte++) {
+    letters |= G_GUINT64_CONSTANT(1) << (*byte & 63);
+  }
+  return letters;
+}
+
+/*
+ * Takes each letter of the pattern at its first place after the previous one, which finds
+ * whether there is a match in one pass. Returns -1 if there isn't.
+ */
+static gint score_match(const gchar *pattern, const gchar *key) {
+  gint score = 0;
+  const gchar *position = key;
+  gboolean adjacent = FALSE;
+  for (const gchar *letter = pattern; *letter; letter++) {
+    while (*position && *position != *letter) {
+      position++;
+      adjacent = FALSE;
+    }
+    if (!*position) {
+      return -1;
+    }
+    score += SCORE_LETTER;
+    if (adjacent) {
+      score += SCORE_ADJACENT;
+    }
+    if (is_word_start(key, position)) {
+      score += SCORE_WORD_START;
+    }
+    adjacent = TRUE;
+    position++;
+  }
+  return score;
+}
+
+static gboolean is_word_start(const gchar *key, const gchar *position) {
+  return position == key || strchr(" -_./:#", position[-1]);
+}
+
+/*
+ * Keeps the best matches, best first. The number of matches is small, so a linear search for
+ * the place is enough.
+ */
+static void add_match(GArray *matches, guint max_results, MumbleNameIndexEntry *entry, gint score) {
+  MumbleNameMatch match = { entry->kind, entry->id, entry->name, score };
+
+  guint position = matches->len;
+  while (position > 0 && compare_matches(&match, &g_array_index(matches, MumbleNameMatch, position - 1)) < 0) {
+    position--;
+  }
+  if (position < max_results) {
+    g_array_insert_val(matches, position, match);
+    if (matches->len > max_results) {
+      g_array_set_size(matches, max_results);
+    }
+  }
+}
+
+static gint compare_matches(const MumbleNameMatch *a, const MumbleNameMatch *b) {
+  if (a->score != b->score) {
+    return b->score - a->score;
+  }
+  gsize length_a = strlen(a->name);
+  gsize length_b = strlen(b->name);
+  if (length_a != length_b) {
+    return length_a < length_b ? -1 : 1;
+  }
+  return strcmp(a->name, b->name);
+}
+
+static gint compare_entries(gconstpointer a, gconstpointer b, gpointer user_data) {
+  const MumbleNameIndexEntry *entry_a = a;
+  const MumbleNameIndexEntry *entry_b = b;
+  gint result = strcmp(entry_a->key, entry_b->key);
+  if (!result) {
+    result = (entry_a->kind > entry_b->kind) - (entry_a->kind < entry_b->kind);
+  }
+  if (!result) {
+    result = (entry_a->id > entry_b->id) - (entry_a->id < entry_b->id);
+  }
+  return result;
+}
+
+static void free_entry(MumbleNameIndexEntry *entry) {
+  g_free(entry->key);
+  g_free(entry->name);
+  g_free(entry);
+}
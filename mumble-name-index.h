@@ -0,0 +1,118 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_NAME_INDEX_H
+#define MUMBLE_NAME_INDEX_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblenameindex
+ * @short_description: Search index over channel and user names
+ *
+ * Keeps the names of channels and users sorted by their case-folded form, so
+ * that names starting with a prefix are found with a binary search and read
+ * in order. Fuzzy matches take the letters of the pattern in order with any
+ * gaps between them, and are ranked so that matches at word starts and runs
+ * of adjacent letters come first. The fuzzy search scans all names, and stops
+ * at a time budget with the best matches so far.
+ */
+
+/**
+ * MumbleNameKind:
+ * @MUMBLE_NAME_CHANNEL: Name of a channel
+ * @MUMBLE_NAME_USER:    Name of a user
+ *
+ * Kinds of names, which can be combined to search for several kinds at once.
+ */
+typedef enum {
+  MUMBLE_NAME_CHANNEL = 1 << 0,
+  MUMBLE_NAME_USER    = 1 << 1
+} MumbleNameKind;
+
+/**
+ * MumbleNameMatch:
+ * @kind:  Kind of the name
+ * @id:    Channel ID or session ID
+ * @name:  The name, valid until the index changes
+ * @score: How well the name matched, higher being better
+ */
+typedef struct _MumbleNameMatch {
+  MumbleNameKind kind;
+  guint id;
+  const gchar *name;
+  gint score;
+} MumbleNameMatch;
+
+typedef struct _MumbleNameIndex MumbleNameIndex;
+
+/**
+ * mumble_name_index_insert:
+ * @index: A #MumbleNameIndex
+ * @kind:  Kind of the name
+ * @id:    Channel ID or session ID
+ * @name:  (nullable): The name, or %NULL to remove the name
+ *
+ * Set the name of a channel or a user, replacing any old one.
+ */
+void mumble_name_index_insert(MumbleNameIndex *index, MumbleNameKind kind, guint id, const gchar *name);
+void mumble_name_index_remove(MumbleNameIndex *index, MumbleNameKind kind, guint id);
+
+/**
+ * mumble_name_index_lookup:
+ * @index: A #MumbleNameIndex
+ * @kind:  Kind of the name
+ * @name:  The exact name
+ * @id:    (out): Return location for the channel ID or session ID
+ *
+ * Returns: %TRUE if the name was found
+ */
+gboolean mumble_name_index_lookup(MumbleNameIndex *index, MumbleNameKind kind, const gchar *name, guint *id);
+
+/**
+ * mumble_name_index_find_prefix:
+ * @index:       A #MumbleNameIndex
+ * @kinds:       #MumbleNameKind flags of the names to search
+ * @prefix:      Prefix to search for, in any case
+ * @max_results: Maximum number of matches to return
+ *
+ * Returns: (transfer full): #GArray of #MumbleNameMatch in order by name
+ */
+GArray *mumble_name_index_find_prefix(MumbleNameIndex *index, guint kinds, const gchar *prefix, guint max_results);
+
+/**
+ * mumble_name_index_find_fuzzy:
+ * @index:       A #MumbleNameIndex
+ * @kinds:       #MumbleNameKind flags of the names to search
+ * @pattern:     Letters to search for, in any case
+ * @max_results: Maximum number of matches to return
+ * @budget:      Time to search for at most in microseconds
+ * @complete:    (out) (optional): Return location for whether all names were
+ *               searched within the budget
+ *
+ * Returns: (transfer full): #GArray of #MumbleNameMatch, best first
+ */
+GArray *mumble_name_index_find_fuzzy(MumbleNameIndex *index, guint kinds, const gchar *pattern, guint max_results, gint64 budget, gboolean *complete);
+
+guint mumble_name_index_get_size(MumbleNameIndex *index);
+void mumble_name_index_free(MumbleNameIndex *index);
+MumbleNameIndex *mumble_name_index_new();
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mumble-network-thread.h"
+#include "mumble-message-queue.h"
+
+#define QUEUE_CAPACITY 1024
+#define DELIVERY_BATCH_SIZE 64
+
+struct _MumbleNetworkThread {
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+  GCancellable *cancellable;
+  MumbleInputStream *input_stream;
+  MumbleOutputStream *output_stream;
+  MumbleMessageQueue *incoming;
+  MumbleMessageQueue *outgoing;
+  GQueue *overflow;
+  GSource *delivery_source;
+  GSource *write_source;
+  gint delivery_pending;
+  gint write_pending;
+  gint read_paused;
+  gint failed;
+  GError *error;
+  MumbleNetworkThreadMessageFunc message_func;
+  MumbleNetworkThreadErrorFunc error_func;
+  gpointer user_data;
+};
+
+static gpointer run(gpointer data);
+static gboolean quit(gpointer data);
+static void start_read(MumbleNetworkThread *thread);
+static gboolean resume_read(gpointer data);
+static void on_read(GObject *source, GAsyncResult *result, gpointer data);
+static gboolean write_messages(gpointer data);
+static gboolean deliver_messages(gpointer data);
+static void move_overflow(MumbleNetworkThread *thread);
+static void wake(GSource *source, gint *pending);
+static GSource *create_wakeup_source(GMainContext *context, GSourceFunc func, gpointer data);
+static gboolean dispatch_wakeup_source(GSource *source, GSourceFunc callback, gpointer data);
+
+static GSourceFuncs wakeup_source_funcs = {
+  NULL,
+  NULL,
+  dispatch_wakeup_source,
+  NULL,
+};
+
+void mumble_network_thread_write_message(MumbleNetworkThread *thread, MumbleMessage *message) {
+  move_overflow(thread);
+
+  if (g_queue_is_empty(thread->overflow) && mumble_message_queue_push(thread->outgoing, message)) {
+    wake(thread->write_source, &thread->write_pending);
+  } else {
+    g_queue_push_tail(thread->overflow, message);
+  }
+}
+
+guint mumble_network_thread_get_write_queue_length(MumbleNetworkThread *thread) {
+  return g_queue_get_length(thread->overflow) + mumble_message_queue_get_length(thread->outgoing);
+}
+
+void mumble_network_thread_free(MumbleNetworkThread *thread) {
+  g_cancellable_cancel(thread->cancellable);
+  g_main_context_invoke(thread->context, quit, thread);
+  g_thread_join(thread->thread);
+
+  // Let the cancelled operations of the worker finish before their streams go away.
+  while (g_main_context_iteration(thread->context, FALSE));
+
+  g_source_destroy(thread->delivery_source);
+  g_source_unref(thread->delivery_source);
+  g_source_destroy(thread->write_source);
+  g_source_unref(thread->write_source);
+
+  mumble_message_queue_free(thread->incoming, (GDestroyNotify) mumble_message_free);
+  mumble_message_queue_free(thread->outgoing, (GDestroyNotify) mumble_message_free);
+  g_queue_free_full(thread->overflow, (GDestroyNotify) mumble_message_free);
+
+  g_clear_error(&thread->error);
+  g_object_unref(thread->input_stream);
+  g_object_unref(thread->output_stream);
+  g_object_unref(thread->cancellable);
+  g_main_loop_unref(thread->loop);
+  g_main_context_unref(thread->context);
+
+  g_free(thread);
+}
+
+MumbleNetworkThread *mumble_network_thread_new(MumbleInputStream *input_stream, MumbleOutputStream *output_stream, MumbleNetworkThreadMessageFunc message_func, MumbleNetworkThreadErrorFunc error_func, gpointer user_data) {
+  MumbleNetworkThread *thread = g_new0(MumbleNetworkThread, 1);
+
+  thread->context       = g_main_context_new();
+  thread->loop          = g_main_loop_new(thread->context, FALSE);
+  thread->cancellable   = g_cancellable_new();
+  thread->input_stream  = g_object_ref(input_stream);
+  thread->output_stream = g_object_ref(output_stream);
+  thread->incoming      = mumble_message_queue_new(QUEUE_CAPACITY);
+  thread->outgoing      = mumble_message_queue_new(QUEUE_CAPACITY);
+  thread->overflow      = g_queue_new();
+  thread->message_func  = message_func;
+  thread->error_func    = error_func;
+  thread->user_data     = user_data;
+
+  thread->delivery_source = create_wakeup_source(g_main_context_get_thread_default(), deliver_messages, thread);
+  thread->write_source    = create_wakeup_source(thread->context, write_messages, thread);
+
+  thread->thread = g_thread_new("mumble-network", run, thread);
+
+  return thread;
+}
+
+static gpointer run(gpointer data) {
+  MumbleNetworkThread *thread = data;
+
+  g_main_context_push_thread_default(thread->context);
+
+  start_read(thread);
+  g_main_loop_run(thread->loop);
+
+  g_main_context_pop_thread_default(thread->context);
+
+  return NULL;
+}
+
+static gboolean quit(gpointer data) {
+  MumbleNetworkThread *thread = data;
+  g_main_loop_quit(thread->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void start_read(MumbleNetworkThread *thread) {
+  mumble_input_stream_read_message_async(thread->input_stream, thread->cancellable, on_read, thread);
+}
+
+static gboolean resume_read(gpointer data) {
+  start_read(data);
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Runs on the worker thread. When the incoming queue is full, reading pauses until the main
+ * context has made room. The flag is raised before the queue is checked again, so that either
+ * the worker carries on by itself or the main context sees the flag and resumes the reading.
+ */
+static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
+  MumbleNetworkThread *thread = data;
+
+  GError *error = NULL;
+  MumbleMessage *message = mumble_input_stream_read_message_finish(thread->input_stream, result, &error);
+  if (error) {
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      g_error_free(error);
+    } else {
+      thread->error = error;
+      g_atomic_int_set(&thread->failed, TRUE);
+      wake(thread->delivery_source, &thread->delivery_pending);
+    }
+    return;
+  }
+
+  mumble_message_queue_push(thread->incoming, message);
+  wake(thread->delivery_source, &thread->delivery_pending);
+
+  if (mumble_message_queue_is_full(thread->incoming)) {
+    g_atomic_int_set(&thread->read_paused, TRUE);
+    if (mumble_message_queue_is_full(thread->incoming) || !g_atomic_int_compare_and_exchange(&thread->read_paused, TRUE, FALSE)) {
+      return;
+    }
+  }
+
+  start_read(thread);
+}
+
+static gboolean write_messages(gpointer data) {
+  MumbleNetworkThread *thread = data;
+
+  MumbleMessage *message;
+  while ((message = mumble_message_queue_pop(thread->outgoing))) {
+    mumble_output_stream_write_message_async(thread->output_stream, message, thread->cancellable, NULL, NULL);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean deliver_messages(gpointer data) {
+  MumbleNetworkThread *thread = data;
+
+  for (guint count = 0; count < DELIVERY_BATCH_SIZE; count++) {
+    MumbleMessage *message = mumble_message_queue_pop(thread->incoming);
+    if (!message) {
+      break;
+    }
+    thread->message_func(message, thread->user_data);
+  }
+
+  if (g_atomic_int_compare_and_exchange(&thread->read_paused, TRUE, FALSE)) {
+    g_main_context_invoke(thread->context, resume_read, thread);
+  }
+
+  move_overflow(thread);
+
+  if (!mumble_message_queue_is_empty(thread->incoming)) {
+    wake(thread->delivery_source, &thread->delivery_pending);
+  } else if (g_atomic_int_get(&thread->failed)) {
+    GError *error = thread->error;
+    thread->error = NULL;
+    if (error) {
+      thread->error_func(error, thread->user_data);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void move_overflow(MumbleNetworkThread *thread) {
+  if (g_queue_is_empty(thread->overflow)) {
+    return;
+  }
+
+  while (!g_queue_is_empty(thread->overflow) && mumble_message_queue_push(thread->outgoing, g_queue_peek_head(thread->overflow))) {
+    g_queue_pop_head(thread->overflow);
+  }
+  wake(thread->write_source, &thread->write_pending);
+}
+
+/*
+ * Make @source dispatch in its context. The pending flag avoids taking the context lock for every
+ * message while an earlier wakeup hasn't been handled yet.
+ */
+static void wake(GSource *source, gint *pending) {
+  if (g_atomic_int_compare_and_exchange(pending, FALSE, TRUE)) {
+    g_source_set_ready_time(source, 0);
+  }
+}
+
+static GSource *create_wakeup_source(GMainContext *context, GSourceFunc func, gpointer data) {
+  GSource *source = g_source_new(&wakeup_source_funcs, sizeof(GSource));
+  g_source_set_callback(source, func, data, NULL);
+  g_source_attach(source, context);
+  return source;
+}
+
+/*
+ * The source is disarmed and its pending flag cleared before the callback runs, so a wakeup
+ * that races with the callback causes another dispatch instead of getting lost.
+ */
+static gboolean dispatch_wakeup_source(GSource *source, GSourceFunc callback, gpointer data) {
+  MumbleNetworkThread *thread = data;
+
+  g_source_set_ready_time(source, -1);
+  if (source == thread->delivery_source) {
+    g_atomic_int_set(&thread->delivery_pending, FALSE);
+  } else {
+    g_atomic_int_set(&thread->write_pending, FALSE);
+  }
+
+  return callback(data);
+}
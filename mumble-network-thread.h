@@ -0,0 +1,108 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_NETWORK_THREAD_H
+#define MUMBLE_NETWORK_THREAD_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "mumble-input-stream.h"
+#include "mumble-output-stream.h"
+#include "mumble-message.h"
+
+/**
+ * SECTION:mumblenetworkthread
+ * @short_description: Connection I/O on a dedicated thread
+ *
+ * Runs the reading, TLS decryption and framing of a connection on a worker
+ * thread with its own #GMainContext. Complete messages are handed over to the
+ * main context through a bounded queue and delivered in batches from a single
+ * source. Outgoing messages travel through a second queue in the opposite
+ * direction.
+ */
+
+typedef struct _MumbleNetworkThread MumbleNetworkThread;
+
+/**
+ * MumbleNetworkThreadMessageFunc:
+ * @message:   A #MumbleMessage, owned by the function
+ * @user_data: User data
+ *
+ * Called in the main context for every message read from the connection.
+ */
+typedef void (*MumbleNetworkThreadMessageFunc)(MumbleMessage *message, gpointer user_data);
+
+/**
+ * MumbleNetworkThreadErrorFunc:
+ * @error:     A #GError, owned by the function
+ * @user_data: User data
+ *
+ * Called in the main context once reading from the connection has failed and
+ * all messages read before the failure have been delivered. The
+ * #MumbleNetworkThread may be freed from within this function.
+ */
+typedef void (*MumbleNetworkThreadErrorFunc)(GError *error, gpointer user_data);
+
+/**
+ * mumble_network_thread_write_message:
+ * @thread:  A #MumbleNetworkThread
+ * @message: A #MumbleMessage, ownership is taken
+ *
+ * Queue @message for writing on the worker thread.
+ */
+void mumble_network_thread_write_message(MumbleNetworkThread *thread, MumbleMessage *message);
+
+/**
+ * mumble_network_thread_get_write_queue_length:
+ * @thread: A #MumbleNetworkThread
+ *
+ * Called only from the thread that writes messages.
+ *
+ * Returns: Number of messages queued for the worker thread that it hasn't
+ * picked up yet
+ */
+guint mumble_network_thread_get_write_queue_length(MumbleNetworkThread *thread);
+
+/**
+ * mumble_network_thread_free:
+ * @thread: A #MumbleNetworkThread
+ *
+ * Stop and join the worker thread and discard undelivered messages. The
+ * streams can be used from the calling thread again afterwards.
+ */
+void mumble_network_thread_free(MumbleNetworkThread *thread);
+
+/**
+ * mumble_network_thread_new:
+ * @input_stream:  Stream that messages are read from
+ * @output_stream: Stream that messages are written to
+ * @message_func:  Called for every message that is read
+ * @error_func:    Called when reading fails
+ * @user_data:     User data for @message_func and @error_func
+ *
+ * Start a worker thread that owns @input_stream and @output_stream until the
+ * thread is freed. The callbacks are invoked in the thread-default main
+ * context of the caller.
+ *
+ * Returns: New #MumbleNetworkThread
+ */
+MumbleNetworkThread *mumble_network_thread_new(MumbleInputStream *input_stream, MumbleOutputStream *output_stream, MumbleNetworkThreadMessageFunc message_func, MumbleNetworkThreadErrorFunc error_func, gpointer user_data);
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-ogg.h"
+
+#define PAGE_HEADER_SIZE 27
+#define CONTINUED_PACKET 0x01
+#define FIRST_PAGE       0x02
+#define LAST_PAGE        0x04
+#define MAX_SEGMENTS     255
+
+struct _MumbleOggReader {
+  GByteArray *buffer;
+  GByteArray *packet;
+  GQueue packets;
+  gboolean has_serial;
+  guint32 serial;
+};
+
+static gboolean read_page(MumbleOggReader *);
+static guint32 read_uint32(const guint8 *);
+static void write_page(MumbleOggWriter *, guint8, GByteArray *);
+static guint32 compute_crc(const guint8 *, gsize);
+
+void mumble_ogg_reader_feed(MumbleOggReader *reader, const guint8 *data, gsize length) {
+  g_byte_array_append(reader->buffer, data, length);
+  while (read_page(reader));
+}
+
+GByteArray *mumble_ogg_reader_next_packet(MumbleOggReader *reader) {
+  return g_queue_pop_head(&reader->packets);
+}
+
+void mumble_ogg_reader_free(MumbleOggReader *reader) {
+  GByteArray *packet;
+  while ((packet = g_queue_pop_head(&reader->packets))) {
+    g_byte_array_unref(packet);
+  }
+  g_byte_array_unref(reader->buffer);
+  g_byte_array_unref(reader->packet);
+  g_free(reader);
+}
+
+MumbleOggReader *mumble_ogg_reader_new() {
+  MumbleOggReader *reader = g_new0(MumbleOggReader, 1);
+  reader->buffer = g_byte_array_new();
+  reader->packet = g_byte_array_new();
+  g_queue_init(&reader->packets);
+  return reader;
+}
+
+void mumble_ogg_writer_add_packet(MumbleOggWriter *writer, const guint8 *data, gsize length, guint64 granule, gboolean flush, GByteArray *output) {
+  guint segment_count = length / 255 + 1;
+  if (writer->segments->len + segment_count > MAX_SEGMENTS) {
+    mumble_ogg_writer_flush(writer, output);
+  }
+
+  for (guint i = 0; i < segment_count - 1; i++) {
+    guint8 lacing_value = 255;
+    g_byte_array_append(writer->segments, &lacing_value, 1);
+  }
+  guint8 last_lacing_value = length % 255;
+  g_byte_array_append(writer->segments, &last_lacing_value, 1);
+  g_byte_array_append(writer->body, data, length);
+
+  writer->granule = granule;
+
+  if (flush) {
+    mumble_ogg_writer_flush(writer, output);
+  }
+}
+
+void mumble_ogg_writer_flush(MumbleOggWriter *writer, GByteArray *output) {
+  if (writer->segments->len) {
+    write_page(writer, writer->page_sequence ? 0 : FIRST_PAGE, output);
+  }
+}
+
+void mumble_ogg_writer_finish(MumbleOggWriter *writer, GByteArray *output) {
+  write_page(writer, LAST_PAGE | (writer->page_sequence ? 0 : FIRST_PAGE), output);
+}
+
+void mumble_ogg_writer_free(MumbleOggWriter *writer) {
+  g_byte_array_unref(writer->segments);
+  g_byte_array_unref(writer->body);
+  g_free(writer);
+}
+
+MumbleOggWriter *mumble_ogg_writer_new(guint32 serial) {
+  MumbleOggWriter *writer = g_new0(MumbleOggWriter, 1);
+  writer->serial   = serial;
+  writer->segments = g_byte_array_new();
+  writer->body     = g_byte_array_new();
+  return writer;
+}
+
+/*
+ * A page consists of a 27-byte header, a table of segment lengths and the segments. A packet is
+ * split into segments of 255 bytes and ends with a shorter segment, so a packet may continue
+ * on the next page.
+ *
+ * Returns: TRUE if a page was consumed
+ */
+static gboolean read_page(MumbleOggReader *reader) {
+  GByteArray *buffer = reader->buffer;
+
+  guint offset = 0;
+  while ((offset + 4 <= buffer->len) && memcmp(buffer->data + offset, "OggS", 4)) {
+    offset++;
+  }
+  if (offset) {
+    g_byte_array_remove_range(buffer, 0, offset);
+  }
+
+  if (buffer->len < PAGE_HEADER_SIZE) {
+    return FALSE;
+  }
+
+  guint8 header_type = buffer->data[5];
+  guint32 serial = read_uint32(buffer->data + 14);
+  guint segment_count = buffer->data[26];
+  if (buffer->len < PAGE_HEADER_SIZE + segment_count) {
+    return FALSE;
+  }
+
+  const guint8 *segment_lengths = buffer->data + PAGE_HEADER_SIZE;
+  guint page_size = PAGE_HEADER_SIZE + segment_count;
+  for (guint i = 0; i < segment_count; i++) {
+    page_size += segment_lengths[i];
+  }
+  if (buffer->len < page_size) {
+    return FALSE;
+  }
+
+  if (!reader->has_serial) {
+    reader->has_serial = TRUE;
+    reader->serial = serial;
+  }
+
+  if (serial == reader->serial) {
+    if (!(header_type & CONTINUED_PACKET)) {
+      g_byte_array_set_size(reader->packet, 0);
+    }
+
+    const guint8 *segment = segment_lengths + segment_count;
+    for (guint i = 0; i < segment_count; i++) {
+      g_byte_array_append(reader->packet, segment, segment_lengths[i]);
+      segment += segment_lengths[i];
+
+      if (segment_lengths[i] < 255) {
+        g_queue_push_tail(&reader->packets, reader->packet);
+        reader->packet = g_byte_array_new();
+      }
+    }
+  }
+
+  g_byte_array_remove_range(buffer, 0, page_size);
+
+  return TRUE;
+}
+
+static guint32 read_uint32(const guint8 *bytes) {
+  return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((guint32) bytes[3] << 24);
+}
+
+static void write_page(MumbleOggWriter *writer, guint8 header_type, GByteArray *output) {
+  guint page_offset = output->len;
+  guint8 header[PAGE_HEADER_SIZE] = { 'O', 'g', 'g', 'S', 0, header_type };
+  for (guint i = 0; i < 8; i++) {
+    header[6 + i] = writer->granule >> (8 * i);
+  }
+  for (guint i = 0; i < 4; i++) {
+    header[14 + i] = writer->serial >> (8 * i);
+    header[18 + i] = writer->page_sequence >> (8 * i);
+  }
+  header[26] = writer->segments->len;
+
+  g_byte_array_append(output, header, PAGE_HEADER_SIZE);
+  g_byte_array_append(output, writer->segments->data, writer->segments->len);
+  g_byte_array_append(output, writer->body->data, writer->body->len);
+
+  guint32 crc = compute_crc(output->data + page_offset, output->len - page_offset);
+  for (guint i = 0; i < 4; i++) {
+    output->data[page_offset + 22 + i] = crc >> (8 * i);
+  }
+
+  g_byte_array_set_size(writer->segments, 0);
+  g_byte_array_set_size(writer->body, 0);
+  writer->page_sequence++;
+}
+
+/*
+ * The Ogg checksum is a CRC-32 with polynomial 0x04C11DB7, no reflection and no final XOR,
+ * computed over the page with the checksum field zeroed.
+ */
+static guint32 compute_crc(const guint8 *data, gsize length) {
+  static guint32 table[256];
+  static gsize table_initialized = 0;
+
+  if (g_once_init_enter(&table_initialized)) {
+    for (guint i = 0; i < 256; i++) {
+      guint32 value = i << 24;
+      for (guint j = 0; j < 8; j++) {
+        value = (value & 0x80000000) ? (value << 1) ^ 0x04C11DB7 : value << 1;
+      }
+      table[i] = value;
+    }
+    g_once_init_leave(&table_initialized, 1);
+  }
+
+  guint32 crc = 0;
+  for (gsize i = 0; i < length; i++) {
+    crc = (crc << 8) ^ table[(crc >> 24) ^ data[i]];
+  }
+  return crc;
+}
@@ -0,0 +1,115 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_OGG_H
+#define MUMBLE_OGG_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumbleogg
+ * @short_description: Ogg container
+ *
+ * Just enough of the Ogg container format (RFC 3533) to get the packets of
+ * an Ogg Opus stream out of a file or a pipe, and to write streams of small
+ * packets.
+ */
+
+typedef struct _MumbleOggReader MumbleOggReader;
+
+/**
+ * MumbleOggWriter:
+ * @serial:        Serial number of the logical stream
+ * @page_sequence: Sequence number of the next page
+ * @granule:       Granule position of the last packet added
+ * @segments:      Lacing values of the packets on the current page
+ * @body:          Packets on the current page
+ *
+ * Writes a single logical stream. Every packet must fit on a page of its own.
+ */
+typedef struct _MumbleOggWriter {
+  guint32 serial;
+  guint32 page_sequence;
+  guint64 granule;
+  GByteArray *segments;
+  GByteArray *body;
+} MumbleOggWriter;
+
+/**
+ * mumble_ogg_reader_feed:
+ * @reader: A #MumbleOggReader
+ * @data:   Bytes of the stream
+ * @length: Length of @data
+ *
+ * Append data to the stream. The data may end in the middle of a page.
+ */
+void mumble_ogg_reader_feed(MumbleOggReader *reader, const guint8 *data, gsize length);
+
+/**
+ * mumble_ogg_reader_next_packet:
+ * @reader: A #MumbleOggReader
+ *
+ * Take the next complete packet of the first logical stream. Packets of
+ * other multiplexed streams are skipped.
+ *
+ * Returns: (transfer full) (nullable): The next packet, or %NULL if more data
+ * is needed
+ */
+GByteArray *mumble_ogg_reader_next_packet(MumbleOggReader *reader);
+
+void mumble_ogg_reader_free(MumbleOggReader *reader);
+MumbleOggReader *mumble_ogg_reader_new();
+
+/**
+ * mumble_ogg_writer_add_packet:
+ * @writer:   A #MumbleOggWriter
+ * @data:     Packet data, less than 255 * 255 bytes
+ * @length:   Length of @data
+ * @granule:  Granule position at the end of the packet
+ * @flush:    Whether to end the page after the packet
+ * @output:   Byte array to append completed pages to
+ *
+ * Add a packet to the current page. The page is written out when it is
+ * flushed or when the packet doesn't fit on it.
+ */
+void mumble_ogg_writer_add_packet(MumbleOggWriter *writer, const guint8 *data, gsize length, guint64 granule, gboolean flush, GByteArray *output);
+
+/**
+ * mumble_ogg_writer_flush:
+ * @writer: A #MumbleOggWriter
+ * @output: Byte array to append the page to
+ *
+ * Write out the current page if it has any packets.
+ */
+void mumble_ogg_writer_flush(MumbleOggWriter *writer, GByteArray *output);
+
+/**
+ * mumble_ogg_writer_finish:
+ * @writer: A #MumbleOggWriter
+ * @output: Byte array to append the last page to
+ *
+ * End the logical stream with an end-of-stream page.
+ */
+void mumble_ogg_writer_finish(MumbleOggWriter *writer, GByteArray *output);
+
+void mumble_ogg_writer_free(MumbleOggWriter *writer);
+MumbleOggWriter *mumble_ogg_writer_new(guint32 serial);
+
+#endif
@@ -20,7 +20,12 @@
 #include <purple.h>
 #include "mumble-output-stream.h"
 
-G_DEFINE_TYPE(MumbleOutputStream, mumble_output_stream, PURPLE_TYPE_QUEUED_OUTPUT_STREAM)
+typedef struct _MumbleOutputStreamPrivate {
+  gint pending_count;
+  MumbleTrace *trace;
+} MumbleOutputStreamPrivate;
+
+G_DEFINE_TYPE_WITH_PRIVATE(MumbleOutputStream, mumble_output_stream, PURPLE_TYPE_QUEUED_OUTPUT_STREAM)
 
 static void on_written(GObject *source, GAsyncResult *result, gpointer data);
 
@@ -33,14 +38,30 @@ void mumble_output_stream_write_message_async(MumbleOutputStream *stream, Mumble
   gint count = mumble_message_write(message, buffer);
   GBytes *bytes = g_bytes_new_take(buffer, count);
 
+  MumbleTraceSpan *span = message->trace_span;
+  message->trace_span = NULL;
   mumble_message_free(message);
 
+  MumbleOutputStreamPrivate *priv = mumble_output_stream_get_instance_private(stream);
+  g_atomic_int_inc(&priv->pending_count);
+
   GTask *task = g_task_new(stream, cancellable, callback, callback_data);
+  g_task_set_task_data(task, span, g_free);
   purple_queued_output_stream_push_bytes_async(stream, bytes, G_PRIORITY_DEFAULT, cancellable, on_written, task);
 
   g_bytes_unref(bytes);
 }
 
+guint mumble_output_stream_get_pending_count(MumbleOutputStream *stream) {
+  MumbleOutputStreamPrivate *priv = mumble_output_stream_get_instance_private(stream);
+  return g_atomic_int_get(&priv->pending_count);
+}
+
+void mumble_output_stream_set_trace(MumbleOutputStream *stream, MumbleTrace *trace) {
+  MumbleOutputStreamPrivate *priv = mumble_output_stream_get_instance_private(stream);
+  priv->trace = trace;
+}
+
 GOutputStream *mumble_output_stream_new(GOutputStream *base_stream) {
   return g_object_new(MUMBLE_TYPE_OUTPUT_STREAM, "base-stream", base_stream, NULL);
 }
@@ -53,6 +74,15 @@ static void mumble_output_stream_class_init(MumbleOutputStreamClass *mumble_outp
 
 static void on_written(GObject *source, GAsyncResult *result, gpointer data) {
   GTask *task = G_TASK(data);
+  MumbleOutputStreamPrivate *priv = mumble_output_stream_get_instance_private(g_task_get_source_object(task));
+  g_atomic_int_add(&priv->pending_count, -1);
+
+  MumbleTraceSpan *span = g_task_get_task_data(task);
+  if (span && priv->trace) {
+    mumble_trace_span_mark(span, MUMBLE_TRACE_WRITTEN);
+    mumble_trace_record(priv->trace, span);
+  }
+
   g_task_return_boolean(task, TRUE);
   g_object_unref(task);
 }
@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <gio/gio.h>
 #include "mumble-message.h"
+#include "mumble-trace.h"
 
 #define MUMBLE_TYPE_OUTPUT_STREAM mumble_output_stream_get_type()
 
@@ -36,6 +37,24 @@ typedef struct _MumbleOutputStream {
 
 gboolean mumble_output_stream_write_message_finish(MumbleOutputStream *stream, GAsyncResult *result, GError **error);
 void mumble_output_stream_write_message_async(MumbleOutputStream *stream, MumbleMessage *message, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+/**
+ * mumble_output_stream_get_pending_count:
+ * @stream: A #MumbleOutputStream
+ *
+ * Can be called from any thread.
+ *
+ * Returns: Number of messages queued for writing but not written yet
+ */
+guint mumble_output_stream_get_pending_count(MumbleOutputStream *stream);
+
+/**
+ * mumble_output_stream_set_trace:
+ * @stream: A #MumbleOutputStream
+ * @trace:  (nullable): #MumbleTrace to record the spans of written messages
+ *          in, or %NULL
+ */
+void mumble_output_stream_set_trace(MumbleOutputStream *stream, MumbleTrace *trace);
+
 GOutputStream *mumble_output_stream_new(GOutputStream *base_stream);
 GType mumble_output_stream_get_type();
 
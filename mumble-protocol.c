@@ -17,20 +17,132 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <errno.h>
+#include <math.h>
+#include <string.h>
 #include <purple.h>
 #include "mumble-input-stream.h"
 #include "mumble-output-stream.h"
 #include "mumble-protocol.h"
 #include "mumble-message.h"
+#include "mumble-blob-cache.h"
 #include "mumble-channel-tree.h"
+#include "mumble-html-splitter.h"
+#include "mumble-inline-image-scanner.h"
+#include "mumble-latency-stats.h"
+#include "mumble-network-thread.h"
+#include "mumble-server-prober.h"
+#include "mumble-stats.h"
+#include "mumble-talk-tracker.h"
+#include "mumble-texture.h"
+#include "mumble-trace.h"
+#include "mumble-udp-transport.h"
+#include "mumble-voice-broadcast.h"
+#include "mumble-voice-packet.h"
+#include "mumble-voice-receiver.h"
+#include "mumble-voice-recorder.h"
 #include "utils.h"
 #include "protobuf-utils.h"
 #include "plugin.h"
 
+/*
+ * Pings are sent at an interval between these bounds in seconds. The server drops clients that
+ * have been silent for 30 seconds.
+ */
+#define MIN_PING_INTERVAL     5
+#define DEFAULT_PING_INTERVAL 10
+#define MAX_PING_INTERVAL     20
+
+/*
+ * Limits that apply until the server sends ServerConfig, the defaults of Murmur. Lengths are in
+ * UTF-16 code units.
+ */
+#define DEFAULT_MESSAGE_LENGTH       5000
+#define DEFAULT_IMAGE_MESSAGE_LENGTH 131072
+
+/*
+ * Longer messages are split into pieces of the maximum length. Murmur lets 5 messages through
+ * in a burst by default, so the UI is told that a message can be up to this many pieces long.
+ */
+#define MAX_MESSAGE_PIECES 5
+
+/*
+ * Decoded size limit in bytes for images received inline in text messages. Larger ones are
+ * dropped from the message.
+ */
+#define MAX_INLINE_IMAGE_SIZE (4 * 1024 * 1024)
+
+/*
+ * Descriptions and comments fetched from the server are kept in memory up to this many bytes.
+ * Requested ones that haven't arrived after this many milliseconds are given up on.
+ */
+#define BLOB_CACHE_MEMORY_SIZE (1024 * 1024)
+#define BLOB_REQUEST_TIMEOUT   5000
+
+/*
+ * /probe sends this many pings to each server at this interval in milliseconds.
+ */
+#define PROBE_PINGS    5
+#define PROBE_INTERVAL 200
+
+/*
+ * Reconnection delays in milliseconds. The delay doubles with every failed attempt and is
+ * randomized to between half and all of its nominal value.
+ */
+#define INITIAL_RECONNECT_DELAY 100
+#define MAX_RECONNECT_DELAY     30000
+#define MAX_RECONNECT_ATTEMPTS  10
+
+/*
+ * Limits of name searches. Fuzzy searches scan all names, so they get a time budget in
+ * microseconds to keep the UI responsive on large servers.
+ */
+#define MAX_FIND_RESULTS     20
+#define MAX_JOIN_CANDIDATES  5
+#define FUZZY_SEARCH_BUDGET  1000
+
+/*
+ * Number of the most recent messages that are kept for trace export when tracing is enabled.
+ */
+#define TRACE_SPAN_COUNT 4096
+
+typedef struct {
+  guint max_bandwidth;
+  gboolean allow_html;
+  guint message_length;
+  guint image_message_length;
+  guint max_users;
+  gboolean recording_allowed;
+} MumbleServerConfig;
+
+/*
+ * Blobs of one kind, identified by channel or session ID. Requests are queued until they are
+ * sent in one RequestBlob, and pending until the blob arrives.
+ */
+typedef struct {
+  GHashTable *pending;
+  GArray *queued;
+} MumbleBlobRequests;
+
+typedef struct {
+  PurpleConnection *connection;
+  guint session_id;
+  gchar *checksum;
+} MumbleTextureDecoding;
+
+typedef void (*MumbleBlobWaiterFunc)(PurpleConnection *, gpointer);
+
+typedef struct {
+  MumbleBlobWaiterFunc func;
+  PurpleConnection *connection;
+  gpointer data;
+} MumbleBlobWaiter;
+
 typedef struct {
   GSocketConnection *connection;
   MumbleInputStream *input_stream;
   MumbleOutputStream *output_stream;
+  MumbleNetworkThread *network_thread;
   GCancellable *cancellable;
   gchar *user_name;
   gchar *server;
@@ -38,6 +150,39 @@ typedef struct {
   PurpleChatConversation *active_chat;
   MumbleChannelTree *tree;
   guint session_id;
+  gboolean synchronized;
+  GHashTable *pending_chat_user_additions;
+  GHashTable *pending_chat_user_removals;
+  guint chat_user_flush_source;
+  MumbleLatencyStats *tcp_ping_stats;
+  guint64 ping_timestamp;
+  gint64 last_ping_time;
+  guint ping_interval;
+  guint ping_good;
+  guint ping_late;
+  guint ping_lost;
+  MumbleChannelTree *baseline_tree;
+  guint previous_channel_id;
+  guint reconnect_source;
+  guint reconnect_attempts;
+  MumbleVoiceReceiver *voice_receiver;
+  MumbleTalkTracker *talk_tracker;
+  MumbleVoiceBroadcast *broadcast;
+  MumbleVoiceRecorder *voice_recorder;
+  MumbleUdpTransport *udp_transport;
+  MumbleServerProber *server_prober;
+  MumbleServerConfig server_config;
+  MumbleBlobCache *blob_cache;
+  MumbleBlobRequests description_requests;
+  MumbleBlobRequests comment_requests;
+  MumbleBlobRequests texture_requests;
+  GHashTable *avatars;
+  guint blob_request_source;
+  guint blob_timeout_source;
+  GList *blob_waiters;
+  MumbleStats *stats;
+  MumbleTrace *trace;
+  gint64 trace_send_time;
 } MumbleProtocolData;
 
 void mumble_protocol_register(PurplePlugin *);
@@ -59,6 +204,7 @@ static const char *mumble_protocol_list_icon(PurpleAccount *, PurpleBuddy *);
 static gssize mumble_protocol_client_interface_get_max_message_size(PurpleConversation *);
 
 static void mumble_protocol_server_interface_keepalive(PurpleConnection *connection);
+static void mumble_protocol_server_interface_get_info(PurpleConnection *, const char *);
 static int mumble_protocol_server_interface_get_keepalive_interval();
 
 static GList *mumble_protocol_chat_interface_info(PurpleConnection *);
@@ -68,6 +214,7 @@ static void mumble_protocol_chat_interface_leave(PurpleConnection *, int);
 static int mumble_protocol_chat_interface_send(PurpleConnection *, int, PurpleMessage *);
 
 static PurpleRoomlist *mumble_protocol_roomlist_interface_get_list(PurpleConnection *);
+static void fill_roomlist(PurpleConnection *, gpointer);
 
 G_DEFINE_DYNAMIC_TYPE_EXTENDED(MumbleProtocol, mumble_protocol, PURPLE_TYPE_PROTOCOL, 0,
   G_IMPLEMENT_INTERFACE_DYNAMIC(PURPLE_TYPE_PROTOCOL_CLIENT, mumble_protocol_client_interface_init)
@@ -77,14 +224,72 @@ G_DEFINE_DYNAMIC_TYPE_EXTENDED(MumbleProtocol, mumble_protocol, PURPLE_TYPE_PROT
 
 G_MODULE_EXPORT GType mumble_protocol_get_type(void);
 
+static void start_connection(PurpleConnection *);
+static void close_connection(MumbleProtocolData *);
+static void handle_connection_error(PurpleConnection *, GError *);
+static gboolean reconnect(gpointer);
+static void resume_session(PurpleConnection *);
+static void reconcile_active_chat_users(PurpleConnection *, MumbleChannelTree *, guint, guint);
 static void on_connected(GObject *, GAsyncResult *, gpointer);
 static void on_read(GObject *, GAsyncResult *, gpointer);
+static void on_network_thread_error(GError *, gpointer);
+static void handle_message(MumbleMessage *, gpointer);
+static void handle_crypt_setup(PurpleConnection *, GByteArray *);
+static void handle_voice_packet(MumbleProtocolData *, const guint8 *, gsize);
+static void on_udp_packet(const guint8 *, gsize, gpointer);
+static void send_voice_packet(MumbleProtocolData *, GByteArray *);
+static void on_talking_changed(guint, gboolean, gpointer);
+static gchar *store_inline_image(const gchar *, GByteArray *, gpointer);
 static void write_mumble_message(MumbleProtocolData *, MumbleMessageType, GByteArray *);
 static PurpleCmdRet handle_join_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
 static PurpleCmdRet handle_channels_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_find_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static MumbleChannel *find_channel(MumbleProtocolData *, gchar *, gchar **);
+static void write_channel_list(PurpleConnection *, gpointer);
+static PurpleCmdRet handle_ping_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_stats_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_trace_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static void update_stats_gauges(MumbleProtocolData *);
+static PurpleCmdRet handle_volume_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_play_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_stop_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static PurpleCmdRet handle_probe_cmd(PurpleConversation *, gchar *, gchar **, gchar **, MumbleProtocolData *);
+static void on_broadcast_send(GByteArray *, gpointer);
+static void on_broadcast_done(GError *, gpointer);
+static void on_probe_done(MumbleServerProber *, gpointer);
+static gint compare_server_probes(gconstpointer, gconstpointer);
+static void apply_user_volume(PurpleAccount *, MumbleProtocolData *, MumbleUser *);
+static gchar *get_volume_setting_name(gchar *);
 static void register_cmd(MumbleProtocolData *, gchar *, gchar *, gchar *, PurpleCmdFunc);
 static MumbleChannel *get_mumble_channel_by_id_string(MumbleChannelTree *, gchar *);
 static void join_channel(PurpleConnection *, MumbleChannel *);
+static void remove_channel(PurpleConnection *, guint);
+static void move_to_channel(MumbleProtocolData *, guint);
+static void add_channel_users_to_active_chat(MumbleProtocolData *, guint);
+static void queue_chat_user_addition(PurpleConnection *, gchar *);
+static void queue_chat_user_removal(PurpleConnection *, gchar *);
+static void schedule_chat_user_flush(PurpleConnection *);
+static gboolean flush_chat_user_changes(gpointer);
+static void discard_chat_user_changes(MumbleProtocolData *);
+static void send_ping(MumbleProtocolData *);
+static void handle_ping_reply(MumbleProtocolData *, guint64);
+static void show_user_info(PurpleConnection *, gpointer);
+static void set_channel_description(PurpleConnection *, MumbleChannel *, gchar *, GByteArray *);
+static gboolean fetch_channel_description(PurpleConnection *, MumbleChannel *);
+static gboolean fetch_user_comment(PurpleConnection *, MumbleUser *);
+static void update_user_texture(PurpleConnection *, MumbleUser *, const MumbleUserUpdate *, guint);
+static void fetch_user_texture(PurpleConnection *, MumbleUser *);
+static void show_user_texture(PurpleConnection *, MumbleUser *, GBytes *);
+static void on_texture_decoded(GObject *, GAsyncResult *, gpointer);
+static gchar *lookup_blob_text(MumbleProtocolData *, const guint8 *, gsize);
+static void cache_blob_text(MumbleProtocolData *, gchar *);
+static void request_blob(PurpleConnection *, MumbleBlobRequests *, guint);
+static void complete_blob_request(PurpleConnection *, MumbleBlobRequests *, guint);
+static gboolean flush_blob_requests(gpointer);
+static gboolean on_blob_request_timeout(gpointer);
+static void wait_for_blobs(PurpleConnection *, MumbleBlobWaiterFunc, gpointer);
+static void run_blob_waiters(MumbleProtocolData *);
+static void discard_blob_requests(MumbleProtocolData *);
 static GList *append_chat_entry(GList *, gchar *, gchar *, gboolean);
 
 void mumble_protocol_register(PurplePlugin *plugin) {
@@ -102,6 +307,17 @@ static void mumble_protocol_init(MumbleProtocol *mumble_protocol) {
   protocol->user_splits = g_list_append(protocol->user_splits, purple_account_user_split_new("Server", "localhost", '@'));
 
   protocol->account_options = g_list_append(protocol->account_options, purple_account_option_int_new("Port", "port", 64738));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_int_new("Chat update delay (ms)", "chat-update-delay", 0));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Reconnect automatically", "reconnect", TRUE));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Use a separate network thread", "network-thread", FALSE));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Use UDP for voice", "udp", TRUE));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_string_new("Voice output file or pipe", "voice-output", ""));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_string_new("Recording directory", "recording-directory", ""));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Record one file per channel", "recording-per-channel", FALSE));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_int_new("Rotate recordings after (MB)", "recording-max-size", 0));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_int_new("Rotate recordings after (minutes)", "recording-max-duration", 60));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Measure message handling times", "stats-timing", FALSE));
+  protocol->account_options = g_list_append(protocol->account_options, purple_account_option_bool_new("Trace message latency", "trace", FALSE));
 }
 
 static void mumble_protocol_class_init(MumbleProtocolClass *mumble_protocol_class) {
@@ -123,6 +339,7 @@ static void mumble_protocol_client_interface_init(PurpleProtocolClientInterface
 static void mumble_protocol_server_interface_init(PurpleProtocolServerInterface *interface) {
   interface->keepalive              = mumble_protocol_server_interface_keepalive;
   interface->get_keepalive_interval = mumble_protocol_server_interface_get_keepalive_interval;
+  interface->get_info               = mumble_protocol_server_interface_get_info;
 }
 
 static void mumble_protocol_chat_interface_init(PurpleProtocolChatInterface *interface) {
@@ -149,21 +366,71 @@ static void mumble_protocol_login(PurpleAccount *account) {
   protocol_data->user_name = g_strdup(parts[0]);
   protocol_data->server = g_strdup(parts[1]);
   g_strfreev(parts);
-  
-  GError *error;
-  GSocketClient *client = purple_gio_socket_client_new(account, &error);
-  if (!client) {
-    purple_connection_take_error(connection, error);
-    return;
+
+  protocol_data->pending_chat_user_additions = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  protocol_data->pending_chat_user_removals  = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+  protocol_data->tcp_ping_stats = mumble_latency_stats_new();
+  protocol_data->ping_interval  = DEFAULT_PING_INTERVAL;
+
+  protocol_data->stats         = mumble_stats_new();
+  protocol_data->stats->timing = purple_account_get_bool(account, "stats-timing", FALSE);
+  if (purple_account_get_bool(account, "trace", FALSE)) {
+    protocol_data->trace = mumble_trace_new(TRACE_SPAN_COUNT);
   }
-  g_socket_client_set_tls(client, TRUE);
-  g_socket_client_set_tls_validation_flags(client, 0);
-  
-  g_socket_client_connect_to_host_async(client, protocol_data->server, purple_account_get_int(account, "port", 64738), NULL, on_connected, connection);
-  
-  g_object_unref(client);
-  
+
+  protocol_data->talk_tracker = mumble_talk_tracker_new(on_talking_changed, connection);
+
+  gchar *blob_directory = g_build_filename(purple_cache_dir(), "mumble", "blobs", NULL);
+  protocol_data->blob_cache = mumble_blob_cache_new(blob_directory, BLOB_CACHE_MEMORY_SIZE);
+  g_free(blob_directory);
+  protocol_data->description_requests.pending = g_hash_table_new(NULL, NULL);
+  protocol_data->description_requests.queued  = g_array_new(FALSE, FALSE, sizeof(guint));
+  protocol_data->comment_requests.pending     = g_hash_table_new(NULL, NULL);
+  protocol_data->comment_requests.queued      = g_array_new(FALSE, FALSE, sizeof(guint));
+  protocol_data->texture_requests.pending     = g_hash_table_new(NULL, NULL);
+  protocol_data->texture_requests.queued      = g_array_new(FALSE, FALSE, sizeof(guint));
+  protocol_data->avatars                      = g_hash_table_new_full(NULL, NULL, NULL, g_object_unref);
+
+  const gchar *recording_directory = purple_account_get_string(account, "recording-directory", "");
+  if (*recording_directory) {
+    if (g_mkdir_with_parents(recording_directory, 0700) == 0) {
+      MumbleVoiceRecorderMode mode = purple_account_get_bool(account, "recording-per-channel", FALSE) ? MUMBLE_VOICE_RECORDER_PER_CHANNEL : MUMBLE_VOICE_RECORDER_PER_SESSION;
+      gsize max_size = (gsize) MAX(purple_account_get_int(account, "recording-max-size", 0), 0) * 1024 * 1024;
+      guint max_duration = MAX(purple_account_get_int(account, "recording-max-duration", 60), 0) * 60;
+      protocol_data->voice_recorder = mumble_voice_recorder_new(recording_directory, mode, max_size, max_duration);
+    } else {
+      purple_debug_warning("mumble", "Recording disabled: can't create %s", recording_directory);
+    }
+  }
+
+  const gchar *voice_output = purple_account_get_string(account, "voice-output", "");
+  if (*voice_output) {
+    GError *error = NULL;
+    protocol_data->voice_receiver = mumble_voice_receiver_new(voice_output, &error);
+    if (!protocol_data->voice_receiver) {
+      purple_debug_warning("mumble", "Voice output disabled: %s", error->message);
+      g_error_free(error);
+    }
+  }
+
+  register_cmd(protocol_data, "join", "w", "join &lt;channel name&gt;:  Join a channel", handle_join_cmd);
+  register_cmd(protocol_data, "join-id", "w", "join-id &lt;channel ID&gt;:  Join a channel", handle_join_cmd);
+  register_cmd(protocol_data, "channels", "", "channels:  List channels", handle_channels_cmd);
+  register_cmd(protocol_data, "find", "s", "find &lt;text&gt;:  Find channels and users by the start of their names or by letters in them", handle_find_cmd);
+  register_cmd(protocol_data, "ping", "", "ping:  Show connection quality", handle_ping_cmd);
+  register_cmd(protocol_data, "mumble-stats", "", "mumble-stats:  Show traffic and handling costs by message type", handle_stats_cmd);
+  register_cmd(protocol_data, "mumble-stats", "s", "mumble-stats &lt;file&gt;:  Save traffic and handling costs by message type as JSON", handle_stats_cmd);
+  register_cmd(protocol_data, "mumble-trace", "", "mumble-trace:  Show where the time goes between the connection and the conversation", handle_trace_cmd);
+  register_cmd(protocol_data, "mumble-trace", "s", "mumble-trace &lt;file&gt;:  Save recent message timings for chrome://tracing or Perfetto", handle_trace_cmd);
+  register_cmd(protocol_data, "volume", "ww", "volume &lt;user name&gt; &lt;percent&gt;:  Set the playback volume of a user", handle_volume_cmd);
+  register_cmd(protocol_data, "play", "s", "play &lt;file&gt;:  Play an Ogg Opus file, or 16-bit mono PCM at 48 kHz, in the current channel", handle_play_cmd);
+  register_cmd(protocol_data, "stop", "", "stop:  Stop playing", handle_stop_cmd);
+  register_cmd(protocol_data, "probe", "s", "probe &lt;server[:port]&gt; ...:  Measure the latency and load of servers without connecting", handle_probe_cmd);
+
   purple_connection_set_state(connection, PURPLE_CONNECTION_CONNECTING);
+
+  start_connection(connection);
 }
 
 static void mumble_protocol_close(PurpleConnection *connection) {
@@ -175,19 +442,52 @@ static void mumble_protocol_close(PurpleConnection *connection) {
 
   purple_account_set_status(purple_connection_get_account(connection), "offline", TRUE, NULL);
 
-  g_cancellable_cancel(protocol_data->cancellable);
-  g_clear_object(&protocol_data->cancellable);
+  discard_chat_user_changes(protocol_data);
+  g_hash_table_destroy(protocol_data->pending_chat_user_additions);
+  g_hash_table_destroy(protocol_data->pending_chat_user_removals);
 
-  purple_gio_graceful_close(G_IO_STREAM(protocol_data->connection), G_INPUT_STREAM(protocol_data->input_stream), G_OUTPUT_STREAM(protocol_data->output_stream));
+  mumble_latency_stats_free(protocol_data->tcp_ping_stats);
 
-  g_clear_object(&protocol_data->input_stream);
-  g_clear_object(&protocol_data->output_stream);
-  g_clear_object(&protocol_data->connection);
+  if (protocol_data->voice_recorder) {
+    mumble_voice_recorder_free(protocol_data->voice_recorder);
+  }
+  if (protocol_data->server_prober) {
+    mumble_server_prober_free(protocol_data->server_prober);
+  }
 
+  if (protocol_data->reconnect_source) {
+    g_source_remove(protocol_data->reconnect_source);
+  }
+
+  /*
+   * Closing the connection resets the voice receiver and the talk tracker, so they are freed
+   * afterwards.
+   */
+  close_connection(protocol_data);
+  g_clear_pointer(&protocol_data->voice_receiver, mumble_voice_receiver_free);
+  g_clear_pointer(&protocol_data->talk_tracker, mumble_talk_tracker_free);
+
+  mumble_blob_cache_free(protocol_data->blob_cache);
+  g_hash_table_destroy(protocol_data->description_requests.pending);
+  g_array_free(protocol_data->description_requests.queued, TRUE);
+  g_hash_table_destroy(protocol_data->comment_requests.pending);
+  g_array_free(protocol_data->comment_requests.queued, TRUE);
+  g_hash_table_destroy(protocol_data->texture_requests.pending);
+  g_array_free(protocol_data->texture_requests.queued, TRUE);
+  g_hash_table_destroy(protocol_data->avatars);
+
+  if (protocol_data->baseline_tree && (protocol_data->baseline_tree != protocol_data->tree)) {
+    mumble_channel_tree_free(protocol_data->baseline_tree);
+  }
   if (protocol_data->tree) {
     mumble_channel_tree_free(protocol_data->tree);
   }
 
+  mumble_stats_free(protocol_data->stats);
+  if (protocol_data->trace) {
+    mumble_trace_free(protocol_data->trace);
+  }
+
   g_free(protocol_data->user_name);
   g_free(protocol_data->server);
   g_free(protocol_data);
@@ -207,16 +507,50 @@ static const char *mumble_protocol_list_icon(PurpleAccount *account, PurpleBuddy
 }
 
 static gssize mumble_protocol_client_interface_get_max_message_size(PurpleConversation *conversation) {
-  return 256;
+  PurpleConnection *connection = purple_conversation_get_connection(conversation);
+  MumbleProtocolData *protocol_data = connection ? purple_connection_get_protocol_data(connection) : NULL;
+  if (!protocol_data) {
+    return 0;
+  }
+
+  if (!protocol_data->server_config.message_length) {
+    return -1;
+  }
+  return protocol_data->server_config.message_length * MAX_MESSAGE_PIECES;
 }
 
+/*
+ * libpurple calls this at the minimum ping interval, and a ping is sent only when the current
+ * adaptive interval has elapsed.
+ */
 static void mumble_protocol_server_interface_keepalive(PurpleConnection *connection) {
   MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
-  write_mumble_message(protocol_data, MUMBLE_PING, g_byte_array_new());
+
+  if (g_get_monotonic_time() - protocol_data->last_ping_time >= protocol_data->ping_interval * G_USEC_PER_SEC) {
+    send_ping(protocol_data);
+  }
+
+  /*
+   * An empty CryptSetup asks the server for a new decrypt nonce.
+   */
+  if (protocol_data->udp_transport && mumble_udp_transport_needs_resync(protocol_data->udp_transport)) {
+    purple_debug_info("mumble", "Requesting UDP crypt resync");
+    write_mumble_message(protocol_data, MUMBLE_CRYPT_SETUP, g_byte_array_new());
+  }
 }
 
 static int mumble_protocol_server_interface_get_keepalive_interval() {
-  return 10;
+  return MIN_PING_INTERVAL;
+}
+
+static void mumble_protocol_server_interface_get_info(PurpleConnection *connection, const char *who) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  MumbleUser *user = mumble_channel_tree_get_user_by_name(protocol_data->tree, (gchar *) who);
+  if (user) {
+    fetch_user_comment(connection, user);
+  }
+  wait_for_blobs(connection, show_user_info, g_strdup(who));
 }
 
 static GList *mumble_protocol_chat_interface_info(PurpleConnection *connection) {
@@ -245,16 +579,19 @@ static void mumble_protocol_chat_interface_join(PurpleConnection *connection, GH
   gchar *id_string    = g_hash_table_lookup(components, "id");
 
   MumbleChannel *channel;
+  gchar *error = NULL;
   if (id_string && strlen(id_string)) {
     channel = get_mumble_channel_by_id_string(protocol_data->tree, id_string);
   } else {
-    channel = mumble_channel_tree_get_channel_by_name(protocol_data->tree, channel_name);
+    channel = find_channel(protocol_data, channel_name, &error);
   }
 
   if (channel) {
     join_channel(connection, channel);
   } else {
-    gchar *error = g_strdup_printf("%s is not a valid channel name", channel_name);
+    if (!error) {
+      error = g_strdup_printf("%s is not a valid channel name", channel_name);
+    }
     purple_notify_error(connection, "Invalid channel name", "Invalid channel name", error, NULL);
     g_free(error);
 
@@ -267,15 +604,43 @@ static void mumble_protocol_chat_interface_leave(PurpleConnection *connection, i
 
   purple_serv_got_chat_left(connection, id);
   protocol_data->active_chat = NULL;
+
+  discard_chat_user_changes(protocol_data);
 }
 
 static int mumble_protocol_chat_interface_send(PurpleConnection *connection, int id, PurpleMessage *message) {
   MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
 
-  GByteArray *text_message_message = g_byte_array_new();
-  encode_protobuf_unsigned_varint(text_message_message, 3, mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id));
-  encode_protobuf_string(text_message_message, 5, purple_message_get_contents(message));
-  write_mumble_message(protocol_data, MUMBLE_TEXT_MESSAGE, text_message_message);
+  if (!protocol_data->synchronized) {
+    return -ENOTCONN;
+  }
+
+  if (protocol_data->trace) {
+    protocol_data->trace_send_time = mumble_stats_get_time();
+  }
+
+  /*
+   * The server rejects messages over the text length limit unless they contain images, which
+   * only need to stay under the image length limit. Messages with images can't be split without
+   * breaking them, so they are sent whole.
+   */
+  const gchar *contents = purple_message_get_contents(message);
+  MumbleServerConfig *config = &protocol_data->server_config;
+  gsize max_length = config->message_length;
+  if (strstr(contents, "<img") && (!config->image_message_length || (mumble_html_get_length(contents) <= config->image_message_length))) {
+    max_length = 0;
+  }
+
+  guint channel_id = mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id);
+  gchar **pieces = mumble_html_split(contents, max_length);
+  for (gchar **piece = pieces; *piece; piece++) {
+    GByteArray *text_message_message = g_byte_array_new();
+    encode_protobuf_unsigned_varint(text_message_message, 3, channel_id);
+    encode_protobuf_string(text_message_message, 5, *piece);
+    write_mumble_message(protocol_data, MUMBLE_TEXT_MESSAGE, text_message_message);
+  }
+  g_strfreev(pieces);
+  protocol_data->trace_send_time = 0;
 
   purple_serv_got_chat_in(connection, purple_chat_conversation_get_id(protocol_data->active_chat), protocol_data->user_name, purple_message_get_flags(message), purple_message_get_contents(message), time(NULL));
 
@@ -294,6 +659,25 @@ static PurpleRoomlist *mumble_protocol_roomlist_interface_get_list(PurpleConnect
 
   purple_roomlist_set_fields(roomlist, fields);
 
+  /*
+   * Long descriptions are fetched first, so the list fills in once they have arrived.
+   */
+  GList *channels = mumble_channel_tree_get_channels_in_topological_order(protocol_data->tree);
+  for (GList *node = channels; node; node = node->next) {
+    fetch_channel_description(connection, node->data);
+  }
+  g_list_free(channels);
+
+  purple_roomlist_set_in_progress(roomlist, TRUE);
+  wait_for_blobs(connection, fill_roomlist, g_object_ref(roomlist));
+
+  return roomlist;
+}
+
+static void fill_roomlist(PurpleConnection *connection, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+  PurpleRoomlist *roomlist = data;
+
   /*
    * Mumble has a hierarchy of channels, so link the rooms to a tree structure.
    */
@@ -314,7 +698,7 @@ static PurpleRoomlist *mumble_protocol_roomlist_interface_get_list(PurpleConnect
     PurpleRoomlistRoom *room = purple_roomlist_room_new(type, channel->name, parent_room);
 
     purple_roomlist_room_add_field(roomlist, room, channel->name);
-    purple_roomlist_room_add_field(roomlist, room, channel->description);
+    purple_roomlist_room_add_field(roomlist, room, channel->description ? channel->description : "");
     purple_roomlist_room_add_field(roomlist, room, GINT_TO_POINTER(channel->id));
 
     purple_roomlist_room_add(roomlist, room);
@@ -327,33 +711,218 @@ static PurpleRoomlist *mumble_protocol_roomlist_interface_get_list(PurpleConnect
   g_hash_table_destroy(channel_id_to_room);
   g_list_free(channels);
 
-  return roomlist;
+  purple_roomlist_set_in_progress(roomlist, FALSE);
+  g_object_unref(roomlist);
+}
+
+static void start_connection(PurpleConnection *connection) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+  PurpleAccount *account = purple_connection_get_account(connection);
+
+  GError *error = NULL;
+  GSocketClient *client = purple_gio_socket_client_new(account, &error);
+  if (!client) {
+    purple_connection_take_error(connection, error);
+    return;
+  }
+  /*
+   * The TLS backends of GIO keep a session cache of their own, so reconnects resume the previous
+   * session without help.
+   */
+  g_socket_client_set_tls(client, TRUE);
+  g_socket_client_set_tls_validation_flags(client, 0);
+
+  gint port = purple_account_get_int(account, "port", 64738);
+
+  protocol_data->cancellable = g_cancellable_new();
+
+  g_socket_client_connect_to_host_async(client, protocol_data->server, port, protocol_data->cancellable, on_connected, connection);
+
+  g_object_unref(client);
+}
+
+static void close_connection(MumbleProtocolData *protocol_data) {
+  g_cancellable_cancel(protocol_data->cancellable);
+  g_clear_object(&protocol_data->cancellable);
+
+  g_clear_pointer(&protocol_data->broadcast, mumble_voice_broadcast_free);
+  g_clear_pointer(&protocol_data->network_thread, mumble_network_thread_free);
+  g_clear_pointer(&protocol_data->udp_transport, mumble_udp_transport_free);
+
+  discard_blob_requests(protocol_data);
+
+  /*
+   * Sessions are only valid for the connection that they were assigned on.
+   */
+  if (protocol_data->voice_receiver) {
+    mumble_voice_receiver_reset(protocol_data->voice_receiver);
+  }
+  mumble_talk_tracker_reset(protocol_data->talk_tracker);
+  g_hash_table_remove_all(protocol_data->avatars);
+
+  if (protocol_data->connection) {
+    purple_gio_graceful_close(G_IO_STREAM(protocol_data->connection), G_INPUT_STREAM(protocol_data->input_stream), G_OUTPUT_STREAM(protocol_data->output_stream));
+  }
+
+  /*
+   * Cancelled writes complete after the connection is gone, possibly after the account too.
+   */
+  if (protocol_data->output_stream) {
+    mumble_output_stream_set_trace(protocol_data->output_stream, NULL);
+  }
+
+  g_clear_object(&protocol_data->input_stream);
+  g_clear_object(&protocol_data->output_stream);
+  g_clear_object(&protocol_data->connection);
+}
+
+/*
+ * When an established connection drops, a new one is made in the background while the
+ * conversation stays open. The tree of the lost connection is kept as a baseline until the new
+ * connection has synchronized, so that only the differences need to reach the UI.
+ */
+static void handle_connection_error(PurpleConnection *connection, GError *error) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+  PurpleAccount *account = purple_connection_get_account(connection);
+
+  gboolean has_session = protocol_data->synchronized || protocol_data->baseline_tree;
+  if (!has_session || !purple_account_get_bool(account, "reconnect", TRUE) || (protocol_data->reconnect_attempts >= MAX_RECONNECT_ATTEMPTS)) {
+    purple_connection_take_error(connection, error);
+    return;
+  }
+
+  purple_debug_info("mumble", "Connection lost (%s), reconnecting", error->message);
+  g_error_free(error);
+
+  close_connection(protocol_data);
+
+  if (protocol_data->chat_user_flush_source) {
+    g_source_remove(protocol_data->chat_user_flush_source);
+    flush_chat_user_changes(connection);
+  }
+
+  if (!protocol_data->baseline_tree) {
+    protocol_data->baseline_tree = protocol_data->tree;
+    protocol_data->previous_channel_id = mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id);
+  } else if (protocol_data->tree != protocol_data->baseline_tree) {
+    mumble_channel_tree_free(protocol_data->tree);
+  }
+  protocol_data->tree = protocol_data->baseline_tree;
+  protocol_data->synchronized = FALSE;
+
+  guint delay = MIN(MAX_RECONNECT_DELAY, INITIAL_RECONNECT_DELAY << protocol_data->reconnect_attempts);
+  delay = g_random_int_range(delay / 2, delay + 1);
+  protocol_data->reconnect_attempts++;
+
+  protocol_data->reconnect_source = g_timeout_add(delay, reconnect, connection);
+}
+
+static gboolean reconnect(gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  protocol_data->reconnect_source = 0;
+  start_connection(connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Called when the new connection has synchronized after a reconnect. The user is moved back to
+ * the channel they were on and the conversation is patched with the users that came and went
+ * while the connection was down.
+ */
+static void resume_session(PurpleConnection *connection) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  MumbleChannel *channel = mumble_channel_tree_get_channel(protocol_data->tree, protocol_data->previous_channel_id);
+  if (channel) {
+    if (channel->id != mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id)) {
+      move_to_channel(protocol_data, channel->id);
+    }
+    if (protocol_data->active_chat) {
+      reconcile_active_chat_users(connection, protocol_data->baseline_tree, protocol_data->previous_channel_id, channel->id);
+    }
+  } else if (protocol_data->active_chat) {
+    channel = mumble_channel_tree_get_channel(protocol_data->tree, mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id));
+    if (channel) {
+      join_channel(connection, channel);
+    }
+  }
+
+  mumble_channel_tree_free(protocol_data->baseline_tree);
+  protocol_data->baseline_tree = NULL;
+  protocol_data->reconnect_attempts = 0;
+}
+
+static void reconcile_active_chat_users(PurpleConnection *connection, MumbleChannelTree *baseline_tree, guint baseline_channel_id, guint channel_id) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  GHashTable *names = g_hash_table_new(g_str_hash, g_str_equal);
+
+  GList *current_names = mumble_channel_tree_get_channel_user_names(protocol_data->tree, channel_id);
+  for (GList *node = current_names; node; node = node->next) {
+    g_hash_table_add(names, node->data);
+  }
+
+  GList *baseline_names = mumble_channel_tree_get_channel_user_names(baseline_tree, baseline_channel_id);
+  for (GList *node = baseline_names; node; node = node->next) {
+    if (!g_hash_table_remove(names, node->data)) {
+      queue_chat_user_removal(connection, node->data);
+    }
+  }
+
+  for (GList *node = current_names; node; node = node->next) {
+    if (g_hash_table_contains(names, node->data)) {
+      queue_chat_user_addition(connection, node->data);
+    }
+  }
+
+  g_list_free(baseline_names);
+  g_list_free(current_names);
+  g_hash_table_destroy(names);
 }
 
 static void on_connected(GObject *source, GAsyncResult *result, gpointer data) {
+  GError *error = NULL;
+  GSocketConnection *socket_connection = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), result, &error);
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
+    return;
+  }
+
   PurpleConnection *purple_connection = data;
   MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(purple_connection);
 
-  GError *error = NULL;
-  protocol_data->connection = g_socket_client_connect_to_host_finish(G_SOCKET_CLIENT(source), result, &error);
   if (error) {
-    purple_connection_take_error(purple_connection, error);
+    handle_connection_error(purple_connection, error);
     return;
   }
 
-  register_cmd(protocol_data, "join", "w", "join &lt;channel name&gt;:  Join a channel", handle_join_cmd);
-  register_cmd(protocol_data, "join-id", "w", "join-id &lt;channel ID&gt;:  Join a channel", handle_join_cmd);
-  register_cmd(protocol_data, "channels", "", "channels:  List channels", handle_channels_cmd);
+  protocol_data->connection = socket_connection;
 
   protocol_data->tree = mumble_channel_tree_new();
   protocol_data->session_id = -1;
+  protocol_data->synchronized = FALSE;
+  protocol_data->ping_timestamp = 0;
+
+  memset(&protocol_data->server_config, 0, sizeof(MumbleServerConfig));
+  protocol_data->server_config.allow_html           = TRUE;
+  protocol_data->server_config.recording_allowed    = TRUE;
+  protocol_data->server_config.message_length       = DEFAULT_MESSAGE_LENGTH;
+  protocol_data->server_config.image_message_length = DEFAULT_IMAGE_MESSAGE_LENGTH;
 
   protocol_data->output_stream = mumble_output_stream_new(g_io_stream_get_output_stream(G_IO_STREAM(protocol_data->connection)));
   protocol_data->input_stream  = mumble_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(protocol_data->connection)));
+  mumble_input_stream_set_stats(protocol_data->input_stream, protocol_data->stats);
+  mumble_input_stream_set_trace(protocol_data->input_stream, protocol_data->trace);
+  mumble_output_stream_set_trace(protocol_data->output_stream, protocol_data->trace);
 
-  protocol_data->cancellable = g_cancellable_new();
-
-  mumble_input_stream_read_message_async(protocol_data->input_stream, protocol_data->cancellable, on_read, purple_connection);
+  if (purple_account_get_bool(purple_connection_get_account(purple_connection), "network-thread", FALSE)) {
+    protocol_data->network_thread = mumble_network_thread_new(protocol_data->input_stream, protocol_data->output_stream, handle_message, on_network_thread_error, purple_connection);
+  } else {
+    mumble_input_stream_read_message_async(protocol_data->input_stream, protocol_data->cancellable, on_read, purple_connection);
+  }
 
   GByteArray *version_message = g_byte_array_new();
   encode_protobuf_unsigned_varint(version_message, 1, 0x010213);
@@ -366,47 +935,184 @@ static void on_connected(GObject *source, GAsyncResult *result, gpointer data) {
   encode_protobuf_string(authenticate_message, 1, protocol_data->user_name);
   write_mumble_message(protocol_data, MUMBLE_AUTHENTICATE, authenticate_message);
 
-  write_mumble_message(protocol_data, MUMBLE_PING, g_byte_array_new());
-
-  purple_connection_set_state(purple_connection, PURPLE_CONNECTION_CONNECTED);
+  send_ping(protocol_data);
 }
 
 static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
-  PurpleConnection *connection = data;
-  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
-
-  if (!protocol_data) {
+  GError *error = NULL;
+  MumbleMessage *message = mumble_input_stream_read_message_finish((MumbleInputStream *) source, result, &error);
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
     return;
   }
 
-  GError *error = NULL;
-  MumbleMessage *message = mumble_input_stream_read_message_finish(protocol_data->input_stream, result, &error);
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
   if (error) {
-    purple_connection_take_error(connection, error);
+    handle_connection_error(connection, error);
     return;
   }
 
+  handle_message(message, connection);
+
+  mumble_input_stream_read_message_async(protocol_data->input_stream, protocol_data->cancellable, on_read, connection);
+}
+
+static void on_network_thread_error(GError *error, gpointer data) {
+  handle_connection_error(data, error);
+}
+
+static void handle_message(MumbleMessage *message, gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  MumbleStats *stats = protocol_data->stats;
+  MumbleMessageType type = message->type;
+  gint64 start_time = stats->timing ? mumble_stats_get_time() : 0;
+  mumble_trace_span_mark(message->trace_span, MUMBLE_TRACE_HANDLER_START);
+
   switch (message->type) {
-    case MUMBLE_CHANNEL_STATE: {
+    case MUMBLE_UDP_TUNNEL:
+      handle_voice_packet(protocol_data, message->payload->data, message->payload->len);
+      break;
+    case MUMBLE_CRYPT_SETUP:
+      handle_crypt_setup(connection, message->payload);
+      break;
+    case MUMBLE_SERVER_CONFIG: {
       GByteArray *payload = message->payload;
+      MumbleServerConfig *config = &protocol_data->server_config;
 
-      guint64 channel_id = 0;
-      guint64 parent = 0;
-      gchar *name = NULL;
-      gchar *description = NULL;
-      GArray *links_remove = g_array_new(FALSE, FALSE, sizeof(guint64));
       for (guint offset = 0; offset < payload->len;) {
         guint field_number;
         guint wire_type;
         if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
           break;
         }
+        guint64 value = 0;
         switch (field_number) {
           case 1:
-            decode_protobuf_unsigned_varint(payload, &offset, &channel_id);
-            break;
-          case 2:
-            decode_protobuf_unsigned_varint(payload, &offset, &parent);
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->max_bandwidth = value;
+            break;
+          case 3:
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->allow_html = (value != 0);
+            break;
+          case 4:
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->message_length = value;
+            break;
+          case 5:
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->image_message_length = value;
+            break;
+          case 6:
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->max_users = value;
+            break;
+          case 7:
+            decode_protobuf_unsigned_varint(payload, &offset, &value);
+            config->recording_allowed = (value != 0);
+            break;
+          default:
+            skip_protobuf_value(payload, &offset, wire_type);
+            break;
+        }
+      }
+
+      purple_debug_info("mumble", "Server config: message length %u, image message length %u, HTML %s", config->message_length, config->image_message_length, config->allow_html ? "allowed" : "not allowed");
+      break;
+    }
+    case MUMBLE_PING: {
+      GByteArray *payload = message->payload;
+
+      guint64 timestamp = 0;
+      for (guint offset = 0; offset < payload->len;) {
+        guint field_number;
+        guint wire_type;
+        if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
+          break;
+        }
+        switch (field_number) {
+          case 1:
+            decode_protobuf_unsigned_varint(payload, &offset, &timestamp);
+            break;
+          default:
+            skip_protobuf_value(payload, &offset, wire_type);
+            break;
+        }
+      }
+
+      handle_ping_reply(protocol_data, timestamp);
+      break;
+    }
+    case MUMBLE_SERVER_SYNC: {
+      GByteArray *payload = message->payload;
+
+      guint64 session = 0;
+      for (guint offset = 0; offset < payload->len;) {
+        guint field_number;
+        guint wire_type;
+        if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
+          break;
+        }
+        switch (field_number) {
+          case 1:
+            decode_protobuf_unsigned_varint(payload, &offset, &session);
+            break;
+          default:
+            skip_protobuf_value(payload, &offset, wire_type);
+            break;
+        }
+      }
+
+      /*
+       * All channels and users have been received, so the tree is complete and the UI can be
+       * brought up to date in one go by joining the channel that the server placed us on.
+       */
+      protocol_data->session_id = session;
+      protocol_data->synchronized = TRUE;
+
+      if (protocol_data->baseline_tree) {
+        resume_session(connection);
+        break;
+      }
+
+      purple_connection_set_state(connection, PURPLE_CONNECTION_CONNECTED);
+
+      MumbleChannel *channel = mumble_channel_tree_get_channel(protocol_data->tree, mumble_channel_tree_get_user_channel_id(protocol_data->tree, session));
+      if (channel) {
+        join_channel(connection, channel);
+      }
+      break;
+    }
+    case MUMBLE_CHANNEL_STATE: {
+      GByteArray *payload = message->payload;
+
+      guint64 channel_id = 0;
+      guint64 parent = 0;
+      gchar *name = NULL;
+      gchar *description = NULL;
+      GByteArray *description_hash = NULL;
+      gboolean has_position = FALSE;
+      guint64 position = 0;
+      gboolean has_links = FALSE;
+      GArray *links = g_array_new(FALSE, FALSE, sizeof(guint64));
+      GArray *links_add = g_array_new(FALSE, FALSE, sizeof(guint64));
+      GArray *links_remove = g_array_new(FALSE, FALSE, sizeof(guint64));
+      for (guint offset = 0; offset < payload->len;) {
+        guint field_number;
+        guint wire_type;
+        if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
+          break;
+        }
+        switch (field_number) {
+          case 1:
+            decode_protobuf_unsigned_varint(payload, &offset, &channel_id);
+            break;
+          case 2:
+            decode_protobuf_unsigned_varint(payload, &offset, &parent);
             break;
           case 3:
             decode_protobuf_string(payload, &offset, &name);
@@ -414,9 +1120,23 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
           case 5:
             decode_protobuf_string(payload, &offset, &description);
             break;
+          case 4:
+            has_links = TRUE;
+            remember_protobuf_unsigned_varint(payload, &offset, links);
+            break;
+          case 6:
+            remember_protobuf_unsigned_varint(payload, &offset, links_add);
+            break;
           case 7:
             remember_protobuf_unsigned_varint(payload, &offset, links_remove);
             break;
+          case 9:
+            has_position = decode_protobuf_unsigned_varint(payload, &offset, &position);
+            break;
+          case 10:
+            g_clear_pointer(&description_hash, g_byte_array_unref);
+            decode_protobuf_bytes(payload, &offset, &description_hash);
+            break;
           default:
             skip_protobuf_value(payload, &offset, wire_type);
             break;
@@ -426,25 +1146,61 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
       MumbleChannel *channel = mumble_channel_tree_get_channel(protocol_data->tree, channel_id);
       if (channel) {
         if (name) {
-          mumble_channel_set_name(channel, name);
+          mumble_channel_tree_set_channel_name(protocol_data->tree, channel_id, name);
         }
-        for (int index = 0; index < links_remove->len; index++) {
-          mumble_channel_tree_remove_subtree(protocol_data->tree, g_array_index(links_remove, guint64, index));
+        if (has_position) {
+          mumble_channel_tree_set_channel_position(protocol_data->tree, channel_id, (gint32) position);
         }
       } else {
-        channel = mumble_channel_new(channel_id, name, description);
-        mumble_channel_tree_add_channel(protocol_data->tree, channel, parent);
+        /*
+         * Servers send the state of a parent before its children, so a channel whose parent is
+         * unknown has nowhere to go and is dropped.
+         */
+        channel = mumble_channel_new(channel_id, name, NULL);
+        channel->position = (gint32) position;
+        if (!mumble_channel_tree_add_channel(protocol_data->tree, channel, parent)) {
+          purple_debug_warning("mumble", "Dropped channel %u with unknown parent %u", (guint) channel_id, (guint) parent);
+          mumble_channel_free(channel);
+          channel = NULL;
+        }
+      }
+
+      if (channel) {
+        set_channel_description(connection, channel, description, description_hash);
+
+        /*
+         * The full list of links comes with the first state of a channel. Later states carry only
+         * the links that were added or removed.
+         */
+        if (has_links) {
+          guint *linked_ids = g_new(guint, links->len);
+          for (guint index = 0; index < links->len; index++) {
+            linked_ids[index] = g_array_index(links, guint64, index);
+          }
+          mumble_channel_tree_set_links(protocol_data->tree, channel_id, linked_ids, links->len);
+          g_free(linked_ids);
+        }
+        for (guint index = 0; index < links_add->len; index++) {
+          mumble_channel_tree_link(protocol_data->tree, channel_id, g_array_index(links_add, guint64, index));
+        }
+        for (guint index = 0; index < links_remove->len; index++) {
+          mumble_channel_tree_unlink(protocol_data->tree, channel_id, g_array_index(links_remove, guint64, index));
+        }
+      } else if (description_hash) {
+        g_byte_array_unref(description_hash);
       }
 
       g_free(name);
       g_free(description);
+      g_array_free(links, TRUE);
+      g_array_free(links_add, TRUE);
       g_array_free(links_remove, TRUE);
       break;
     }
-    case MUMBLE_USER_REMOVE: {
+    case MUMBLE_CHANNEL_REMOVE: {
       GByteArray *payload = message->payload;
 
-      guint64 session = 0;
+      guint64 channel_id = 0;
       for (guint offset = 0; offset < payload->len;) {
         guint field_number;
         guint wire_type;
@@ -453,7 +1209,7 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
         }
         switch (field_number) {
           case 1:
-            decode_protobuf_unsigned_varint(payload, &offset, &session);
+            decode_protobuf_unsigned_varint(payload, &offset, &channel_id);
             break;
           default:
             skip_protobuf_value(payload, &offset, wire_type);
@@ -461,24 +1217,13 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
         }
       }
 
-      MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, session);
-      if (user) {
-        if (protocol_data->active_chat) {
-          if (user->channel_id == mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id)) {
-            purple_chat_conversation_remove_user(protocol_data->active_chat, user->name, NULL);
-          }
-        }
-        mumble_channel_tree_remove_user(protocol_data->tree, user->session_id);
-      }
+      remove_channel(connection, channel_id);
       break;
     }
-    case MUMBLE_USER_STATE: {
+    case MUMBLE_USER_REMOVE: {
       GByteArray *payload = message->payload;
 
       guint64 session = 0;
-      gboolean has_channel_id = FALSE;
-      guint64 channel_id = 0;
-      gchar *name = NULL;
       for (guint offset = 0; offset < payload->len;) {
         guint field_number;
         guint wire_type;
@@ -489,13 +1234,6 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
           case 1:
             decode_protobuf_unsigned_varint(payload, &offset, &session);
             break;
-          case 3:
-            decode_protobuf_string(payload, &offset, &name);
-            break;
-          case 5:
-            decode_protobuf_unsigned_varint(payload, &offset, &channel_id);
-            has_channel_id = TRUE;
-            break;
           default:
             skip_protobuf_value(payload, &offset, wire_type);
             break;
@@ -504,45 +1242,81 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
 
       MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, session);
       if (user) {
-        if (has_channel_id && (channel_id != user->channel_id)) {
-          if (session == protocol_data->session_id) {
-            join_channel(connection, mumble_channel_tree_get_channel(protocol_data->tree, channel_id));
+        if (protocol_data->synchronized && protocol_data->active_chat) {
+          if (user->channel_id == mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id)) {
+            queue_chat_user_removal(connection, user->name);
+          }
+        }
+        mumble_talk_tracker_remove(protocol_data->talk_tracker, user->session_id);
+        g_hash_table_remove(protocol_data->avatars, GUINT_TO_POINTER(user->session_id));
+        mumble_channel_tree_remove_user(protocol_data->tree, user->session_id);
+      }
+      break;
+    }
+    case MUMBLE_USER_STATE: {
+      MumbleUserUpdate update;
+      mumble_user_update_read(&update, message->payload);
+
+      MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, update.session_id);
+      guint changed;
+      if (user) {
+        /*
+         * Moves are handled before merging, since joining a channel compares with the channel
+         * that we are in.
+         */
+        if ((update.fields & MUMBLE_USER_FIELD_CHANNEL_ID) && (update.channel_id != user->channel_id)) {
+          if (update.session_id == protocol_data->session_id) {
+            join_channel(connection, mumble_channel_tree_get_channel(protocol_data->tree, update.channel_id));
           } else {
-            if (protocol_data->active_chat) {
+            if (protocol_data->synchronized && protocol_data->active_chat) {
               guint active_channel_id = mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id);
               if (user->channel_id == active_channel_id) {
-                purple_chat_conversation_remove_user(protocol_data->active_chat, user->name, NULL);
-              } else if (channel_id == active_channel_id) {
-                purple_chat_conversation_add_user(protocol_data->active_chat, user->name, NULL, 0, FALSE);
+                queue_chat_user_removal(connection, user->name);
+              } else if (update.channel_id == active_channel_id) {
+                queue_chat_user_addition(connection, user->name);
               }
             }
           }
-          
-          user->channel_id = channel_id;
+          mumble_channel_tree_set_user_channel_id(protocol_data->tree, user->session_id, update.channel_id);
+        }
+        changed = mumble_user_merge(user, &update);
+        if (changed & MUMBLE_USER_FIELD_NAME) {
+          mumble_channel_tree_update_user_name(protocol_data->tree, user->session_id);
         }
       } else {
-        user = mumble_user_new(session, name, channel_id);
+        user = mumble_user_new(update.session_id, NULL, 0);
+        changed = mumble_user_merge(user, &update);
         mumble_channel_tree_add_user(protocol_data->tree, user);
 
-        if (!g_strcmp0(protocol_data->user_name, user->name)) {
-          protocol_data->session_id = user->session_id;
-        }
+        apply_user_volume(purple_connection_get_account(connection), protocol_data, user);
 
-        if (protocol_data->active_chat) {
+        if (protocol_data->synchronized && protocol_data->active_chat) {
           if (user->channel_id == mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id)) {
-            purple_chat_conversation_add_user(protocol_data->active_chat, user->name, NULL, 0, FALSE);
+            queue_chat_user_addition(connection, user->name);
           }
         }
       }
 
-      g_free(name);
+      if (update.fields & MUMBLE_USER_FIELD_COMMENT) {
+        if ((user->flags & MUMBLE_USER_HAS_COMMENT_HASH) && user->comment) {
+          cache_blob_text(protocol_data, user->comment);
+        }
+        complete_blob_request(connection, &protocol_data->comment_requests, user->session_id);
+      }
+      update_user_texture(connection, user, &update, changed);
       break;
     }
     case MUMBLE_TEXT_MESSAGE: {
       GByteArray *payload = message->payload;
 
+      /*
+       * Messages can carry megabytes of base64 images. The text is scanned straight from the
+       * payload and the images are decoded into the image store, leaving only references in the
+       * text that is passed on.
+       */
       guint64 actor_value = 0;
-      gchar *text_message = NULL;
+      gboolean has_actor = FALSE;
+      MumbleInlineImageScanner *scanner = mumble_inline_image_scanner_new(MAX_INLINE_IMAGE_SIZE, store_inline_image, NULL);
       for (guint offset = 0; offset < payload->len;) {
         guint field_number;
         guint wire_type;
@@ -551,19 +1325,39 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
         }
         switch (field_number) {
           case 1:
-            decode_protobuf_unsigned_varint(payload, &offset, &actor_value);
+            has_actor = decode_protobuf_unsigned_varint(payload, &offset, &actor_value);
             break;
-          case 5:
-            decode_protobuf_string(payload, &offset, &text_message);
+          case 5: {
+            const guint8 *text;
+            gsize length;
+            if (decode_protobuf_bytes_view(payload, &offset, &text, &length)) {
+              mumble_inline_image_scanner_feed(scanner, (const gchar *) text, length);
+            }
             break;
+          }
           default:
             skip_protobuf_value(payload, &offset, wire_type);
             break;
         }
       }
-
-      MumbleUser *actor = mumble_channel_tree_get_user(protocol_data->tree, actor_value);
-      purple_serv_got_chat_in(connection, purple_chat_conversation_get_id(protocol_data->active_chat), actor->name, PURPLE_MESSAGE_RECV, text_message, time(NULL));
+      gchar *text_message = mumble_inline_image_scanner_finish(scanner);
+      mumble_inline_image_scanner_free(scanner);
+
+      /*
+       * Messages from the server itself have no actor, and the actor may have left before the
+       * message arrived, so those are shown without a sender.
+       */
+      MumbleUser *actor = has_actor ? mumble_channel_tree_get_user(protocol_data->tree, actor_value) : NULL;
+      if (protocol_data->active_chat) {
+        if (actor) {
+          purple_serv_got_chat_in(connection, purple_chat_conversation_get_id(protocol_data->active_chat), actor->name, PURPLE_MESSAGE_RECV, text_message, time(NULL));
+        } else {
+          purple_conversation_write_system_message(PURPLE_CONVERSATION(protocol_data->active_chat), text_message, 0);
+        }
+        mumble_trace_span_mark(message->trace_span, MUMBLE_TRACE_DELIVERED);
+      } else {
+        purple_debug_info("mumble", "Dropped a text message received outside of any channel");
+      }
 
       g_free(text_message);
       break;
@@ -578,21 +1372,145 @@ static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
     }
   }
 
+  if (message->trace_span) {
+    mumble_trace_span_mark(message->trace_span, MUMBLE_TRACE_HANDLER_END);
+    mumble_trace_record(protocol_data->trace, message->trace_span);
+  }
   mumble_message_free(message);
 
-  mumble_input_stream_read_message_async(protocol_data->input_stream, protocol_data->cancellable, on_read, connection);
+  if (start_time) {
+    mumble_stats_add_handler_time(stats, type, mumble_stats_get_time() - start_time);
+  }
+}
+
+/*
+ * CryptSetup with all three fields starts the UDP channel with new key material, a server nonce
+ * alone answers a resync request, and an empty message asks for our encrypt nonce.
+ */
+static void handle_crypt_setup(PurpleConnection *connection, GByteArray *payload) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  GByteArray *key = NULL;
+  GByteArray *client_nonce = NULL;
+  GByteArray *server_nonce = NULL;
+  for (guint offset = 0; offset < payload->len;) {
+    guint field_number;
+    guint wire_type;
+    if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
+      break;
+    }
+    switch (field_number) {
+      case 1:
+        g_clear_pointer(&key, g_byte_array_unref);
+        decode_protobuf_bytes(payload, &offset, &key);
+        break;
+      case 2:
+        g_clear_pointer(&client_nonce, g_byte_array_unref);
+        decode_protobuf_bytes(payload, &offset, &client_nonce);
+        break;
+      case 3:
+        g_clear_pointer(&server_nonce, g_byte_array_unref);
+        decode_protobuf_bytes(payload, &offset, &server_nonce);
+        break;
+      default:
+        skip_protobuf_value(payload, &offset, wire_type);
+        break;
+    }
+  }
+
+  gboolean has_key = key && (key->len == MUMBLE_CRYPT_STATE_KEY_SIZE);
+  gboolean has_client_nonce = client_nonce && (client_nonce->len == MUMBLE_AES_BLOCK_SIZE);
+  gboolean has_server_nonce = server_nonce && (server_nonce->len == MUMBLE_AES_BLOCK_SIZE);
+
+  if (has_key && has_client_nonce && has_server_nonce) {
+    g_clear_pointer(&protocol_data->udp_transport, mumble_udp_transport_free);
+
+    if (purple_account_get_bool(purple_connection_get_account(connection), "udp", TRUE)) {
+      GError *error = NULL;
+      GSocketAddress *address = g_socket_connection_get_remote_address(protocol_data->connection, &error);
+      if (address) {
+        protocol_data->udp_transport = mumble_udp_transport_new(address, key->data, client_nonce->data, server_nonce->data, on_udp_packet, connection, &error);
+        g_object_unref(address);
+      }
+      if (!protocol_data->udp_transport) {
+        purple_debug_warning("mumble", "UDP disabled: %s", error->message);
+        g_error_free(error);
+      }
+    }
+  } else if (has_server_nonce) {
+    if (protocol_data->udp_transport) {
+      mumble_udp_transport_resync(protocol_data->udp_transport, server_nonce->data);
+    }
+  } else if (!key && !client_nonce && !server_nonce && protocol_data->udp_transport) {
+    MumbleCryptState *crypt_state = mumble_udp_transport_get_crypt_state(protocol_data->udp_transport);
+    GByteArray *reply = g_byte_array_new();
+    encode_protobuf_bytes(reply, 2, crypt_state->encrypt_iv, MUMBLE_AES_BLOCK_SIZE);
+    write_mumble_message(protocol_data, MUMBLE_CRYPT_SETUP, reply);
+  }
+
+  g_clear_pointer(&key, g_byte_array_unref);
+  g_clear_pointer(&client_nonce, g_byte_array_unref);
+  g_clear_pointer(&server_nonce, g_byte_array_unref);
+}
+
+/*
+ * Voice from the server arrives the same way over UDP and through UDPTunnel.
+ */
+static void handle_voice_packet(MumbleProtocolData *protocol_data, const guint8 *data, gsize length) {
+  MumbleVoicePacket packet;
+  if (!mumble_voice_packet_read(&packet, data, length, TRUE)) {
+    purple_debug_warning("mumble", "Ignoring malformed voice packet");
+    return;
+  }
+
+  mumble_talk_tracker_update(protocol_data->talk_tracker, packet.session, packet.sequence, packet.terminator);
+
+  if (protocol_data->voice_receiver) {
+    mumble_voice_receiver_push(protocol_data->voice_receiver, &packet);
+  }
+
+  /*
+   * Servers can forbid recording.
+   */
+  if (protocol_data->voice_recorder && protocol_data->server_config.recording_allowed) {
+    MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, packet.session);
+    if (user) {
+      mumble_voice_recorder_record(protocol_data->voice_recorder, user->channel_id, &packet);
+    }
+  }
+}
+
+static void on_udp_packet(const guint8 *packet, gsize length, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(data);
+  handle_voice_packet(protocol_data, packet, length);
+}
+
+/*
+ * Voice goes over UDP while pings show that it gets through, and through the TCP connection
+ * otherwise.
+ */
+static void send_voice_packet(MumbleProtocolData *protocol_data, GByteArray *packet) {
+  if (protocol_data->udp_transport && mumble_udp_transport_is_reachable(protocol_data->udp_transport)) {
+    if (mumble_udp_transport_send(protocol_data->udp_transport, packet->data, packet->len)) {
+      g_byte_array_unref(packet);
+      return;
+    }
+  }
+  write_mumble_message(protocol_data, MUMBLE_UDP_TUNNEL, packet);
 }
 
 static PurpleCmdRet handle_join_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
   MumbleChannel *channel;
   if (!g_strcmp0(cmd, "join")) {
-    channel = mumble_channel_tree_get_channel_by_name(protocol_data->tree, args[0]);
+    channel = find_channel(protocol_data, args[0], error);
   } else {
     channel = get_mumble_channel_by_id_string(protocol_data->tree, args[0]);
   }
 
   if (!channel) {
-    *error = g_strdup("No such channel");
+    if (!*error) {
+      *error = g_strdup("No such channel");
+    }
     return PURPLE_CMD_RET_FAILED;
   }
 
@@ -601,7 +1519,112 @@ static PurpleCmdRet handle_join_cmd(PurpleConversation *conversation, gchar *cmd
   return PURPLE_CMD_RET_OK;
 }
 
+/*
+ * Resolves a channel name typed by the user. An exact name wins, then a name that is the only one
+ * with the given start, and then the clearly best fuzzy match. Otherwise the error lists the
+ * candidates.
+ */
+static MumbleChannel *find_channel(MumbleProtocolData *protocol_data, gchar *name, gchar **error) {
+  MumbleChannelTree *tree = protocol_data->tree;
+
+  MumbleChannel *channel = mumble_channel_tree_get_channel_by_name(tree, name);
+  if (channel || !name || !*name) {
+    return channel;
+  }
+
+  GArray *matches = mumble_name_index_find_prefix(tree->names, MUMBLE_NAME_CHANNEL, name, MAX_JOIN_CANDIDATES);
+  if (!matches->len) {
+    g_array_free(matches, TRUE);
+    matches = mumble_name_index_find_fuzzy(tree->names, MUMBLE_NAME_CHANNEL, name, MAX_JOIN_CANDIDATES, FUZZY_SEARCH_BUDGET, NULL);
+    if ((matches->len > 1) && (g_array_index(matches, MumbleNameMatch, 0).score > g_array_index(matches, MumbleNameMatch, 1).score)) {
+      g_array_set_size(matches, 1);
+    }
+  }
+
+  if (matches->len == 1) {
+    channel = mumble_channel_tree_get_channel(tree, g_array_index(matches, MumbleNameMatch, 0).id);
+  } else if (matches->len > 1) {
+    GString *names = g_string_new(NULL);
+    for (guint index = 0; index < matches->len; index++) {
+      g_string_append_with_delimiter(names, g_strdup(g_array_index(matches, MumbleNameMatch, index).name), ", ");
+    }
+    *error = g_strdup_printf("%s matches several channels: %s", name, names->str);
+    g_string_free(names, TRUE);
+  }
+
+  g_array_free(matches, TRUE);
+  return channel;
+}
+
+static PurpleCmdRet handle_find_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  MumbleChannelTree *tree = protocol_data->tree;
+
+  /*
+   * Names that start with the text come first, in order, and fuzzy matches fill the rest.
+   */
+  GArray *matches = mumble_name_index_find_prefix(tree->names, MUMBLE_NAME_CHANNEL | MUMBLE_NAME_USER, args[0], MAX_FIND_RESULTS);
+  gboolean complete = TRUE;
+  if (matches->len < MAX_FIND_RESULTS) {
+    GArray *fuzzy_matches = mumble_name_index_find_fuzzy(tree->names, MUMBLE_NAME_CHANNEL | MUMBLE_NAME_USER, args[0], MAX_FIND_RESULTS, FUZZY_SEARCH_BUDGET, &complete);
+    guint prefix_count = matches->len;
+    for (guint index = 0; (index < fuzzy_matches->len) && (matches->len < MAX_FIND_RESULTS); index++) {
+      MumbleNameMatch *match = &g_array_index(fuzzy_matches, MumbleNameMatch, index);
+      gboolean listed = FALSE;
+      for (guint prefix_index = 0; prefix_index < prefix_count; prefix_index++) {
+        MumbleNameMatch *prefix_match = &g_array_index(matches, MumbleNameMatch, prefix_index);
+        listed |= (prefix_match->kind == match->kind) && (prefix_match->id == match->id);
+      }
+      if (!listed) {
+        g_array_append_val(matches, *match);
+      }
+    }
+    g_array_free(fuzzy_matches, TRUE);
+  }
+
+  GString *message = g_string_new(NULL);
+  for (guint index = 0; index < matches->len; index++) {
+    MumbleNameMatch *match = &g_array_index(matches, MumbleNameMatch, index);
+    if (match->kind == MUMBLE_NAME_CHANNEL) {
+      g_string_append_with_delimiter(message, g_strdup_printf("Channel: %s (ID %u)", match->name, match->id), "<br>");
+    } else {
+      MumbleUser *user = mumble_channel_tree_get_user(tree, match->id);
+      MumbleChannel *channel = user ? mumble_channel_tree_get_channel(tree, user->channel_id) : NULL;
+      g_string_append_with_delimiter(message, g_strdup_printf("User: %s (in %s)", match->name, channel ? channel->name : "unknown channel"), "<br>");
+    }
+  }
+  if (!matches->len) {
+    g_string_append(message, "No matches");
+  }
+  if (!complete) {
+    g_string_append_with_delimiter(message, g_strdup("Search stopped early, try a longer text"), "<br>");
+  }
+
+  purple_conversation_write_system_message(conversation, message->str, 0);
+
+  g_string_free(message, TRUE);
+  g_array_free(matches, TRUE);
+
+  return PURPLE_CMD_RET_OK;
+}
+
 static PurpleCmdRet handle_channels_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  PurpleConnection *connection = purple_conversation_get_connection(conversation);
+
+  GList *channels = mumble_channel_tree_get_channels_in_topological_order(protocol_data->tree);
+  for (GList *node = channels; node; node = node->next) {
+    fetch_channel_description(connection, node->data);
+  }
+  g_list_free(channels);
+
+  wait_for_blobs(connection, write_channel_list, g_object_ref(conversation));
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static void write_channel_list(PurpleConnection *connection, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+  PurpleConversation *conversation = data;
+
   GList *channels = mumble_channel_tree_get_channels_in_topological_order(protocol_data->tree);
 
   GString *message = g_string_new(NULL);
@@ -610,37 +1633,402 @@ static PurpleCmdRet handle_channels_cmd(PurpleConversation *conversation, gchar
     int parent_id = mumble_channel_tree_get_parent_id(protocol_data->tree, channel->id);
 
     g_string_append_with_delimiter(message, g_strdup_printf("Name: %s", channel->name), "<br><br>");
-    g_string_append_with_delimiter(message, g_strdup_printf("Description: %s", channel->description), "<br>");
+    g_string_append_with_delimiter(message, g_strdup_printf("Description: %s", channel->description ? channel->description : ""), "<br>");
     g_string_append_with_delimiter(message, g_strdup_printf("ID: %d", channel->id), "<br>");
     if (parent_id >= 0) {
       g_string_append_with_delimiter(message, g_strdup_printf("Parent: %d", parent_id), "<br>");
     }
+    GArray *links = mumble_channel_tree_get_links(protocol_data->tree, channel->id);
+    if (links) {
+      GString *ids = g_string_new(NULL);
+      for (guint index = 0; index < links->len; index++) {
+        g_string_append_with_delimiter(ids, g_strdup_printf("%u", g_array_index(links, guint, index)), ", ");
+      }
+      g_string_append_with_delimiter(message, g_strdup_printf("Links: %s", ids->str), "<br>");
+      g_string_free(ids, TRUE);
+    }
   }
 
   purple_conversation_write_system_message(conversation, message->str, 0);
 
   g_list_free(channels);
   g_string_free(message, NULL);
-
-  return PURPLE_CMD_RET_OK;
+  g_object_unref(conversation);
 }
 
-static void register_cmd(MumbleProtocolData *protocol_data, gchar *name, gchar *args, gchar *help, PurpleCmdFunc func) {
-  void *id = GINT_TO_POINTER(purple_cmd_register(name, args, PURPLE_CMD_P_PROTOCOL, PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_PROTOCOL_ONLY, PROTOCOL_ID, func, help, protocol_data));
-  protocol_data->registered_cmds = g_list_append(protocol_data->registered_cmds, id);
-}
+static PurpleCmdRet handle_ping_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  MumbleLatencyStats *stats = protocol_data->tcp_ping_stats;
 
-static MumbleChannel *get_mumble_channel_by_id_string(MumbleChannelTree *tree, gchar *id_string) {
-  return mumble_channel_tree_get_channel(tree, g_ascii_strtoull(id_string, NULL, 10));
+  GString *message = g_string_new(NULL);
+  g_string_append_with_delimiter(message, g_strdup_printf("Round-trip time: mean %.1f ms, standard deviation %.1f ms", mumble_latency_stats_get_mean(stats), sqrt(mumble_latency_stats_get_variance(stats))), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Percentiles: 50th %.1f ms, 95th %.1f ms, 99th %.1f ms", mumble_latency_stats_get_percentile(stats, 50), mumble_latency_stats_get_percentile(stats, 95), mumble_latency_stats_get_percentile(stats, 99)), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Replies: %u good, %u late, %u lost", protocol_data->ping_good, protocol_data->ping_late, protocol_data->ping_lost), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Ping interval: %u s", protocol_data->ping_interval), "<br>");
+
+  if (protocol_data->udp_transport) {
+    MumbleLatencyStats *udp_stats = mumble_udp_transport_get_ping_stats(protocol_data->udp_transport);
+    MumbleCryptState *crypt_state = mumble_udp_transport_get_crypt_state(protocol_data->udp_transport);
+    gboolean reachable = mumble_udp_transport_is_reachable(protocol_data->udp_transport);
+    g_string_append_with_delimiter(message, g_strdup_printf("UDP round-trip time: mean %.1f ms, standard deviation %.1f ms", mumble_latency_stats_get_mean(udp_stats), sqrt(mumble_latency_stats_get_variance(udp_stats))), "<br>");
+    g_string_append_with_delimiter(message, g_strdup_printf("UDP packets: %u good, %u late, %u lost, %u resyncs", crypt_state->good, crypt_state->late, crypt_state->lost, crypt_state->resync), "<br>");
+    if (reachable && stats->count && udp_stats->count) {
+      g_string_append_with_delimiter(message, g_strdup_printf("Voice path: UDP, median round-trip time %.1f ms against %.1f ms over TCP", mumble_latency_stats_get_percentile(udp_stats, 50), mumble_latency_stats_get_percentile(stats, 50)), "<br>");
+    } else {
+      g_string_append_with_delimiter(message, g_strdup_printf("Voice path: %s", reachable ? "UDP" : "TCP tunnel, UDP unreachable"), "<br>");
+    }
+  } else {
+    g_string_append_with_delimiter(message, g_strdup("Voice path: TCP tunnel"), "<br>");
+  }
+
+  if (protocol_data->voice_receiver) {
+    MumbleLatencyStats *voice_stats = mumble_voice_receiver_get_latency_stats(protocol_data->voice_receiver);
+    guint lost, late;
+    mumble_voice_receiver_get_loss(protocol_data->voice_receiver, &lost, &late);
+    g_string_append_with_delimiter(message, g_strdup_printf("Voice latency: mean %.1f ms, 95th percentile %.1f ms", mumble_latency_stats_get_mean(voice_stats), mumble_latency_stats_get_percentile(voice_stats, 95)), "<br>");
+    g_string_append_with_delimiter(message, g_strdup_printf("Voice frames: %u concealed, %u packets late", lost, late), "<br>");
+  }
+
+  purple_conversation_write_system_message(conversation, message->str, 0);
+
+  g_string_free(message, TRUE);
+
+  return PURPLE_CMD_RET_OK;
 }
 
 /*
- * The user is always on a single channel, so there is a maximum of 1 active conversations at
- * a time. When the user joins a new channel, the conversation that they're leaving becomes
- * inactive.
+ * The counters only cost a few additions per message. The clock is read only when timing is
+ * enabled in the account, and the gauges are sampled here rather than kept up to date.
  */
-static void join_channel(PurpleConnection *connection, MumbleChannel *channel) {
-  static int chat_id_counter = 0;
+static PurpleCmdRet handle_stats_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  MumbleStats *stats = protocol_data->stats;
+  update_stats_gauges(protocol_data);
+
+  if (args[0]) {
+    gchar *json = mumble_stats_to_json(stats);
+    GError *write_error = NULL;
+    gboolean written = g_file_set_contents(args[0], json, -1, &write_error);
+    g_free(json);
+
+    if (!written) {
+      *error = g_strdup_printf("Can't save stats: %s", write_error->message);
+      g_error_free(write_error);
+      return PURPLE_CMD_RET_FAILED;
+    }
+
+    gchar *message = g_strdup_printf("Stats saved to %s", args[0]);
+    purple_conversation_write_system_message(conversation, message, 0);
+    g_free(message);
+
+    return PURPLE_CMD_RET_OK;
+  }
+
+  MumbleMessageTypeStats total;
+  mumble_stats_get_total(stats, &total);
+
+  GString *message = g_string_new(NULL);
+  g_string_append_with_delimiter(message, g_strdup_printf("Total: %" G_GUINT64_FORMAT " in (%" G_GUINT64_FORMAT " bytes), %" G_GUINT64_FORMAT " out (%" G_GUINT64_FORMAT " bytes)", total.frames_in, total.bytes_in, total.frames_out, total.bytes_out), "<br>");
+  for (guint type = 0; type < MUMBLE_STATS_TYPE_COUNT; type++) {
+    MumbleMessageTypeStats type_stats;
+    mumble_stats_get_type_stats(stats, type, &type_stats);
+    if (!type_stats.frames_in && !type_stats.frames_out) {
+      continue;
+    }
+    GString *line = g_string_new(NULL);
+    g_string_printf(line, "%s: %" G_GUINT64_FORMAT " in (%" G_GUINT64_FORMAT " bytes), %" G_GUINT64_FORMAT " out (%" G_GUINT64_FORMAT " bytes)", mumble_stats_get_type_name(type), type_stats.frames_in, type_stats.bytes_in, type_stats.frames_out, type_stats.bytes_out);
+    if (stats->timing && type_stats.frames_in) {
+      g_string_append_printf(line, ", decoding %.1f µs, handling %.1f µs on average, %.1f µs at most", type_stats.decode_time / 1000.0 / type_stats.frames_in, type_stats.handler_time / 1000.0 / type_stats.frames_in, type_stats.max_handler_time / 1000.0);
+    }
+    g_string_append_with_delimiter(message, g_string_free(line, FALSE), "<br>");
+  }
+  if (!stats->timing) {
+    g_string_append_with_delimiter(message, g_strdup("Handling times: not measured, see the account options"), "<br>");
+  }
+  g_string_append_with_delimiter(message, g_strdup_printf("Send queue: %u messages", stats->send_queue_length), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Largest frame received: %" G_GUINT64_FORMAT " bytes", mumble_stats_get_largest_frame_in(stats)), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Tree: %u channels, %u with links, %u users, %u names", stats->channel_count, stats->linked_channel_count, stats->user_count, stats->name_count), "<br>");
+  g_string_append_with_delimiter(message, g_strdup_printf("Messages allocated: %u, %u not freed yet", stats->message_allocations, stats->live_messages), "<br>");
+
+  purple_conversation_write_system_message(conversation, message->str, 0);
+
+  g_string_free(message, TRUE);
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static PurpleCmdRet handle_trace_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  MumbleTrace *trace = protocol_data->trace;
+  if (!trace) {
+    *error = g_strdup("Tracing is off, turn on \"Trace message latency\" in the account options and reconnect");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  if (args[0]) {
+    gchar *json = mumble_trace_to_chrome_json(trace);
+    GError *write_error = NULL;
+    gboolean written = g_file_set_contents(args[0], json, -1, &write_error);
+    g_free(json);
+
+    if (!written) {
+      *error = g_strdup_printf("Can't save trace: %s", write_error->message);
+      g_error_free(write_error);
+      return PURPLE_CMD_RET_FAILED;
+    }
+
+    gchar *message = g_strdup_printf("Trace saved to %s", args[0]);
+    purple_conversation_write_system_message(conversation, message, 0);
+    g_free(message);
+
+    return PURPLE_CMD_RET_OK;
+  }
+
+  GString *message = g_string_new(NULL);
+  for (guint stage = 0; stage < MUMBLE_TRACE_STAGE_COUNT; stage++) {
+    guint count = mumble_trace_get_count(trace, stage);
+    if (!count) {
+      continue;
+    }
+    g_string_append_with_delimiter(message, g_strdup_printf("%s: %u messages, 50th %.1f µs, 99th %.1f µs, at most %.1f µs", mumble_trace_get_stage_name(stage), count,
+      mumble_trace_get_percentile(trace, stage, 50) / 1000.0, mumble_trace_get_percentile(trace, stage, 99) / 1000.0, mumble_trace_get_percentile(trace, stage, 100) / 1000.0), "<br>");
+  }
+  if (!message->len) {
+    g_string_append(message, "No messages traced yet");
+  }
+
+  purple_conversation_write_system_message(conversation, message->str, 0);
+
+  g_string_free(message, TRUE);
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static void update_stats_gauges(MumbleProtocolData *protocol_data) {
+  MumbleStats *stats = protocol_data->stats;
+
+  stats->send_queue_length = 0;
+  if (protocol_data->network_thread) {
+    stats->send_queue_length += mumble_network_thread_get_write_queue_length(protocol_data->network_thread);
+  }
+  if (protocol_data->output_stream) {
+    stats->send_queue_length += mumble_output_stream_get_pending_count(protocol_data->output_stream);
+  }
+
+  MumbleChannelTree *tree = protocol_data->tree;
+  if (tree) {
+    stats->channel_count        = g_hash_table_size(tree->id_to_channel);
+    stats->user_count           = g_hash_table_size(tree->id_to_user);
+    stats->linked_channel_count = g_hash_table_size(tree->links);
+    stats->name_count           = mumble_name_index_get_size(tree->names);
+  }
+
+  mumble_message_get_allocation_counts(&stats->message_allocations, &stats->live_messages);
+}
+
+/*
+ * Volumes are stored in the account by user name, so that they survive reconnects and restarts
+ * even though sessions don't.
+ */
+static PurpleCmdRet handle_volume_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  gchar *end;
+  guint64 percent = g_ascii_strtoull(args[1], &end, 10);
+  if ((end == args[1]) || *end || (percent > 400)) {
+    *error = g_strdup("Volume must be between 0 and 400 percent");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  MumbleUser *user = mumble_channel_tree_get_user_by_name(protocol_data->tree, args[0]);
+  if (!user) {
+    *error = g_strdup("No such user");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  PurpleAccount *account = purple_connection_get_account(purple_conversation_get_connection(conversation));
+  gchar *setting_name = get_volume_setting_name(user->name);
+  purple_account_set_int(account, setting_name, percent);
+  g_free(setting_name);
+
+  apply_user_volume(account, protocol_data, user);
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static void apply_user_volume(PurpleAccount *account, MumbleProtocolData *protocol_data, MumbleUser *user) {
+  if (!protocol_data->voice_receiver) {
+    return;
+  }
+
+  gchar *setting_name = get_volume_setting_name(user->name);
+  int percent = purple_account_get_int(account, setting_name, 100);
+  g_free(setting_name);
+
+  mumble_voice_receiver_set_gain(protocol_data->voice_receiver, user->session_id, percent / 100.0f);
+}
+
+static gchar *get_volume_setting_name(gchar *user_name) {
+  return g_strdup_printf("volume-%s", user_name);
+}
+
+static PurpleCmdRet handle_play_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  if (!protocol_data->synchronized) {
+    *error = g_strdup("Not connected");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  if (protocol_data->broadcast) {
+    mumble_voice_broadcast_stop(protocol_data->broadcast);
+  }
+  protocol_data->broadcast = mumble_voice_broadcast_new(args[0], on_broadcast_send, on_broadcast_done, purple_conversation_get_connection(conversation));
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static PurpleCmdRet handle_stop_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  if (!protocol_data->broadcast) {
+    *error = g_strdup("Not playing");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  mumble_voice_broadcast_stop(protocol_data->broadcast);
+
+  return PURPLE_CMD_RET_OK;
+}
+
+static void on_broadcast_send(GByteArray *packet, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(data);
+  send_voice_packet(protocol_data, packet);
+}
+
+static void on_broadcast_done(GError *error, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(data);
+  MumbleVoiceBroadcast *broadcast = protocol_data->broadcast;
+
+  if (protocol_data->active_chat) {
+    gchar *message;
+    if (error) {
+      message = g_strdup_printf("Playing failed: %s", error->message);
+    } else {
+      MumbleLatencyStats *pacing_stats = mumble_voice_broadcast_get_pacing_stats(broadcast);
+      MumbleLatencyStats *lag_stats = mumble_voice_broadcast_get_lag_stats(broadcast);
+      message = g_strdup_printf("Played %u packets<br>Pacing jitter: mean %.1f ms, 99th percentile %.1f ms<br>Send queue lag: mean %.1f ms, maximum %.1f ms",
+          mumble_voice_broadcast_get_packet_count(broadcast),
+          mumble_latency_stats_get_mean(pacing_stats), mumble_latency_stats_get_percentile(pacing_stats, 99),
+          mumble_latency_stats_get_mean(lag_stats), mumble_latency_stats_get_percentile(lag_stats, 100));
+    }
+    purple_conversation_write_system_message(PURPLE_CONVERSATION(protocol_data->active_chat), message, 0);
+    g_free(message);
+  }
+
+  g_clear_pointer(&protocol_data->broadcast, mumble_voice_broadcast_free);
+}
+
+static PurpleCmdRet handle_probe_cmd(PurpleConversation *conversation, gchar *cmd, gchar **args, gchar **error, MumbleProtocolData *protocol_data) {
+  GError *socket_error = NULL;
+  MumbleServerProber *prober = mumble_server_prober_new(PROBE_PINGS, PROBE_INTERVAL, on_probe_done, purple_conversation_get_connection(conversation), &socket_error);
+  if (!prober) {
+    *error = g_strdup(socket_error->message);
+    g_error_free(socket_error);
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  gchar **servers = g_strsplit_set(args[0], " \t", -1);
+  for (gchar **server = servers; *server; server++) {
+    if (!**server) {
+      continue;
+    }
+    GError *parse_error = NULL;
+    GSocketConnectable *address = g_network_address_parse(*server, 64738, &parse_error);
+    if (!address) {
+      *error = g_strdup_printf("%s: %s", *server, parse_error->message);
+      g_error_free(parse_error);
+      g_strfreev(servers);
+      mumble_server_prober_free(prober);
+      return PURPLE_CMD_RET_FAILED;
+    }
+    mumble_server_prober_add(prober, g_network_address_get_hostname(G_NETWORK_ADDRESS(address)), g_network_address_get_port(G_NETWORK_ADDRESS(address)));
+    g_object_unref(address);
+  }
+  g_strfreev(servers);
+
+  if (!mumble_server_prober_get_probes(prober)->len) {
+    mumble_server_prober_free(prober);
+    *error = g_strdup("No servers given");
+    return PURPLE_CMD_RET_FAILED;
+  }
+
+  if (protocol_data->server_prober) {
+    mumble_server_prober_free(protocol_data->server_prober);
+  }
+  protocol_data->server_prober = prober;
+  mumble_server_prober_start(prober);
+
+  purple_conversation_write_system_message(conversation, "Probing...", 0);
+
+  return PURPLE_CMD_RET_OK;
+}
+
+/*
+ * Results are listed from the closest server to the farthest, with unreachable servers last.
+ */
+static void on_probe_done(MumbleServerProber *prober, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(data);
+  GPtrArray *all_probes = mumble_server_prober_get_probes(prober);
+
+  GPtrArray *probes = g_ptr_array_sized_new(all_probes->len);
+  for (guint index = 0; index < all_probes->len; index++) {
+    g_ptr_array_add(probes, g_ptr_array_index(all_probes, index));
+  }
+  g_ptr_array_sort(probes, compare_server_probes);
+
+  GString *message = g_string_new(NULL);
+  for (guint index = 0; index < probes->len; index++) {
+    MumbleServerProbe *probe = g_ptr_array_index(probes, index);
+    if (probe->error) {
+      g_string_append_with_delimiter(message, g_strdup_printf("%s:%u: %s", probe->host, probe->port, probe->error), "<br>");
+    } else if (!probe->received) {
+      g_string_append_with_delimiter(message, g_strdup_printf("%s:%u: no reply", probe->host, probe->port), "<br>");
+    } else {
+      g_string_append_with_delimiter(message, g_strdup_printf("%s:%u: %.1f ms (variation %.1f ms), %u/%u replies, %u/%u users, %u kbit/s, version %u.%u.%u",
+          probe->host, probe->port, probe->smoothed_rtt, probe->rtt_variation, probe->received, probe->sent, probe->users, probe->max_users,
+          probe->bandwidth / 1000, (probe->version >> 16) & 0xFF, (probe->version >> 8) & 0xFF, probe->version & 0xFF), "<br>");
+    }
+  }
+  g_ptr_array_free(probes, TRUE);
+
+  if (protocol_data->active_chat) {
+    purple_conversation_write_system_message(PURPLE_CONVERSATION(protocol_data->active_chat), message->str, 0);
+  } else {
+    purple_debug_info("mumble", "Probe results: %s", message->str);
+  }
+  g_string_free(message, TRUE);
+
+  g_clear_pointer(&protocol_data->server_prober, mumble_server_prober_free);
+}
+
+static gint compare_server_probes(gconstpointer a, gconstpointer b) {
+  const MumbleServerProbe *probe_a = *(const MumbleServerProbe **) a;
+  const MumbleServerProbe *probe_b = *(const MumbleServerProbe **) b;
+
+  if (!probe_a->received || !probe_b->received) {
+    return (probe_a->received == 0) - (probe_b->received == 0);
+  }
+  return (probe_a->smoothed_rtt > probe_b->smoothed_rtt) - (probe_a->smoothed_rtt < probe_b->smoothed_rtt);
+}
+
+static void register_cmd(MumbleProtocolData *protocol_data, gchar *name, gchar *args, gchar *help, PurpleCmdFunc func) {
+  void *id = GINT_TO_POINTER(purple_cmd_register(name, args, PURPLE_CMD_P_PROTOCOL, PURPLE_CMD_FLAG_IM | PURPLE_CMD_FLAG_CHAT | PURPLE_CMD_FLAG_PROTOCOL_ONLY, PROTOCOL_ID, func, help, protocol_data));
+  protocol_data->registered_cmds = g_list_append(protocol_data->registered_cmds, id);
+}
+
+static MumbleChannel *get_mumble_channel_by_id_string(MumbleChannelTree *tree, gchar *id_string) {
+  return mumble_channel_tree_get_channel(tree, g_ascii_strtoull(id_string, NULL, 10));
+}
+
+/*
+ * The user is always on a single channel, so there is a maximum of 1 active conversations at
+ * a time. When the user joins a new channel, the conversation that they're leaving becomes
+ * inactive.
+ */
+static void join_channel(PurpleConnection *connection, MumbleChannel *channel) {
+  static int chat_id_counter = 0;
 
   MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
 
@@ -649,12 +2037,7 @@ static void join_channel(PurpleConnection *connection, MumbleChannel *channel) {
 
   if (!(already_joined && has_active_chat)) {
     if (!already_joined) {
-      mumble_channel_tree_set_user_channel_id(protocol_data->tree, protocol_data->session_id, channel->id);
-
-      GByteArray *user_state_message = g_byte_array_new();
-      encode_protobuf_unsigned_varint(user_state_message, 1, protocol_data->session_id);
-      encode_protobuf_unsigned_varint(user_state_message, 5, channel->id);
-      write_mumble_message(protocol_data, MUMBLE_USER_STATE, user_state_message);
+      move_to_channel(protocol_data, channel->id);
     }
 
     if (has_active_chat) {
@@ -662,13 +2045,148 @@ static void join_channel(PurpleConnection *connection, MumbleChannel *channel) {
       purple_serv_got_chat_left(connection, purple_chat_conversation_get_id(protocol_data->active_chat));
     }
 
+    discard_chat_user_changes(protocol_data);
+
     protocol_data->active_chat = purple_serv_got_joined_chat(connection, chat_id_counter++, channel->name);
 
-    GList *names = mumble_channel_tree_get_channel_user_names(protocol_data->tree, channel->id);
-    GList *flags = g_list_append_times(NULL, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE), g_list_length(names));
-    purple_chat_conversation_add_users(protocol_data->active_chat, names, NULL, flags, FALSE);
-    g_list_free(names);
+    add_channel_users_to_active_chat(protocol_data, channel->id);
+  }
+}
+
+/*
+ * The server moves the users out of a channel before it removes the channel, but their states may
+ * still be on the way. Any users left are moved to the parent like the server does, and the chat
+ * gets them in one batch.
+ */
+static void remove_channel(PurpleConnection *connection, guint channel_id) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!channel_id || !mumble_channel_tree_get_channel(protocol_data->tree, channel_id)) {
+    return;
+  }
+  guint parent_id = mumble_channel_tree_get_parent_id(protocol_data->tree, channel_id);
+
+  GArray *removed_ids = g_array_new(FALSE, FALSE, sizeof(guint));
+  GList *moved_users = mumble_channel_tree_remove_subtree(protocol_data->tree, channel_id, removed_ids);
+
+  for (guint index = 0; index < removed_ids->len; index++) {
+    complete_blob_request(connection, &protocol_data->description_requests, g_array_index(removed_ids, guint, index));
   }
+
+  gboolean moved_self = FALSE;
+  for (GList *node = moved_users; node; node = node->next) {
+    moved_self |= ((MumbleUser *) node->data)->session_id == protocol_data->session_id;
+  }
+
+  if (moved_self) {
+    if (protocol_data->active_chat) {
+      purple_serv_got_chat_left(connection, purple_chat_conversation_get_id(protocol_data->active_chat));
+      protocol_data->active_chat = NULL;
+    }
+    join_channel(connection, mumble_channel_tree_get_channel(protocol_data->tree, parent_id));
+  } else if (protocol_data->synchronized && protocol_data->active_chat) {
+    if (parent_id == mumble_channel_tree_get_user_channel_id(protocol_data->tree, protocol_data->session_id)) {
+      for (GList *node = moved_users; node; node = node->next) {
+        queue_chat_user_addition(connection, ((MumbleUser *) node->data)->name);
+      }
+    }
+  }
+
+  g_list_free(moved_users);
+  g_array_free(removed_ids, TRUE);
+}
+
+static void move_to_channel(MumbleProtocolData *protocol_data, guint channel_id) {
+  mumble_channel_tree_set_user_channel_id(protocol_data->tree, protocol_data->session_id, channel_id);
+
+  GByteArray *user_state_message = g_byte_array_new();
+  encode_protobuf_unsigned_varint(user_state_message, 1, protocol_data->session_id);
+  encode_protobuf_unsigned_varint(user_state_message, 5, channel_id);
+  write_mumble_message(protocol_data, MUMBLE_USER_STATE, user_state_message);
+}
+
+static void add_channel_users_to_active_chat(MumbleProtocolData *protocol_data, guint channel_id) {
+  GList *names = mumble_channel_tree_get_channel_user_names(protocol_data->tree, channel_id);
+  GList *flags = g_list_append_times(NULL, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE), g_list_length(names));
+  purple_chat_conversation_add_users(protocol_data->active_chat, names, NULL, flags, FALSE);
+  g_list_free(flags);
+  g_list_free(names);
+}
+
+/*
+ * Membership changes of the active chat are collected and applied in batches, so that a storm of
+ * joins and leaves results in a single UI update. A user that joins and leaves again before the
+ * batch is flushed cancels out and never reaches the UI.
+ */
+static void queue_chat_user_addition(PurpleConnection *connection, gchar *name) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!g_hash_table_remove(protocol_data->pending_chat_user_removals, name)) {
+    g_hash_table_add(protocol_data->pending_chat_user_additions, g_strdup(name));
+  }
+
+  schedule_chat_user_flush(connection);
+}
+
+static void queue_chat_user_removal(PurpleConnection *connection, gchar *name) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!g_hash_table_remove(protocol_data->pending_chat_user_additions, name)) {
+    g_hash_table_add(protocol_data->pending_chat_user_removals, g_strdup(name));
+  }
+
+  schedule_chat_user_flush(connection);
+}
+
+static void schedule_chat_user_flush(PurpleConnection *connection) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!protocol_data->chat_user_flush_source) {
+    gint delay = purple_account_get_int(purple_connection_get_account(connection), "chat-update-delay", 0);
+    if (delay > 0) {
+      protocol_data->chat_user_flush_source = g_timeout_add(delay, flush_chat_user_changes, connection);
+    } else {
+      protocol_data->chat_user_flush_source = g_idle_add(flush_chat_user_changes, connection);
+    }
+  }
+}
+
+static gboolean flush_chat_user_changes(gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  protocol_data->chat_user_flush_source = 0;
+
+  if (protocol_data->active_chat) {
+    GList *removed_names = g_hash_table_get_keys(protocol_data->pending_chat_user_removals);
+    if (removed_names) {
+      purple_chat_conversation_remove_users(protocol_data->active_chat, removed_names, NULL);
+    }
+    g_list_free(removed_names);
+
+    GList *added_names = g_hash_table_get_keys(protocol_data->pending_chat_user_additions);
+    if (added_names) {
+      GList *flags = g_list_append_times(NULL, GINT_TO_POINTER(PURPLE_CHAT_USER_NONE), g_list_length(added_names));
+      purple_chat_conversation_add_users(protocol_data->active_chat, added_names, NULL, flags, FALSE);
+      g_list_free(flags);
+    }
+    g_list_free(added_names);
+  }
+
+  g_hash_table_remove_all(protocol_data->pending_chat_user_removals);
+  g_hash_table_remove_all(protocol_data->pending_chat_user_additions);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void discard_chat_user_changes(MumbleProtocolData *protocol_data) {
+  if (protocol_data->chat_user_flush_source) {
+    g_source_remove(protocol_data->chat_user_flush_source);
+    protocol_data->chat_user_flush_source = 0;
+  }
+
+  g_hash_table_remove_all(protocol_data->pending_chat_user_removals);
+  g_hash_table_remove_all(protocol_data->pending_chat_user_additions);
 }
 
 static GList *append_chat_entry(GList *entries, gchar *label, gchar *identifier, gboolean required) {
@@ -682,7 +2200,500 @@ static GList *append_chat_entry(GList *entries, gchar *label, gchar *identifier,
   return g_list_append(entries, entry);
 }
 
+/*
+ * Pings carry a monotonic timestamp in microseconds that the server echoes back. Only one ping is
+ * outstanding at a time: if it hasn't been answered when the next one is sent, it's counted as
+ * lost, and if the answer arrives after all, it's counted as late instead.
+ */
+static void send_ping(MumbleProtocolData *protocol_data) {
+  MumbleLatencyStats *stats = protocol_data->tcp_ping_stats;
+
+  /*
+   * There is no connection while reconnecting, so a ping couldn't be sent or answered and must
+   * not count as lost.
+   */
+  if (!protocol_data->output_stream) {
+    return;
+  }
+
+  if (protocol_data->ping_timestamp) {
+    protocol_data->ping_lost++;
+    protocol_data->ping_interval = MIN_PING_INTERVAL;
+  }
+
+  protocol_data->last_ping_time = g_get_monotonic_time();
+  protocol_data->ping_timestamp = protocol_data->last_ping_time;
+
+  GByteArray *ping_message = g_byte_array_new();
+  encode_protobuf_unsigned_varint(ping_message, 1, protocol_data->ping_timestamp);
+  if (protocol_data->udp_transport) {
+    MumbleCryptState *crypt_state = mumble_udp_transport_get_crypt_state(protocol_data->udp_transport);
+    MumbleLatencyStats *udp_stats = mumble_udp_transport_get_ping_stats(protocol_data->udp_transport);
+    encode_protobuf_unsigned_varint(ping_message, 2, crypt_state->good);
+    encode_protobuf_unsigned_varint(ping_message, 3, crypt_state->late);
+    encode_protobuf_unsigned_varint(ping_message, 4, crypt_state->lost);
+    encode_protobuf_unsigned_varint(ping_message, 5, crypt_state->resync);
+    if (udp_stats->count) {
+      encode_protobuf_unsigned_varint(ping_message, 6, udp_stats->count);
+      encode_protobuf_float(ping_message, 8, mumble_latency_stats_get_mean(udp_stats));
+      encode_protobuf_float(ping_message, 9, mumble_latency_stats_get_variance(udp_stats));
+    }
+  } else {
+    encode_protobuf_unsigned_varint(ping_message, 2, protocol_data->ping_good);
+    encode_protobuf_unsigned_varint(ping_message, 3, protocol_data->ping_late);
+    encode_protobuf_unsigned_varint(ping_message, 4, protocol_data->ping_lost);
+  }
+  if (stats->count) {
+    encode_protobuf_unsigned_varint(ping_message, 7, stats->count);
+    encode_protobuf_float(ping_message, 10, mumble_latency_stats_get_mean(stats));
+    encode_protobuf_float(ping_message, 11, mumble_latency_stats_get_variance(stats));
+  }
+  write_mumble_message(protocol_data, MUMBLE_PING, ping_message);
+}
+
+/*
+ * The ping interval shrinks to the minimum while pings are lost or round-trip times are erratic,
+ * so that a degrading link is noticed quickly, and grows back while the link is stable.
+ */
+static void handle_ping_reply(MumbleProtocolData *protocol_data, guint64 timestamp) {
+  MumbleLatencyStats *stats = protocol_data->tcp_ping_stats;
+
+  if (!timestamp || ((gint64) timestamp > protocol_data->last_ping_time)) {
+    return;
+  }
+
+  gdouble round_trip_time = (g_get_monotonic_time() - (gint64) timestamp) / 1000.0;
+
+  if (timestamp == protocol_data->ping_timestamp) {
+    protocol_data->ping_good++;
+    protocol_data->ping_timestamp = 0;
+
+    gdouble mean = mumble_latency_stats_get_mean(stats);
+    gdouble deviation = sqrt(mumble_latency_stats_get_variance(stats));
+    if (stats->count && (round_trip_time > mean + 3 * deviation + 1)) {
+      protocol_data->ping_interval = MAX(MIN_PING_INTERVAL, protocol_data->ping_interval / 2);
+    } else {
+      protocol_data->ping_interval = MIN(MAX_PING_INTERVAL, protocol_data->ping_interval + MIN_PING_INTERVAL);
+    }
+  } else {
+    protocol_data->ping_late++;
+    if (protocol_data->ping_lost) {
+      protocol_data->ping_lost--;
+    }
+  }
+
+  mumble_latency_stats_add(stats, round_trip_time);
+
+  purple_debug_misc("mumble", "Ping round-trip time %.1f ms, next ping in %u s", round_trip_time, protocol_data->ping_interval);
+}
+
+static void show_user_info(PurpleConnection *connection, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+  gchar *name = data;
+
+  PurpleNotifyUserInfo *user_info = purple_notify_user_info_new();
+  MumbleUser *user = mumble_channel_tree_get_user_by_name(protocol_data->tree, name);
+  if (user) {
+    /*
+     * The store hands out the same ID for an image as long as it's alive, which is until the avatar
+     * changes or the user leaves.
+     */
+    PurpleImage *avatar = g_hash_table_lookup(protocol_data->avatars, GUINT_TO_POINTER(user->session_id));
+    if (avatar) {
+      gchar *html = g_strdup_printf("<img src=\"" PURPLE_IMAGE_STORE_PROTOCOL "%u\">", purple_image_store_add(avatar));
+      purple_notify_user_info_add_pair_html(user_info, "Avatar", html);
+      g_free(html);
+    }
+
+    MumbleChannel *channel = mumble_channel_tree_get_channel(protocol_data->tree, user->channel_id);
+    if (channel) {
+      purple_notify_user_info_add_pair_plaintext(user_info, "Channel", channel->name);
+    }
+
+    static const struct {
+      MumbleUserFlags flag;
+      const gchar *description;
+    } states[] = {
+      { MUMBLE_USER_MUTE,             "muted" },
+      { MUMBLE_USER_DEAF,             "deafened" },
+      { MUMBLE_USER_SUPPRESS,         "suppressed" },
+      { MUMBLE_USER_SELF_MUTE,        "self-muted" },
+      { MUMBLE_USER_SELF_DEAF,        "self-deafened" },
+      { MUMBLE_USER_PRIORITY_SPEAKER, "priority speaker" },
+      { MUMBLE_USER_RECORDING,        "recording" }
+    };
+    GString *status = g_string_new(NULL);
+    for (guint i = 0; i < G_N_ELEMENTS(states); i++) {
+      if (user->flags & states[i].flag) {
+        g_string_append_with_delimiter(status, g_strdup(states[i].description), ", ");
+      }
+    }
+    if (status->len) {
+      purple_notify_user_info_add_pair_plaintext(user_info, "Status", status->str);
+    }
+    g_string_free(status, TRUE);
+
+    if (user->flags & MUMBLE_USER_REGISTERED) {
+      gchar *user_id = g_strdup_printf("%u", user->user_id);
+      purple_notify_user_info_add_pair_plaintext(user_info, "Registered ID", user_id);
+      g_free(user_id);
+    }
+    if (*user->certificate_hash) {
+      purple_notify_user_info_add_pair_plaintext(user_info, "Certificate", user->certificate_hash);
+    }
+    if (user->comment && *user->comment) {
+      purple_notify_user_info_add_pair_html(user_info, "Comment", user->comment);
+    }
+  }
+  purple_notify_userinfo(connection, name, user_info, NULL, NULL);
+
+  purple_notify_user_info_destroy(user_info);
+  g_free(name);
+}
+
+/*
+ * The server sends a hash in place of a long description and the text only on request, or when
+ * it changes. A new hash makes the text that we have stale.
+ */
+static void set_channel_description(PurpleConnection *connection, MumbleChannel *channel, gchar *description, GByteArray *description_hash) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (description_hash) {
+    GBytes *hash = g_byte_array_free_to_bytes(description_hash);
+    if (!channel->description_hash || !g_bytes_equal(hash, channel->description_hash)) {
+      mumble_channel_set_description_hash(channel, hash);
+      mumble_channel_set_description(channel, NULL);
+    }
+    g_bytes_unref(hash);
+  }
+
+  if (description) {
+    mumble_channel_set_description(channel, description);
+    if (channel->description_hash) {
+      cache_blob_text(protocol_data, description);
+    }
+    complete_blob_request(connection, &protocol_data->description_requests, channel->id);
+  }
+}
+
+/*
+ * Returns TRUE if the description is known, and otherwise requests it.
+ */
+static gboolean fetch_channel_description(PurpleConnection *connection, MumbleChannel *channel) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (channel->description || !channel->description_hash) {
+    return TRUE;
+  }
+
+  gsize hash_length;
+  const guint8 *hash = g_bytes_get_data(channel->description_hash, &hash_length);
+  channel->description = lookup_blob_text(protocol_data, hash, hash_length);
+  if (channel->description) {
+    return TRUE;
+  }
+
+  request_blob(connection, &protocol_data->description_requests, channel->id);
+  return FALSE;
+}
+
+static gboolean fetch_user_comment(PurpleConnection *connection, MumbleUser *user) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (user->comment || !(user->flags & MUMBLE_USER_HAS_COMMENT_HASH)) {
+    return TRUE;
+  }
+
+  user->comment = lookup_blob_text(protocol_data, user->comment_hash, MUMBLE_USER_HASH_SIZE);
+  if (user->comment) {
+    return TRUE;
+  }
+
+  request_blob(connection, &protocol_data->comment_requests, user->session_id);
+  return FALSE;
+}
+
+/*
+ * Avatars are fetched as soon as their hash is known, unless they are cached from an earlier
+ * session, so that they are there when the info of the user is opened.
+ */
+static void update_user_texture(PurpleConnection *connection, MumbleUser *user, const MumbleUserUpdate *update, guint changed) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!(update->fields & MUMBLE_USER_FIELD_TEXTURE)) {
+    if (changed & MUMBLE_USER_FIELD_TEXTURE_HASH) {
+      fetch_user_texture(connection, user);
+    }
+    return;
+  }
+
+  if (update->texture_length) {
+    GBytes *blob = g_bytes_new(update->texture, update->texture_length);
+    mumble_blob_cache_insert(protocol_data->blob_cache, blob);
+    show_user_texture(connection, user, blob);
+    g_bytes_unref(blob);
+  } else {
+    g_hash_table_remove(protocol_data->avatars, GUINT_TO_POINTER(user->session_id));
+    purple_buddy_icons_set_for_user(purple_connection_get_account(connection), user->name, NULL, 0, NULL);
+  }
+  complete_blob_request(connection, &protocol_data->texture_requests, user->session_id);
+}
+
+static void fetch_user_texture(PurpleConnection *connection, MumbleUser *user) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  GBytes *blob = mumble_blob_cache_lookup(protocol_data->blob_cache, user->texture_hash, MUMBLE_USER_HASH_SIZE);
+  if (blob) {
+    show_user_texture(connection, user, blob);
+    g_bytes_unref(blob);
+  } else {
+    request_blob(connection, &protocol_data->texture_requests, user->session_id);
+  }
+}
+
+/*
+ * Decoding is cancelled with the connection, since the session ID is only valid for it.
+ */
+static void show_user_texture(PurpleConnection *connection, MumbleUser *user, GBytes *texture) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  MumbleTextureDecoding *decoding = g_new(MumbleTextureDecoding, 1);
+  decoding->connection = connection;
+  decoding->session_id = user->session_id;
+  decoding->checksum = g_compute_checksum_for_bytes(G_CHECKSUM_SHA1, texture);
+  mumble_texture_decode_async(texture, protocol_data->cancellable, on_texture_decoded, decoding);
+}
+
+static void on_texture_decoded(GObject *source, GAsyncResult *result, gpointer data) {
+  MumbleTextureDecoding *decoding = data;
+
+  GError *error = NULL;
+  GBytes *image = mumble_texture_decode_finish(result, &error);
+  if (image) {
+    MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(decoding->connection);
+    MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, decoding->session_id);
+    if (user) {
+      /*
+       * libpurple only keeps buddy icons for buddies, and chat user lists have no icons of their
+       * own. The avatar is kept for the info dialog, which the chat user list opens for anyone,
+       * and is set as the buddy icon for users who are also buddies.
+       */
+      gsize length;
+      gconstpointer image_data = g_bytes_get_data(image, &length);
+      g_hash_table_insert(protocol_data->avatars, GUINT_TO_POINTER(user->session_id), purple_image_new_from_data(image_data, length));
+      purple_buddy_icons_set_for_user(purple_connection_get_account(decoding->connection), user->name, g_memdup2(image_data, length), length, decoding->checksum);
+    }
+    g_bytes_unref(image);
+  } else {
+    if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+      purple_debug_info("mumble", "Can't show avatar: %s", error->message);
+    }
+    g_error_free(error);
+  }
+
+  g_free(decoding->checksum);
+  g_free(decoding);
+}
+
+static gchar *lookup_blob_text(MumbleProtocolData *protocol_data, const guint8 *hash, gsize hash_length) {
+  GBytes *blob = mumble_blob_cache_lookup(protocol_data->blob_cache, hash, hash_length);
+  if (!blob) {
+    return NULL;
+  }
+
+  gsize length;
+  const gchar *data = g_bytes_get_data(blob, &length);
+  gchar *text = g_strndup(data, length);
+  g_bytes_unref(blob);
+  return text;
+}
+
+static void cache_blob_text(MumbleProtocolData *protocol_data, gchar *text) {
+  GBytes *blob = g_bytes_new(text, strlen(text));
+  mumble_blob_cache_insert(protocol_data->blob_cache, blob);
+  g_bytes_unref(blob);
+}
+
+/*
+ * Requests made during one iteration of the main loop go out together in one RequestBlob.
+ */
+static void request_blob(PurpleConnection *connection, MumbleBlobRequests *requests, guint id) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (g_hash_table_contains(requests->pending, GUINT_TO_POINTER(id))) {
+    return;
+  }
+  g_hash_table_add(requests->pending, GUINT_TO_POINTER(id));
+  g_array_append_val(requests->queued, id);
+
+  if (!protocol_data->blob_request_source) {
+    protocol_data->blob_request_source = g_idle_add(flush_blob_requests, connection);
+  }
+}
+
+static void complete_blob_request(PurpleConnection *connection, MumbleBlobRequests *requests, guint id) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!g_hash_table_remove(requests->pending, GUINT_TO_POINTER(id))) {
+    return;
+  }
+
+  if (!g_hash_table_size(protocol_data->description_requests.pending) && !g_hash_table_size(protocol_data->comment_requests.pending)) {
+    if (protocol_data->blob_timeout_source) {
+      g_source_remove(protocol_data->blob_timeout_source);
+      protocol_data->blob_timeout_source = 0;
+    }
+    run_blob_waiters(protocol_data);
+  }
+}
+
+static gboolean flush_blob_requests(gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  protocol_data->blob_request_source = 0;
+
+  GByteArray *request_blob_message = g_byte_array_new();
+  for (guint i = 0; i < protocol_data->texture_requests.queued->len; i++) {
+    encode_protobuf_unsigned_varint(request_blob_message, 1, g_array_index(protocol_data->texture_requests.queued, guint, i));
+  }
+  for (guint i = 0; i < protocol_data->comment_requests.queued->len; i++) {
+    encode_protobuf_unsigned_varint(request_blob_message, 2, g_array_index(protocol_data->comment_requests.queued, guint, i));
+  }
+  for (guint i = 0; i < protocol_data->description_requests.queued->len; i++) {
+    encode_protobuf_unsigned_varint(request_blob_message, 3, g_array_index(protocol_data->description_requests.queued, guint, i));
+  }
+  g_array_set_size(protocol_data->texture_requests.queued, 0);
+  g_array_set_size(protocol_data->comment_requests.queued, 0);
+  g_array_set_size(protocol_data->description_requests.queued, 0);
+  write_mumble_message(protocol_data, MUMBLE_REQUEST_BLOB, request_blob_message);
+
+  if (protocol_data->blob_timeout_source) {
+    g_source_remove(protocol_data->blob_timeout_source);
+  }
+  protocol_data->blob_timeout_source = g_timeout_add(BLOB_REQUEST_TIMEOUT, on_blob_request_timeout, connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * The server ignores requests for channels and users that are already gone, so the waiters get
+ * what has arrived by the timeout.
+ */
+static gboolean on_blob_request_timeout(gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  protocol_data->blob_timeout_source = 0;
+  discard_blob_requests(protocol_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * Call a function once no blobs are pending, which may be right away.
+ */
+static void wait_for_blobs(PurpleConnection *connection, MumbleBlobWaiterFunc func, gpointer data) {
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  MumbleBlobWaiter *waiter = g_new(MumbleBlobWaiter, 1);
+  waiter->func = func;
+  waiter->connection = connection;
+  waiter->data = data;
+  protocol_data->blob_waiters = g_list_append(protocol_data->blob_waiters, waiter);
+
+  if (!g_hash_table_size(protocol_data->description_requests.pending) && !g_hash_table_size(protocol_data->comment_requests.pending)) {
+    run_blob_waiters(protocol_data);
+  }
+}
+
+static void run_blob_waiters(MumbleProtocolData *protocol_data) {
+  GList *waiters = protocol_data->blob_waiters;
+  protocol_data->blob_waiters = NULL;
+
+  for (GList *node = waiters; node; node = node->next) {
+    MumbleBlobWaiter *waiter = node->data;
+    waiter->func(waiter->connection, waiter->data);
+  }
+
+  g_list_free_full(waiters, g_free);
+}
+
+static void discard_blob_requests(MumbleProtocolData *protocol_data) {
+  if (protocol_data->blob_request_source) {
+    g_source_remove(protocol_data->blob_request_source);
+    protocol_data->blob_request_source = 0;
+  }
+  if (protocol_data->blob_timeout_source) {
+    g_source_remove(protocol_data->blob_timeout_source);
+    protocol_data->blob_timeout_source = 0;
+  }
+
+  g_hash_table_remove_all(protocol_data->description_requests.pending);
+  g_array_set_size(protocol_data->description_requests.queued, 0);
+  g_hash_table_remove_all(protocol_data->comment_requests.pending);
+  g_array_set_size(protocol_data->comment_requests.queued, 0);
+  g_hash_table_remove_all(protocol_data->texture_requests.pending);
+  g_array_set_size(protocol_data->texture_requests.queued, 0);
+
+  run_blob_waiters(protocol_data);
+}
+
+/*
+ * The typing flag is the closest thing to a talking indicator that chat user lists show.
+ */
+static void on_talking_changed(guint session, gboolean talking, gpointer data) {
+  PurpleConnection *connection = data;
+  MumbleProtocolData *protocol_data = purple_connection_get_protocol_data(connection);
+
+  if (!protocol_data->synchronized || !protocol_data->active_chat) {
+    return;
+  }
+
+  MumbleUser *user = mumble_channel_tree_get_user(protocol_data->tree, session);
+  if (!user) {
+    return;
+  }
+
+  PurpleChatUser *chat_user = purple_chat_conversation_find_user(protocol_data->active_chat, user->name);
+  if (!chat_user) {
+    return;
+  }
+
+  PurpleChatUserFlags flags = purple_chat_user_get_flags(chat_user);
+  if (talking) {
+    flags |= PURPLE_CHAT_USER_TYPING;
+  } else {
+    flags &= ~PURPLE_CHAT_USER_TYPING;
+  }
+  purple_chat_user_set_flags(chat_user, flags);
+}
+
+static gchar *store_inline_image(const gchar *mime_type, GByteArray *data, gpointer user_data) {
+  gsize size = data->len;
+  PurpleImage *image = purple_image_new_take_data(g_byte_array_free(data, FALSE), size);
+  guint id = purple_image_store_add_temporary(image);
+  g_object_unref(image);
+  return g_strdup_printf(PURPLE_IMAGE_STORE_PROTOCOL "%u", id);
+}
+
 static void write_mumble_message(MumbleProtocolData *protocol_data, MumbleMessageType type, GByteArray *payload) {
+  if (!protocol_data->output_stream) {
+    g_byte_array_unref(payload);
+    return;
+  }
+
+  mumble_stats_count_out(protocol_data->stats, type, payload->len + 6);
+
   MumbleMessage *message = mumble_message_new(type, payload);
-  mumble_output_stream_write_message_async(protocol_data->output_stream, message, protocol_data->cancellable, NULL, NULL);
+  if (protocol_data->trace) {
+    message->trace_span = mumble_trace_span_new(type);
+    message->trace_span->points[MUMBLE_TRACE_SEND] = protocol_data->trace_send_time;
+    mumble_trace_span_mark(message->trace_span, MUMBLE_TRACE_QUEUED);
+  }
+  if (protocol_data->network_thread) {
+    mumble_network_thread_write_message(protocol_data->network_thread, message);
+  } else {
+    mumble_output_stream_write_message_async(protocol_data->output_stream, message, protocol_data->cancellable, NULL, NULL);
+  }
 }
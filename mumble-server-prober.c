@@ -0,0 +1,308 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "mumble-server-prober.h"
+
+#define REQUEST_SIZE 12
+#define REPLY_SIZE   24
+
+/*
+ * Replies are waited for this many milliseconds after the last ping.
+ */
+#define REPLY_TIMEOUT 1000
+
+struct _MumbleServerProber {
+  GSocket *socket;
+  GSocketFamily family;
+  GSource *receive_source;
+  GCancellable *cancellable;
+  GPtrArray *probes;
+  guint pings;
+  guint interval;
+  guint pending_lookups;
+  gboolean started;
+  guint round;
+  guint timer;
+  MumbleServerProberDoneFunc done_func;
+  gpointer user_data;
+};
+
+typedef struct {
+  MumbleServerProber *prober;
+  MumbleServerProbe *probe;
+} MumbleServerProberLookup;
+
+static void on_resolved(GObject *, GAsyncResult *, gpointer);
+static GSocketAddress *get_socket_address(MumbleServerProber *, GInetAddress *, guint16);
+static void start_rounds(MumbleServerProber *);
+static gboolean on_round(gpointer);
+static gboolean on_timeout(gpointer);
+static void send_ping(MumbleServerProber *, guint);
+static gboolean on_socket_readable(GSocket *, GIOCondition, gpointer);
+static void handle_reply(MumbleServerProber *, const guint8 *);
+static void server_probe_free(MumbleServerProbe *);
+
+void mumble_server_prober_add(MumbleServerProber *prober, const gchar *host, guint16 port) {
+  MumbleServerProbe *probe = g_new0(MumbleServerProbe, 1);
+  probe->host = g_strdup(host);
+  probe->port = port;
+  probe->rtt_stats = mumble_latency_stats_new();
+  g_ptr_array_add(prober->probes, probe);
+
+  MumbleServerProberLookup *lookup = g_new(MumbleServerProberLookup, 1);
+  lookup->prober = prober;
+  lookup->probe = probe;
+
+  prober->pending_lookups++;
+  g_resolver_lookup_by_name_async(g_resolver_get_default(), host, prober->cancellable, on_resolved, lookup);
+}
+
+void mumble_server_prober_start(MumbleServerProber *prober) {
+  prober->started = TRUE;
+  if (!prober->pending_lookups) {
+    start_rounds(prober);
+  }
+}
+
+GPtrArray *mumble_server_prober_get_probes(MumbleServerProber *prober) {
+  return prober->probes;
+}
+
+void mumble_server_prober_free(MumbleServerProber *prober) {
+  g_cancellable_cancel(prober->cancellable);
+  g_object_unref(prober->cancellable);
+
+  if (prober->timer) {
+    g_source_remove(prober->timer);
+  }
+  g_source_destroy(prober->receive_source);
+  g_source_unref(prober->receive_source);
+  g_socket_close(prober->socket, NULL);
+  g_object_unref(prober->socket);
+
+  g_ptr_array_free(prober->probes, TRUE);
+  g_free(prober);
+}
+
+MumbleServerProber *mumble_server_prober_new(guint pings, guint interval, MumbleServerProberDoneFunc done_func, gpointer user_data, GError **error) {
+  GSocketFamily family = G_SOCKET_FAMILY_IPV6;
+  GSocket *socket = g_socket_new(family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+  if (!socket) {
+    family = G_SOCKET_FAMILY_IPV4;
+    socket = g_socket_new(family, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, error);
+    if (!socket) {
+      return NULL;
+    }
+  }
+  g_socket_set_blocking(socket, FALSE);
+
+  MumbleServerProber *prober = g_new0(MumbleServerProber, 1);
+  prober->socket = socket;
+  prober->family = family;
+  prober->cancellable = g_cancellable_new();
+  prober->probes = g_ptr_array_new_with_free_func((GDestroyNotify) server_probe_free);
+  prober->pings = CLAMP(pings, 1, MUMBLE_SERVER_PROBER_MAX_PINGS);
+  prober->interval = interval;
+  prober->done_func = done_func;
+  prober->user_data = user_data;
+
+  prober->receive_source = g_socket_create_source(socket, G_IO_IN, NULL);
+  g_source_set_callback(prober->receive_source, (GSourceFunc) on_socket_readable, prober, NULL);
+  g_source_attach(prober->receive_source, NULL);
+
+  return prober;
+}
+
+static void on_resolved(GObject *source, GAsyncResult *result, gpointer data) {
+  MumbleServerProberLookup *lookup = data;
+  GError *error = NULL;
+  GList *addresses = g_resolver_lookup_by_name_finish(G_RESOLVER(source), result, &error);
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
+    g_free(lookup);
+    return;
+  }
+
+  MumbleServerProber *prober = lookup->prober;
+  MumbleServerProbe *probe = lookup->probe;
+  g_free(lookup);
+
+  if (error) {
+    probe->error = g_strdup(error->message);
+    g_error_free(error);
+  } else {
+    for (GList *node = addresses; node && !probe->address; node = node->next) {
+      probe->address = get_socket_address(prober, node->data, probe->port);
+    }
+    if (!probe->address) {
+      probe->error = g_strdup("No IPv4 address");
+    }
+    g_resolver_free_addresses(addresses);
+  }
+
+  prober->pending_lookups--;
+  if (prober->started && !prober->pending_lookups) {
+    start_rounds(prober);
+  }
+}
+
+/*
+ * An IPv6 socket reaches IPv4 hosts through IPv4-mapped addresses, ::ffff:a.b.c.d.
+ */
+static GSocketAddress *get_socket_address(MumbleServerProber *prober, GInetAddress *address, guint16 port) {
+  GSocketFamily family = g_inet_address_get_family(address);
+  if (family == prober->family) {
+    return g_inet_socket_address_new(address, port);
+  }
+  if (family == G_SOCKET_FAMILY_IPV6) {
+    return NULL;
+  }
+
+  guint8 bytes[16] = { 0 };
+  bytes[10] = 0xFF;
+  bytes[11] = 0xFF;
+  memcpy(bytes + 12, g_inet_address_to_bytes(address), 4);
+  GInetAddress *mapped_address = g_inet_address_new_from_bytes(bytes, G_SOCKET_FAMILY_IPV6);
+  GSocketAddress *socket_address = g_inet_socket_address_new(mapped_address, port);
+  g_object_unref(mapped_address);
+  return socket_address;
+}
+
+static void start_rounds(MumbleServerProber *prober) {
+  if (prober->timer) {
+    return;
+  }
+  on_round(prober);
+  prober->timer = g_timeout_add(prober->interval, on_round, prober);
+}
+
+static gboolean on_round(gpointer data) {
+  MumbleServerProber *prober = data;
+
+  for (guint index = 0; index < prober->probes->len; index++) {
+    send_ping(prober, index);
+  }
+
+  if (++prober->round < prober->pings) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  prober->timer = g_timeout_add(REPLY_TIMEOUT, on_timeout, prober);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean on_timeout(gpointer data) {
+  MumbleServerProber *prober = data;
+  prober->timer = 0;
+  prober->done_func(prober, prober->user_data);
+  return G_SOURCE_REMOVE;
+}
+
+/*
+ * The request is a zero type field followed by the ident, both big-endian. The ident holds the
+ * index of the server in the high half and the number of the ping in the low half.
+ */
+static void send_ping(MumbleServerProber *prober, guint index) {
+  MumbleServerProbe *probe = g_ptr_array_index(prober->probes, index);
+  if (!probe->address) {
+    return;
+  }
+
+  guint8 request[REQUEST_SIZE] = { 0 };
+  guint64 ident = GUINT64_TO_BE(((guint64) index << 32) | probe->sent);
+  memcpy(request + 4, &ident, sizeof(ident));
+
+  probe->send_times[probe->sent++] = g_get_monotonic_time();
+  g_socket_send_to(prober->socket, probe->address, (const gchar *) request, sizeof(request), NULL, NULL);
+}
+
+static gboolean on_socket_readable(GSocket *socket, GIOCondition condition, gpointer data) {
+  MumbleServerProber *prober = data;
+  guint8 reply[REPLY_SIZE + 1];
+
+  while (TRUE) {
+    GError *error = NULL;
+    gssize length = g_socket_receive(socket, (gchar *) reply, sizeof(reply), NULL, &error);
+    if (length < 0) {
+      gboolean would_block = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+      g_error_free(error);
+      if (would_block) {
+        break;
+      }
+      continue;
+    }
+    if (length == REPLY_SIZE) {
+      handle_reply(prober, reply);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * The reply is the version, the ident echoed back, the number of users, the user limit and the
+ * bandwidth, all big-endian.
+ */
+static void handle_reply(MumbleServerProber *prober, const guint8 *reply) {
+  guint32 fields[4];
+  guint64 ident;
+  memcpy(&fields[0], reply, 4);
+  memcpy(&ident, reply + 4, 8);
+  memcpy(&fields[1], reply + 12, 12);
+  ident = GUINT64_FROM_BE(ident);
+
+  guint index = ident >> 32;
+  guint sequence = ident & G_MAXUINT32;
+  if (index >= prober->probes->len) {
+    return;
+  }
+  MumbleServerProbe *probe = g_ptr_array_index(prober->probes, index);
+  if ((sequence >= probe->sent) || !probe->send_times[sequence]) {
+    return;
+  }
+
+  gdouble rtt = (g_get_monotonic_time() - probe->send_times[sequence]) / 1000.0;
+  probe->send_times[sequence] = 0;
+
+  if (!probe->received) {
+    probe->smoothed_rtt = rtt;
+    probe->rtt_variation = rtt / 2;
+  } else {
+    probe->rtt_variation = 0.75 * probe->rtt_variation + 0.25 * fabs(probe->smoothed_rtt - rtt);
+    probe->smoothed_rtt = 0.875 * probe->smoothed_rtt + 0.125 * rtt;
+  }
+  probe->received++;
+  mumble_latency_stats_add(probe->rtt_stats, rtt);
+
+  probe->version   = GUINT32_FROM_BE(fields[0]);
+  probe->users     = GUINT32_FROM_BE(fields[1]);
+  probe->max_users = GUINT32_FROM_BE(fields[2]);
+  probe->bandwidth = GUINT32_FROM_BE(fields[3]);
+}
+
+static void server_probe_free(MumbleServerProbe *probe) {
+  g_free(probe->host);
+  g_free(probe->error);
+  g_clear_object(&probe->address);
+  mumble_latency_stats_free(probe->rtt_stats);
+  g_free(probe);
+}
@@ -0,0 +1,132 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_SERVER_PROBER_H
+#define MUMBLE_SERVER_PROBER_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "mumble-latency-stats.h"
+
+/**
+ * SECTION:mumbleserverprober
+ * @short_description: Server pings without logging in
+ *
+ * Measures the round-trip time to any number of servers in parallel with
+ * Mumble's unauthenticated UDP ping, whose reply also tells the server
+ * version, the number of users, the user limit and the allowed bandwidth.
+ * All servers are pinged from a single non-blocking socket, and replies are
+ * matched to servers by the 64-bit ident that the server echoes back.
+ *
+ * The socket is an IPv6 socket that reaches IPv4 servers through mapped
+ * addresses, or an IPv4 socket on hosts without IPv6.
+ */
+
+#define MUMBLE_SERVER_PROBER_MAX_PINGS 32
+
+typedef struct _MumbleServerProber MumbleServerProber;
+
+/**
+ * MumbleServerProbe:
+ * @host:          Host name of the server
+ * @port:          UDP port of the server
+ * @error:         (nullable): Why the server couldn't be pinged
+ * @version:       Server version as 0x00MMmmpp, or 0 if it never answered
+ * @users:         Number of connected users
+ * @max_users:     User limit
+ * @bandwidth:     Maximum voice bandwidth per user in bits per second
+ * @sent:          Number of pings sent
+ * @received:      Number of replies received
+ * @smoothed_rtt:  Smoothed round-trip time in milliseconds
+ * @rtt_variation: Smoothed variation of the round-trip time in milliseconds
+ * @rtt_stats:     Round-trip times of all replies
+ *
+ * The round-trip time is smoothed the way TCP does it (RFC 6298).
+ */
+typedef struct _MumbleServerProbe {
+  gchar *host;
+  guint16 port;
+  gchar *error;
+  GSocketAddress *address;
+  guint32 version;
+  guint32 users;
+  guint32 max_users;
+  guint32 bandwidth;
+  guint sent;
+  guint received;
+  gdouble smoothed_rtt;
+  gdouble rtt_variation;
+  MumbleLatencyStats *rtt_stats;
+  gint64 send_times[MUMBLE_SERVER_PROBER_MAX_PINGS];
+} MumbleServerProbe;
+
+/**
+ * MumbleServerProberDoneFunc:
+ * @prober:    The #MumbleServerProber
+ * @user_data: User data passed to mumble_server_prober_new()
+ *
+ * Called once all pings have been answered or timed out. The prober may be
+ * freed in the callback.
+ */
+typedef void (*MumbleServerProberDoneFunc)(MumbleServerProber *prober, gpointer user_data);
+
+/**
+ * mumble_server_prober_add:
+ * @prober: A #MumbleServerProber
+ * @host:   Host name or address of a server
+ * @port:   UDP port of the server
+ *
+ * Add a server to ping. The name is resolved asynchronously.
+ */
+void mumble_server_prober_add(MumbleServerProber *prober, const gchar *host, guint16 port);
+
+/**
+ * mumble_server_prober_start:
+ * @prober: A #MumbleServerProber
+ *
+ * Start pinging once all added servers have been resolved.
+ */
+void mumble_server_prober_start(MumbleServerProber *prober);
+
+/**
+ * mumble_server_prober_get_probes:
+ * @prober: A #MumbleServerProber
+ *
+ * Returns: (transfer none) (element-type MumbleServerProbe): The servers in
+ * the order they were added
+ */
+GPtrArray *mumble_server_prober_get_probes(MumbleServerProber *prober);
+
+void mumble_server_prober_free(MumbleServerProber *prober);
+
+/**
+ * mumble_server_prober_new:
+ * @pings:     Number of pings to send to each server, at most
+ *             %MUMBLE_SERVER_PROBER_MAX_PINGS
+ * @interval:  Interval between pings in milliseconds
+ * @done_func: Function to call when probing has finished
+ * @user_data: User data for @done_func
+ * @error:     Return location for a #GError
+ *
+ * Returns: A new #MumbleServerProber, or %NULL if no socket could be opened
+ */
+MumbleServerProber *mumble_server_prober_new(guint pings, guint interval, MumbleServerProberDoneFunc done_func, gpointer user_data, GError **error);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include <time.h>
+#include "mumble-stats.h"
+
+static const gchar *type_names[MUMBLE_STATS_TYPE_COUNT] = {
+  "Version",
+  "UDPTunnel",
+  "Authenticate",
+  "Ping",
+  "Reject",
+  "ServerSync",
+  "ChannelRemove",
+  "ChannelState",
+  "UserRemove",
+  "UserState",
+  "BanList",
+  "TextMessage",
+  "PermissionDenied",
+  "ACL",
+  "QueryUsers",
+  "CryptSetup",
+  "ContextActionModify",
+  "ContextAction",
+  "UserList",
+  "VoiceTarget",
+  "PermissionQuery",
+  "CodecVersion",
+  "UserStats",
+  "RequestBlob",
+  "ServerConfig",
+  "SuggestConfig",
+  "Unknown"
+};
+
+static MumbleMessageTypeStats *get_type_stats(MumbleStats *stats, guint type);
+static void add_counter(guint64 *counter, guint64 value);
+static void raise_counter(guint64 *counter, guint64 value);
+static guint64 read_counter(guint64 *counter);
+
+void mumble_stats_count_in(MumbleStats *stats, guint type, gsize length, gint64 decode_time) {
+  MumbleMessageTypeStats *type_stats = get_type_stats(stats, type);
+  add_counter(&type_stats->frames_in, 1);
+  add_counter(&type_stats->bytes_in, length);
+  add_counter(&type_stats->decode_time, decode_time);
+  raise_counter(&stats->largest_frame_in, length);
+}
+
+void mumble_stats_count_out(MumbleStats *stats, guint type, gsize length) {
+  MumbleMessageTypeStats *type_stats = get_type_stats(stats, type);
+  add_counter(&type_stats->frames_out, 1);
+  add_counter(&type_stats->bytes_out, length);
+}
+
+void mumble_stats_add_handler_time(MumbleStats *stats, guint type, gint64 time) {
+  MumbleMessageTypeStats *type_stats = get_type_stats(stats, type);
+  add_counter(&type_stats->handler_time, time);
+  raise_counter(&type_stats->max_handler_time, time);
+}
+
+void mumble_stats_get_type_stats(MumbleStats *stats, guint type, MumbleMessageTypeStats *type_stats) {
+  MumbleMessageTypeStats *counters = get_type_stats(stats, type);
+  type_stats->frames_in        = read_counter(&counters->frames_in);
+  type_stats->bytes_in         = read_counter(&counters->bytes_in);
+  type_stats->frames_out       = read_counter(&counters->frames_out);
+  type_stats->bytes_out        = read_counter(&counters->bytes_out);
+  type_stats->decode_time      = read_counter(&counters->decode_time);
+  type_stats->handler_time     = read_counter(&counters->handler_time);
+  type_stats->max_handler_time = read_counter(&counters->max_handler_time);
+}
+
+guint64 mumble_stats_get_largest_frame_in(MumbleStats *stats) {
+  return read_counter(&stats->largest_frame_in);
+}
+
+void mumble_stats_get_total(MumbleStats *stats, MumbleMessageTypeStats *total) {
+  memset(total, 0, sizeof(MumbleMessageTypeStats));
+  for (guint type = 0; type < MUMBLE_STATS_TYPE_COUNT; type++) {
+    MumbleMessageTypeStats type_stats;
+    mumble_stats_get_type_stats(stats, type, &type_stats);
+    total->frames_in    += type_stats.frames_in;
+    total->bytes_in     += type_stats.bytes_in;
+    total->frames_out   += type_stats.frames_out;
+    total->bytes_out    += type_stats.bytes_out;
+    total->decode_time  += type_stats.decode_time;
+    total->handler_time += type_stats.handler_time;
+    total->max_handler_time = MAX(total->max_handler_time, type_stats.max_handler_time);
+  }
+}
+
+const gchar *mumble_stats_get_type_name(guint type) {
+  return type_names[MIN(type, MUMBLE_STATS_TYPE_COUNT - 1)];
+}
+
+gchar *mumble_stats_to_json(MumbleStats *stats) {
+  GString *json = g_string_new("{\n");
+
+  g_string_append_printf(json, "  \"uptime_us\": %" G_GINT64_FORMAT ",\n", g_get_monotonic_time() - stats->start_time);
+  g_string_append_printf(json, "  \"timing\": %s,\n", stats->timing ? "true" : "false");
+  g_string_append(json, "  \"types\": [\n");
+  for (guint type = 0; type < MUMBLE_STATS_TYPE_COUNT; type++) {
+    MumbleMessageTypeStats type_stats;
+    mumble_stats_get_type_stats(stats, type, &type_stats);
+    g_string_append_printf(json,
+      "    {\"type\": \"%s\", \"frames_in\": %" G_GUINT64_FORMAT ", \"bytes_in\": %" G_GUINT64_FORMAT ", "
+      "\"frames_out\": %" G_GUINT64_FORMAT ", \"bytes_out\": %" G_GUINT64_FORMAT ", \"decode_ns\": %" G_GUINT64_FORMAT ", "
+      "\"handler_ns\": %" G_GUINT64_FORMAT ", \"max_handler_ns\": %" G_GUINT64_FORMAT "}%s\n",
+      type_names[type], type_stats.frames_in, type_stats.bytes_in, type_stats.frames_out, type_stats.bytes_out,
+      type_stats.decode_time, type_stats.handler_time, type_stats.max_handler_time, (type + 1 < MUMBLE_STATS_TYPE_COUNT) ? "," : "");
+  }
+  g_string_append(json, "  ],\n");
+  g_string_append_printf(json, "  \"largest_frame_in\": %" G_GUINT64_FORMAT ",\n", mumble_stats_get_largest_frame_in(stats));
+  g_string_append_printf(json, "  \"send_queue_length\": %u,\n", stats->send_queue_length);
+  g_string_append_printf(json, "  \"channels\": %u,\n", stats->channel_count);
+  g_string_append_printf(json, "  \"users\": %u,\n", stats->user_count);
+  g_string_append_printf(json, "  \"linked_channels\": %u,\n", stats->linked_channel_count);
+  g_string_append_printf(json, "  \"names\": %u,\n", stats->name_count);
+  g_string_append_printf(json, "  \"message_allocations\": %u,\n", stats->message_allocations);
+  g_string_append_printf(json, "  \"live_messages\": %u\n", stats->live_messages);
+  g_string_append(json, "}\n");
+
+  return g_string_free(json, FALSE);
+}
+
+gint64 mumble_stats_get_time() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (gint64) now.tv_sec * G_GINT64_CONSTANT(1000000000) + now.tv_nsec;
+}
+
+void mumble_stats_free(MumbleStats *stats) {
+  g_free(stats);
+}
+
+MumbleStats *mumble_stats_new() {
+  MumbleStats *stats = g_new0(MumbleStats, 1);
+  stats->start_time = g_get_monotonic_time();
+  return stats;
+}
+
+static MumbleMessageTypeStats *get_type_stats(MumbleStats *stats, guint type) {
+  return &stats->types[MIN(type, MUMBLE_STATS_TYPE_COUNT - 1)];
+}
+
+/*
+ * GLib has no 64-bit atomics, so the compiler builtins are used. Relaxed ordering is enough, since
+ * the counters don't guard any other data.
+ */
+static void add_counter(guint64 *counter, guint64 value) {
+  __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static void raise_counter(guint64 *counter, guint64 value) {
+  guint64 current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+  while (value > current) {
+    if (__atomic_compare_exchange_n(counter, &current, value, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      break;
+    }
+  }
+}
+
+static guint64 read_counter(guint64 *counter) {
+  return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,163 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_STATS_H
+#define MUMBLE_STATS_H
+
+#include <glib.h>
+#include "mumble-message.h"
+
+/**
+ * SECTION:mumblestats
+ * @short_description: Traffic and cost counters by message type
+ *
+ * Counts the frames and bytes of each message type in both directions, and
+ * optionally the time spent decoding and handling them. Counting is a few
+ * additions per message. Timing reads the clock twice per message, so it is
+ * off unless enabled. The gauges are snapshots that the owner fills in before
+ * reading the stats.
+ *
+ * Incoming frames are counted by the thread that reads the connection, which
+ * may not be the main thread, so the counters are only updated and read
+ * atomically. Read them through mumble_stats_get_type_stats() and the other
+ * getters rather than directly.
+ */
+
+/*
+ * One slot for each known message type and one for unknown types.
+ */
+#define MUMBLE_STATS_TYPE_COUNT (MUMBLE_SUGGEST_CONFIG + 2)
+
+/**
+ * MumbleMessageTypeStats:
+ * @frames_in:        Frames received
+ * @bytes_in:         Bytes received, including the frame prefixes
+ * @frames_out:       Frames sent
+ * @bytes_out:        Bytes sent, including the frame prefixes
+ * @decode_time:      Nanoseconds spent turning frames into messages
+ * @handler_time:     Nanoseconds spent handling messages
+ * @max_handler_time: Longest time spent handling a message in nanoseconds
+ */
+typedef struct _MumbleMessageTypeStats {
+  guint64 frames_in;
+  guint64 bytes_in;
+  guint64 frames_out;
+  guint64 bytes_out;
+  guint64 decode_time;
+  guint64 handler_time;
+  guint64 max_handler_time;
+} MumbleMessageTypeStats;
+
+/**
+ * MumbleStats:
+ * @types:                Counters by message type
+ * @timing:               Whether to measure decoding and handling times
+ * @start_time:           Monotonic time of creation in microseconds
+ * @largest_frame_in:     Size of the largest frame received in bytes
+ * @send_queue_length:    Gauge of the messages waiting to be written
+ * @channel_count:        Gauge of the channels in the tree
+ * @user_count:           Gauge of the users in the tree
+ * @linked_channel_count: Gauge of the channels with links
+ * @name_count:           Gauge of the names in the name index
+ * @message_allocations:  Gauge of the #MumbleMessage allocations so far
+ * @live_messages:        Gauge of the #MumbleMessage instances not freed yet
+ */
+typedef struct _MumbleStats {
+  MumbleMessageTypeStats types[MUMBLE_STATS_TYPE_COUNT];
+  gboolean timing;
+  gint64 start_time;
+  guint64 largest_frame_in;
+  guint send_queue_length;
+  guint channel_count;
+  guint user_count;
+  guint linked_channel_count;
+  guint name_count;
+  guint message_allocations;
+  guint live_messages;
+} MumbleStats;
+
+/**
+ * mumble_stats_count_in:
+ * @stats:       A #MumbleStats
+ * @type:        Type of the frame
+ * @length:      Length of the frame in bytes
+ * @decode_time: Nanoseconds spent decoding the frame, or 0 if not timed
+ */
+void mumble_stats_count_in(MumbleStats *stats, guint type, gsize length, gint64 decode_time);
+void mumble_stats_count_out(MumbleStats *stats, guint type, gsize length);
+
+/**
+ * mumble_stats_add_handler_time:
+ * @stats: A #MumbleStats
+ * @type:  Type of the message
+ * @time:  Nanoseconds spent handling the message
+ */
+void mumble_stats_add_handler_time(MumbleStats *stats, guint type, gint64 time);
+
+/**
+ * mumble_stats_get_type_stats:
+ * @stats:      A #MumbleStats
+ * @type:       Index of a message type in #MumbleStats
+ * @type_stats: (out): Return location for a snapshot of the counters of @type
+ */
+void mumble_stats_get_type_stats(MumbleStats *stats, guint type, MumbleMessageTypeStats *type_stats);
+
+/**
+ * mumble_stats_get_largest_frame_in:
+ * @stats: A #MumbleStats
+ *
+ * Returns: Size of the largest frame received so far in bytes
+ */
+guint64 mumble_stats_get_largest_frame_in(MumbleStats *stats);
+
+/**
+ * mumble_stats_get_total:
+ * @stats: A #MumbleStats
+ * @total: (out): Return location for the sums over all types
+ */
+void mumble_stats_get_total(MumbleStats *stats, MumbleMessageTypeStats *total);
+
+/**
+ * mumble_stats_get_type_name:
+ * @type: Index of a message type in #MumbleStats
+ *
+ * Returns: Name of the message type in Mumble.proto, or "Unknown"
+ */
+const gchar *mumble_stats_get_type_name(guint type);
+
+/**
+ * mumble_stats_to_json:
+ * @stats: A #MumbleStats
+ *
+ * Returns: (transfer full): The counters and gauges as a JSON object
+ */
+gchar *mumble_stats_to_json(MumbleStats *stats);
+
+/**
+ * mumble_stats_get_time:
+ *
+ * Returns: Monotonic time in nanoseconds
+ */
+gint64 mumble_stats_get_time();
+
+void mumble_stats_free(MumbleStats *stats);
+MumbleStats *mumble_stats_new();
+
+#endif
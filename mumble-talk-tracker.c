@@ -0,0 +1,202 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include "mumble-talk-tracker.h"
+
+/*
+ * The wheel turns every TICK milliseconds and a user stops talking TIMEOUT_TICKS ticks after
+ * their last packet. The wheel has to have more slots than that.
+ */
+#define TICK          50
+#define TIMEOUT_TICKS 6
+#define WHEEL_SLOTS   8
+
+/*
+ * Packets that arrive after a terminator but were sent before it are recognized by their
+ * sequence numbers as long as they are within this many frames of it.
+ */
+#define MAX_REORDERING 50
+
+typedef struct {
+  guint session;
+  gboolean talking;
+  gboolean reported_talking;
+  gboolean dirty;
+  gboolean terminated;
+  guint64 terminator_sequence;
+  GList wheel_link;
+  GList dirty_link;
+  GQueue *slot;
+} MumbleTalker;
+
+struct _MumbleTalkTracker {
+  MumbleTalkTrackerFunc func;
+  gpointer user_data;
+  GHashTable *talkers;
+  GQueue wheel[WHEEL_SLOTS];
+  GQueue dirty;
+  guint tick;
+  guint source;
+};
+
+static gboolean on_tick(gpointer);
+static void set_talking(MumbleTalkTracker *, MumbleTalker *, gboolean);
+static void schedule(MumbleTalkTracker *, MumbleTalker *);
+static void unschedule(MumbleTalker *);
+static void start_ticking(MumbleTalkTracker *);
+static void talker_free(gpointer);
+
+void mumble_talk_tracker_update(MumbleTalkTracker *tracker, guint session, guint64 sequence, gboolean terminator) {
+  MumbleTalker *talker = g_hash_table_lookup(tracker->talkers, GUINT_TO_POINTER(session));
+  if (!talker) {
+    talker = g_new0(MumbleTalker, 1);
+    talker->session = session;
+    talker->wheel_link.data = talker;
+    talker->dirty_link.data = talker;
+    g_hash_table_insert(tracker->talkers, GUINT_TO_POINTER(session), talker);
+  }
+
+  if (talker->terminated && (sequence <= talker->terminator_sequence) && (talker->terminator_sequence - sequence < MAX_REORDERING)) {
+    return;
+  }
+
+  if (terminator) {
+    talker->terminated = TRUE;
+    talker->terminator_sequence = sequence;
+    unschedule(talker);
+    set_talking(tracker, talker, FALSE);
+  } else {
+    talker->terminated = FALSE;
+    schedule(tracker, talker);
+    set_talking(tracker, talker, TRUE);
+  }
+}
+
+void mumble_talk_tracker_remove(MumbleTalkTracker *tracker, guint session) {
+  MumbleTalker *talker = g_hash_table_lookup(tracker->talkers, GUINT_TO_POINTER(session));
+  if (talker) {
+    if (talker->dirty) {
+      g_queue_unlink(&tracker->dirty, &talker->dirty_link);
+    }
+    g_hash_table_remove(tracker->talkers, GUINT_TO_POINTER(session));
+  }
+}
+
+void mumble_talk_tracker_reset(MumbleTalkTracker *tracker) {
+  g_queue_init(&tracker->dirty);
+  g_hash_table_remove_all(tracker->talkers);
+
+  if (tracker->source) {
+    g_source_remove(tracker->source);
+    tracker->source = 0;
+  }
+}
+
+void mumble_talk_tracker_free(MumbleTalkTracker *tracker) {
+  mumble_talk_tracker_reset(tracker);
+  g_hash_table_destroy(tracker->talkers);
+  g_free(tracker);
+}
+
+MumbleTalkTracker *mumble_talk_tracker_new(MumbleTalkTrackerFunc func, gpointer user_data) {
+  MumbleTalkTracker *tracker = g_new0(MumbleTalkTracker, 1);
+  tracker->func      = func;
+  tracker->user_data = user_data;
+  tracker->talkers   = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, talker_free);
+  for (guint i = 0; i < WHEEL_SLOTS; i++) {
+    g_queue_init(&tracker->wheel[i]);
+  }
+  g_queue_init(&tracker->dirty);
+  return tracker;
+}
+
+static gboolean on_tick(gpointer data) {
+  MumbleTalkTracker *tracker = data;
+
+  tracker->tick++;
+
+  GQueue *expired = &tracker->wheel[tracker->tick % WHEEL_SLOTS];
+  GList *link;
+  while ((link = g_queue_pop_head_link(expired))) {
+    MumbleTalker *talker = link->data;
+    talker->slot = NULL;
+    set_talking(tracker, talker, FALSE);
+  }
+
+  /*
+   * The callback may remove users, so each one is taken off the dirty list before it is
+   * reported.
+   */
+  while ((link = g_queue_pop_head_link(&tracker->dirty))) {
+    MumbleTalker *talker = link->data;
+    talker->dirty = FALSE;
+    if (talker->talking != talker->reported_talking) {
+      talker->reported_talking = talker->talking;
+      tracker->func(talker->session, talker->talking, tracker->user_data);
+    }
+  }
+
+  gboolean scheduled = FALSE;
+  for (guint i = 0; i < WHEEL_SLOTS; i++) {
+    scheduled |= !g_queue_is_empty(&tracker->wheel[i]);
+  }
+  if (!scheduled && g_queue_is_empty(&tracker->dirty)) {
+    tracker->source = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void set_talking(MumbleTalkTracker *tracker, MumbleTalker *talker, gboolean talking) {
+  talker->talking = talking;
+
+  if (!talker->dirty && (talking != talker->reported_talking)) {
+    talker->dirty = TRUE;
+    g_queue_push_tail_link(&tracker->dirty, &talker->dirty_link);
+    start_ticking(tracker);
+  }
+}
+
+static void schedule(MumbleTalkTracker *tracker, MumbleTalker *talker) {
+  unschedule(talker);
+  talker->slot = &tracker->wheel[(tracker->tick + TIMEOUT_TICKS) % WHEEL_SLOTS];
+  g_queue_push_tail_link(talker->slot, &talker->wheel_link);
+  start_ticking(tracker);
+}
+
+static void unschedule(MumbleTalker *talker) {
+  if (talker->slot) {
+    g_queue_unlink(talker->slot, &talker->wheel_link);
+    talker->slot = NULL;
+  }
+}
+
+static void start_ticking(MumbleTalkTracker *tracker) {
+  if (!tracker->source) {
+    tracker->source = g_timeout_add(TICK, on_tick, tracker);
+  }
+}
+
+static void talker_free(gpointer data) {
+  MumbleTalker *talker = data;
+  unschedule(talker);
+  g_free(talker);
+}
@@ -0,0 +1,80 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_TALK_TRACKER_H
+#define MUMBLE_TALK_TRACKER_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumbletalktracker
+ * @short_description: Talking state of users
+ *
+ * Tells who is speaking from the headers of their voice packets alone. A user
+ * starts talking with their first packet and stops with a terminator packet
+ * or when their packets stop arriving. The timeouts of all users share one
+ * timer wheel.
+ *
+ * Changes are reported in batches once per tick of the wheel, and a user who
+ * stops and starts again within the same tick isn't reported at all.
+ */
+
+/**
+ * MumbleTalkTrackerFunc:
+ * @session:   Session of the user
+ * @talking:   Whether the user is talking now
+ * @user_data: User data passed to mumble_talk_tracker_new()
+ */
+typedef void (*MumbleTalkTrackerFunc)(guint session, gboolean talking, gpointer user_data);
+
+typedef struct _MumbleTalkTracker MumbleTalkTracker;
+
+/**
+ * mumble_talk_tracker_update:
+ * @tracker:    A #MumbleTalkTracker
+ * @session:    Session of the sender
+ * @sequence:   Sequence number of the packet
+ * @terminator: Whether the packet ends the transmission
+ *
+ * Record a voice packet.
+ */
+void mumble_talk_tracker_update(MumbleTalkTracker *tracker, guint session, guint64 sequence, gboolean terminator);
+
+/**
+ * mumble_talk_tracker_remove:
+ * @tracker: A #MumbleTalkTracker
+ * @session: Session of a user who has left
+ *
+ * Forget a user without reporting a change.
+ */
+void mumble_talk_tracker_remove(MumbleTalkTracker *tracker, guint session);
+
+/**
+ * mumble_talk_tracker_reset:
+ * @tracker: A #MumbleTalkTracker
+ *
+ * Forget all users without reporting changes.
+ */
+void mumble_talk_tracker_reset(MumbleTalkTracker *tracker);
+
+void mumble_talk_tracker_free(MumbleTalkTracker *tracker);
+MumbleTalkTracker *mumble_talk_tracker_new(MumbleTalkTrackerFunc func, gpointer user_data);
+
+#endif
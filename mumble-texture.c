@@ -0,0 +1,172 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-texture.h"
+
+/*
+ * Declared sizes of compressed textures above this are rejected before decompressing.
+ */
+#define MAX_TEXTURE_SIZE (1024 * 1024)
+
+#define LEGACY_TEXTURE_SIZE (MUMBLE_TEXTURE_LEGACY_WIDTH * MUMBLE_TEXTURE_LEGACY_HEIGHT * 4)
+#define BMP_HEADER_SIZE     54
+
+static gboolean is_image(const guint8 *, gsize);
+static guint8 *decompress(const guint8 *, gsize, gsize *, GError **);
+static GBytes *encode_bmp(const guint8 *);
+static void decode_in_thread(GTask *, gpointer, gpointer, GCancellable *);
+
+GBytes *mumble_texture_decode(GBytes *texture, GError **error) {
+  gsize length;
+  const guint8 *data = g_bytes_get_data(texture, &length);
+
+  if (is_image(data, length)) {
+    return g_bytes_ref(texture);
+  }
+
+  gsize decompressed_length;
+  guint8 *decompressed = decompress(data, length, &decompressed_length, error);
+  if (!decompressed) {
+    return NULL;
+  }
+
+  GBytes *image = NULL;
+  if (is_image(decompressed, decompressed_length)) {
+    image = g_bytes_new_take(decompressed, decompressed_length);
+    decompressed = NULL;
+  } else if (decompressed_length == LEGACY_TEXTURE_SIZE) {
+    image = encode_bmp(decompressed);
+  } else {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Unknown texture format");
+  }
+
+  g_free(decompressed);
+  return image;
+}
+
+void mumble_texture_decode_async(GBytes *texture, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data) {
+  GTask *task = g_task_new(NULL, cancellable, callback, user_data);
+  g_task_set_task_data(task, g_bytes_ref(texture), (GDestroyNotify) g_bytes_unref);
+  g_task_run_in_thread(task, decode_in_thread);
+  g_object_unref(task);
+}
+
+GBytes *mumble_texture_decode_finish(GAsyncResult *result, GError **error) {
+  return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+static gboolean is_image(const guint8 *data, gsize length) {
+  static const struct {
+    const gchar *magic;
+    gsize length;
+  } formats[] = {
+    { "\x89PNG\r\n\x1A\n", 8 },
+    { "\xFF\xD8\xFF",      3 },
+    { "GIF8",              4 },
+    { "BM",                2 }
+  };
+
+  for (guint i = 0; i < G_N_ELEMENTS(formats); i++) {
+    if ((length >= formats[i].length) && (memcmp(data, formats[i].magic, formats[i].length) == 0)) {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static guint8 *decompress(const guint8 *data, gsize length, gsize *decompressed_length, GError **error) {
+  if (length < 4) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Texture too short");
+    return NULL;
+  }
+
+  guint32 expected_length = ((guint32) data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+  if (!expected_length || (expected_length > MAX_TEXTURE_SIZE)) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Invalid texture size %u", expected_length);
+    return NULL;
+  }
+
+  GZlibDecompressor *decompressor = g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_ZLIB);
+  guint8 *output = g_malloc(expected_length);
+  gsize input_offset = 4;
+  gsize output_offset = 0;
+  GConverterResult result;
+  do {
+    gsize read;
+    gsize written;
+    result = g_converter_convert(G_CONVERTER(decompressor), data + input_offset, length - input_offset, output + output_offset, expected_length - output_offset, G_CONVERTER_INPUT_AT_END, &read, &written, error);
+    input_offset += read;
+    output_offset += written;
+  } while (result == G_CONVERTER_CONVERTED);
+  g_object_unref(decompressor);
+
+  /*
+   * A stream that is longer than declared fails with G_IO_ERROR_NO_SPACE.
+   */
+  if (result != G_CONVERTER_FINISHED) {
+    g_free(output);
+    return NULL;
+  }
+
+  *decompressed_length = output_offset;
+  return output;
+}
+
+/*
+ * Legacy pixels are premultiplied ARGB32 in little-endian order, which is the byte order of a
+ * 32-bit BMP. A negative height makes the rows run from top to bottom as in the texture.
+ */
+static GBytes *encode_bmp(const guint8 *pixels) {
+  gsize size = BMP_HEADER_SIZE + LEGACY_TEXTURE_SIZE;
+  guint8 *bmp = g_malloc0(size);
+
+  guint32 file_size = GUINT32_TO_LE(size);
+  guint32 pixel_offset = GUINT32_TO_LE(BMP_HEADER_SIZE);
+  guint32 info_size = GUINT32_TO_LE(40);
+  gint32 width = GINT32_TO_LE(MUMBLE_TEXTURE_LEGACY_WIDTH);
+  gint32 height = GINT32_TO_LE(-MUMBLE_TEXTURE_LEGACY_HEIGHT);
+  guint16 planes = GUINT16_TO_LE(1);
+  guint16 bits_per_pixel = GUINT16_TO_LE(32);
+  guint32 image_size = GUINT32_TO_LE(LEGACY_TEXTURE_SIZE);
+
+  memcpy(bmp, "BM", 2);
+  memcpy(bmp + 2, &file_size, 4);
+  memcpy(bmp + 10, &pixel_offset, 4);
+  memcpy(bmp + 14, &info_size, 4);
+  memcpy(bmp + 18, &width, 4);
+  memcpy(bmp + 22, &height, 4);
+  memcpy(bmp + 26, &planes, 2);
+  memcpy(bmp + 28, &bits_per_pixel, 2);
+  memcpy(bmp + 34, &image_size, 4);
+  memcpy(bmp + BMP_HEADER_SIZE, pixels, LEGACY_TEXTURE_SIZE);
+
+  return g_bytes_new_take(bmp, size);
+}
+
+static void decode_in_thread(GTask *task, gpointer source_object, gpointer task_data, GCancellable *cancellable) {
+  GError *error = NULL;
+  GBytes *image = mumble_texture_decode(task_data, &error);
+  if (image) {
+    g_task_return_pointer(task, image, (GDestroyNotify) g_bytes_unref);
+  } else {
+    g_task_return_error(task, error);
+  }
+}
@@ -0,0 +1,63 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_TEXTURE_H
+#define MUMBLE_TEXTURE_H
+
+#include <glib.h>
+#include <gio/gio.h>
+
+/**
+ * SECTION:mumbletexture
+ * @short_description: Decoding of user avatars
+ *
+ * Current Mumble clients send avatars, called textures in the protocol, as
+ * image files. Clients before 1.2 sent raw 600x60 BGRA pixels compressed with
+ * Qt's qCompress(), which is a big-endian 32-bit length followed by a zlib
+ * stream. Decoding turns either kind into an image file that libpurple can
+ * show, and it can run in a worker thread.
+ */
+
+#define MUMBLE_TEXTURE_LEGACY_WIDTH  600
+#define MUMBLE_TEXTURE_LEGACY_HEIGHT 60
+
+/**
+ * mumble_texture_decode:
+ * @texture: A texture from UserState
+ * @error:   Return location for a #GError
+ *
+ * Returns: (transfer full): PNG, JPEG, GIF or BMP data, or %NULL on error
+ */
+GBytes *mumble_texture_decode(GBytes *texture, GError **error);
+
+/**
+ * mumble_texture_decode_async:
+ * @texture:     A texture from UserState
+ * @cancellable: (nullable): A #GCancellable
+ * @callback:    Function to call in the calling thread when decoding is done
+ * @user_data:   User data for @callback
+ *
+ * Decode @texture in a worker thread.
+ */
+void mumble_texture_decode_async(GBytes *texture, GCancellable *cancellable, GAsyncReadyCallback callback, gpointer user_data);
+
+GBytes *mumble_texture_decode_finish(GAsyncResult *result, GError **error);
+
+#endif
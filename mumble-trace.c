@@ -0,0 +1,216 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <math.h>
+#include <string.h>
+#include "mumble-stats.h"
+#include "mumble-trace.h"
+
+/*
+ * Values below 16 have a bucket each. Above that, every power of two is split into 16 buckets, so
+ * 976 buckets cover all 64-bit values.
+ */
+#define SUB_BUCKET_BITS  4
+#define SUB_BUCKET_COUNT (1 << SUB_BUCKET_BITS)
+#define BUCKET_COUNT     ((64 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT)
+
+#define INBOUND_THREAD_ID  1
+#define OUTBOUND_THREAD_ID 2
+
+typedef struct {
+  gint count;
+  gint buckets[BUCKET_COUNT];
+} MumbleTraceHistogram;
+
+struct _MumbleTrace {
+  MumbleTraceHistogram histograms[MUMBLE_TRACE_STAGE_COUNT];
+  GMutex lock;
+  MumbleTraceSpan *spans;
+  guint capacity;
+  guint64 span_count;
+};
+
+typedef struct {
+  const gchar *name;
+  MumbleTracePoint from;
+  MumbleTracePoint to;
+  guint thread_id;
+} MumbleTraceStageInfo;
+
+static const MumbleTraceStageInfo stage_infos[MUMBLE_TRACE_STAGE_COUNT] = {
+  { "read",     MUMBLE_TRACE_READ,          MUMBLE_TRACE_FRAME,         INBOUND_THREAD_ID  },
+  { "decode",   MUMBLE_TRACE_FRAME,         MUMBLE_TRACE_DECODED,       INBOUND_THREAD_ID  },
+  { "dispatch", MUMBLE_TRACE_DECODED,       MUMBLE_TRACE_HANDLER_START, INBOUND_THREAD_ID  },
+  { "handle",   MUMBLE_TRACE_HANDLER_START, MUMBLE_TRACE_HANDLER_END,   INBOUND_THREAD_ID  },
+  { "deliver",  MUMBLE_TRACE_HANDLER_START, MUMBLE_TRACE_DELIVERED,     INBOUND_THREAD_ID  },
+  { "inbound",  MUMBLE_TRACE_READ,          MUMBLE_TRACE_HANDLER_END,   INBOUND_THREAD_ID  },
+  { "queue",    MUMBLE_TRACE_SEND,          MUMBLE_TRACE_QUEUED,        OUTBOUND_THREAD_ID },
+  { "write",    MUMBLE_TRACE_QUEUED,        MUMBLE_TRACE_WRITTEN,       OUTBOUND_THREAD_ID },
+  { "outbound", MUMBLE_TRACE_SEND,          MUMBLE_TRACE_WRITTEN,       OUTBOUND_THREAD_ID }
+};
+
+static guint get_bucket(guint64 value);
+static guint64 get_bucket_value(guint bucket);
+static gboolean get_stage_times(MumbleTraceSpan *span, MumbleTraceStage stage, gint64 *start, gint64 *end);
+
+void mumble_trace_span_mark(MumbleTraceSpan *span, MumbleTracePoint point) {
+  if (span) {
+    span->points[point] = mumble_stats_get_time();
+  }
+}
+
+MumbleTraceSpan *mumble_trace_span_new(guint type) {
+  MumbleTraceSpan *span = g_new0(MumbleTraceSpan, 1);
+  span->type = type;
+  return span;
+}
+
+void mumble_trace_record(MumbleTrace *trace, MumbleTraceSpan *span) {
+  if (!span) {
+    return;
+  }
+
+  for (guint stage = 0; stage < MUMBLE_TRACE_STAGE_COUNT; stage++) {
+    gint64 start, end;
+    if (get_stage_times(span, stage, &start, &end)) {
+      MumbleTraceHistogram *histogram = &trace->histograms[stage];
+      g_atomic_int_inc(&histogram->buckets[get_bucket(end - start)]);
+      g_atomic_int_inc(&histogram->count);
+    }
+  }
+
+  g_mutex_lock(&trace->lock);
+  trace->spans[trace->span_count % trace->capacity] = *span;
+  trace->span_count++;
+  g_mutex_unlock(&trace->lock);
+}
+
+guint mumble_trace_get_count(MumbleTrace *trace, MumbleTraceStage stage) {
+  return g_atomic_int_get(&trace->histograms[stage].count);
+}
+
+gint64 mumble_trace_get_percentile(MumbleTrace *trace, MumbleTraceStage stage, gdouble percentile) {
+  MumbleTraceHistogram *histogram = &trace->histograms[stage];
+
+  /*
+   * Spans may be recorded while the buckets are read, so the rank is taken from the buckets
+   * themselves rather than from the count.
+   */
+  guint counts[BUCKET_COUNT];
+  guint64 total = 0;
+  for (guint bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+    counts[bucket] = g_atomic_int_get(&histogram->buckets[bucket]);
+    total += counts[bucket];
+  }
+  if (!total) {
+    return 0;
+  }
+
+  guint64 rank = MAX(ceil(CLAMP(percentile, 0, 100) / 100 * total), 1);
+  guint64 cumulative = 0;
+  for (guint bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+    cumulative += counts[bucket];
+    if (cumulative >= rank) {
+      return get_bucket_value(bucket);
+    }
+  }
+  return 0;
+}
+
+const gchar *mumble_trace_get_stage_name(MumbleTraceStage stage) {
+  return stage_infos[stage].name;
+}
+
+gchar *mumble_trace_to_chrome_json(MumbleTrace *trace) {
+  g_mutex_lock(&trace->lock);
+  guint count = MIN(trace->span_count, trace->capacity);
+  guint first = (trace->span_count - count) % trace->capacity;
+  MumbleTraceSpan *spans = g_new(MumbleTraceSpan, count ? count : 1);
+  for (guint index = 0; index < count; index++) {
+    spans[index] = trace->spans[(first + index) % trace->capacity];
+  }
+  g_mutex_unlock(&trace->lock);
+
+  GString *json = g_string_new("{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  g_string_append_printf(json, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"Incoming\"}},\n", INBOUND_THREAD_ID);
+  g_string_append_printf(json, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"Outgoing\"}}", OUTBOUND_THREAD_ID);
+
+  /*
+   * Timestamps are in microseconds. The totals enclose the other stages of the same message, so
+   * viewers nest the stages under them.
+   */
+  for (guint index = 0; index < count; index++) {
+    MumbleTraceSpan *span = &spans[index];
+    for (guint stage = 0; stage < MUMBLE_TRACE_STAGE_COUNT; stage++) {
+      gint64 start, end;
+      if (get_stage_times(span, stage, &start, &end)) {
+        g_string_append_printf(json, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+          stage_infos[stage].name, mumble_stats_get_type_name(span->type), stage_infos[stage].thread_id, start / 1000.0, (end - start) / 1000.0);
+      }
+    }
+  }
+  g_string_append(json, "\n]}\n");
+
+  g_free(spans);
+
+  return g_string_free(json, FALSE);
+}
+
+void mumble_trace_free(MumbleTrace *trace) {
+  g_mutex_clear(&trace->lock);
+  g_free(trace->spans);
+  g_free(trace);
+}
+
+MumbleTrace *mumble_trace_new(guint capacity) {
+  MumbleTrace *trace = g_new0(MumbleTrace, 1);
+
+  g_mutex_init(&trace->lock);
+  trace->capacity = MAX(capacity, 1);
+  trace->spans    = g_new0(MumbleTraceSpan, trace->capacity);
+
+  return trace;
+}
+
+static guint get_bucket(guint64 value) {
+  if (value < SUB_BUCKET_COUNT) {
+    return value;
+  }
+  guint shift = g_bit_storage(value) - 1 - SUB_BUCKET_BITS;
+  return (shift + 1) * SUB_BUCKET_COUNT + ((value >> shift) & (SUB_BUCKET_COUNT - 1));
+}
+
+/*
+ * The middle of the range of values that fall into the bucket.
+ */
+static guint64 get_bucket_value(guint bucket) {
+  if (bucket < SUB_BUCKET_COUNT) {
+    return bucket;
+  }
+  guint shift = bucket / SUB_BUCKET_COUNT - 1;
+  guint64 lowest = (guint64) (SUB_BUCKET_COUNT + bucket % SUB_BUCKET_COUNT) << shift;
+  return lowest + ((G_GUINT64_CONSTANT(1) << shift) >> 1);
+}
+
+static gboolean get_stage_times(MumbleTraceSpan *span, MumbleTraceStage stage, gint64 *start, gint64 *end) {
+  *start = span->points[stage_infos[stage].from];
+  *end   = span->points[stage_infos[stage].to];
+  return *start && (*end >= *start);
+}
@@ -0,0 +1,173 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_TRACE_H
+#define MUMBLE_TRACE_H
+
+#include <glib.h>
+#include "mumble-message.h"
+
+/**
+ * SECTION:mumbletrace
+ * @short_description: Latency tracing of messages
+ *
+ * A #MumbleTraceSpan travels with a message and collects monotonic timestamps
+ * as the message passes points on its way between the socket and the UI. When
+ * the message is done with, the span is recorded: the time between points goes
+ * into one histogram per stage, and the span itself into a ring of recent
+ * spans that can be exported for a trace viewer.
+ *
+ * The histograms are log-linear like HdrHistogram, with 16 buckets for every
+ * power of two, so values are kept within about 6 percent. Buckets are
+ * updated with atomic operations, so spans can be recorded from any thread
+ * without locking.
+ */
+
+/**
+ * MumbleTracePoint:
+ * @MUMBLE_TRACE_READ:          First bytes of an incoming frame were read
+ * @MUMBLE_TRACE_FRAME:         Incoming frame was complete
+ * @MUMBLE_TRACE_DECODED:       Incoming frame was turned into a message
+ * @MUMBLE_TRACE_HANDLER_START: Handling of the message started
+ * @MUMBLE_TRACE_HANDLER_END:   Handling of the message ended
+ * @MUMBLE_TRACE_DELIVERED:     Text of the message was passed to the UI
+ * @MUMBLE_TRACE_SEND:          UI asked for a text message to be sent
+ * @MUMBLE_TRACE_QUEUED:        Outgoing message was queued for writing
+ * @MUMBLE_TRACE_WRITTEN:       Outgoing message was written
+ */
+typedef enum {
+  MUMBLE_TRACE_READ,
+  MUMBLE_TRACE_FRAME,
+  MUMBLE_TRACE_DECODED,
+  MUMBLE_TRACE_HANDLER_START,
+  MUMBLE_TRACE_HANDLER_END,
+  MUMBLE_TRACE_DELIVERED,
+  MUMBLE_TRACE_SEND,
+  MUMBLE_TRACE_QUEUED,
+  MUMBLE_TRACE_WRITTEN,
+  MUMBLE_TRACE_POINT_COUNT
+} MumbleTracePoint;
+
+/**
+ * MumbleTraceStage:
+ * @MUMBLE_TRACE_STAGE_READ:     From %MUMBLE_TRACE_READ to %MUMBLE_TRACE_FRAME
+ * @MUMBLE_TRACE_STAGE_DECODE:   From %MUMBLE_TRACE_FRAME to %MUMBLE_TRACE_DECODED
+ * @MUMBLE_TRACE_STAGE_DISPATCH: From %MUMBLE_TRACE_DECODED to
+ *                               %MUMBLE_TRACE_HANDLER_START, including the
+ *                               hand-over from the network thread
+ * @MUMBLE_TRACE_STAGE_HANDLE:   From %MUMBLE_TRACE_HANDLER_START to
+ *                               %MUMBLE_TRACE_HANDLER_END
+ * @MUMBLE_TRACE_STAGE_DELIVER:  From %MUMBLE_TRACE_HANDLER_START to
+ *                               %MUMBLE_TRACE_DELIVERED
+ * @MUMBLE_TRACE_STAGE_INBOUND:  From %MUMBLE_TRACE_READ to
+ *                               %MUMBLE_TRACE_HANDLER_END
+ * @MUMBLE_TRACE_STAGE_QUEUE:    From %MUMBLE_TRACE_SEND to %MUMBLE_TRACE_QUEUED
+ * @MUMBLE_TRACE_STAGE_WRITE:    From %MUMBLE_TRACE_QUEUED to %MUMBLE_TRACE_WRITTEN
+ * @MUMBLE_TRACE_STAGE_OUTBOUND: From %MUMBLE_TRACE_SEND to %MUMBLE_TRACE_WRITTEN
+ */
+typedef enum {
+  MUMBLE_TRACE_STAGE_READ,
+  MUMBLE_TRACE_STAGE_DECODE,
+  MUMBLE_TRACE_STAGE_DISPATCH,
+  MUMBLE_TRACE_STAGE_HANDLE,
+  MUMBLE_TRACE_STAGE_DELIVER,
+  MUMBLE_TRACE_STAGE_INBOUND,
+  MUMBLE_TRACE_STAGE_QUEUE,
+  MUMBLE_TRACE_STAGE_WRITE,
+  MUMBLE_TRACE_STAGE_OUTBOUND,
+  MUMBLE_TRACE_STAGE_COUNT
+} MumbleTraceStage;
+
+/**
+ * MumbleTraceSpan:
+ * @type:   #MumbleMessageType of the message
+ * @points: Monotonic times of the #MumbleTracePoint values in nanoseconds, or
+ *          0 for points the message didn't pass
+ */
+struct _MumbleTraceSpan {
+  guint type;
+  gint64 points[MUMBLE_TRACE_POINT_COUNT];
+};
+
+typedef struct _MumbleTrace MumbleTrace;
+
+/**
+ * mumble_trace_span_mark:
+ * @span:  (nullable): A #MumbleTraceSpan, or %NULL to do nothing
+ * @point: Point that was passed now
+ */
+void mumble_trace_span_mark(MumbleTraceSpan *span, MumbleTracePoint point);
+MumbleTraceSpan *mumble_trace_span_new(guint type);
+
+/**
+ * mumble_trace_record:
+ * @trace: A #MumbleTrace
+ * @span:  (nullable): A finished #MumbleTraceSpan, or %NULL to do nothing
+ *
+ * Add the stages that @span passed through to the histograms and keep a copy
+ * of @span for export. Can be called from any thread.
+ */
+void mumble_trace_record(MumbleTrace *trace, MumbleTraceSpan *span);
+
+/**
+ * mumble_trace_get_count:
+ * @trace: A #MumbleTrace
+ * @stage: A #MumbleTraceStage
+ *
+ * Returns: Number of times recorded for the stage
+ */
+guint mumble_trace_get_count(MumbleTrace *trace, MumbleTraceStage stage);
+
+/**
+ * mumble_trace_get_percentile:
+ * @trace:      A #MumbleTrace
+ * @stage:      A #MumbleTraceStage
+ * @percentile: Percentile between 0 and 100
+ *
+ * Returns: Nearest-rank percentile of the times recorded for the stage in
+ * nanoseconds, or 0 if there are none
+ */
+gint64 mumble_trace_get_percentile(MumbleTrace *trace, MumbleTraceStage stage, gdouble percentile);
+
+const gchar *mumble_trace_get_stage_name(MumbleTraceStage stage);
+
+/**
+ * mumble_trace_to_chrome_json:
+ * @trace: A #MumbleTrace
+ *
+ * Export the recent spans in the Trace Event Format, which chrome://tracing
+ * and Perfetto can load. Incoming and outgoing messages are shown as two
+ * threads, with a slice for every stage.
+ *
+ * Returns: (transfer full): The trace as JSON
+ */
+gchar *mumble_trace_to_chrome_json(MumbleTrace *trace);
+
+void mumble_trace_free(MumbleTrace *trace);
+
+/**
+ * mumble_trace_new:
+ * @capacity: Number of recent spans to keep for export
+ *
+ * Returns: A new #MumbleTrace
+ */
+MumbleTrace *mumble_trace_new(guint capacity);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-udp-transport.h"
+#include "mumble-voice-packet.h"
+
+/*
+ * UDP counts as unreachable once this many ping intervals have passed without an answer.
+ */
+#define REACHABILITY_INTERVALS 3
+
+struct _MumbleUdpTransport {
+  GSocket *socket;
+  GSource *receive_source;
+  guint ping_source;
+  MumbleCryptState *crypt_state;
+  MumbleUdpTransportPacketFunc packet_func;
+  gpointer user_data;
+  MumbleLatencyStats *ping_stats;
+  gint64 last_reply_time;
+  gint64 last_resync_request_time;
+  guint failed_decryptions;
+};
+
+static gboolean on_socket_readable(GSocket *, GIOCondition, gpointer);
+static void handle_datagram(MumbleUdpTransport *, const guint8 *, gsize);
+static gboolean send_ping(gpointer);
+
+gboolean mumble_udp_transport_send(MumbleUdpTransport *transport, const guint8 *packet, gsize length) {
+  guint8 datagram[MUMBLE_UDP_TRANSPORT_MAX_PACKET];
+
+  if (length + MUMBLE_CRYPT_STATE_OVERHEAD > sizeof(datagram)) {
+    return FALSE;
+  }
+  if (!mumble_crypt_state_encrypt(transport->crypt_state, packet, datagram, length)) {
+    return FALSE;
+  }
+
+  return g_socket_send(transport->socket, (const gchar *) datagram, length + MUMBLE_CRYPT_STATE_OVERHEAD, NULL, NULL) >= 0;
+}
+
+void mumble_udp_transport_resync(MumbleUdpTransport *transport, const guint8 *server_nonce) {
+  mumble_crypt_state_set_decrypt_iv(transport->crypt_state, server_nonce);
+  transport->failed_decryptions = 0;
+}
+
+/*
+ * Unlike Mumble itself, a resync is only requested when datagrams do arrive but fail to decrypt.
+ * When UDP is blocked altogether, a new nonce wouldn't help.
+ */
+gboolean mumble_udp_transport_needs_resync(MumbleUdpTransport *transport) {
+  gint64 now = g_get_monotonic_time();
+  gint64 interval = MUMBLE_UDP_TRANSPORT_PING_INTERVAL * G_USEC_PER_SEC;
+
+  if (!transport->failed_decryptions) {
+    return FALSE;
+  }
+  if ((now - transport->crypt_state->last_good_time < interval) || (now - transport->last_resync_request_time < interval)) {
+    return FALSE;
+  }
+
+  transport->last_resync_request_time = now;
+  return TRUE;
+}
+
+gboolean mumble_udp_transport_is_reachable(MumbleUdpTransport *transport) {
+  return transport->last_reply_time && (g_get_monotonic_time() - transport->last_reply_time < REACHABILITY_INTERVALS * MUMBLE_UDP_TRANSPORT_PING_INTERVAL * G_USEC_PER_SEC);
+}
+
+MumbleCryptState *mumble_udp_transport_get_crypt_state(MumbleUdpTransport *transport) {
+  return transport->crypt_state;
+}
+
+MumbleLatencyStats *mumble_udp_transport_get_ping_stats(MumbleUdpTransport *transport) {
+  return transport->ping_stats;
+}
+
+void mumble_udp_transport_free(MumbleUdpTransport *transport) {
+  g_source_remove(transport->ping_source);
+  g_source_destroy(transport->receive_source);
+  g_source_unref(transport->receive_source);
+  g_socket_close(transport->socket, NULL);
+  g_object_unref(transport->socket);
+  mumble_crypt_state_free(transport->crypt_state);
+  mumble_latency_stats_free(transport->ping_stats);
+  g_free(transport);
+}
+
+MumbleUdpTransport *mumble_udp_transport_new(GSocketAddress *address, const guint8 *key, const guint8 *client_nonce, const guint8 *server_nonce, MumbleUdpTransportPacketFunc packet_func, gpointer user_data, GError **error) {
+  GSocket *socket = g_socket_new(g_socket_address_get_family(address), G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, error);
+  if (!socket) {
+    return NULL;
+  }
+  g_socket_set_blocking(socket, FALSE);
+  if (!g_socket_connect(socket, address, NULL, error)) {
+    g_object_unref(socket);
+    return NULL;
+  }
+
+  MumbleUdpTransport *transport = g_new0(MumbleUdpTransport, 1);
+  transport->socket = socket;
+  transport->packet_func = packet_func;
+  transport->user_data = user_data;
+  transport->ping_stats = mumble_latency_stats_new();
+
+  transport->crypt_state = mumble_crypt_state_new();
+  mumble_crypt_state_set_key(transport->crypt_state, key, client_nonce, server_nonce);
+
+  transport->receive_source = g_socket_create_source(socket, G_IO_IN, NULL);
+  g_source_set_callback(transport->receive_source, (GSourceFunc) on_socket_readable, transport, NULL);
+  g_source_attach(transport->receive_source, NULL);
+
+  transport->ping_source = g_timeout_add_seconds(MUMBLE_UDP_TRANSPORT_PING_INTERVAL, send_ping, transport);
+  send_ping(transport);
+
+  return transport;
+}
+
+/*
+ * Everything queued on the socket is read at once. Errors such as ICMP port unreachable
+ * notifications are left for the reachability check to deal with.
+ */
+static gboolean on_socket_readable(GSocket *socket, GIOCondition condition, gpointer data) {
+  MumbleUdpTransport *transport = data;
+  guint8 datagram[MUMBLE_UDP_TRANSPORT_MAX_PACKET];
+
+  while (TRUE) {
+    GError *error = NULL;
+    gssize length = g_socket_receive(socket, (gchar *) datagram, sizeof(datagram), NULL, &error);
+    if (length < 0) {
+      gboolean would_block = g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+      g_error_free(error);
+      if (would_block) {
+        break;
+      }
+      continue;
+    }
+    handle_datagram(transport, datagram, length);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void handle_datagram(MumbleUdpTransport *transport, const guint8 *datagram, gsize length) {
+  guint8 packet[MUMBLE_UDP_TRANSPORT_MAX_PACKET];
+
+  if (length <= MUMBLE_CRYPT_STATE_OVERHEAD) {
+    return;
+  }
+  if (!mumble_crypt_state_decrypt(transport->crypt_state, datagram, packet, length)) {
+    transport->failed_decryptions++;
+    return;
+  }
+  transport->failed_decryptions = 0;
+
+  length -= MUMBLE_CRYPT_STATE_OVERHEAD;
+  if ((packet[0] >> 5) != MUMBLE_VOICE_PING) {
+    transport->packet_func(packet, length, transport->user_data);
+    return;
+  }
+
+  MumbleVoicePacket ping;
+  if (!mumble_voice_packet_read(&ping, packet, length, FALSE)) {
+    return;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  if (!ping.sequence || ((gint64) ping.sequence > now)) {
+    return;
+  }
+  transport->last_reply_time = now;
+  mumble_latency_stats_add(transport->ping_stats, (now - (gint64) ping.sequence) / 1000.0);
+}
+
+static gboolean send_ping(gpointer data) {
+  MumbleUdpTransport *transport = data;
+
+  MumbleVoicePacket ping = { 0 };
+  ping.type = MUMBLE_VOICE_PING;
+  ping.sequence = g_get_monotonic_time();
+
+  GByteArray *packet = g_byte_array_new();
+  mumble_voice_packet_write(&ping, packet, FALSE);
+  mumble_udp_transport_send(transport, packet->data, packet->len);
+  g_byte_array_unref(packet);
+
+  return G_SOURCE_CONTINUE;
+}
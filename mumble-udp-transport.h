@@ -0,0 +1,133 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_UDP_TRANSPORT_H
+#define MUMBLE_UDP_TRANSPORT_H
+
+#include <glib.h>
+#include <gio/gio.h>
+#include "mumble-crypt-state.h"
+#include "mumble-latency-stats.h"
+
+/**
+ * SECTION:mumbleudptransport
+ * @short_description: Encrypted UDP voice channel
+ *
+ * Sends and receives voice packets over UDP, encrypted with the key material
+ * from CryptSetup, to avoid the head-of-line blocking of the TCP connection.
+ * Encrypted voice pings are sent every %MUMBLE_UDP_TRANSPORT_PING_INTERVAL
+ * seconds to measure the round-trip time and to find out whether UDP gets
+ * through at all. The channel counts as reachable while pings are answered,
+ * and voice should go through UDPTunnel messages otherwise.
+ */
+
+#define MUMBLE_UDP_TRANSPORT_PING_INTERVAL 5
+#define MUMBLE_UDP_TRANSPORT_MAX_PACKET    1024
+
+/**
+ * MumbleUdpTransportPacketFunc:
+ * @packet:    Decrypted voice packet, valid only during the call
+ * @length:    Length of @packet
+ * @user_data: User data passed to mumble_udp_transport_new()
+ *
+ * Called in the main context for every voice packet other than a ping.
+ */
+typedef void (*MumbleUdpTransportPacketFunc)(const guint8 *packet, gsize length, gpointer user_data);
+
+typedef struct _MumbleUdpTransport MumbleUdpTransport;
+
+/**
+ * mumble_udp_transport_send:
+ * @transport: A #MumbleUdpTransport
+ * @packet:    Voice packet without a session
+ * @length:    Length of @packet
+ *
+ * Encrypt and send @packet.
+ *
+ * Returns: %FALSE if the packet couldn't be sent
+ */
+gboolean mumble_udp_transport_send(MumbleUdpTransport *transport, const guint8 *packet, gsize length);
+
+/**
+ * mumble_udp_transport_resync:
+ * @transport:    A #MumbleUdpTransport
+ * @server_nonce: 16-byte nonce from CryptSetup
+ *
+ * Set the decrypt nonce sent by the server in answer to a resync request.
+ */
+void mumble_udp_transport_resync(MumbleUdpTransport *transport, const guint8 *server_nonce);
+
+/**
+ * mumble_udp_transport_needs_resync:
+ * @transport: A #MumbleUdpTransport
+ *
+ * Check whether nothing has been decrypted for a while even though packets
+ * keep arriving, which means the nonces have drifted apart. Returns %TRUE at
+ * most once per %MUMBLE_UDP_TRANSPORT_PING_INTERVAL.
+ *
+ * Returns: Whether a resync should be requested from the server
+ */
+gboolean mumble_udp_transport_needs_resync(MumbleUdpTransport *transport);
+
+/**
+ * mumble_udp_transport_is_reachable:
+ * @transport: A #MumbleUdpTransport
+ *
+ * Returns: Whether recent pings have been answered over UDP
+ */
+gboolean mumble_udp_transport_is_reachable(MumbleUdpTransport *transport);
+
+/**
+ * mumble_udp_transport_get_crypt_state:
+ * @transport: A #MumbleUdpTransport
+ *
+ * Returns: (transfer none): The #MumbleCryptState with the nonces and the
+ * packet statistics
+ */
+MumbleCryptState *mumble_udp_transport_get_crypt_state(MumbleUdpTransport *transport);
+
+/**
+ * mumble_udp_transport_get_ping_stats:
+ * @transport: A #MumbleUdpTransport
+ *
+ * Returns: (transfer none): Round-trip times of UDP pings
+ */
+MumbleLatencyStats *mumble_udp_transport_get_ping_stats(MumbleUdpTransport *transport);
+
+void mumble_udp_transport_free(MumbleUdpTransport *transport);
+
+/**
+ * mumble_udp_transport_new:
+ * @address:      Address of the server
+ * @key:          16-byte key from CryptSetup
+ * @client_nonce: 16-byte client nonce from CryptSetup
+ * @server_nonce: 16-byte server nonce from CryptSetup
+ * @packet_func:  Function to call for received voice packets
+ * @user_data:    User data for @packet_func
+ * @error:        Return location for a #GError
+ *
+ * Open a UDP socket to @address and start pinging.
+ *
+ * Returns: A new #MumbleUdpTransport, or %NULL if the socket couldn't be
+ * opened
+ */
+MumbleUdpTransport *mumble_udp_transport_new(GSocketAddress *address, const guint8 *key, const guint8 *client_nonce, const guint8 *server_nonce, MumbleUdpTransportPacketFunc packet_func, gpointer user_data, GError **error);
+
+#endif
@@ -17,7 +17,170 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <string.h>
 #include "mumble-user.h"
+#include "protobuf-utils.h"
+
+static gboolean text_equals(const gchar *, const gchar *, gsize);
+
+void mumble_user_update_read(MumbleUserUpdate *update, GByteArray *payload) {
+  memset(update, 0, sizeof(MumbleUserUpdate));
+
+  for (guint offset = 0; offset < payload->len;) {
+    guint field_number;
+    guint wire_type;
+    if (!decode_protobuf_tag(payload, &offset, &field_number, &wire_type)) {
+      break;
+    }
+
+    guint64 value = 0;
+    const guint8 *data = NULL;
+    gsize length = 0;
+    gboolean valid;
+    if (wire_type == 0) {
+      valid = decode_protobuf_unsigned_varint(payload, &offset, &value);
+    } else if (wire_type == 2) {
+      valid = decode_protobuf_bytes_view(payload, &offset, &data, &length);
+    } else {
+      skip_protobuf_value(payload, &offset, wire_type);
+      continue;
+    }
+    if (!valid) {
+      break;
+    }
+
+    switch (field_number) {
+      case 1:
+        update->session_id = value;
+        break;
+      case 3:
+        update->fields |= MUMBLE_USER_FIELD_NAME;
+        update->name = (const gchar *) data;
+        update->name_length = length;
+        break;
+      case 4:
+        update->fields |= MUMBLE_USER_FIELD_USER_ID;
+        update->user_id = value;
+        break;
+      case 5:
+        update->fields |= MUMBLE_USER_FIELD_CHANNEL_ID;
+        update->channel_id = value;
+        break;
+      case 6:
+      case 7:
+      case 8:
+      case 9:
+      case 10: {
+        guint16 flag = 1 << (field_number - 6);
+        update->fields |= MUMBLE_USER_FIELD_FLAGS;
+        update->flags_mask |= flag;
+        update->flags = value ? (update->flags | flag) : (update->flags & ~flag);
+        break;
+      }
+      case 11:
+        update->fields |= MUMBLE_USER_FIELD_TEXTURE;
+        update->texture = data;
+        update->texture_length = length;
+        break;
+      case 14:
+        update->fields |= MUMBLE_USER_FIELD_COMMENT;
+        update->comment = (const gchar *) data;
+        update->comment_length = length;
+        break;
+      case 15:
+        update->fields |= MUMBLE_USER_FIELD_CERTIFICATE_HASH;
+        update->certificate_hash = (const gchar *) data;
+        update->certificate_hash_length = MIN(length, MUMBLE_USER_CERTIFICATE_HASH_SIZE);
+        break;
+      case 16:
+        if (length == MUMBLE_USER_HASH_SIZE) {
+          update->fields |= MUMBLE_USER_FIELD_COMMENT_HASH;
+          update->comment_hash = data;
+        }
+        break;
+      case 17:
+        if (length == MUMBLE_USER_HASH_SIZE) {
+          update->fields |= MUMBLE_USER_FIELD_TEXTURE_HASH;
+          update->texture_hash = data;
+        }
+        break;
+      case 18:
+      case 19: {
+        guint16 flag = 1 << (field_number - 13);
+        update->fields |= MUMBLE_USER_FIELD_FLAGS;
+        update->flags_mask |= flag;
+        update->flags = value ? (update->flags | flag) : (update->flags & ~flag);
+        break;
+      }
+    }
+  }
+}
+
+guint mumble_user_merge(MumbleUser *user, const MumbleUserUpdate *update) {
+  guint changed = 0;
+  guint16 flags = user->flags;
+
+  if ((update->fields & MUMBLE_USER_FIELD_NAME) && !text_equals(user->name, update->name, update->name_length)) {
+    g_free(user->name);
+    user->name = g_strndup(update->name, update->name_length);
+    changed |= MUMBLE_USER_FIELD_NAME;
+  }
+
+  if ((update->fields & MUMBLE_USER_FIELD_USER_ID) && (!(flags & MUMBLE_USER_REGISTERED) || (user->user_id != update->user_id))) {
+    user->user_id = update->user_id;
+    flags |= MUMBLE_USER_REGISTERED;
+    changed |= MUMBLE_USER_FIELD_USER_ID;
+  }
+
+  if ((update->fields & MUMBLE_USER_FIELD_CHANNEL_ID) && (user->channel_id != update->channel_id)) {
+    user->channel_id = update->channel_id;
+    changed |= MUMBLE_USER_FIELD_CHANNEL_ID;
+  }
+
+  flags = (flags & ~update->flags_mask) | (update->flags & update->flags_mask);
+
+  if ((update->fields & MUMBLE_USER_FIELD_COMMENT_HASH) && (!(flags & MUMBLE_USER_HAS_COMMENT_HASH) || memcmp(user->comment_hash, update->comment_hash, MUMBLE_USER_HASH_SIZE))) {
+    memcpy(user->comment_hash, update->comment_hash, MUMBLE_USER_HASH_SIZE);
+    flags |= MUMBLE_USER_HAS_COMMENT_HASH;
+    changed |= MUMBLE_USER_FIELD_COMMENT_HASH;
+    if (user->comment && !(update->fields & MUMBLE_USER_FIELD_COMMENT)) {
+      g_clear_pointer(&user->comment, g_free);
+      changed |= MUMBLE_USER_FIELD_COMMENT;
+    }
+  }
+
+  if ((update->fields & MUMBLE_USER_FIELD_COMMENT) && !text_equals(user->comment, update->comment, update->comment_length)) {
+    g_free(user->comment);
+    user->comment = g_strndup(update->comment, update->comment_length);
+    changed |= MUMBLE_USER_FIELD_COMMENT;
+  }
+
+  if ((update->fields & MUMBLE_USER_FIELD_TEXTURE_HASH) && (!(flags & MUMBLE_USER_HAS_TEXTURE_HASH) || memcmp(user->texture_hash, update->texture_hash, MUMBLE_USER_HASH_SIZE))) {
+    memcpy(user->texture_hash, update->texture_hash, MUMBLE_USER_HASH_SIZE);
+    flags |= MUMBLE_USER_HAS_TEXTURE_HASH;
+    changed |= MUMBLE_USER_FIELD_TEXTURE_HASH;
+  }
+
+  if ((update->fields & MUMBLE_USER_FIELD_CERTIFICATE_HASH) && !text_equals(user->certificate_hash, update->certificate_hash, update->certificate_hash_length)) {
+    memcpy(user->certificate_hash, update->certificate_hash, update->certificate_hash_length);
+    user->certificate_hash[update->certificate_hash_length] = '\0';
+    changed |= MUMBLE_USER_FIELD_CERTIFICATE_HASH;
+  }
+
+  if (flags != user->flags) {
+    if ((flags ^ user->flags) & update->flags_mask) {
+      changed |= MUMBLE_USER_FIELD_FLAGS;
+    }
+    user->flags = flags;
+  }
+
+  return changed;
+}
+
+void mumble_user_set_comment(MumbleUser *user, gchar *comment) {
+  g_free(user->comment);
+  user->comment = g_strdup(comment);
+}
 
 void mumble_user_set_name(MumbleUser *user, gchar *name) {
   g_free(user->name);
@@ -26,11 +189,14 @@ void mumble_user_set_name(MumbleUser *user, gchar *name) {
 
 void mumble_user_free(MumbleUser *user) {
   g_free(user->name);
+  g_free(user->comment);
   g_free(user);
 }
 
 MumbleUser *mumble_user_copy(MumbleUser *user) {
-  MumbleUser *copy = mumble_user_new(user->session_id, user->name, user->channel_id);
+  MumbleUser *copy = g_memdup2(user, sizeof(MumbleUser));
+  copy->name = g_strdup(user->name);
+  copy->comment = g_strdup(user->comment);
   return copy;
 }
 
@@ -44,4 +210,8 @@ MumbleUser *mumble_user_new(guint session_id, gchar *name, guint channel_id) {
   return user;
 }
 
+static gboolean text_equals(const gchar *text, const gchar *other, gsize other_length) {
+  return text && (strlen(text) == other_length) && (memcmp(text, other, other_length) == 0);
+}
+
 G_DEFINE_BOXED_TYPE(MumbleUser, mumble_user, mumble_user_copy, mumble_user_free)
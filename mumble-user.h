@@ -22,12 +22,125 @@
 
 #include <glib-object.h>
 
+#define MUMBLE_USER_HASH_SIZE             20
+#define MUMBLE_USER_CERTIFICATE_HASH_SIZE 40
+
+/**
+ * MumbleUserFlags:
+ * @MUMBLE_USER_MUTE:             Muted by an admin
+ * @MUMBLE_USER_DEAF:             Deafened by an admin
+ * @MUMBLE_USER_SUPPRESS:         Suppressed by the server
+ * @MUMBLE_USER_SELF_MUTE:        Muted by the user
+ * @MUMBLE_USER_SELF_DEAF:        Deafened by the user
+ * @MUMBLE_USER_PRIORITY_SPEAKER: Speaks over others
+ * @MUMBLE_USER_RECORDING:        Recording the channel
+ * @MUMBLE_USER_REGISTERED:       Has a user ID
+ * @MUMBLE_USER_HAS_COMMENT_HASH: Has a comment hash
+ * @MUMBLE_USER_HAS_TEXTURE_HASH: Has an avatar hash
+ *
+ * The first seven are the boolean fields of UserState in the same order.
+ */
+typedef enum {
+  MUMBLE_USER_MUTE             = 1 << 0,
+  MUMBLE_USER_DEAF             = 1 << 1,
+  MUMBLE_USER_SUPPRESS         = 1 << 2,
+  MUMBLE_USER_SELF_MUTE        = 1 << 3,
+  MUMBLE_USER_SELF_DEAF        = 1 << 4,
+  MUMBLE_USER_PRIORITY_SPEAKER = 1 << 5,
+  MUMBLE_USER_RECORDING        = 1 << 6,
+  MUMBLE_USER_REGISTERED       = 1 << 7,
+  MUMBLE_USER_HAS_COMMENT_HASH = 1 << 8,
+  MUMBLE_USER_HAS_TEXTURE_HASH = 1 << 9
+} MumbleUserFlags;
+
+/**
+ * MumbleUserField:
+ *
+ * Fields of a #MumbleUserUpdate that are present, and fields of a #MumbleUser
+ * that an update changed.
+ */
+typedef enum {
+  MUMBLE_USER_FIELD_NAME             = 1 << 0,
+  MUMBLE_USER_FIELD_USER_ID          = 1 << 1,
+  MUMBLE_USER_FIELD_CHANNEL_ID       = 1 << 2,
+  MUMBLE_USER_FIELD_FLAGS            = 1 << 3,
+  MUMBLE_USER_FIELD_COMMENT          = 1 << 4,
+  MUMBLE_USER_FIELD_COMMENT_HASH     = 1 << 5,
+  MUMBLE_USER_FIELD_TEXTURE          = 1 << 6,
+  MUMBLE_USER_FIELD_TEXTURE_HASH     = 1 << 7,
+  MUMBLE_USER_FIELD_CERTIFICATE_HASH = 1 << 8
+} MumbleUserField;
+
+/**
+ * MumbleUser:
+ * @flags:            #MumbleUserFlags
+ * @comment:          (nullable): Comment, or %NULL if only its hash is known
+ * @certificate_hash: Hex SHA-1 of the certificate, or empty
+ */
 typedef struct _MumbleUser {
   guint session_id;
   gchar *name;
   guint channel_id;
+  guint user_id;
+  guint16 flags;
+  gchar *comment;
+  guint8 comment_hash[MUMBLE_USER_HASH_SIZE];
+  guint8 texture_hash[MUMBLE_USER_HASH_SIZE];
+  gchar certificate_hash[MUMBLE_USER_CERTIFICATE_HASH_SIZE + 1];
 } MumbleUser;
 
+/**
+ * MumbleUserUpdate:
+ * @fields:     #MumbleUserField values of the fields present
+ * @flags:      Values of the #MumbleUserFlags present
+ * @flags_mask: #MumbleUserFlags present
+ *
+ * A UserState message. Strings and byte fields point into the message, so an
+ * update is only valid as long as the message.
+ */
+typedef struct {
+  guint fields;
+  guint16 flags;
+  guint16 flags_mask;
+  guint session_id;
+  guint user_id;
+  guint channel_id;
+  const gchar *name;
+  gsize name_length;
+  const gchar *comment;
+  gsize comment_length;
+  const guint8 *comment_hash;
+  const guint8 *texture;
+  gsize texture_length;
+  const guint8 *texture_hash;
+  const gchar *certificate_hash;
+  gsize certificate_hash_length;
+} MumbleUserUpdate;
+
+/**
+ * mumble_user_update_read:
+ * @update:  Return location for the update
+ * @payload: Payload of a UserState message
+ *
+ * Parse a UserState message without copying. Hashes that are not SHA-1 are
+ * ignored.
+ */
+void mumble_user_update_read(MumbleUserUpdate *update, GByteArray *payload);
+
+/**
+ * mumble_user_merge:
+ * @user:   A #MumbleUser
+ * @update: An update for @user
+ *
+ * Apply the fields present in @update. Memory is only allocated for strings
+ * that change. A new comment hash drops the comment, unless the update has
+ * the new comment too. @update's texture is not stored.
+ *
+ * Returns: #MumbleUserField values of the fields that changed
+ */
+guint mumble_user_merge(MumbleUser *user, const MumbleUserUpdate *update);
+
+void mumble_user_set_comment(MumbleUser *user, gchar *comment);
 void mumble_user_set_name(MumbleUser *user, gchar *name);
 void mumble_user_free(MumbleUser *user);
 MumbleUser *mumble_user_copy(MumbleUser *user);
@@ -0,0 +1,485 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include <gio/gio.h>
+#include <opus.h>
+#include "mumble-ogg.h"
+#include "mumble-voice-broadcast.h"
+#include "mumble-voice-packet.h"
+
+#define SAMPLE_RATE       48000
+#define FRAME_SAMPLES     480
+#define FRAME_DURATION    10000
+#define FRAMES_PER_PACKET 6
+#define MAX_PACKET_SIZE   (3 * 1275)
+#define BITRATE           40000
+#define READ_SIZE         4096
+
+/*
+ * Reading pauses while this many frames are waiting to be sent.
+ */
+#define MAX_QUEUED_FRAMES 200
+
+typedef enum {
+  FORMAT_UNKNOWN,
+  FORMAT_OGG_OPUS,
+  FORMAT_PCM
+} MumbleVoiceBroadcastFormat;
+
+typedef struct {
+  GBytes *data;
+  guint frames;
+} MumbleBroadcastPacket;
+
+struct _MumbleVoiceBroadcast {
+  MumbleVoiceBroadcastSendFunc send_func;
+  MumbleVoiceBroadcastDoneFunc done_func;
+  gpointer user_data;
+  GCancellable *cancellable;
+  GInputStream *input_stream;
+  gboolean reading;
+  gboolean end_of_input;
+  gboolean finished;
+  MumbleVoiceBroadcastFormat format;
+  GByteArray *input;
+  MumbleOggReader *ogg_reader;
+  guint ogg_packet_count;
+  OpusRepacketizer *repacketizer;
+  GPtrArray *repacketizer_inputs;
+  guint repacketized_frames;
+  OpusEncoder *encoder;
+  GQueue packets;
+  guint queued_frames;
+  guint64 sequence;
+  gint64 start_time;
+  guint timer;
+  guint packet_count;
+  MumbleLatencyStats *pacing_stats;
+  MumbleLatencyStats *lag_stats;
+};
+
+static void on_opened(GObject *, GAsyncResult *, gpointer);
+static void on_read(GObject *, GAsyncResult *, gpointer);
+static void read_more(MumbleVoiceBroadcast *);
+static gboolean process_input(MumbleVoiceBroadcast *, GError **);
+static gboolean process_ogg_opus(MumbleVoiceBroadcast *, GError **);
+static void process_pcm(MumbleVoiceBroadcast *);
+static void add_opus_packet(MumbleVoiceBroadcast *, GByteArray *);
+static void flush_repacketizer(MumbleVoiceBroadcast *);
+static void encode_pcm(MumbleVoiceBroadcast *, const guint8 *);
+static void queue_packet(MumbleVoiceBroadcast *, const guint8 *, gsize, guint);
+static void schedule_next(MumbleVoiceBroadcast *);
+static gboolean on_tick(gpointer);
+static void send_packet(MumbleVoiceBroadcast *, const guint8 *, gsize, gboolean);
+static void finish(MumbleVoiceBroadcast *, GError *);
+static void broadcast_packet_free(MumbleBroadcastPacket *);
+
+void mumble_voice_broadcast_stop(MumbleVoiceBroadcast *broadcast) {
+  if (!broadcast->finished) {
+    finish(broadcast, NULL);
+  }
+}
+
+MumbleLatencyStats *mumble_voice_broadcast_get_pacing_stats(MumbleVoiceBroadcast *broadcast) {
+  return broadcast->pacing_stats;
+}
+
+MumbleLatencyStats *mumble_voice_broadcast_get_lag_stats(MumbleVoiceBroadcast *broadcast) {
+  return broadcast->lag_stats;
+}
+
+guint mumble_voice_broadcast_get_packet_count(MumbleVoiceBroadcast *broadcast) {
+  return broadcast->packet_count;
+}
+
+void mumble_voice_broadcast_free(MumbleVoiceBroadcast *broadcast) {
+  g_cancellable_cancel(broadcast->cancellable);
+  g_object_unref(broadcast->cancellable);
+  g_clear_object(&broadcast->input_stream);
+
+  if (broadcast->timer) {
+    g_source_remove(broadcast->timer);
+  }
+
+  MumbleBroadcastPacket *packet;
+  while ((packet = g_queue_pop_head(&broadcast->packets))) {
+    broadcast_packet_free(packet);
+  }
+
+  g_byte_array_unref(broadcast->input);
+  g_clear_pointer(&broadcast->ogg_reader, mumble_ogg_reader_free);
+  g_clear_pointer(&broadcast->repacketizer, opus_repacketizer_destroy);
+  g_ptr_array_free(broadcast->repacketizer_inputs, TRUE);
+  g_clear_pointer(&broadcast->encoder, opus_encoder_destroy);
+
+  mumble_latency_stats_free(broadcast->pacing_stats);
+  mumble_latency_stats_free(broadcast->lag_stats);
+
+  g_free(broadcast);
+}
+
+MumbleVoiceBroadcast *mumble_voice_broadcast_new(const gchar *path, MumbleVoiceBroadcastSendFunc send_func, MumbleVoiceBroadcastDoneFunc done_func, gpointer user_data) {
+  MumbleVoiceBroadcast *broadcast = g_new0(MumbleVoiceBroadcast, 1);
+  broadcast->send_func           = send_func;
+  broadcast->done_func           = done_func;
+  broadcast->user_data           = user_data;
+  broadcast->cancellable         = g_cancellable_new();
+  broadcast->input               = g_byte_array_new();
+  broadcast->repacketizer_inputs = g_ptr_array_new_with_free_func((GDestroyNotify) g_byte_array_unref);
+  broadcast->pacing_stats        = mumble_latency_stats_new();
+  broadcast->lag_stats           = mumble_latency_stats_new();
+  g_queue_init(&broadcast->packets);
+
+  GFile *file = g_file_new_for_path(path);
+  g_file_read_async(file, G_PRIORITY_DEFAULT, broadcast->cancellable, on_opened, broadcast);
+  g_object_unref(file);
+
+  return broadcast;
+}
+
+static void on_opened(GObject *source, GAsyncResult *result, gpointer data) {
+  GError *error = NULL;
+  GFileInputStream *input_stream = g_file_read_finish(G_FILE(source), result, &error);
+
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
+    return;
+  }
+
+  MumbleVoiceBroadcast *broadcast = data;
+
+  if (error) {
+    finish(broadcast, error);
+    return;
+  }
+
+  broadcast->input_stream = G_INPUT_STREAM(input_stream);
+  read_more(broadcast);
+}
+
+static void on_read(GObject *source, GAsyncResult *result, gpointer data) {
+  GError *error = NULL;
+  GBytes *bytes = g_input_stream_read_bytes_finish(G_INPUT_STREAM(source), result, &error);
+
+  if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+    g_error_free(error);
+    return;
+  }
+
+  MumbleVoiceBroadcast *broadcast = data;
+  broadcast->reading = FALSE;
+
+  if (error) {
+    finish(broadcast, error);
+    return;
+  }
+
+  gsize length;
+  const guint8 *chunk = g_bytes_get_data(bytes, &length);
+  if (length) {
+    g_byte_array_append(broadcast->input, chunk, length);
+  } else {
+    broadcast->end_of_input = TRUE;
+  }
+  g_bytes_unref(bytes);
+
+  if (!process_input(broadcast, &error)) {
+    finish(broadcast, error);
+    return;
+  }
+
+  read_more(broadcast);
+  schedule_next(broadcast);
+}
+
+static void read_more(MumbleVoiceBroadcast *broadcast) {
+  if (broadcast->reading || broadcast->end_of_input || (broadcast->queued_frames >= MAX_QUEUED_FRAMES)) {
+    return;
+  }
+
+  broadcast->reading = TRUE;
+  g_input_stream_read_bytes_async(broadcast->input_stream, READ_SIZE, G_PRIORITY_DEFAULT, broadcast->cancellable, on_read, broadcast);
+}
+
+/*
+ * The format is recognized by the capture pattern at the start of every Ogg page. Anything else
+ * is taken as PCM.
+ */
+static gboolean process_input(MumbleVoiceBroadcast *broadcast, GError **error) {
+  if (broadcast->format == FORMAT_UNKNOWN) {
+    if ((broadcast->input->len < 4) && !broadcast->end_of_input) {
+      return TRUE;
+    }
+
+    if ((broadcast->input->len >= 4) && !memcmp(broadcast->input->data, "OggS", 4)) {
+      broadcast->format       = FORMAT_OGG_OPUS;
+      broadcast->ogg_reader   = mumble_ogg_reader_new();
+      broadcast->repacketizer = opus_repacketizer_create();
+    } else {
+      int opus_error;
+      broadcast->encoder = opus_encoder_create(SAMPLE_RATE, 1, OPUS_APPLICATION_VOIP, &opus_error);
+      if (opus_error != OPUS_OK) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED, "Failed to create Opus encoder: %s", opus_strerror(opus_error));
+        return FALSE;
+      }
+      opus_encoder_ctl(broadcast->encoder, OPUS_SET_BITRATE(BITRATE));
+      broadcast->format = FORMAT_PCM;
+    }
+  }
+
+  if (broadcast->format == FORMAT_OGG_OPUS) {
+    return process_ogg_opus(broadcast, error);
+  }
+
+  process_pcm(broadcast);
+  return TRUE;
+}
+
+/*
+ * The first two packets of an Ogg Opus stream are the identification and comment headers. The
+ * rest are Opus packets, typically of 20 ms, which are merged into packets of up to 60 ms.
+ */
+static gboolean process_ogg_opus(MumbleVoiceBroadcast *broadcast, GError **error) {
+  mumble_ogg_reader_feed(broadcast->ogg_reader, broadcast->input->data, broadcast->input->len);
+  g_byte_array_set_size(broadcast->input, 0);
+
+  GByteArray *packet;
+  while ((packet = mumble_ogg_reader_next_packet(broadcast->ogg_reader))) {
+    broadcast->ogg_packet_count++;
+
+    if (broadcast->ogg_packet_count == 1) {
+      gboolean is_opus = (packet->len >= 8) && !memcmp(packet->data, "OpusHead", 8);
+      g_byte_array_unref(packet);
+      if (!is_opus) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "Not an Ogg Opus stream");
+        return FALSE;
+      }
+    } else if (broadcast->ogg_packet_count == 2) {
+      g_byte_array_unref(packet);
+    } else {
+      add_opus_packet(broadcast, packet);
+    }
+  }
+
+  if (broadcast->end_of_input) {
+    flush_repacketizer(broadcast);
+  }
+
+  return TRUE;
+}
+
+static void process_pcm(MumbleVoiceBroadcast *broadcast) {
+  const gsize packet_bytes = FRAMES_PER_PACKET * FRAME_SAMPLES * sizeof(gint16);
+
+  gsize offset = 0;
+  for (; offset + packet_bytes <= broadcast->input->len; offset += packet_bytes) {
+    encode_pcm(broadcast, broadcast->input->data + offset);
+  }
+  g_byte_array_remove_range(broadcast->input, 0, offset);
+
+  if (broadcast->end_of_input && broadcast->input->len) {
+    guint length = broadcast->input->len;
+    g_byte_array_set_size(broadcast->input, packet_bytes);
+    memset(broadcast->input->data + length, 0, packet_bytes - length);
+    encode_pcm(broadcast, broadcast->input->data);
+    g_byte_array_set_size(broadcast->input, 0);
+  }
+}
+
+/*
+ * The repacketizer refers to the packets given to it until it's reset, so they're kept alive
+ * until then.
+ */
+static void add_opus_packet(MumbleVoiceBroadcast *broadcast, GByteArray *packet) {
+  gint samples = opus_packet_get_nb_samples(packet->data, packet->len, SAMPLE_RATE);
+  if (samples < FRAME_SAMPLES) {
+    g_byte_array_unref(packet);
+    return;
+  }
+  guint frames = samples / FRAME_SAMPLES;
+
+  if (broadcast->repacketized_frames + frames > FRAMES_PER_PACKET) {
+    flush_repacketizer(broadcast);
+  }
+
+  if (opus_repacketizer_cat(broadcast->repacketizer, packet->data, packet->len) != OPUS_OK) {
+    flush_repacketizer(broadcast);
+    if (opus_repacketizer_cat(broadcast->repacketizer, packet->data, packet->len) != OPUS_OK) {
+      g_byte_array_unref(packet);
+      return;
+    }
+  }
+
+  g_ptr_array_add(broadcast->repacketizer_inputs, packet);
+  broadcast->repacketized_frames += frames;
+
+  if (broadcast->repacketized_frames >= FRAMES_PER_PACKET) {
+    flush_repacketizer(broadcast);
+  }
+}
+
+static void flush_repacketizer(MumbleVoiceBroadcast *broadcast) {
+  if (!broadcast->repacketized_frames) {
+    return;
+  }
+
+  guint8 buffer[MAX_PACKET_SIZE];
+  opus_int32 length = opus_repacketizer_out(broadcast->repacketizer, buffer, sizeof(buffer));
+  if (length > 0) {
+    queue_packet(broadcast, buffer, length, broadcast->repacketized_frames);
+  }
+
+  opus_repacketizer_init(broadcast->repacketizer);
+  g_ptr_array_set_size(broadcast->repacketizer_inputs, 0);
+  broadcast->repacketized_frames = 0;
+}
+
+static void encode_pcm(MumbleVoiceBroadcast *broadcast, const guint8 *pcm) {
+  opus_int16 samples[FRAMES_PER_PACKET * FRAME_SAMPLES];
+  for (guint i = 0; i < G_N_ELEMENTS(samples); i++) {
+    samples[i] = (gint16) (pcm[2 * i] | (pcm[2 * i + 1] << 8));
+  }
+
+  guint8 buffer[MAX_PACKET_SIZE];
+  opus_int32 length = opus_encode(broadcast->encoder, samples, G_N_ELEMENTS(samples), buffer, sizeof(buffer));
+  if (length > 0) {
+    queue_packet(broadcast, buffer, length, FRAMES_PER_PACKET);
+  }
+}
+
+static void queue_packet(MumbleVoiceBroadcast *broadcast, const guint8 *data, gsize length, guint frames) {
+  MumbleBroadcastPacket *packet = g_new(MumbleBroadcastPacket, 1);
+  packet->data   = g_bytes_new(data, length);
+  packet->frames = frames;
+  g_queue_push_tail(&broadcast->packets, packet);
+  broadcast->queued_frames += frames;
+}
+
+static void schedule_next(MumbleVoiceBroadcast *broadcast) {
+  if (broadcast->timer || broadcast->finished) {
+    return;
+  }
+
+  if (g_queue_is_empty(&broadcast->packets)) {
+    if (broadcast->end_of_input) {
+      finish(broadcast, NULL);
+    }
+    return;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  if (!broadcast->start_time) {
+    broadcast->start_time = now - broadcast->sequence * FRAME_DURATION;
+  }
+
+  gint64 due_time = broadcast->start_time + broadcast->sequence * FRAME_DURATION;
+  gint64 delay = MAX(due_time - now, 0);
+  broadcast->timer = g_timeout_add((delay + 999) / 1000, on_tick, broadcast);
+}
+
+/*
+ * Every packet that is due is sent, so that a main loop that was blocked catches up instead of
+ * shifting the rest of the broadcast.
+ */
+static gboolean on_tick(gpointer data) {
+  MumbleVoiceBroadcast *broadcast = data;
+  broadcast->timer = 0;
+
+  gint64 now = g_get_monotonic_time();
+  gint64 due_time = broadcast->start_time + broadcast->sequence * FRAME_DURATION;
+  mumble_latency_stats_add(broadcast->pacing_stats, (now - due_time) / 1000.0);
+
+  MumbleBroadcastPacket *packet;
+  while ((packet = g_queue_peek_head(&broadcast->packets)) && (due_time <= now)) {
+    g_queue_pop_head(&broadcast->packets);
+
+    mumble_latency_stats_add(broadcast->lag_stats, (now - due_time) / 1000.0);
+
+    gsize length;
+    const guint8 *payload = g_bytes_get_data(packet->data, &length);
+    gboolean last = broadcast->end_of_input && g_queue_is_empty(&broadcast->packets);
+    send_packet(broadcast, payload, length, last);
+
+    broadcast->sequence += packet->frames;
+    broadcast->queued_frames -= packet->frames;
+    broadcast_packet_free(packet);
+
+    due_time = broadcast->start_time + broadcast->sequence * FRAME_DURATION;
+  }
+
+  /*
+   * When the input can't keep up, the schedule starts over from the next packet.
+   */
+  if (g_queue_is_empty(&broadcast->packets) && !broadcast->end_of_input) {
+    broadcast->start_time = 0;
+  }
+
+  read_more(broadcast);
+  schedule_next(broadcast);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void send_packet(MumbleVoiceBroadcast *broadcast, const guint8 *payload, gsize length, gboolean terminator) {
+  MumbleVoicePacket packet = {
+    .type           = MUMBLE_VOICE_OPUS,
+    .sequence       = broadcast->sequence,
+    .payload        = payload,
+    .payload_length = length,
+    .terminator     = terminator
+  };
+
+  GByteArray *buffer = g_byte_array_new();
+  mumble_voice_packet_write(&packet, buffer, FALSE);
+  broadcast->send_func(buffer, broadcast->user_data);
+
+  broadcast->packet_count++;
+}
+
+/*
+ * A broadcast that ends normally has marked its last packet as the terminator. Otherwise an
+ * empty terminator is sent, provided that anything was sent at all.
+ */
+static void finish(MumbleVoiceBroadcast *broadcast, GError *error) {
+  gboolean terminated = !error && broadcast->end_of_input && g_queue_is_empty(&broadcast->packets);
+
+  broadcast->finished = TRUE;
+  g_cancellable_cancel(broadcast->cancellable);
+  if (broadcast->timer) {
+    g_source_remove(broadcast->timer);
+    broadcast->timer = 0;
+  }
+
+  if (broadcast->packet_count && !terminated) {
+    send_packet(broadcast, NULL, 0, TRUE);
+  }
+
+  broadcast->done_func(error, broadcast->user_data);
+
+  if (error) {
+    g_error_free(error);
+  }
+}
+
+static void broadcast_packet_free(MumbleBroadcastPacket *packet) {
+  g_bytes_unref(packet->data);
+  g_free(packet);
+}
@@ -0,0 +1,109 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_VOICE_BROADCAST_H
+#define MUMBLE_VOICE_BROADCAST_H
+
+#include <glib.h>
+#include "mumble-latency-stats.h"
+
+/**
+ * SECTION:mumblevoicebroadcast
+ * @short_description: Voice broadcast from a file
+ *
+ * Streams a file or a pipe as voice at real-time pace. The input is either an
+ * Ogg Opus stream, whose packets are sent as they are, or signed 16-bit
+ * little-endian mono PCM at 48 kHz, which is encoded with Opus. Packets carry
+ * up to 60 ms of audio each.
+ *
+ * Packets are due at fixed intervals from the start of the broadcast by the
+ * monotonic clock. If the input runs dry, the schedule starts over when more
+ * data arrives. The broadcast ends with a terminator packet.
+ */
+
+/**
+ * MumbleVoiceBroadcastSendFunc:
+ * @packet:    (transfer full): Encoded voice packet without a session
+ * @user_data: User data passed to mumble_voice_broadcast_new()
+ */
+typedef void (*MumbleVoiceBroadcastSendFunc)(GByteArray *packet, gpointer user_data);
+
+/**
+ * MumbleVoiceBroadcastDoneFunc:
+ * @error:     (nullable): Why the broadcast failed, or %NULL if it ended normally
+ * @user_data: User data passed to mumble_voice_broadcast_new()
+ *
+ * Called once when the broadcast ends. The broadcast may be freed in the
+ * callback.
+ */
+typedef void (*MumbleVoiceBroadcastDoneFunc)(GError *error, gpointer user_data);
+
+typedef struct _MumbleVoiceBroadcast MumbleVoiceBroadcast;
+
+/**
+ * mumble_voice_broadcast_stop:
+ * @broadcast: A #MumbleVoiceBroadcast
+ *
+ * End the broadcast now with a terminator packet.
+ */
+void mumble_voice_broadcast_stop(MumbleVoiceBroadcast *broadcast);
+
+/**
+ * mumble_voice_broadcast_get_pacing_stats:
+ * @broadcast: A #MumbleVoiceBroadcast
+ *
+ * Returns: (transfer none): How late the scheduler woke up for each packet
+ */
+MumbleLatencyStats *mumble_voice_broadcast_get_pacing_stats(MumbleVoiceBroadcast *broadcast);
+
+/**
+ * mumble_voice_broadcast_get_lag_stats:
+ * @broadcast: A #MumbleVoiceBroadcast
+ *
+ * Returns: (transfer none): How long each packet waited in the send queue
+ * after it was due
+ */
+MumbleLatencyStats *mumble_voice_broadcast_get_lag_stats(MumbleVoiceBroadcast *broadcast);
+
+/**
+ * mumble_voice_broadcast_get_packet_count:
+ * @broadcast: A #MumbleVoiceBroadcast
+ *
+ * Returns: Number of packets sent so far
+ */
+guint mumble_voice_broadcast_get_packet_count(MumbleVoiceBroadcast *broadcast);
+
+void mumble_voice_broadcast_free(MumbleVoiceBroadcast *broadcast);
+
+/**
+ * mumble_voice_broadcast_new:
+ * @path:      Path of the file or pipe to play
+ * @send_func: Function to send voice packets with
+ * @done_func: Function to call when the broadcast ends
+ * @user_data: User data for @send_func and @done_func
+ *
+ * Start a broadcast. Reading happens asynchronously, so errors in opening
+ * @path are reported through @done_func.
+ *
+ * Returns: A new #MumbleVoiceBroadcast
+ */
+MumbleVoiceBroadcast *mumble_voice_broadcast_new(const gchar *path, MumbleVoiceBroadcastSendFunc send_func, MumbleVoiceBroadcastDoneFunc done_func, gpointer user_data);
+
+#endif
@@ -0,0 +1,256 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <string.h>
+#include "mumble-voice-packet.h"
+
+#define OPUS_LENGTH_MASK    0x1FFF
+#define OPUS_TERMINATOR_BIT 0x2000
+
+static gboolean read_legacy_frames(MumbleVoicePacket *packet, const guint8 *buffer, gsize length, gsize *offset);
+static gfloat read_float(const guint8 *buffer);
+
+gboolean mumble_voice_packet_read(MumbleVoicePacket *packet, const guint8 *buffer, gsize length, gboolean has_session) {
+  if (!length) {
+    return FALSE;
+  }
+
+  memset(packet, 0, sizeof(MumbleVoicePacket));
+  packet->type   = buffer[0] >> 5;
+  packet->target = buffer[0] & 0x1F;
+
+  gsize offset = 1;
+
+  if (packet->type == MUMBLE_VOICE_PING) {
+    return read_mumble_varint(buffer, length, &offset, &packet->sequence);
+  }
+
+  if (has_session && !read_mumble_varint(buffer, length, &offset, &packet->session)) {
+    return FALSE;
+  }
+  if (!read_mumble_varint(buffer, length, &offset, &packet->sequence)) {
+    return FALSE;
+  }
+
+  switch (packet->type) {
+    case MUMBLE_VOICE_OPUS: {
+      guint64 header;
+      if (!read_mumble_varint(buffer, length, &offset, &header)) {
+        return FALSE;
+      }
+      packet->payload_length = header & OPUS_LENGTH_MASK;
+      packet->terminator     = (header & OPUS_TERMINATOR_BIT) != 0;
+      if (packet->payload_length > length - offset) {
+        return FALSE;
+      }
+      packet->payload = buffer + offset;
+      offset += packet->payload_length;
+      break;
+    }
+    case MUMBLE_VOICE_CELT_ALPHA:
+    case MUMBLE_VOICE_SPEEX:
+    case MUMBLE_VOICE_CELT_BETA:
+      if (!read_legacy_frames(packet, buffer, length, &offset)) {
+        return FALSE;
+      }
+      break;
+    default:
+      return FALSE;
+  }
+
+  if (length - offset >= 3 * sizeof(gfloat)) {
+    packet->has_position = TRUE;
+    for (guint i = 0; i < 3; i++) {
+      packet->position[i] = read_float(buffer + offset + i * sizeof(gfloat));
+    }
+  }
+
+  return TRUE;
+}
+
+void mumble_voice_packet_write(MumbleVoicePacket *packet, GByteArray *buffer, gboolean has_session) {
+  guint8 header = (packet->type << 5) | (packet->target & 0x1F);
+  g_byte_array_append(buffer, &header, 1);
+
+  if (packet->type == MUMBLE_VOICE_PING) {
+    write_mumble_varint(buffer, packet->sequence);
+    return;
+  }
+
+  if (has_session) {
+    write_mumble_varint(buffer, packet->session);
+  }
+  write_mumble_varint(buffer, packet->sequence);
+  write_mumble_varint(buffer, (packet->payload_length & OPUS_LENGTH_MASK) | (packet->terminator ? OPUS_TERMINATOR_BIT : 0));
+  g_byte_array_append(buffer, packet->payload, packet->payload_length);
+}
+
+/*
+ * The first byte tells the length of the encoding: 0xxxxxxx is a 7-bit number, 10xxxxxx a 14-bit
+ * number, 110xxxxx a 21-bit number and 1110xxxx a 28-bit number with the rest of the bits in the
+ * following bytes. 111100__ and 111101__ are followed by a 32-bit and a 64-bit number,
+ * 111110__ negates the following varint and 111111xx is a negated two-bit number.
+ */
+gboolean read_mumble_varint(const guint8 *buffer, gsize length, gsize *offset, guint64 *value) {
+  if (*offset >= length) {
+    return FALSE;
+  }
+
+  const guint8 *bytes = buffer + *offset;
+  gsize available = length - *offset;
+  guint8 first = bytes[0];
+  gsize size;
+
+  if (!(first & 0x80)) {
+    *value = first;
+    size = 1;
+  } else if ((first & 0xC0) == 0x80) {
+    if (available < 2) {
+      return FALSE;
+    }
+    *value = ((guint64) (first & 0x3F) << 8) | bytes[1];
+    size = 2;
+  } else if ((first & 0xE0) == 0xC0) {
+    if (available < 3) {
+      return FALSE;
+    }
+    *value = ((guint64) (first & 0x1F) << 16) | (bytes[1] << 8) | bytes[2];
+    size = 3;
+  } else if ((first & 0xF0) == 0xE0) {
+    if (available < 4) {
+      return FALSE;
+    }
+    *value = ((guint64) (first & 0x0F) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+    size = 4;
+  } else {
+    switch (first & 0xFC) {
+      case 0xF0:
+        if (available < 5) {
+          return FALSE;
+        }
+        *value = ((guint64) bytes[1] << 24) | (bytes[2] << 16) | (bytes[3] << 8) | bytes[4];
+        size = 5;
+        break;
+      case 0xF4:
+        if (available < 9) {
+          return FALSE;
+        }
+        *value = 0;
+        for (guint i = 1; i < 9; i++) {
+          *value = (*value << 8) | bytes[i];
+        }
+        size = 9;
+        break;
+      case 0xF8: {
+        gsize inner_offset = *offset + 1;
+        if (!read_mumble_varint(buffer, length, &inner_offset, value)) {
+          return FALSE;
+        }
+        *value = ~*value;
+        *offset = inner_offset;
+        return TRUE;
+      }
+      default:
+        *value = ~((guint64) (first & 0x03));
+        size = 1;
+        break;
+    }
+  }
+
+  *offset += size;
+  return TRUE;
+}
+
+/*
+ * Frames of the legacy codecs are prefixed with a byte whose low seven bits are the length of
+ * the frame and whose high bit tells if another frame follows. An empty frame terminates the
+ * transmission.
+ */
+static gboolean read_legacy_frames(MumbleVoicePacket *packet, const guint8 *buffer, gsize length, gsize *offset) {
+  gsize start = *offset;
+  guint8 header;
+
+  do {
+    if (*offset >= length) {
+      return FALSE;
+    }
+    header = buffer[(*offset)++];
+    gsize frame_length = header & 0x7F;
+    if (frame_length > length - *offset) {
+      return FALSE;
+    }
+    *offset += frame_length;
+    packet->terminator = !frame_length;
+  } while (header & 0x80);
+
+  packet->payload        = buffer + start;
+  packet->payload_length = *offset - start;
+
+  return TRUE;
+}
+
+static gfloat read_float(const guint8 *buffer) {
+  guint32 bits;
+  memcpy(&bits, buffer, sizeof(bits));
+  bits = GUINT32_FROM_LE(bits);
+
+  gfloat value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
+void write_mumble_varint(GByteArray *buffer, guint64 value) {
+  guint8 bytes[9];
+  gsize size;
+
+  if (value < 0x80) {
+    bytes[0] = value;
+    size = 1;
+  } else if (value < 0x4000) {
+    bytes[0] = 0x80 | (value >> 8);
+    bytes[1] = value;
+    size = 2;
+  } else if (value < 0x200000) {
+    bytes[0] = 0xC0 | (value >> 16);
+    bytes[1] = value >> 8;
+    bytes[2] = value;
+    size = 3;
+  } else if (value < 0x10000000) {
+    bytes[0] = 0xE0 | (value >> 24);
+    bytes[1] = value >> 16;
+    bytes[2] = value >> 8;
+    bytes[3] = value;
+    size = 4;
+  } else if (value <= G_MAXUINT32) {
+    bytes[0] = 0xF0;
+    for (guint i = 1; i < 5; i++) {
+      bytes[i] = value >> (8 * (4 - i));
+    }
+    size = 5;
+  } else {
+    bytes[0] = 0xF4;
+    for (guint i = 1; i < 9; i++) {
+      bytes[i] = value >> (8 * (8 - i));
+    }
+    size = 9;
+  }
+
+  g_byte_array_append(buffer, bytes, size);
+}
@@ -0,0 +1,130 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_VOICE_PACKET_H
+#define MUMBLE_VOICE_PACKET_H
+
+#include <glib.h>
+
+/**
+ * SECTION:mumblevoicepacket
+ * @short_description: Mumble legacy voice packet
+ *
+ * Voice packets travel inside UDPTunnel messages or UDP datagrams. They begin
+ * with a header byte whose three high bits are the codec type and five low
+ * bits the target, followed by fields encoded with Mumble's own variable
+ * length integer scheme. Packets sent by the server include the session of
+ * the speaker, packets sent by clients don't.
+ *
+ * Parsing doesn't copy or allocate: the payload of a parsed packet points into
+ * the buffer it was read from.
+ */
+
+/**
+ * MumbleVoiceType:
+ * @MUMBLE_VOICE_CELT_ALPHA: 0
+ * @MUMBLE_VOICE_PING:       1
+ * @MUMBLE_VOICE_SPEEX:      2
+ * @MUMBLE_VOICE_CELT_BETA:  3
+ * @MUMBLE_VOICE_OPUS:       4
+ */
+typedef enum {
+  MUMBLE_VOICE_CELT_ALPHA,
+  MUMBLE_VOICE_PING,
+  MUMBLE_VOICE_SPEEX,
+  MUMBLE_VOICE_CELT_BETA,
+  MUMBLE_VOICE_OPUS
+} MumbleVoiceType;
+
+/**
+ * MumbleVoicePacket:
+ * @type:           Codec type
+ * @target:         Voice target, 0 for normal talking
+ * @session:        Session of the speaker, only in packets from the server
+ * @sequence:       Sequence number, or the timestamp of a ping
+ * @payload:        Codec data, pointing into the parsed buffer
+ * @payload_length: Length of @payload
+ * @terminator:     Whether this is the last packet of a transmission
+ * @has_position:   Whether @position is set
+ * @position:       Positional audio coordinates
+ *
+ * For Opus the payload is a single Opus packet. For the legacy codecs it's the
+ * sequence of length-prefixed frames as is.
+ */
+typedef struct _MumbleVoicePacket {
+  MumbleVoiceType type;
+  guint target;
+  guint64 session;
+  guint64 sequence;
+  const guint8 *payload;
+  gsize payload_length;
+  gboolean terminator;
+  gboolean has_position;
+  gfloat position[3];
+} MumbleVoicePacket;
+
+/**
+ * mumble_voice_packet_read:
+ * @packet:      Destination #MumbleVoicePacket
+ * @buffer:      Byte buffer
+ * @length:      Length of @buffer
+ * @has_session: Whether the packet includes the session of the speaker
+ *
+ * Parse the voice packet in @buffer. @buffer must stay alive as long as the
+ * payload of @packet is used.
+ *
+ * Returns: %FALSE if the packet is malformed
+ */
+gboolean mumble_voice_packet_read(MumbleVoicePacket *packet, const guint8 *buffer, gsize length, gboolean has_session);
+
+/**
+ * mumble_voice_packet_write:
+ * @packet:      A #MumbleVoicePacket of type %MUMBLE_VOICE_OPUS or %MUMBLE_VOICE_PING
+ * @buffer:      Byte array to append the packet to
+ * @has_session: Whether to include the session of the speaker
+ *
+ * Encode @packet. Positional audio isn't written.
+ */
+void mumble_voice_packet_write(MumbleVoicePacket *packet, GByteArray *buffer, gboolean has_session);
+
+/**
+ * read_mumble_varint:
+ * @buffer: Byte buffer
+ * @length: Length of @buffer
+ * @offset: Offset of the integer in @buffer, advanced past it
+ * @value:  Destination for the decoded integer
+ *
+ * Decode an integer encoded with Mumble's variable length scheme.
+ *
+ * Returns: %FALSE if @buffer ends before the integer does
+ */
+gboolean read_mumble_varint(const guint8 *buffer, gsize length, gsize *offset, guint64 *value);
+
+/**
+ * write_mumble_varint:
+ * @buffer: Byte array to append the integer to
+ * @value:  Integer to encode
+ *
+ * Encode an integer with Mumble's variable length scheme in as few bytes as
+ * possible.
+ */
+void write_mumble_varint(GByteArray *buffer, guint64 value);
+
+#endif
@@ -0,0 +1,375 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+#include <opus.h>
+#include "mumble-jitter-buffer.h"
+#include "mumble-mixer.h"
+#include "mumble-voice-receiver.h"
+
+#define SAMPLE_RATE        48000
+#define FRAME_SAMPLES      480
+#define MAX_PACKET_SAMPLES 5760
+
+/*
+ * When the main loop falls behind, at most this many 10 ms frames are produced to catch up; the
+ * rest are skipped.
+ */
+#define MAX_CATCH_UP_FRAMES 5
+
+/*
+ * Speakers whose last packet is older than this are dropped along with their decoder.
+ */
+#define SPEAKER_TIMEOUT (5 * G_USEC_PER_SEC)
+
+typedef struct {
+  OpusDecoder *decoder;
+  MumbleJitterBuffer *jitter_buffer;
+  gfloat pcm[MAX_PACKET_SAMPLES + FRAME_SAMPLES];
+  guint pcm_length;
+  gint64 last_packet_time;
+  gfloat gain;
+} MumbleSpeaker;
+
+struct _MumbleVoiceReceiver {
+  gchar *sink_path;
+  gint sink;
+  GHashTable *speakers;
+  GHashTable *gains;
+  MumbleLatencyStats *latency_stats;
+  guint lost;
+  guint late;
+  guint playout_source;
+  gint64 playout_start;
+  guint64 played_frames;
+  GPtrArray *mix_inputs;
+  GArray *mix_gains;
+  gint16 output[FRAME_SAMPLES];
+};
+
+static gint open_sink(const gchar *);
+static void write_frame(MumbleVoiceReceiver *);
+static gboolean on_playout_tick(gpointer);
+static void mix_frame(MumbleVoiceReceiver *, gint64);
+static gboolean fill_speaker(MumbleVoiceReceiver *, MumbleSpeaker *, gint64);
+static void conceal_frame(MumbleSpeaker *);
+static MumbleSpeaker *speaker_new();
+static void speaker_free(MumbleSpeaker *);
+
+void mumble_voice_receiver_push(MumbleVoiceReceiver *receiver, MumbleVoicePacket *packet) {
+  if (packet->type != MUMBLE_VOICE_OPUS) {
+    return;
+  }
+
+  /*
+   * A terminator may come without audio. It still takes up a frame so that it has a place in the
+   * sequence.
+   */
+  guint frames = 1;
+  if (packet->payload_length) {
+    gint samples = opus_packet_get_nb_samples(packet->payload, packet->payload_length, SAMPLE_RATE);
+    if (samples < FRAME_SAMPLES) {
+      return;
+    }
+    frames = samples / FRAME_SAMPLES;
+  } else if (!packet->terminator) {
+    return;
+  }
+
+  MumbleSpeaker *speaker = g_hash_table_lookup(receiver->speakers, GUINT_TO_POINTER(packet->session));
+  if (!speaker) {
+    speaker = speaker_new();
+    if (!speaker) {
+      return;
+    }
+    gfloat *gain = g_hash_table_lookup(receiver->gains, GUINT_TO_POINTER(packet->session));
+    speaker->gain = gain ? *gain : 1.0f;
+    g_hash_table_insert(receiver->speakers, GUINT_TO_POINTER(packet->session), speaker);
+  }
+
+  gint64 now = g_get_monotonic_time();
+  speaker->last_packet_time = now;
+
+  mumble_jitter_buffer_push(speaker->jitter_buffer, packet->sequence, frames, packet->payload, packet->payload_length, packet->terminator, now);
+
+  if (!receiver->playout_source) {
+    receiver->playout_start  = now;
+    receiver->played_frames  = 0;
+    receiver->playout_source = g_timeout_add(MUMBLE_JITTER_BUFFER_FRAME_DURATION / 1000, on_playout_tick, receiver);
+  }
+}
+
+void mumble_voice_receiver_reset(MumbleVoiceReceiver *receiver) {
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, receiver->speakers);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleSpeaker *speaker = value;
+    receiver->lost += speaker->jitter_buffer->lost;
+    receiver->late += speaker->jitter_buffer->late;
+  }
+  g_hash_table_remove_all(receiver->speakers);
+  g_hash_table_remove_all(receiver->gains);
+
+  if (receiver->playout_source) {
+    g_source_remove(receiver->playout_source);
+    receiver->playout_source = 0;
+  }
+}
+
+void mumble_voice_receiver_set_gain(MumbleVoiceReceiver *receiver, guint session, gfloat gain) {
+  gfloat *stored_gain = g_new(gfloat, 1);
+  *stored_gain = gain;
+  g_hash_table_insert(receiver->gains, GUINT_TO_POINTER(session), stored_gain);
+
+  MumbleSpeaker *speaker = g_hash_table_lookup(receiver->speakers, GUINT_TO_POINTER(session));
+  if (speaker) {
+    speaker->gain = gain;
+  }
+}
+
+MumbleLatencyStats *mumble_voice_receiver_get_latency_stats(MumbleVoiceReceiver *receiver) {
+  return receiver->latency_stats;
+}
+
+void mumble_voice_receiver_get_loss(MumbleVoiceReceiver *receiver, guint *lost, guint *late) {
+  *lost = receiver->lost;
+  *late = receiver->late;
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, receiver->speakers);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleSpeaker *speaker = value;
+    *lost += speaker->jitter_buffer->lost;
+    *late += speaker->jitter_buffer->late;
+  }
+}
+
+void mumble_voice_receiver_free(MumbleVoiceReceiver *receiver) {
+  mumble_voice_receiver_reset(receiver);
+  g_hash_table_destroy(receiver->speakers);
+  g_hash_table_destroy(receiver->gains);
+  g_ptr_array_free(receiver->mix_inputs, TRUE);
+  g_array_free(receiver->mix_gains, TRUE);
+  mumble_latency_stats_free(receiver->latency_stats);
+  if (receiver->sink >= 0) {
+    close(receiver->sink);
+  }
+  g_free(receiver->sink_path);
+  g_free(receiver);
+}
+
+MumbleVoiceReceiver *mumble_voice_receiver_new(const gchar *sink_path, GError **error) {
+  gint sink = open_sink(sink_path);
+  if (sink < 0 && errno != ENXIO) {
+    int saved_errno = errno;
+    g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "Failed to open %s: %s", sink_path, g_strerror(saved_errno));
+    return NULL;
+  }
+
+  MumbleVoiceReceiver *receiver = g_new0(MumbleVoiceReceiver, 1);
+  receiver->sink_path     = g_strdup(sink_path);
+  receiver->sink          = sink;
+  receiver->speakers      = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) speaker_free);
+  receiver->gains         = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  receiver->latency_stats = mumble_latency_stats_new();
+  receiver->mix_inputs    = g_ptr_array_new();
+  receiver->mix_gains     = g_array_new(FALSE, FALSE, sizeof(gfloat));
+  return receiver;
+}
+
+/*
+ * The sink is written from the main loop, so it's opened without blocking: opening a named pipe
+ * that has no reader yet fails with ENXIO instead of waiting for one, and is retried on every
+ * tick until a reader shows up.
+ */
+static gint open_sink(const gchar *sink_path) {
+  return g_open(sink_path, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0666);
+}
+
+/*
+ * A frame is smaller than PIPE_BUF, so a non-blocking write to a pipe takes all of it or none.
+ * Frames that a slow reader has no room for are dropped rather than stalling the main loop, and
+ * when the reader goes away the pipe is reopened for the next one.
+ */
+static void write_frame(MumbleVoiceReceiver *receiver) {
+  if (receiver->sink < 0) {
+    return;
+  }
+
+  if (write(receiver->sink, receiver->output, sizeof(receiver->output)) < 0 && errno == EPIPE) {
+    close(receiver->sink);
+    receiver->sink = -1;
+  }
+}
+
+/*
+ * Playout is paced by the monotonic clock rather than by counting timer callbacks, so that a
+ * late callback produces the frames it missed instead of letting the output drift.
+ */
+static gboolean on_playout_tick(gpointer data) {
+  MumbleVoiceReceiver *receiver = data;
+
+  if (receiver->sink < 0) {
+    receiver->sink = open_sink(receiver->sink_path);
+  }
+
+  gint64 now = g_get_monotonic_time();
+  guint64 due_frames = (now - receiver->playout_start) / MUMBLE_JITTER_BUFFER_FRAME_DURATION + 1;
+  if (due_frames - receiver->played_frames > MAX_CATCH_UP_FRAMES) {
+    receiver->played_frames = due_frames - MAX_CATCH_UP_FRAMES;
+  }
+
+  for (; receiver->played_frames < due_frames; receiver->played_frames++) {
+    mix_frame(receiver, now);
+  }
+
+  if (!g_hash_table_size(receiver->speakers)) {
+    receiver->playout_source = 0;
+    return G_SOURCE_REMOVE;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Every speaker with audio for this frame is mixed first; their buffers are only advanced
+ * afterwards, so that the mixer reads them in place.
+ */
+static void mix_frame(MumbleVoiceReceiver *receiver, gint64 now) {
+  g_ptr_array_set_size(receiver->mix_inputs, 0);
+  g_array_set_size(receiver->mix_gains, 0);
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, receiver->speakers);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleSpeaker *speaker = value;
+
+    if (fill_speaker(receiver, speaker, now)) {
+      g_ptr_array_add(receiver->mix_inputs, speaker);
+      g_array_append_val(receiver->mix_gains, speaker->gain);
+    } else if (now - speaker->last_packet_time > SPEAKER_TIMEOUT) {
+      receiver->lost += speaker->jitter_buffer->lost;
+      receiver->late += speaker->jitter_buffer->late;
+      g_hash_table_iter_remove(&iter);
+    }
+  }
+
+  guint input_count = receiver->mix_inputs->len;
+  const gfloat *inputs[input_count ? input_count : 1];
+  for (guint i = 0; i < input_count; i++) {
+    inputs[i] = ((MumbleSpeaker *) g_ptr_array_index(receiver->mix_inputs, i))->pcm;
+  }
+
+  mumble_mixer_mix(inputs, (gfloat *) receiver->mix_gains->data, input_count, receiver->output, FRAME_SAMPLES);
+
+  for (guint i = 0; i < input_count; i++) {
+    MumbleSpeaker *speaker = g_ptr_array_index(receiver->mix_inputs, i);
+    speaker->pcm_length -= FRAME_SAMPLES;
+    memmove(speaker->pcm, speaker->pcm + FRAME_SAMPLES, speaker->pcm_length * sizeof(gfloat));
+  }
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  for (guint i = 0; i < FRAME_SAMPLES; i++) {
+    receiver->output[i] = GINT16_TO_LE(receiver->output[i]);
+  }
+#endif
+
+  write_frame(receiver);
+}
+
+/*
+ * Decode packets from the jitter buffer until the speaker has at least one frame of PCM. The end
+ * of a transmission is padded with silence to a whole frame.
+ *
+ * Returns: TRUE if a frame is available at the start of the PCM buffer
+ */
+static gboolean fill_speaker(MumbleVoiceReceiver *receiver, MumbleSpeaker *speaker, gint64 now) {
+  while (speaker->pcm_length < FRAME_SAMPLES) {
+    MumbleJitterBufferSlot *slot;
+    MumbleJitterBufferResult result = mumble_jitter_buffer_pop(speaker->jitter_buffer, &slot);
+
+    if (result == MUMBLE_JITTER_BUFFER_PACKET) {
+      if (slot->length) {
+        gint samples = opus_decode_float(speaker->decoder, slot->data, slot->length, speaker->pcm + speaker->pcm_length, MAX_PACKET_SAMPLES, 0);
+        if (samples > 0) {
+          speaker->pcm_length += samples;
+          mumble_latency_stats_add(receiver->latency_stats, (now - slot->arrival_time) / 1000.0);
+        } else {
+          conceal_frame(speaker);
+        }
+      }
+
+      if (slot->terminator) {
+        opus_decoder_ctl(speaker->decoder, OPUS_RESET_STATE);
+        break;
+      }
+    } else if (result == MUMBLE_JITTER_BUFFER_LOST) {
+      conceal_frame(speaker);
+    } else {
+      break;
+    }
+  }
+
+  if (!speaker->pcm_length) {
+    return FALSE;
+  }
+
+  if (speaker->pcm_length < FRAME_SAMPLES) {
+    memset(speaker->pcm + speaker->pcm_length, 0, (FRAME_SAMPLES - speaker->pcm_length) * sizeof(gfloat));
+    speaker->pcm_length = FRAME_SAMPLES;
+  }
+
+  return TRUE;
+}
+
+static void conceal_frame(MumbleSpeaker *speaker) {
+  gint samples = opus_decode_float(speaker->decoder, NULL, 0, speaker->pcm + speaker->pcm_length, FRAME_SAMPLES, 0);
+  if (samples <= 0) {
+    memset(speaker->pcm + speaker->pcm_length, 0, FRAME_SAMPLES * sizeof(gfloat));
+    samples = FRAME_SAMPLES;
+  }
+  speaker->pcm_length += samples;
+}
+
+static MumbleSpeaker *speaker_new() {
+  int error;
+  OpusDecoder *decoder = opus_decoder_create(SAMPLE_RATE, 1, &error);
+  if (error != OPUS_OK) {
+    return NULL;
+  }
+
+  MumbleSpeaker *speaker = g_new0(MumbleSpeaker, 1);
+  speaker->decoder = decoder;
+  speaker->jitter_buffer = mumble_jitter_buffer_new();
+  return speaker;
+}
+
+static void speaker_free(MumbleSpeaker *speaker) {
+  opus_decoder_destroy(speaker->decoder);
+  mumble_jitter_buffer_free(speaker->jitter_buffer);
+  g_free(speaker);
+}
@@ -0,0 +1,97 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_VOICE_RECEIVER_H
+#define MUMBLE_VOICE_RECEIVER_H
+
+#include <glib.h>
+#include "mumble-latency-stats.h"
+#include "mumble-voice-packet.h"
+
+/**
+ * SECTION:mumblevoicereceiver
+ * @short_description: Voice receive pipeline
+ *
+ * Decodes the Opus voice of every speaker through a per-session jitter buffer
+ * and mixes the result into a PCM sink. The sink receives signed 16-bit
+ * little-endian mono samples at 48 kHz while anyone is speaking; it can be a
+ * regular file or a named pipe. Writing never blocks: audio is dropped while
+ * a pipe has no reader or its reader falls behind.
+ */
+
+typedef struct _MumbleVoiceReceiver MumbleVoiceReceiver;
+
+/**
+ * mumble_voice_receiver_push:
+ * @receiver: A #MumbleVoiceReceiver
+ * @packet:   A voice packet with a session
+ *
+ * Queue a received packet for playout. Packets in codecs other than Opus are
+ * ignored.
+ */
+void mumble_voice_receiver_push(MumbleVoiceReceiver *receiver, MumbleVoicePacket *packet);
+
+/**
+ * mumble_voice_receiver_reset:
+ * @receiver: A #MumbleVoiceReceiver
+ *
+ * Drop all speakers, their gains and the audio queued for them, e.g. when the sessions
+ * they belong to are no longer valid.
+ */
+void mumble_voice_receiver_reset(MumbleVoiceReceiver *receiver);
+
+/**
+ * mumble_voice_receiver_set_gain:
+ * @receiver: A #MumbleVoiceReceiver
+ * @session:  Session of the speaker
+ * @gain:     Linear gain, 1.0 being unchanged
+ *
+ * Set the volume of a speaker in the mix.
+ */
+void mumble_voice_receiver_set_gain(MumbleVoiceReceiver *receiver, guint session, gfloat gain);
+
+/**
+ * mumble_voice_receiver_get_latency_stats:
+ * @receiver: A #MumbleVoiceReceiver
+ *
+ * Returns: (transfer none): Latencies from packet arrival to PCM output
+ */
+MumbleLatencyStats *mumble_voice_receiver_get_latency_stats(MumbleVoiceReceiver *receiver);
+
+/**
+ * mumble_voice_receiver_get_loss:
+ * @receiver: A #MumbleVoiceReceiver
+ * @lost:     Destination for the number of concealed frames
+ * @late:     Destination for the number of packets that arrived too late
+ */
+void mumble_voice_receiver_get_loss(MumbleVoiceReceiver *receiver, guint *lost, guint *late);
+
+void mumble_voice_receiver_free(MumbleVoiceReceiver *receiver);
+
+/**
+ * mumble_voice_receiver_new:
+ * @sink_path: Path of the file or pipe to write PCM to
+ * @error:     Return location for a #GError
+ *
+ * Returns: A new #MumbleVoiceReceiver, or %NULL if the sink can't be opened
+ */
+MumbleVoiceReceiver *mumble_voice_receiver_new(const gchar *sink_path, GError **error);
+
+#endif
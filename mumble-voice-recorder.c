@@ -0,0 +1,374 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include <glib/gstdio.h>
+#include <opus.h>
+#include "mumble-ogg.h"
+#include "mumble-voice-recorder.h"
+
+#define SAMPLE_RATE 48000
+
+/*
+ * Decoder delay of the libopus encoder at 48 kHz, to be skipped at the start of a stream.
+ */
+#define PRE_SKIP 312
+
+/*
+ * Packets that arrive later than their position in the stream by less than this many samples
+ * are taken as jitter. Longer pauses are filled with empty 20 ms frames, up to six per packet.
+ */
+#define MAX_JITTER_SAMPLES  9600
+#define SILENCE_SAMPLES     960
+#define MAX_SILENCE_FRAMES  6
+
+/*
+ * Buffered pages are written out when there are this many bytes of them or the oldest is
+ * older than FLUSH_INTERVAL. Files that haven't received packets for IDLE_TIMEOUT are closed.
+ */
+#define FLUSH_SIZE     (64 * 1024)
+#define FLUSH_INTERVAL G_USEC_PER_SEC
+#define IDLE_TIMEOUT   (60 * G_USEC_PER_SEC)
+
+typedef struct {
+  guint key;
+  guint session;
+  gint64 arrival_time;
+  gsize length;
+  guint8 data[];
+} MumbleRecorderItem;
+
+typedef struct {
+  MumbleOggWriter *writer;
+  guint64 position;
+} MumbleRecordingStream;
+
+typedef struct {
+  FILE *file;
+  gsize size;
+  gint64 start_time;
+  gint64 last_packet_time;
+  gint64 last_write_time;
+  GByteArray *pending;
+  GHashTable *streams;
+} MumbleRecording;
+
+struct _MumbleVoiceRecorder {
+  gchar *directory;
+  MumbleVoiceRecorderMode mode;
+  gsize max_size;
+  gint64 max_duration;
+  GAsyncQueue *queue;
+  GThread *thread;
+  GHashTable *recordings;
+};
+
+static MumbleRecorderItem stop_item;
+
+static gpointer run(gpointer);
+static void write_item(MumbleVoiceRecorder *, MumbleRecorderItem *);
+static MumbleRecording *open_recording(MumbleVoiceRecorder *, guint, gint64);
+static void start_link(MumbleRecording *, guint, guint64);
+static void write_identification_header(MumbleOggWriter *, GByteArray *);
+static void write_comment_header(MumbleOggWriter *, guint, GByteArray *);
+static void fill_silence(MumbleRecordingStream *, guint64, GByteArray *);
+static void flush_recordings(MumbleVoiceRecorder *, gint64);
+static void write_pending(MumbleRecording *, gint64);
+static void close_recording(gpointer);
+static void recording_stream_free(gpointer);
+
+void mumble_voice_recorder_record(MumbleVoiceRecorder *recorder, guint channel_id, MumbleVoicePacket *packet) {
+  if ((packet->type != MUMBLE_VOICE_OPUS) || !packet->payload_length) {
+    return;
+  }
+
+  MumbleRecorderItem *item = g_malloc(sizeof(MumbleRecorderItem) + packet->payload_length);
+  item->key          = (recorder->mode == MUMBLE_VOICE_RECORDER_PER_CHANNEL) ? channel_id : packet->session;
+  item->session      = packet->session;
+  item->arrival_time = g_get_monotonic_time();
+  item->length       = packet->payload_length;
+  memcpy(item->data, packet->payload, packet->payload_length);
+
+  g_async_queue_push(recorder->queue, item);
+}
+
+void mumble_voice_recorder_free(MumbleVoiceRecorder *recorder) {
+  g_async_queue_push(recorder->queue, &stop_item);
+  g_thread_join(recorder->thread);
+
+  g_async_queue_unref(recorder->queue);
+  g_hash_table_destroy(recorder->recordings);
+  g_free(recorder->directory);
+  g_free(recorder);
+}
+
+MumbleVoiceRecorder *mumble_voice_recorder_new(const gchar *directory, MumbleVoiceRecorderMode mode, gsize max_size, guint max_duration) {
+  MumbleVoiceRecorder *recorder = g_new0(MumbleVoiceRecorder, 1);
+  recorder->directory    = g_strdup(directory);
+  recorder->mode         = mode;
+  recorder->max_size     = max_size;
+  recorder->max_duration = (gint64) max_duration * G_USEC_PER_SEC;
+  recorder->queue        = g_async_queue_new();
+  recorder->recordings   = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, close_recording);
+  recorder->thread       = g_thread_new("mumble-recorder", run, recorder);
+  return recorder;
+}
+
+/*
+ * Everything that is queued is handled before any file is written to, so that writes are
+ * batched under load. Recordings are owned by this thread.
+ */
+static gpointer run(gpointer data) {
+  MumbleVoiceRecorder *recorder = data;
+
+  for (;;) {
+    MumbleRecorderItem *item = g_async_queue_timeout_pop(recorder->queue, FLUSH_INTERVAL);
+    for (; item; item = g_async_queue_try_pop(recorder->queue)) {
+      if (item == &stop_item) {
+        g_hash_table_remove_all(recorder->recordings);
+        return NULL;
+      }
+      write_item(recorder, item);
+      g_free(item);
+    }
+
+    flush_recordings(recorder, g_get_monotonic_time());
+  }
+}
+
+static void write_item(MumbleVoiceRecorder *recorder, MumbleRecorderItem *item) {
+  gint samples = opus_packet_get_nb_samples(item->data, item->length, SAMPLE_RATE);
+  if (samples <= 0) {
+    return;
+  }
+
+  MumbleRecording *recording = g_hash_table_lookup(recorder->recordings, GUINT_TO_POINTER(item->key));
+  if (recording) {
+    gboolean too_large = recorder->max_size && (recording->size + recording->pending->len >= recorder->max_size);
+    gboolean too_long = recorder->max_duration && (item->arrival_time - recording->start_time >= recorder->max_duration);
+    if (too_large || too_long) {
+      g_hash_table_remove(recorder->recordings, GUINT_TO_POINTER(item->key));
+      recording = NULL;
+    }
+  }
+  if (!recording) {
+    recording = open_recording(recorder, item->key, item->arrival_time);
+    if (!recording) {
+      return;
+    }
+  }
+
+  guint64 arrival_position = (item->arrival_time - recording->start_time) * SAMPLE_RATE / G_USEC_PER_SEC;
+
+  MumbleRecordingStream *stream = g_hash_table_lookup(recording->streams, GUINT_TO_POINTER(item->session));
+  if (!stream) {
+    start_link(recording, item->session, arrival_position);
+    stream = g_hash_table_lookup(recording->streams, GUINT_TO_POINTER(item->session));
+  }
+
+  if (arrival_position > stream->position + MAX_JITTER_SAMPLES) {
+    fill_silence(stream, arrival_position, recording->pending);
+  }
+
+  stream->position += samples;
+  mumble_ogg_writer_add_packet(stream->writer, item->data, item->length, stream->position + PRE_SKIP, FALSE, recording->pending);
+
+  recording->last_packet_time = item->arrival_time;
+}
+
+static MumbleRecording *open_recording(MumbleVoiceRecorder *recorder, guint key, gint64 start_time) {
+  GDateTime *now = g_date_time_new_now_local();
+  gchar *timestamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+  g_date_time_unref(now);
+
+  const gchar *kind = (recorder->mode == MUMBLE_VOICE_RECORDER_PER_CHANNEL) ? "channel" : "session";
+  gchar *path = g_strdup_printf("%s/%s-%u-%s.opus", recorder->directory, kind, key, timestamp);
+  for (guint i = 1; g_file_test(path, G_FILE_TEST_EXISTS); i++) {
+    g_free(path);
+    path = g_strdup_printf("%s/%s-%u-%s-%u.opus", recorder->directory, kind, key, timestamp, i);
+  }
+  g_free(timestamp);
+
+  FILE *file = g_fopen(path, "wb");
+  g_free(path);
+  if (!file) {
+    return NULL;
+  }
+
+  MumbleRecording *recording = g_new0(MumbleRecording, 1);
+  recording->file             = file;
+  recording->start_time       = start_time;
+  recording->last_packet_time = start_time;
+  recording->last_write_time  = start_time;
+  recording->pending          = g_byte_array_new();
+  recording->streams          = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, recording_stream_free);
+
+  g_hash_table_insert(recorder->recordings, GUINT_TO_POINTER(key), recording);
+
+  return recording;
+}
+
+/*
+ * The beginnings of all logical streams of an Ogg file have to come before any data, so a
+ * speaker joining a channel recording ends the current group of streams and starts a new one
+ * that includes everyone. The file plays as a chain of such groups. Streams continue at their
+ * current positions; a stream whose first granule position is ahead of its samples starts
+ * later than the beginning of the group.
+ */
+static void start_link(MumbleRecording *recording, guint session, guint64 position) {
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init(&iter, recording->streams);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleRecordingStream *stream = value;
+    mumble_ogg_writer_finish(stream->writer, recording->pending);
+    mumble_ogg_writer_free(stream->writer);
+    stream->writer = mumble_ogg_writer_new(g_random_int());
+  }
+
+  MumbleRecordingStream *new_stream = g_new0(MumbleRecordingStream, 1);
+  new_stream->writer   = mumble_ogg_writer_new(g_random_int());
+  new_stream->position = position;
+  g_hash_table_insert(recording->streams, GUINT_TO_POINTER(session), new_stream);
+
+  g_hash_table_iter_init(&iter, recording->streams);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleRecordingStream *stream = value;
+    write_identification_header(stream->writer, recording->pending);
+  }
+
+  g_hash_table_iter_init(&iter, recording->streams);
+  while (g_hash_table_iter_next(&iter, &key, &value)) {
+    MumbleRecordingStream *stream = value;
+    write_comment_header(stream->writer, GPOINTER_TO_UINT(key), recording->pending);
+  }
+}
+
+static void write_identification_header(MumbleOggWriter *writer, GByteArray *output) {
+  guint8 head[19] = { 'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 1, PRE_SKIP & 0xFF, PRE_SKIP >> 8 };
+  guint32 sample_rate = SAMPLE_RATE;
+  for (guint i = 0; i < 4; i++) {
+    head[12 + i] = sample_rate >> (8 * i);
+  }
+  mumble_ogg_writer_add_packet(writer, head, sizeof(head), 0, TRUE, output);
+}
+
+static void write_comment_header(MumbleOggWriter *writer, guint session, GByteArray *output) {
+  const gchar *vendor = "purple-mumble";
+  gchar *comment = g_strdup_printf("MUMBLE_SESSION=%u", session);
+  guint32 vendor_length = strlen(vendor);
+  guint32 comment_length = strlen(comment);
+  guint32 comment_count = 1;
+
+  GByteArray *tags = g_byte_array_new();
+  g_byte_array_append(tags, (const guint8 *) "OpusTags", 8);
+  for (guint i = 0; i < 4; i++) {
+    guint8 byte = vendor_length >> (8 * i);
+    g_byte_array_append(tags, &byte, 1);
+  }
+  g_byte_array_append(tags, (const guint8 *) vendor, vendor_length);
+  for (guint i = 0; i < 4; i++) {
+    guint8 byte = comment_count >> (8 * i);
+    g_byte_array_append(tags, &byte, 1);
+  }
+  for (guint i = 0; i < 4; i++) {
+    guint8 byte = comment_length >> (8 * i);
+    g_byte_array_append(tags, &byte, 1);
+  }
+  g_byte_array_append(tags, (const guint8 *) comment, comment_length);
+
+  mumble_ogg_writer_add_packet(writer, tags->data, tags->len, 0, TRUE, output);
+
+  g_byte_array_unref(tags);
+  g_free(comment);
+}
+
+/*
+ * An Opus packet made of just a table-of-contents byte for 20 ms CELT frames and a frame count
+ * holds empty frames, which decoders play as silence.
+ */
+static void fill_silence(MumbleRecordingStream *stream, guint64 position, GByteArray *output) {
+  while (stream->position + SILENCE_SAMPLES <= position) {
+    guint frames = MIN((position - stream->position) / SILENCE_SAMPLES, MAX_SILENCE_FRAMES);
+    guint8 packet[2] = { 0xFB, frames };
+    stream->position += frames * SILENCE_SAMPLES;
+    mumble_ogg_writer_add_packet(stream->writer, packet, sizeof(packet), stream->position + PRE_SKIP, FALSE, output);
+  }
+}
+
+static void flush_recordings(MumbleVoiceRecorder *recorder, gint64 now) {
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, recorder->recordings);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleRecording *recording = value;
+
+    if (now - recording->last_packet_time > IDLE_TIMEOUT) {
+      g_hash_table_iter_remove(&iter);
+    } else if ((now - recording->last_write_time >= FLUSH_INTERVAL) || (recording->pending->len >= FLUSH_SIZE)) {
+      write_pending(recording, now);
+    }
+  }
+}
+
+static void write_pending(MumbleRecording *recording, gint64 now) {
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, recording->streams);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleRecordingStream *stream = value;
+    mumble_ogg_writer_flush(stream->writer, recording->pending);
+  }
+
+  if (recording->pending->len) {
+    fwrite(recording->pending->data, 1, recording->pending->len, recording->file);
+    fflush(recording->file);
+    recording->size += recording->pending->len;
+    g_byte_array_set_size(recording->pending, 0);
+  }
+
+  recording->last_write_time = now;
+}
+
+static void close_recording(gpointer data) {
+  MumbleRecording *recording = data;
+
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, recording->streams);
+  while (g_hash_table_iter_next(&iter, NULL, &value)) {
+    MumbleRecordingStream *stream = value;
+    mumble_ogg_writer_finish(stream->writer, recording->pending);
+  }
+  write_pending(recording, 0);
+
+  fclose(recording->file);
+  g_hash_table_destroy(recording->streams);
+  g_byte_array_unref(recording->pending);
+  g_free(recording);
+}
+
+static void recording_stream_free(gpointer data) {
+  MumbleRecordingStream *stream = data;
+  mumble_ogg_writer_free(stream->writer);
+  g_free(stream);
+}
@@ -0,0 +1,82 @@
+/*
+ * purple-mumble -- Mumble protocol plugin for libpurple
+ * Copyright (C) 2020  Petteri Pitkänen
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef MUMBLE_VOICE_RECORDER_H
+#define MUMBLE_VOICE_RECORDER_H
+
+#include <glib.h>
+#include "mumble-voice-packet.h"
+
+/**
+ * SECTION:mumblevoicerecorder
+ * @short_description: Voice recorder
+ *
+ * Writes received Opus packets into Ogg Opus files as they are, without
+ * decoding them. Each speaker is a logical stream whose granule positions
+ * follow the arrival times of the packets, and pauses between transmissions
+ * are filled with empty Opus frames, so the recording keeps its timing.
+ *
+ * Files are written by a background thread in batches. The main thread only
+ * copies each packet to a queue.
+ */
+
+/**
+ * MumbleVoiceRecorderMode:
+ * @MUMBLE_VOICE_RECORDER_PER_SESSION: One file per speaker
+ * @MUMBLE_VOICE_RECORDER_PER_CHANNEL: One file per channel with a logical stream per speaker
+ */
+typedef enum {
+  MUMBLE_VOICE_RECORDER_PER_SESSION,
+  MUMBLE_VOICE_RECORDER_PER_CHANNEL
+} MumbleVoiceRecorderMode;
+
+typedef struct _MumbleVoiceRecorder MumbleVoiceRecorder;
+
+/**
+ * mumble_voice_recorder_record:
+ * @recorder:   A #MumbleVoiceRecorder
+ * @channel_id: Channel of the speaker
+ * @packet:     A voice packet with a session
+ *
+ * Queue a received packet for writing. Packets in codecs other than Opus are
+ * ignored.
+ */
+void mumble_voice_recorder_record(MumbleVoiceRecorder *recorder, guint channel_id, MumbleVoicePacket *packet);
+
+/**
+ * mumble_voice_recorder_free:
+ * @recorder: A #MumbleVoiceRecorder
+ *
+ * Write out everything that is queued, close the files and stop the thread.
+ */
+void mumble_voice_recorder_free(MumbleVoiceRecorder *recorder);
+
+/**
+ * mumble_voice_recorder_new:
+ * @directory:    Directory to write the files to
+ * @mode:         A #MumbleVoiceRecorderMode
+ * @max_size:     Size in bytes after which a file is rotated, or 0
+ * @max_duration: Duration in seconds after which a file is rotated, or 0
+ *
+ * Returns: A new #MumbleVoiceRecorder
+ */
+MumbleVoiceRecorder *mumble_voice_recorder_new(const gchar *directory, MumbleVoiceRecorderMode mode, gsize max_size, guint max_duration);
+
+#endif
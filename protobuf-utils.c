@@ -17,6 +17,7 @@
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <string.h>
 #include "protobuf-utils.h"
 
 static void encode_tag(GByteArray *message, guint field_number, guint wire_type);
@@ -44,7 +45,7 @@ void append_protobuf_debug_info(GString *string, GByteArray *message) {
 
 gboolean remember_protobuf_unsigned_varint(GByteArray *message, guint *offset, GArray *values) {
   guint64 value;
-  if (decode_protobuf_unsigned_varint(message, offset, &value)) {
+  if (!decode_protobuf_unsigned_varint(message, offset, &value)) {
     return FALSE;
   }
   g_array_append_val(values, value);
@@ -75,6 +76,32 @@ void skip_protobuf_value(GByteArray *message, guint *offset, guint wire_type) {
   }
 }
 
+gboolean decode_protobuf_bytes(GByteArray *message, guint *offset, GByteArray **value) {
+  guint64 length;
+  if (!decode_protobuf_unsigned_varint(message, offset, &length) || (length > message->len - *offset)) {
+    return FALSE;
+  }
+  *value = g_byte_array_new();
+  g_byte_array_append(*value, &message->data[*offset], length);
+  *offset += length;
+  return TRUE;
+}
+
+/*
+ * Unlike the other decoders, leaves the value in the message so that large fields can be
+ * processed without a copy.
+ */
+gboolean decode_protobuf_bytes_view(GByteArray *message, guint *offset, const guint8 **value, gsize *length) {
+  guint64 value_length;
+  if (!decode_protobuf_unsigned_varint(message, offset, &value_length) || (value_length > message->len - *offset)) {
+    return FALSE;
+  }
+  *value = &message->data[*offset];
+  *length = value_length;
+  *offset += value_length;
+  return TRUE;
+}
+
 gboolean decode_protobuf_string(GByteArray *message, guint *offset, gchar **value) {
   guint64 length;
   if (!decode_protobuf_unsigned_varint(message, offset, &length)) {
@@ -97,17 +124,23 @@ gboolean decode_protobuf_tag(GByteArray *message, guint *offset, guint *field_nu
 
 gboolean decode_protobuf_unsigned_varint(GByteArray *message, guint *offset, guint64 *value) {
   *value = 0;
-  while (message->data[*offset] >= 0x80) {
-    if ((*offset) > message->len) {
+  for (guint shift = 0; shift < 64; shift += 7) {
+    if ((*offset) >= message->len) {
       return FALSE;
     }
-    *value = ((*value) << 7) | (message->data[(*offset)++] & 0x7F);
-  }
-  if ((*offset) >= message->len) {
-    return FALSE;
+    guint8 byte = message->data[(*offset)++];
+    *value |= ((guint64) (byte & 0x7F)) << shift;
+    if (byte < 0x80) {
+      return TRUE;
+    }
   }
-  *value = ((*value) << 7) | message->data[(*offset)++];
-  return TRUE;
+  return FALSE;
+}
+
+void encode_protobuf_bytes(GByteArray *message, guint field_number, const guint8 *value, gsize length) {
+  encode_tag(message, field_number, 2);
+  encode_varint(message, length);
+  g_byte_array_append(message, value, length);
 }
 
 void encode_protobuf_string(GByteArray *message, guint field_number, gchar *value) {
@@ -117,6 +150,14 @@ void encode_protobuf_string(GByteArray *message, guint field_number, gchar *valu
   g_byte_array_append(message, value, count);
 }
 
+void encode_protobuf_float(GByteArray *message, guint field_number, gfloat value) {
+  encode_tag(message, field_number, 5);
+  guint32 bits;
+  memcpy(&bits, &value, sizeof(bits));
+  bits = GUINT32_TO_LE(bits);
+  g_byte_array_append(message, (guint8 *) &bits, sizeof(bits));
+}
+
 void encode_protobuf_unsigned_varint(GByteArray *message, guint field_number, guint64 value) {
   encode_tag(message, field_number, 0);
   encode_varint(message, value);
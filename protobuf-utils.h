@@ -25,10 +25,14 @@
 void append_protobuf_debug_info(GString *string, GByteArray *message);
 gboolean remember_protobuf_unsigned_varint(GByteArray *message, guint *offset, GArray *values);
 void skip_protobuf_value(GByteArray *message, guint *offset, guint wire_type);
+gboolean decode_protobuf_bytes(GByteArray *message, guint *offset, GByteArray **value);
+gboolean decode_protobuf_bytes_view(GByteArray *message, guint *offset, const guint8 **value, gsize *length);
 gboolean decode_protobuf_string(GByteArray *message, guint *offset, gchar **value);
 gboolean decode_protobuf_tag(GByteArray *message, guint *offset, guint *field_number, guint *wire_type);
 gboolean decode_protobuf_unsigned_varint(GByteArray *message, guint *offset, guint64 *value);
+void encode_protobuf_bytes(GByteArray *message, guint field_number, const guint8 *value, gsize length);
 void encode_protobuf_string(GByteArray *message, guint field_number, gchar *value);
+void encode_protobuf_float(GByteArray *message, guint field_number, gfloat value);
 void encode_protobuf_unsigned_varint(GByteArray *message, guint field_number, guint64 value);
 
 #endif
@@ -35,9 +35,12 @@ GList *g_list_append_times(GList *list, gpointer data, gint count) {
   return list;
 }
 
+/*
+ * Prepends in constant time, so the list is in reverse traversal order until the caller reverses it.
+ */
 gboolean g_node_traverse_func_create_list(GNode *node, gpointer data) {
   GList *nodes = *((GList **) data);
-  nodes = g_list_append(nodes, node->data);
+  nodes = g_list_prepend(nodes, node->data);
   *((GList **) data) = nodes;
 
   return FALSE;